@@ -0,0 +1,16 @@
+#include "lock/lock_errors.h"
+
+namespace dlock {
+
+const char *LockErrorToString(int error) {
+  switch (error) {
+    case ERR_LOCK_HELD:
+      return "ERR_LOCK_HELD";
+    case ERR_LOCK_NOT_HELD:
+      return "ERR_LOCK_NOT_HELD";
+    default:
+      return ErrorToString(error);
+  }
+}
+
+}  // namespace dlock
@@ -0,0 +1,22 @@
+#ifndef DLOCK_LOCK_LOCK_ERRORS_H_
+#define DLOCK_LOCK_LOCK_ERRORS_H_
+
+#include "net/net_errors.h"
+
+namespace dlock {
+
+// Results of lock operations, on top of the NetError codes so that both
+// fit the status of one RPC reply. Success is OK.
+enum LockError {
+  // The lock is held by another owner.
+  ERR_LOCK_HELD = -100,
+  // The caller does not hold the lock, e.g. its lease expired.
+  ERR_LOCK_NOT_HELD = -101,
+};
+
+// Also knows the NetError codes.
+const char *LockErrorToString(int error);
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,396 @@
+#include "lock/lock_service.h"
+#include <utility>
+#include <vector>
+#include "lock/lock_errors.h"
+#include "lock/lock_table.h"
+#include "net/event_pump.h"
+#include "net/io_buffer.h"
+#include "net/io_buffer_chain.h"
+#include "net/rpc_server_connection.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+namespace {
+
+// Holds the tokens of a few dozen replies.
+const int kTokenBufferSize = 512;
+const int kTokenSize = 8;
+
+void WriteBE(uint64_t value, int size, char *out) {
+  for (int i = size - 1; i >= 0; --i) {
+    out[i] = static_cast<char>(value & 0xff);
+    value >>= 8;
+  }
+}
+
+uint64_t ReadBE(const char *in, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value = (value << 8) | static_cast<unsigned char>(in[i]);
+  }
+  return value;
+}
+
+}  // namespace
+
+const int LockRequest::kHeaderSize = 16;
+const size_t LockRequest::kMaxKeySize = 1024;
+
+void LockRequest::Encode(IOBufferChain *out) const {
+  int size = kHeaderSize + static_cast<int>(key.size());
+  scoped_refptr<IOBuffer> buf = new IOBuffer(size);
+  char *data = buf->data();
+  WriteBE(owner, 8, data);
+  WriteBE(static_cast<uint32_t>(lease_ms), 4, data + 8);
+  WriteBE(static_cast<uint32_t>(wait_ms), 4, data + 12);
+  key.copy(data + kHeaderSize, key.size());
+  out->Append(buf, 0, size);
+}
+
+bool LockRequest::Decode(IOBufferChain *body) {
+  if (body->size() <= static_cast<size_t>(kHeaderSize) ||
+      body->size() > kHeaderSize + kMaxKeySize) {
+    return false;
+  }
+  char header[kHeaderSize];
+  body->CopyTo(header, kHeaderSize);
+  body->Consume(kHeaderSize);
+  owner = ReadBE(header, 8);
+  lease_ms = static_cast<int32_t>(ReadBE(header + 8, 4));
+  wait_ms = static_cast<int32_t>(ReadBE(header + 12, 4));
+  key.resize(body->size());
+  body->CopyTo(&key[0], static_cast<int>(key.size()));
+  body->Clear();
+  return true;
+}
+
+bool DecodeLockToken(const IOBufferChain &reply, uint64_t *token) {
+  char data[kTokenSize];
+  if (reply.size() != kTokenSize) {
+    return false;
+  }
+  reply.CopyTo(data, kTokenSize);
+  *token = ReadBE(data, kTokenSize);
+  return true;
+}
+
+// The state of one connection. Shared with the callbacks of the operations
+// in flight, which may complete after the connection is gone.
+class LockService::Session : public std::enable_shared_from_this<Session> {
+ public:
+  Session(LockService *service, std::unique_ptr<TCPSocket> socket);
+
+  void Start();
+  // Closes the connection without telling the service. Loop thread only.
+  void Shutdown();
+
+  EventPump *pump() const { return pump_; }
+
+ private:
+  // A queued acquire, by call id.
+  struct Wait {
+    std::string key;
+    uint64_t owner;
+    uint64_t wait_id;
+    // Set once the client or the connection gave up on it.
+    bool cancelled;
+  };
+
+  // An acquire that does not queue, by call id, kept until its result is
+  // back in case the connection closes first.
+  struct Acquire {
+    std::string key;
+    uint64_t owner;
+  };
+
+  struct Reply {
+    uint64_t call_id;
+    int result;
+    uint64_t token;
+    bool waited;
+    // A non-queued ACQUIRE, see |acquires_|.
+    bool acquire;
+  };
+
+  void OnRequest(uint64_t call_id, uint32_t method, IOBufferChain *request);
+  void OnCancel(uint64_t call_id);
+  void OnClosed();
+  void CancelWaits();
+  // Hands a result over to the loop of the connection. Any thread.
+  void Deliver(const Reply &reply);
+  void FlushOutbox();
+  void Finish(const Reply &reply);
+  void SendReply(uint64_t call_id, int result, uint64_t token);
+
+  LockService *const service_;
+  LockTable *const table_;
+  EventPump *const pump_;
+
+  // Loop thread only.
+  std::unique_ptr<RpcServerConnection> connection_;
+  std::unordered_map<uint64_t, Wait> waits_;
+  std::unordered_map<uint64_t, Acquire> acquires_;
+  // Set while replies join a batch of the connection anyway.
+  bool batching_;
+  bool closed_;
+  // Room for the tokens of outgoing replies.
+  scoped_refptr<IOBuffer> token_buf_;
+  int token_used_;
+  // The outbox being sent; keeps its capacity between flushes.
+  std::vector<Reply> flushing_;
+
+  Mutex mutex_;
+  // Replies delivered from other loops, or outside of a batch. A flush
+  // task is posted whenever it stops being empty.
+  std::vector<Reply> outbox_;
+
+  DISALLOW_COPY_AND_ASSIGN(Session);
+};
+
+LockService::Session::Session(LockService *service,
+                              std::unique_ptr<TCPSocket> socket)
+    : service_(service),
+      table_(service->table_),
+      pump_(socket->pump()),
+      batching_(false),
+      closed_(false),
+      token_used_(kTokenBufferSize) {
+  connection_.reset(new RpcServerConnection(
+      std::move(socket), service->options_,
+      [this](RpcServerConnection *, uint64_t call_id, uint32_t method,
+             IOBufferChain *request) { OnRequest(call_id, method, request); }));
+  connection_->set_cancel_handler(
+      [this](RpcServerConnection *, uint64_t call_id) { OnCancel(call_id); });
+  connection_->set_close_callback([this](int) { OnClosed(); });
+}
+
+void LockService::Session::Start() { connection_->Start(); }
+
+void LockService::Session::Shutdown() {
+  if (closed_) {
+    // OnClosed() ran and posted the rest.
+    return;
+  }
+  closed_ = true;
+  CancelWaits();
+  connection_.reset();
+}
+
+void LockService::Session::OnRequest(uint64_t call_id, uint32_t method,
+                                     IOBufferChain *request) {
+  LockRequest req;
+  if (!req.Decode(request)) {
+    SendReply(call_id, ERR_INVALID_ARGUMENT, 0);
+    return;
+  }
+  // Results of the shards of this loop come back right away and join the
+  // batch of the read.
+  batching_ = true;
+  std::shared_ptr<Session> self = shared_from_this();
+  switch (method) {
+    case LockRequest::ACQUIRE:
+      if (waits_.count(call_id) || acquires_.count(call_id)) {
+        SendReply(call_id, ERR_INVALID_ARGUMENT, 0);
+        break;
+      }
+      if (req.wait_ms == 0) {
+        acquires_[call_id] = Acquire{req.key, req.owner};
+        table_->Acquire(req.key, req.owner, req.lease_ms,
+                        [self, call_id](int rv, uint64_t token) {
+                          self->Deliver(
+                              Reply{call_id, rv, token, false, true});
+                        });
+        break;
+      }
+      {
+        uint64_t wait_id =
+            service_->next_wait_id_.fetch_add(1, std::memory_order_relaxed);
+        waits_[call_id] = Wait{req.key, req.owner, wait_id, false};
+        table_->Acquire(req.key, req.owner, req.lease_ms, req.wait_ms,
+                        wait_id, [self, call_id](int rv, uint64_t token) {
+                          self->Deliver(Reply{call_id, rv, token, true, false});
+                        });
+      }
+      break;
+    case LockRequest::RELEASE:
+      table_->Release(req.key, req.owner, [self, call_id](int rv) {
+        self->Deliver(Reply{call_id, rv, 0, false, false});
+      });
+      break;
+    case LockRequest::RENEW:
+      table_->Renew(req.key, req.owner, req.lease_ms,
+                    [self, call_id](int rv) {
+                      self->Deliver(Reply{call_id, rv, 0, false, false});
+                    });
+      break;
+    default:
+      SendReply(call_id, ERR_INVALID_ARGUMENT, 0);
+      break;
+  }
+  batching_ = false;
+}
+
+void LockService::Session::OnCancel(uint64_t call_id) {
+  auto it = waits_.find(call_id);
+  if (it == waits_.end() || it->second.cancelled) {
+    return;
+  }
+  // The wait still finishes, see Finish().
+  it->second.cancelled = true;
+  table_->CancelWait(it->second.key, it->second.owner, it->second.wait_id);
+}
+
+void LockService::Session::OnClosed() {
+  std::shared_ptr<Session> self = shared_from_this();
+  closed_ = true;
+  CancelWaits();
+  service_->OnSessionClosed(this);
+  pump_->PostTask([self] { self->connection_.reset(); });
+}
+
+void LockService::Session::CancelWaits() {
+  for (auto &entry : waits_) {
+    Wait &wait = entry.second;
+    if (!wait.cancelled) {
+      wait.cancelled = true;
+      table_->CancelWait(wait.key, wait.owner, wait.wait_id);
+    }
+  }
+}
+
+void LockService::Session::Deliver(const Reply &reply) {
+  if (pump_->IsInLoopThread() && batching_) {
+    Finish(reply);
+    return;
+  }
+  bool post;
+  {
+    MutexLock lock(&mutex_);
+    post = outbox_.empty();
+    outbox_.push_back(reply);
+  }
+  if (post) {
+    std::shared_ptr<Session> self = shared_from_this();
+    pump_->PostTask([self] { self->FlushOutbox(); });
+  }
+}
+
+// Everything delivered since the task was posted leaves in one batch.
+void LockService::Session::FlushOutbox() {
+  {
+    MutexLock lock(&mutex_);
+    flushing_.swap(outbox_);
+  }
+  bool batch = connection_ && !closed_;
+  if (batch) {
+    connection_->BeginBatch();
+  }
+  batching_ = true;
+  for (const Reply &reply : flushing_) {
+    Finish(reply);
+  }
+  batching_ = false;
+  if (batch) {
+    connection_->EndBatch();
+  }
+  flushing_.clear();
+}
+
+void LockService::Session::Finish(const Reply &reply) {
+  if (reply.waited) {
+    auto it = waits_.find(reply.call_id);
+    CHECK(it != waits_.end());
+    if (it->second.cancelled) {
+      if (reply.result == OK) {
+        // Granted before the cancel got to the shard; nobody will use it.
+        table_->Release(it->second.key, it->second.owner, [](int) {});
+      }
+      waits_.erase(it);
+      return;
+    }
+    waits_.erase(it);
+  } else if (reply.acquire) {
+    auto it = acquires_.find(reply.call_id);
+    CHECK(it != acquires_.end());
+    if (closed_ && reply.result == OK) {
+      // Taken after the connection went away; nobody knows it holds it.
+      table_->Release(it->second.key, it->second.owner, [](int) {});
+    }
+    acquires_.erase(it);
+  }
+  if (!closed_) {
+    SendReply(reply.call_id, reply.result, reply.token);
+  }
+}
+
+void LockService::Session::SendReply(uint64_t call_id, int result,
+                                     uint64_t token) {
+  IOBufferChain body;
+  // Tokens start at 1; only granted acquires carry one.
+  if (result == OK && token) {
+    if (token_used_ + kTokenSize > kTokenBufferSize) {
+      token_buf_ = new IOBuffer(kTokenBufferSize);
+      token_used_ = 0;
+    }
+    WriteBE(token, kTokenSize, token_buf_->data() + token_used_);
+    body.Append(token_buf_, token_used_, kTokenSize);
+    token_used_ += kTokenSize;
+  }
+  connection_->SendReply(call_id, result, body);
+}
+
+LockService::LockService(LockTable *table, const FrameOptions &options)
+    : table_(table), options_(options), next_wait_id_(1) {}
+
+LockService::~LockService() {
+  std::unordered_map<Session *, std::shared_ptr<Session>> sessions;
+  {
+    MutexLock lock(&mutex_);
+    sessions.swap(sessions_);
+  }
+  // Connections are loop thread state, so they are closed there.
+  Mutex mutex;
+  CondVar cond(&mutex);
+  size_t pending = sessions.size();
+  for (auto &entry : sessions) {
+    std::shared_ptr<Session> session = entry.second;
+    EventPump *pump = session->pump();
+    CHECK(!pump->IsInLoopThread());
+    pump->PostTask([session, &mutex, &cond, &pending]() {
+      session->Shutdown();
+      MutexLock lock(&mutex);
+      if (--pending == 0) {
+        cond.Signal();
+      }
+    });
+  }
+  MutexLock lock(&mutex);
+  while (pending) {
+    cond.Wait();
+  }
+}
+
+void LockService::AddConnection(std::unique_ptr<TCPSocket> socket) {
+  CHECK(socket->pump()->IsInLoopThread());
+  std::shared_ptr<Session> session(new Session(this, std::move(socket)));
+  {
+    MutexLock lock(&mutex_);
+    sessions_[session.get()] = session;
+  }
+  session->Start();
+}
+
+void LockService::OnSessionClosed(Session *session) {
+  MutexLock lock(&mutex_);
+  sessions_.erase(session);
+}
+
+size_t LockService::num_connections() const {
+  MutexLock lock(&mutex_);
+  return sessions_.size();
+}
+
+}  // namespace dlock
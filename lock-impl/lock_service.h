@@ -0,0 +1,101 @@
+#ifndef DLOCK_LOCK_LOCK_SERVICE_H_
+#define DLOCK_LOCK_LOCK_SERVICE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "base/noncopyable.h"
+#include "base/sync.h"
+#include "net/frame_codec.h"
+
+namespace dlock {
+
+class IOBufferChain;
+class LockTable;
+class TCPSocket;
+
+// A lock operation as carried in the body of an RPC request: the owner, the
+// lease and wait in milliseconds, all big-endian, then the name of the lock.
+struct LockRequest {
+  enum Method {
+    ACQUIRE = 1,
+    RELEASE = 2,
+    RENEW = 3,
+  };
+
+  static const int kHeaderSize;
+  static const size_t kMaxKeySize;
+
+  // Appends the encoded request to |out|.
+  void Encode(IOBufferChain *out) const;
+  // Parses and consumes |body|. Returns false if it is malformed.
+  bool Decode(IOBufferChain *body);
+
+  uint64_t owner;
+  int32_t lease_ms;
+  // Acquire only: how long to queue behind the holder, 0 not to queue and
+  // LockShard::kWaitForever to queue until granted or cancelled.
+  int32_t wait_ms;
+  std::string key;
+};
+
+// Parses the fencing token in the reply to a successful ACQUIRE.
+bool DecodeLockToken(const IOBufferChain &reply, uint64_t *token);
+
+// Serves a LockTable over RPC connections. The status of a reply is the
+// result of the operation; the reply to a successful ACQUIRE carries the
+// fencing token.
+//
+// A queued ACQUIRE is answered once the lock is handed over or the wait
+// ends, and cancelling the call dequeues it. Grants come in on the loops of
+// the shards, usually many at a time as a hot lock moves down its queue or
+// a burst of releases lands, so they are not written one by one: a
+// connection collects the replies due to it in an outbox, and a single task
+// on its loop sends everything collected meanwhile in one batch, which is
+// one vectored write on the socket. Replies to requests that complete
+// while the connection is handling a read leave with the batch of the read.
+//
+// The lease of a queued ACQUIRE starts when the shard hands the lock over,
+// not when the reply is written, so the wait for the callback batch of the
+// table and for the outbox flush is part of it, on top of the trip to the
+// client. Clients must count the lease from when they sent the request.
+//
+// A lock granted to a connection that is gone, or to a call that was
+// cancelled, is released again. Locks held by a connection that closes
+// stay held until released by the same owner on another connection or
+// until their leases run out.
+class LockService {
+ public:
+  // |table| and the pumps of the connections must outlive the service.
+  LockService(LockTable *table, const FrameOptions &options);
+  // Closes the connections, waiting for their loops to do so. Must not be
+  // called on one of them.
+  ~LockService();
+
+  // Serves requests on |socket|. Call on the loop of the socket, ideally
+  // the one LockTable::PumpFor() picks for the keys the client uses.
+  void AddConnection(std::unique_ptr<TCPSocket> socket);
+
+  size_t num_connections() const;
+
+ private:
+  class Session;
+
+  void OnSessionClosed(Session *session);
+
+  LockTable *const table_;
+  const FrameOptions options_;
+  // Names waits uniquely across connections sharing an owner.
+  std::atomic<uint64_t> next_wait_id_;
+
+  mutable Mutex mutex_;
+  std::unordered_map<Session *, std::shared_ptr<Session>> sessions_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockService);
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,343 @@
+#include "lock/lock_service.h"
+#include <sys/socket.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "base/sync.h"
+#include "lock/lock_errors.h"
+#include "lock/lock_shard.h"
+#include "lock/lock_table.h"
+#include "net/event_pump.h"
+#include "net/event_pump_test_util.h"
+#include "net/io_buffer.h"
+#include "net/io_buffer_chain.h"
+#include "net/net_errors.h"
+#include "net/rpc_channel.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(LockServiceTest);
+
+namespace {
+
+const int64_t kLeaseMs = 10000;
+
+LockRequest MakeRequest(uint64_t owner, const std::string &key,
+                        int32_t wait_ms) {
+  LockRequest request;
+  request.owner = owner;
+  request.lease_ms = static_cast<int32_t>(kLeaseMs);
+  request.wait_ms = wait_ms;
+  request.key = key;
+  return request;
+}
+
+// Holds up a loop until opened.
+class Gate {
+ public:
+  Gate() : cond_(&mutex_), open_(false) {}
+
+  void Close(EventPump *pump) {
+    pump->PostTask([this] {
+      MutexLock lock(&mutex_);
+      while (!open_) {
+        cond_.Wait();
+      }
+    });
+  }
+  void Open() {
+    MutexLock lock(&mutex_);
+    open_ = true;
+    cond_.Signal();
+  }
+
+ private:
+  Mutex mutex_;
+  CondVar cond_;
+  bool open_;
+};
+
+struct Reply {
+  uint64_t call_id;
+  int result;
+  uint64_t token;
+};
+
+// A client connection to the service, over a socketpair. Loop thread only,
+// like the channel it wraps.
+class Client {
+ public:
+  Client(EventPump *pump, LockService *service) {
+    int fds[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    std::unique_ptr<TCPSocket> server(new TCPSocket(pump));
+    CHECK_EQ(server->AdoptUnconnectedSocket(fds[0]), 0);
+    server_socket_ = server.get();
+    service->AddConnection(std::move(server));
+    std::unique_ptr<TCPSocket> client(new TCPSocket(pump));
+    CHECK_EQ(client->AdoptUnconnectedSocket(fds[1]), 0);
+    channel_.reset(new RpcChannel(std::move(client), FrameOptions()));
+    channel_->Start();
+  }
+
+  uint64_t Send(LockRequest::Method method, uint64_t owner,
+                const std::string &key, int32_t wait_ms) {
+    IOBufferChain body;
+    MakeRequest(owner, key, wait_ms).Encode(&body);
+    std::shared_ptr<uint64_t> call_id(new uint64_t(0));
+    *call_id = channel_->Call(
+        method, body, 0, [this, call_id](int rv, IOBufferChain *reply) {
+          uint64_t token = 0;
+          if (rv == OK && reply->size()) {
+            CHECK(DecodeLockToken(*reply, &token));
+          }
+          replies_.push_back(Reply{*call_id, rv, token});
+        });
+    CHECK_NE(*call_id, 0u);
+    return *call_id;
+  }
+
+  RpcChannel *channel() { return channel_.get(); }
+  // The service's end, owned by the service.
+  TCPSocket *server_socket() { return server_socket_; }
+  std::vector<Reply> *replies() { return &replies_; }
+
+ private:
+  std::unique_ptr<RpcChannel> channel_;
+  TCPSocket *server_socket_;
+  std::vector<Reply> replies_;
+};
+
+}  // namespace
+
+TEST(LockServiceTest, TestRequestRoundTrip) {
+  const std::string keys[] = {"k", std::string(LockRequest::kMaxKeySize, 'x')};
+  for (const std::string &key : keys) {
+    LockRequest request = MakeRequest(0x0102030405060708ull, key,
+                                      static_cast<int32_t>(
+                                          LockShard::kWaitForever));
+    IOBufferChain body;
+    request.Encode(&body);
+    CHECK_EQ(body.size(), LockRequest::kHeaderSize + key.size());
+
+    LockRequest decoded = MakeRequest(0, "", 0);
+    CHECK(decoded.Decode(&body));
+    CHECK(body.empty());
+    CHECK_EQ(decoded.owner, request.owner);
+    CHECK_EQ(decoded.lease_ms, kLeaseMs);
+    CHECK_EQ(decoded.wait_ms, LockShard::kWaitForever);
+    CHECK_EQ(decoded.key, key);
+  }
+
+  // No key, and a key over the limit.
+  const std::string bad[] = {"",
+                             std::string(LockRequest::kMaxKeySize + 1, 'x')};
+  for (const std::string &key : bad) {
+    IOBufferChain body;
+    MakeRequest(1, key, 0).Encode(&body);
+    LockRequest decoded;
+    CHECK(!decoded.Decode(&body));
+  }
+}
+
+TEST(LockServiceTest, TestDecodeLockToken) {
+  scoped_refptr<IOBuffer> buf = new IOBuffer(9);
+  const char token[] = "\x00\x00\x00\x00\x01\x02\x03\x04\x05";
+  for (int i = 0; i < 9; ++i) {
+    buf->data()[i] = token[i];
+  }
+  uint64_t value = 0;
+  // Split over two slices.
+  IOBufferChain reply;
+  reply.Append(buf, 0, 3);
+  reply.Append(buf, 3, 5);
+  CHECK(DecodeLockToken(reply, &value));
+  CHECK_EQ(value, 0x01020304ull);
+
+  value = 7;
+  IOBufferChain short_reply;
+  short_reply.Append(buf, 0, 7);
+  CHECK(!DecodeLockToken(short_reply, &value));
+  IOBufferChain long_reply;
+  long_reply.Append(buf, 0, 9);
+  CHECK(!DecodeLockToken(long_reply, &value));
+  CHECK(!DecodeLockToken(IOBufferChain(), &value));
+  CHECK_EQ(value, 7u);
+}
+
+TEST(LockServiceTest, TestFifoGrantOrder) {
+  EventPump pump;
+  LockTable table({&pump}, 0, 64);
+  LockService service(&table, FrameOptions());
+  std::unique_ptr<Client> client;
+  std::vector<uint64_t> waits;
+  RunOnLoop(&pump, [&] {
+    client.reset(new Client(&pump, &service));
+    client->Send(LockRequest::ACQUIRE, 1, "k", 0);
+    for (uint64_t owner = 2; owner <= 4; ++owner) {
+      waits.push_back(client->Send(LockRequest::ACQUIRE, owner, "k",
+                                   LockShard::kWaitForever));
+    }
+  });
+  std::vector<Reply> *replies = client->replies();
+  CHECK(WaitFor(&pump, [&] { return replies->size() == 1; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ((*replies)[0].result, OK);
+    client->Send(LockRequest::RELEASE, 1, "k", 0);
+  });
+
+  // Each waiter in turn gets the lock when the one before releases it.
+  uint64_t last_token = (*replies)[0].token;
+  for (size_t i = 0; i < waits.size(); ++i) {
+    size_t grant = 2 + 2 * i;
+    CHECK(WaitFor(&pump, [&] { return replies->size() == grant + 1; }));
+    RunOnLoop(&pump, [&] {
+      const Reply &reply = (*replies)[grant];
+      CHECK_EQ(reply.call_id, waits[i]);
+      CHECK_EQ(reply.result, OK);
+      CHECK_GT(reply.token, last_token);
+      last_token = reply.token;
+      client->Send(LockRequest::RELEASE, 2 + i, "k", 0);
+    });
+  }
+  CHECK(WaitFor(&pump, [&] { return replies->size() == 8; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ((*replies)[7].result, OK);
+    CHECK_EQ(table.size(), 0u);
+    client.reset();
+  });
+}
+
+// The shard runs on a loop of its own, so the release hands the lock over
+// and the grant heads for the outbox before the cancel gets to the shard.
+// The service has to give the lock back.
+TEST(LockServiceTest, TestCancelWhileGranting) {
+  EventPump pump;
+  EventPump shard_pump;
+  LockTable table({&shard_pump}, 0, 64);
+  LockService service(&table, FrameOptions());
+  std::unique_ptr<Client> client;
+  uint64_t wait = 0;
+  RunOnLoop(&pump, [&] {
+    client.reset(new Client(&pump, &service));
+    client->Send(LockRequest::ACQUIRE, 1, "k", 0);
+    wait = client->Send(LockRequest::ACQUIRE, 2, "k",
+                        LockShard::kWaitForever);
+  });
+  std::vector<Reply> *replies = client->replies();
+  CHECK(WaitFor(&pump, [&] { return replies->size() == 1; }));
+  RunOnLoop(&pump, [&] {
+    // One read on the service's end.
+    client->channel()->BeginBatch();
+    client->Send(LockRequest::RELEASE, 1, "k", 0);
+    CHECK(client->channel()->Cancel(wait));
+    client->channel()->EndBatch();
+  });
+  CHECK(WaitFor(&pump, [&] { return replies->size() == 2; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(replies->back().result, OK);
+    client->Send(LockRequest::ACQUIRE, 3, "k", 0);
+  });
+  CHECK(WaitFor(&pump, [&] { return replies->size() == 3; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(replies->back().result, OK);
+    client.reset();
+  });
+  RunOnLoop(&shard_pump, [&] {
+    CHECK_EQ(table.GetStats().grants, 1);
+    CHECK_EQ(table.GetStats().releases, 2);
+  });
+}
+
+// An acquire that succeeds after its connection closed gives the lock back.
+TEST(LockServiceTest, TestReleasesAfterClose) {
+  EventPump pump;
+  EventPump shard_pump;
+  LockTable table({&shard_pump}, 0, 64);
+  LockService service(&table, FrameOptions());
+  std::unique_ptr<Client> client;
+  Gate shard_gate;
+  shard_gate.Close(&shard_pump);
+  RunOnLoop(&pump, [&] {
+    client.reset(new Client(&pump, &service));
+    client->Send(LockRequest::ACQUIRE, 1, "k", 0);
+  });
+  CHECK(WaitFor(&pump, [&] {
+    return client->server_socket()->stats().bytes_read ==
+           client->channel()->socket()->stats().bytes_written;
+  }));
+  RunOnLoop(&pump, [&] { client.reset(); });
+  CHECK(WaitFor(&pump, [&] { return service.num_connections() == 0; }));
+
+  shard_gate.Open();
+  CHECK(WaitFor(&shard_pump, [&] {
+    return table.GetStats().releases == 1 && table.size() == 0;
+  }));
+  CHECK_EQ(table.GetStats().acquires, 1);
+}
+
+// Results from the shard's loop collect in the outbox of the connection
+// and leave with one write, however many there are.
+TEST(LockServiceTest, TestBatchesOutbox) {
+  // Few enough that the replies fit the iovecs of one writev().
+  const size_t kKeys = 10;
+  EventPump pump;
+  EventPump shard_pump;
+  LockTable table({&shard_pump}, 0, 64);
+  LockService service(&table, FrameOptions());
+  std::unique_ptr<Client> client;
+  RunOnLoop(&pump, [&] {
+    client.reset(new Client(&pump, &service));
+    for (size_t i = 0; i < kKeys; ++i) {
+      std::string key = "k" + std::to_string(i);
+      client->Send(LockRequest::ACQUIRE, 1, key, 0);
+      client->Send(LockRequest::ACQUIRE, 2, key, LockShard::kWaitForever);
+    }
+  });
+  std::vector<Reply> *replies = client->replies();
+  CHECK(WaitFor(&pump, [&] { return replies->size() == kKeys; }));
+
+  // The shard queues the releases until the connection has read them all,
+  // and the connection sits on the results until the shard is done.
+  Gate shard_gate;
+  Gate connection_gate;
+  shard_gate.Close(&shard_pump);
+  int64_t writes = 0;
+  RunOnLoop(&pump, [&] {
+    writes = client->server_socket()->stats().write_calls;
+    client->channel()->BeginBatch();
+    for (size_t i = 0; i < kKeys; ++i) {
+      client->Send(LockRequest::RELEASE, 1, "k" + std::to_string(i), 0);
+    }
+    client->channel()->EndBatch();
+  });
+  CHECK(WaitFor(&pump, [&] {
+    return client->server_socket()->stats().bytes_read ==
+           client->channel()->socket()->stats().bytes_written;
+  }));
+  connection_gate.Close(&pump);
+  shard_gate.Open();
+  CHECK(WaitFor(&shard_pump, [&] {
+    return table.GetStats().grants == static_cast<int64_t>(kKeys);
+  }));
+  connection_gate.Open();
+
+  CHECK(WaitFor(&pump, [&] { return replies->size() == 3 * kKeys; }));
+  RunOnLoop(&pump, [&] {
+    for (const Reply &reply : *replies) {
+      CHECK_EQ(reply.result, OK);
+    }
+    CHECK_EQ(client->server_socket()->stats().write_calls - writes, 1);
+    client.reset();
+  });
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(LockServiceTest)
@@ -0,0 +1,372 @@
+#include "lock/lock_shard.h"
+#include <functional>
+#include <utility>
+#include "lock/lock_errors.h"
+#include "util/logging.h"
+
+namespace dlock {
+
+namespace {
+
+const size_t kMinCapacity = 16;
+
+// Grow once more than 3/4 of the slots are used; longer probe sequences
+// cost more than the memory saved.
+bool OverLoaded(size_t size, size_t capacity) {
+  return size * 4 > capacity * 3;
+}
+
+}  // namespace
+
+const int64_t LockShard::kWaitForever = -1;
+
+uint64_t HashLockKey(const std::string &key) {
+  uint64_t h = std::hash<std::string>()(key);
+  // Finalizer of MurmurHash3, so that both ends of the hash are usable.
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h ? h : 1;
+}
+
+LockShard::LockShard(uint64_t now_ms, size_t capacity)
+    : size_(0),
+      next_token_(1),
+      timers_(now_ms),
+      free_waiters_(nullptr),
+      stats_() {
+  size_t slots = kMinCapacity;
+  while (OverLoaded(capacity, slots)) {
+    slots *= 2;
+  }
+  slots_.assign(slots, Slot{0, nullptr});
+  mask_ = slots - 1;
+}
+
+LockShard::~LockShard() {
+  for (const Slot &slot : slots_) {
+    delete slot.lock;
+  }
+  for (Lock *lock : free_locks_) {
+    delete lock;
+  }
+  for (const auto &entry : waits_) {
+    delete entry.second;
+  }
+  while (free_waiters_) {
+    Waiter *waiter = free_waiters_;
+    free_waiters_ = waiter->next;
+    delete waiter;
+  }
+}
+
+size_t LockShard::Find(uint64_t hash, const std::string &key,
+                       bool *found) const {
+  size_t index = hash & mask_;
+  for (;;) {
+    const Slot &slot = slots_[index];
+    if (slot.hash == 0) {
+      *found = false;
+      return index;
+    }
+    if (slot.hash == hash && slot.lock->key == key) {
+      *found = true;
+      return index;
+    }
+    index = (index + 1) & mask_;
+  }
+}
+
+size_t LockShard::IndexOf(const Lock *lock) const {
+  size_t index = lock->hash & mask_;
+  while (slots_[index].lock != lock) {
+    CHECK_NE(slots_[index].hash, 0);
+    index = (index + 1) & mask_;
+  }
+  return index;
+}
+
+void LockShard::Insert(size_t index, Lock *lock) {
+  slots_[index].hash = lock->hash;
+  slots_[index].lock = lock;
+  ++size_;
+}
+
+void LockShard::EraseAt(size_t index) {
+  size_t hole = index;
+  size_t next = index;
+  for (;;) {
+    next = (next + 1) & mask_;
+    const Slot &slot = slots_[next];
+    if (slot.hash == 0) {
+      break;
+    }
+    // A slot whose home lies after the hole, up to itself, has to stay;
+    // any other can fill the hole and shorten its probe sequence.
+    size_t home = slot.hash & mask_;
+    if (((home - hole - 1) & mask_) < ((next - hole) & mask_)) {
+      continue;
+    }
+    slots_[hole] = slot;
+    hole = next;
+  }
+  slots_[hole] = Slot{0, nullptr};
+  --size_;
+}
+
+void LockShard::Grow() {
+  std::vector<Slot> old;
+  old.swap(slots_);
+  slots_.assign(old.size() * 2, Slot{0, nullptr});
+  mask_ = slots_.size() - 1;
+  for (const Slot &slot : old) {
+    if (slot.hash == 0) {
+      continue;
+    }
+    size_t index = slot.hash & mask_;
+    while (slots_[index].hash != 0) {
+      index = (index + 1) & mask_;
+    }
+    slots_[index] = slot;
+  }
+}
+
+uint64_t LockShard::Create(size_t index, uint64_t hash,
+                          const std::string &key, uint64_t owner,
+                          int64_t lease_ms) {
+  if (OverLoaded(size_ + 1, slots_.size())) {
+    Grow();
+    bool found;
+    index = Find(hash, key, &found);
+  }
+  Lock *lock;
+  if (free_locks_.empty()) {
+    lock = new Lock();
+  } else {
+    lock = free_locks_.back();
+    free_locks_.pop_back();
+  }
+  // Reuses the capacity of the recycled name.
+  lock->key.assign(key);
+  lock->hash = hash;
+  lock->owner = owner;
+  lock->token = next_token_++;
+  lock->lease_timer = kInvalidTimerId;
+  lock->first_waiter = nullptr;
+  lock->last_waiter = nullptr;
+  lock->num_waiters = 0;
+  Insert(index, lock);
+  ScheduleLease(lock, lease_ms);
+  return lock->token;
+}
+
+void LockShard::ScheduleLease(Lock *lock, int64_t lease_ms) {
+  if (lock->lease_timer != kInvalidTimerId) {
+    timers_.Cancel(lock->lease_timer);
+  }
+  lock->lease_timer = timers_.Schedule(static_cast<uint64_t>(lease_ms), 0,
+                                       [this, lock] { OnLeaseExpired(lock); });
+}
+
+void LockShard::OnLeaseExpired(Lock *lock) {
+  lock->lease_timer = kInvalidTimerId;
+  ++stats_.expirations;
+  HandOver(lock);
+}
+
+void LockShard::HandOver(Lock *lock) {
+  Waiter *waiter = lock->first_waiter;
+  if (!waiter) {
+    Remove(lock);
+    return;
+  }
+  lock->owner = waiter->owner;
+  lock->token = next_token_++;
+  ScheduleLease(lock, waiter->lease_ms);
+  ++stats_.grants;
+  FinishWait(waiter, OK, lock->token);
+}
+
+void LockShard::Remove(Lock *lock) {
+  DCHECK(!lock->first_waiter);
+  if (lock->lease_timer != kInvalidTimerId) {
+    timers_.Cancel(lock->lease_timer);
+    lock->lease_timer = kInvalidTimerId;
+  }
+  EraseAt(IndexOf(lock));
+  free_locks_.push_back(lock);
+}
+
+void LockShard::OnWaitTimeout(Waiter *waiter) {
+  waiter->wait_timer = kInvalidTimerId;
+  ++stats_.wait_timeouts;
+  FinishWait(waiter, ERR_TIMED_OUT, 0);
+}
+
+void LockShard::FinishWait(Waiter *waiter, int result, uint64_t token) {
+  Lock *lock = waiter->lock;
+  if (waiter->prev) {
+    waiter->prev->next = waiter->next;
+  } else {
+    lock->first_waiter = waiter->next;
+  }
+  if (waiter->next) {
+    waiter->next->prev = waiter->prev;
+  } else {
+    lock->last_waiter = waiter->prev;
+  }
+  --lock->num_waiters;
+  if (waiter->wait_timer != kInvalidTimerId) {
+    timers_.Cancel(waiter->wait_timer);
+    waiter->wait_timer = kInvalidTimerId;
+  }
+  waits_.erase(WaitKey{waiter->owner, waiter->wait_id});
+  callbacks_.push_back(Completion{std::move(waiter->callback), result, token});
+  waiter->callback = nullptr;
+  waiter->next = free_waiters_;
+  free_waiters_ = waiter;
+}
+
+int LockShard::Advance(uint64_t now_ms) { return timers_.Advance(now_ms); }
+
+int LockShard::Acquire(uint64_t now_ms, uint64_t hash, const std::string &key,
+                       uint64_t owner, int64_t lease_ms, uint64_t *token) {
+  return AcquireOrWait(now_ms, hash, key, owner, lease_ms, 0, 0,
+                       GrantCallback(), token);
+}
+
+int LockShard::AcquireOrWait(uint64_t now_ms, uint64_t hash,
+                             const std::string &key, uint64_t owner,
+                             int64_t lease_ms, int64_t wait_ms,
+                             uint64_t wait_id, GrantCallback callback,
+                             uint64_t *token) {
+  if (lease_ms <= 0 || (wait_ms < 0 && wait_ms != kWaitForever)) {
+    return ERR_INVALID_ARGUMENT;
+  }
+  Advance(now_ms);
+  bool found;
+  size_t index = Find(hash, key, &found);
+  if (!found) {
+    // A lock with waiters is never free, so nobody is overtaken here.
+    *token = Create(index, hash, key, owner, lease_ms);
+    ++stats_.acquires;
+    return OK;
+  }
+  Lock *lock = slots_[index].lock;
+  if (lock->owner == owner) {
+    ScheduleLease(lock, lease_ms);
+    *token = lock->token;
+    ++stats_.acquires;
+    return OK;
+  }
+  if (wait_ms == 0) {
+    ++stats_.contended;
+    return ERR_LOCK_HELD;
+  }
+  WaitKey wait_key = {owner, wait_id};
+  if (waits_.count(wait_key)) {
+    return ERR_INVALID_ARGUMENT;
+  }
+
+  Waiter *waiter = free_waiters_;
+  if (waiter) {
+    free_waiters_ = waiter->next;
+  } else {
+    waiter = new Waiter();
+  }
+  waiter->lock = lock;
+  waiter->prev = lock->last_waiter;
+  waiter->next = nullptr;
+  waiter->owner = owner;
+  waiter->wait_id = wait_id;
+  waiter->lease_ms = lease_ms;
+  waiter->wait_timer = kInvalidTimerId;
+  waiter->callback = std::move(callback);
+  if (lock->last_waiter) {
+    lock->last_waiter->next = waiter;
+  } else {
+    lock->first_waiter = waiter;
+  }
+  lock->last_waiter = waiter;
+  ++lock->num_waiters;
+  if (wait_ms != kWaitForever) {
+    waiter->wait_timer =
+        timers_.Schedule(static_cast<uint64_t>(wait_ms), 0,
+                         [this, waiter] { OnWaitTimeout(waiter); });
+  }
+  waits_[wait_key] = waiter;
+  ++stats_.waits;
+  return ERR_IO_PENDING;
+}
+
+bool LockShard::CancelWait(uint64_t now_ms, uint64_t owner,
+                           uint64_t wait_id) {
+  Advance(now_ms);
+  auto it = waits_.find(WaitKey{owner, wait_id});
+  if (it == waits_.end()) {
+    return false;
+  }
+  FinishWait(it->second, ERR_ABORTED, 0);
+  return true;
+}
+
+int LockShard::Release(uint64_t now_ms, uint64_t hash, const std::string &key,
+                       uint64_t owner) {
+  Advance(now_ms);
+  bool found;
+  size_t index = Find(hash, key, &found);
+  if (!found || slots_[index].lock->owner != owner) {
+    return ERR_LOCK_NOT_HELD;
+  }
+  ++stats_.releases;
+  HandOver(slots_[index].lock);
+  return OK;
+}
+
+int LockShard::Renew(uint64_t now_ms, uint64_t hash, const std::string &key,
+                     uint64_t owner, int64_t lease_ms) {
+  if (lease_ms <= 0) {
+    return ERR_INVALID_ARGUMENT;
+  }
+  Advance(now_ms);
+  bool found;
+  size_t index = Find(hash, key, &found);
+  if (!found || slots_[index].lock->owner != owner) {
+    return ERR_LOCK_NOT_HELD;
+  }
+  ScheduleLease(slots_[index].lock, lease_ms);
+  ++stats_.renewals;
+  return OK;
+}
+
+int LockShard::RunCallbacks(int max) {
+  int ran = 0;
+  while (ran < max && !callbacks_.empty()) {
+    // Callbacks may queue more.
+    Completion completion = std::move(callbacks_.front());
+    callbacks_.pop_front();
+    completion.callback(completion.result, completion.token);
+    ++ran;
+  }
+  return ran;
+}
+
+bool LockShard::GetOwner(uint64_t hash, const std::string &key,
+                         uint64_t *owner) const {
+  bool found;
+  size_t index = Find(hash, key, &found);
+  if (found) {
+    *owner = slots_[index].lock->owner;
+  }
+  return found;
+}
+
+size_t LockShard::NumWaiters(uint64_t hash, const std::string &key) const {
+  bool found;
+  size_t index = Find(hash, key, &found);
+  return found ? slots_[index].lock->num_waiters : 0;
+}
+
+}  // namespace dlock
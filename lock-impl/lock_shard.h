@@ -0,0 +1,219 @@
+#ifndef DLOCK_LOCK_LOCK_SHARD_H_
+#define DLOCK_LOCK_LOCK_SHARD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "base/noncopyable.h"
+#include "net/timing_wheel.h"
+
+namespace dlock {
+
+const size_t kCacheLineSize = 64;
+
+// Hash of a lock name, never 0. Its high bits pick the shard and its low
+// bits the slot within the shard.
+uint64_t HashLockKey(const std::string &key);
+
+// One shard of the lock table: the named locks whose hash maps to it, the
+// leases they are held under and the owners queued for them. Not
+// thread-safe; the table gives every shard to exactly one event loop, so no
+// operation takes a lock.
+//
+// Locks are found through an open-addressing table of (hash, lock) slots
+// with linear probing, which keeps a lookup to one or two cache lines of
+// slots plus the lock it ends at. Removal shifts the following slots back
+// instead of leaving tombstones. Lock records do not move when the table
+// grows and are recycled, as are the lease timers of the wheel, so steady
+// acquire/release traffic does not allocate.
+//
+// A contended lock keeps its waiters in a FIFO list. Releasing it, or its
+// lease running out, hands it straight to the first waiter, so exactly one
+// waiter hears about it and nobody races for the free lock. Queueing,
+// granting and cancelling a wait are O(1) however long the list is.
+//
+// Time is in CLOCK_MONOTONIC milliseconds. Every operation first expires
+// the leases due by |now_ms|, so a lease never outlives its deadline by
+// more than the time until the next operation or Advance().
+class alignas(kCacheLineSize) LockShard {
+ public:
+  struct Stats {
+    int64_t acquires;
+    // Acquires refused because another owner held the lock.
+    int64_t contended;
+    int64_t releases;
+    int64_t renewals;
+    int64_t expirations;
+    // Acquires queued behind another owner.
+    int64_t waits;
+    // Locks handed to a waiter.
+    int64_t grants;
+    int64_t wait_timeouts;
+  };
+
+  // Gets OK and the fencing token once a queued acquire got the lock, or
+  // ERR_TIMED_OUT or ERR_ABORTED and 0.
+  typedef std::function<void(int result, uint64_t token)> GrantCallback;
+
+  static const int64_t kWaitForever;
+
+  // Sizes the table for |capacity| locks up front.
+  LockShard(uint64_t now_ms, size_t capacity);
+  ~LockShard();
+
+  // Takes the lock |key| for |owner| until |lease_ms| from now and sets
+  // |token| to a fencing token that grows with every new holder. If
+  // |owner| holds it already the lease is extended and the token kept.
+  // Returns OK, ERR_LOCK_HELD, or ERR_INVALID_ARGUMENT if |lease_ms| is not
+  // positive. |hash| must be HashLockKey(key).
+  int Acquire(uint64_t now_ms, uint64_t hash, const std::string &key,
+              uint64_t owner, int64_t lease_ms, uint64_t *token);
+  // Same, but if another owner holds the lock the request is queued behind
+  // the earlier ones and ERR_IO_PENDING returned. |callback| then gets the
+  // lock once it is handed over, or ERR_TIMED_OUT after |wait_ms|, which
+  // may be kWaitForever. The lease runs from the hand-over, so the time the
+  // callback spends queued for RunCallbacks() counts against it. |wait_id|
+  // names the wait for CancelWait() and must be unique among the queued
+  // waits of |owner| in this shard.
+  int AcquireOrWait(uint64_t now_ms, uint64_t hash, const std::string &key,
+                    uint64_t owner, int64_t lease_ms, int64_t wait_ms,
+                    uint64_t wait_id, GrantCallback callback,
+                    uint64_t *token);
+  // Dequeues a wait, whose callback then gets ERR_ABORTED. Returns false if
+  // it is not queued, e.g. because it was granted already.
+  bool CancelWait(uint64_t now_ms, uint64_t owner, uint64_t wait_id);
+  // Returns OK, or ERR_LOCK_NOT_HELD if |owner| does not hold |key|.
+  int Release(uint64_t now_ms, uint64_t hash, const std::string &key,
+              uint64_t owner);
+  // Moves the deadline of the lease to |lease_ms| from now. Returns OK,
+  // ERR_LOCK_NOT_HELD or ERR_INVALID_ARGUMENT.
+  int Renew(uint64_t now_ms, uint64_t hash, const std::string &key,
+            uint64_t owner, int64_t lease_ms);
+
+  // Expires the leases and waits due by |now_ms|, returns how many timers
+  // ran.
+  int Advance(uint64_t now_ms);
+  bool has_timers() const { return !timers_.empty(); }
+  // The earliest tick at which Advance() may have work to do. Only
+  // meaningful if has_timers().
+  uint64_t NextExpiryTick() const { return timers_.NextTick(); }
+
+  // Grant callbacks are never run from within an operation, which would
+  // let a callback that releases right away recurse through every waiter.
+  // They are queued in order instead and the owner of the shard runs them
+  // with RunCallbacks(), which returns how many of at most |max| it ran.
+  // Callbacks may call into the shard.
+  int RunCallbacks(int max);
+  bool has_callbacks() const { return !callbacks_.empty(); }
+
+  // Returns the owner of |key| in |owner|, or false if it is free.
+  bool GetOwner(uint64_t hash, const std::string &key,
+                uint64_t *owner) const;
+  // Number of waits queued for |key|.
+  size_t NumWaiters(uint64_t hash, const std::string &key) const;
+  size_t size() const { return size_; }
+  size_t capacity() const { return slots_.size(); }
+  size_t waiters() const { return waits_.size(); }
+  const Stats &stats() const { return stats_; }
+
+ private:
+  struct Waiter;
+
+  struct Lock {
+    std::string key;
+    uint64_t hash;
+    uint64_t owner;
+    uint64_t token;
+    TimerId lease_timer;
+    // FIFO list of the queued waits.
+    Waiter *first_waiter;
+    Waiter *last_waiter;
+    size_t num_waiters;
+  };
+
+  struct Waiter {
+    Lock *lock;
+    Waiter *prev;
+    Waiter *next;
+    uint64_t owner;
+    uint64_t wait_id;
+    int64_t lease_ms;
+    TimerId wait_timer;
+    GrantCallback callback;
+  };
+
+  // 0 in |hash| marks an empty slot.
+  struct Slot {
+    uint64_t hash;
+    Lock *lock;
+  };
+
+  struct WaitKey {
+    uint64_t owner;
+    uint64_t wait_id;
+    bool operator==(const WaitKey &other) const {
+      return owner == other.owner && wait_id == other.wait_id;
+    }
+  };
+
+  struct WaitKeyHash {
+    size_t operator()(const WaitKey &key) const {
+      return std::hash<uint64_t>()(key.owner * 0x9e3779b97f4a7c15ULL ^
+                                   key.wait_id);
+    }
+  };
+
+  struct Completion {
+    GrantCallback callback;
+    int result;
+    uint64_t token;
+  };
+
+  // Returns the index of the slot holding |key|, or of the empty slot
+  // ending its probe sequence, and sets |found| accordingly.
+  size_t Find(uint64_t hash, const std::string &key, bool *found) const;
+  // Returns the index of the slot holding |lock|.
+  size_t IndexOf(const Lock *lock) const;
+  void Insert(size_t index, Lock *lock);
+  // Empties |index| and moves back the slots of the probe sequences
+  // running through it.
+  void EraseAt(size_t index);
+  void Grow();
+  // Takes the free lock |key|, whose probe sequence ends at |index|.
+  uint64_t Create(size_t index, uint64_t hash, const std::string &key,
+                  uint64_t owner, int64_t lease_ms);
+  void ScheduleLease(Lock *lock, int64_t lease_ms);
+  void OnLeaseExpired(Lock *lock);
+  // Gives |lock|, whose holder is gone, to its first waiter, or removes it
+  // if nobody waits.
+  void HandOver(Lock *lock);
+  // Takes |lock| out of the table and recycles it.
+  void Remove(Lock *lock);
+  void OnWaitTimeout(Waiter *waiter);
+  // Unlinks |waiter|, queues its callback with |result| and recycles it.
+  void FinishWait(Waiter *waiter, int result, uint64_t token);
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+  size_t size_;
+  uint64_t next_token_;
+  // Lease and wait deadlines.
+  TimingWheel timers_;
+  std::vector<Lock *> free_locks_;
+  // Linked through |next|, so that recycling the waiters of a long queue
+  // never has to grow a vector.
+  Waiter *free_waiters_;
+  std::unordered_map<WaitKey, Waiter *, WaitKeyHash> waits_;
+  std::deque<Completion> callbacks_;
+  Stats stats_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockShard);
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,270 @@
+#include "lock/lock_shard.h"
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "lock/lock_errors.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+static int Acquire(LockShard *shard, uint64_t now, const std::string &key,
+                   uint64_t owner, int64_t lease_ms, uint64_t *token) {
+  return shard->Acquire(now, HashLockKey(key), key, owner, lease_ms, token);
+}
+
+static int Release(LockShard *shard, uint64_t now, const std::string &key,
+                   uint64_t owner) {
+  return shard->Release(now, HashLockKey(key), key, owner);
+}
+
+// Records the results of the waits it makes callbacks for.
+struct Grants {
+  LockShard::GrantCallback Callback(uint64_t owner) {
+    return [this, owner](int result, uint64_t token) {
+      owners.push_back(owner);
+      results.push_back(result);
+      tokens.push_back(token);
+    };
+  }
+
+  std::vector<uint64_t> owners;
+  std::vector<int> results;
+  std::vector<uint64_t> tokens;
+};
+
+static int Wait(LockShard *shard, uint64_t now, const std::string &key,
+                uint64_t owner, int64_t wait_ms, Grants *grants) {
+  uint64_t token = 0;
+  return shard->AcquireOrWait(now, HashLockKey(key), key, owner, 1000,
+                              wait_ms, owner, grants->Callback(owner),
+                              &token);
+}
+
+UNITTEST_DEFINITION(LockShardTest);
+
+TEST(LockShardTest, TestAcquireRelease) {
+  LockShard shard(1000, 0);
+  uint64_t token = 0;
+  CHECK_EQ(Acquire(&shard, 1000, "a", 1, 5000, &token), OK);
+  uint64_t first = token;
+  CHECK_EQ(Acquire(&shard, 1000, "a", 2, 5000, &token), ERR_LOCK_HELD);
+  // Re-acquiring keeps the token.
+  CHECK_EQ(Acquire(&shard, 1001, "a", 1, 5000, &token), OK);
+  CHECK_EQ(token, first);
+  CHECK_EQ(Release(&shard, 1002, "a", 2), ERR_LOCK_NOT_HELD);
+  CHECK_EQ(Release(&shard, 1002, "a", 1), OK);
+  CHECK_EQ(Release(&shard, 1002, "a", 1), ERR_LOCK_NOT_HELD);
+  CHECK_EQ(Acquire(&shard, 1003, "a", 2, 5000, &token), OK);
+  CHECK_GT(token, first);
+  CHECK_EQ(shard.size(), 1u);
+  CHECK_EQ(Acquire(&shard, 1003, "b", 2, 0, &token), ERR_INVALID_ARGUMENT);
+
+  const LockShard::Stats &stats = shard.stats();
+  CHECK_EQ(stats.acquires, 3);
+  CHECK_EQ(stats.contended, 1);
+  CHECK_EQ(stats.releases, 1);
+}
+
+TEST(LockShardTest, TestLeaseExpiry) {
+  LockShard shard(0, 0);
+  uint64_t token;
+  CHECK_EQ(Acquire(&shard, 0, "short", 1, 100, &token), OK);
+  CHECK_EQ(Acquire(&shard, 0, "long", 1, 100, &token), OK);
+  CHECK_EQ(true, shard.has_timers());
+  CHECK_EQ(shard.Renew(50, HashLockKey("long"), "long", 1, 1000), OK);
+  CHECK_EQ(shard.Renew(50, HashLockKey("long"), "long", 2, 1000),
+           ERR_LOCK_NOT_HELD);
+
+  // Leases end on the first tick past their deadline.
+  shard.Advance(100);
+  CHECK_EQ(shard.size(), 2u);
+  shard.Advance(101);
+  CHECK_EQ(shard.size(), 1u);
+  uint64_t owner = 0;
+  CHECK_EQ(false, shard.GetOwner(HashLockKey("short"), "short", &owner));
+  CHECK_EQ(Acquire(&shard, 200, "short", 2, 100, &token), OK);
+  CHECK_EQ(Acquire(&shard, 200, "long", 2, 100, &token), ERR_LOCK_HELD);
+
+  // Operations expire what is due before they look at the lock.
+  CHECK_EQ(Acquire(&shard, 1050, "long", 2, 100, &token), ERR_LOCK_HELD);
+  CHECK_EQ(Acquire(&shard, 1051, "long", 2, 100, &token), OK);
+  CHECK_EQ(true, shard.GetOwner(HashLockKey("long"), "long", &owner));
+  CHECK_EQ(owner, 2u);
+  CHECK_EQ(shard.stats().expirations, 3);
+}
+
+TEST(LockShardTest, TestManyLocks) {
+  // Starts small, so the table grows several times, and removes keys all
+  // over their probe sequences.
+  LockShard shard(0, 0);
+  std::unordered_map<std::string, uint64_t> held;
+  std::mt19937_64 rng(7);
+  uint64_t token;
+  for (int i = 0; i < 200000; ++i) {
+    std::string key = "lock/" + std::to_string(rng() % 20000);
+    uint64_t owner = 1 + rng() % 3;
+    auto it = held.find(key);
+    if (rng() % 2) {
+      int rv = Acquire(&shard, 0, key, owner, 60000, &token);
+      if (it == held.end()) {
+        CHECK_EQ(rv, OK);
+        held[key] = owner;
+      } else {
+        CHECK_EQ(rv, it->second == owner ? static_cast<int>(OK)
+                                         : static_cast<int>(ERR_LOCK_HELD));
+      }
+    } else {
+      int rv = Release(&shard, 0, key, owner);
+      if (it != held.end() && it->second == owner) {
+        CHECK_EQ(rv, OK);
+        held.erase(it);
+      } else {
+        CHECK_EQ(rv, ERR_LOCK_NOT_HELD);
+      }
+    }
+  }
+  CHECK_EQ(shard.size(), held.size());
+  CHECK_GE(shard.capacity(), held.size() * 4 / 3);
+  for (const auto &entry : held) {
+    uint64_t owner = 0;
+    CHECK_EQ(true,
+             shard.GetOwner(HashLockKey(entry.first), entry.first, &owner));
+    CHECK_EQ(owner, entry.second);
+  }
+
+  // Every lease runs out in the end.
+  shard.Advance(60001);
+  CHECK_EQ(shard.size(), 0u);
+  CHECK_EQ(false, shard.has_timers());
+}
+
+TEST(LockShardTest, TestWaitersFifo) {
+  LockShard shard(0, 0);
+  Grants grants;
+  uint64_t token;
+  CHECK_EQ(Acquire(&shard, 0, "a", 1, 1000, &token), OK);
+  uint64_t first = token;
+  for (uint64_t owner = 2; owner <= 4; ++owner) {
+    CHECK_EQ(Wait(&shard, 0, "a", owner, LockShard::kWaitForever, &grants),
+             ERR_IO_PENDING);
+  }
+  CHECK_EQ(shard.NumWaiters(HashLockKey("a"), "a"), 3u);
+  // The same wait can not be queued twice, and a try-lock never queues.
+  CHECK_EQ(Wait(&shard, 0, "a", 2, LockShard::kWaitForever, &grants),
+           ERR_INVALID_ARGUMENT);
+  CHECK_EQ(Wait(&shard, 0, "a", 5, 0, &grants), ERR_LOCK_HELD);
+
+  // Releasing hands the lock to the first waiter; the callback only runs
+  // from RunCallbacks().
+  CHECK_EQ(Release(&shard, 1, "a", 1), OK);
+  uint64_t owner = 0;
+  CHECK_EQ(true, shard.GetOwner(HashLockKey("a"), "a", &owner));
+  CHECK_EQ(owner, 2u);
+  CHECK_EQ(grants.owners.size(), 0u);
+  CHECK_EQ(true, shard.has_callbacks());
+  CHECK_EQ(shard.RunCallbacks(10), 1);
+  CHECK_EQ(grants.results[0], OK);
+  CHECK_GT(grants.tokens[0], first);
+
+  // Nobody can take the lock between the holder and the next waiter.
+  CHECK_EQ(Release(&shard, 2, "a", 2), OK);
+  CHECK_EQ(Acquire(&shard, 2, "a", 5, 1000, &token), ERR_LOCK_HELD);
+  CHECK_EQ(Release(&shard, 3, "a", 3), OK);
+  CHECK_EQ(shard.RunCallbacks(10), 2);
+  CHECK_EQ(grants.owners[1], 3u);
+  CHECK_EQ(grants.owners[2], 4u);
+  CHECK_GT(grants.tokens[2], grants.tokens[1]);
+  CHECK_EQ(Release(&shard, 4, "a", 4), OK);
+  CHECK_EQ(shard.size(), 0u);
+  CHECK_EQ(shard.waiters(), 0u);
+  CHECK_EQ(shard.stats().grants, 3);
+}
+
+TEST(LockShardTest, TestWaitTimeoutAndCancel) {
+  LockShard shard(0, 0);
+  Grants grants;
+  uint64_t token;
+  CHECK_EQ(Acquire(&shard, 0, "a", 1, 500, &token), OK);
+  CHECK_EQ(Wait(&shard, 0, "a", 2, 100, &grants), ERR_IO_PENDING);
+  CHECK_EQ(Wait(&shard, 0, "a", 3, LockShard::kWaitForever, &grants),
+           ERR_IO_PENDING);
+  CHECK_EQ(Wait(&shard, 0, "a", 4, LockShard::kWaitForever, &grants),
+           ERR_IO_PENDING);
+
+  shard.Advance(101);
+  CHECK_EQ(shard.RunCallbacks(10), 1);
+  CHECK_EQ(grants.owners[0], 2u);
+  CHECK_EQ(grants.results[0], ERR_TIMED_OUT);
+  CHECK_EQ(true, shard.CancelWait(200, 3, 3));
+  CHECK_EQ(false, shard.CancelWait(200, 3, 3));
+  CHECK_EQ(shard.RunCallbacks(10), 1);
+  CHECK_EQ(grants.results[1], ERR_ABORTED);
+
+  // An expired lease hands the lock over as well.
+  shard.Advance(501);
+  uint64_t owner = 0;
+  CHECK_EQ(true, shard.GetOwner(HashLockKey("a"), "a", &owner));
+  CHECK_EQ(owner, 4u);
+  CHECK_EQ(shard.RunCallbacks(10), 1);
+  CHECK_EQ(grants.results[2], OK);
+  CHECK_EQ(false, shard.CancelWait(600, 4, 4));
+  // With the lease of the waiter, from the tick after the old one ended.
+  shard.Advance(1501);
+  CHECK_EQ(shard.size(), 1u);
+  shard.Advance(1502);
+  CHECK_EQ(shard.size(), 0u);
+  CHECK_EQ(shard.stats().wait_timeouts, 1);
+  CHECK_EQ(shard.stats().expirations, 2);
+}
+
+TEST(LockShardTest, TestHotLock) {
+  // Every holder releases from its grant callback, which must neither
+  // recurse through the queue nor skip anybody.
+  LockShard shard(0, 0);
+  const uint64_t kWaiters = 10000;
+  uint64_t token;
+  std::vector<uint64_t> order;
+  CHECK_EQ(Acquire(&shard, 0, "hot", 0, 1000, &token), OK);
+  for (uint64_t owner = 1; owner <= kWaiters; ++owner) {
+    int rv = shard.AcquireOrWait(
+        0, HashLockKey("hot"), "hot", owner, 1000, LockShard::kWaitForever,
+        owner,
+        [&shard, &order, owner](int result, uint64_t) {
+          if (result != OK) {
+            return;
+          }
+          order.push_back(owner);
+          CHECK_EQ(Release(&shard, 0, "hot", owner), OK);
+        },
+        &token);
+    CHECK_EQ(rv, ERR_IO_PENDING);
+  }
+  // Cancels every other waiter from the back half.
+  for (uint64_t owner = kWaiters / 2; owner <= kWaiters; owner += 2) {
+    CHECK_EQ(true, shard.CancelWait(0, owner, owner));
+  }
+  shard.RunCallbacks(kWaiters);
+  CHECK_EQ(Release(&shard, 0, "hot", 0), OK);
+  // Each callback queues the grant of the next waiter, so the chain runs
+  // in batches of the given size.
+  int batches = 0;
+  while (shard.has_callbacks()) {
+    CHECK_LE(shard.RunCallbacks(64), 64);
+    ++batches;
+  }
+  CHECK_GT(batches, 100);
+  CHECK_EQ(order.size(), kWaiters - kWaiters / 4 - 1);
+  for (size_t i = 1; i < order.size(); ++i) {
+    CHECK_LT(order[i - 1], order[i]);
+  }
+  CHECK_EQ(shard.size(), 0u);
+  CHECK_EQ(shard.waiters(), 0u);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(LockShardTest)
@@ -0,0 +1,243 @@
+#include "lock/lock_table.h"
+#include <time.h>
+#include <utility>
+#include "base/sync.h"
+#include "net/event_pump.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+namespace {
+
+// Grant callbacks run per loop task.
+const int kCallbacksPerTask = 64;
+
+}  // namespace
+
+// Same clock and unit as the EventPump timers.
+static uint64_t NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+LockTable::Shard::Shard(EventPump *pump, size_t capacity)
+    : table(NowMs(), capacity),
+      pump(pump),
+      expiry_timer(kInvalidTimerId),
+      armed_tick(0),
+      running_callbacks(false),
+      callbacks_posted(false) {}
+
+LockTable::LockTable(const std::vector<EventPump *> &pumps, int num_shards,
+                     size_t capacity_per_shard) {
+  CHECK(!pumps.empty());
+  if (num_shards <= 0) {
+    num_shards = static_cast<int>(pumps.size());
+  }
+  for (int i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(
+        new Shard(pumps[i % pumps.size()], capacity_per_shard));
+  }
+}
+
+LockTable::~LockTable() {
+  // Expiry timers are loop thread state, so they are cancelled there.
+  Mutex mutex;
+  CondVar cond(&mutex);
+  size_t pending = shards_.size();
+  for (auto &shard : shards_) {
+    Shard *s = shard.get();
+    CHECK(!s->pump->IsInLoopThread());
+    s->pump->PostTask([s, &mutex, &cond, &pending]() {
+      if (s->expiry_timer != kInvalidTimerId) {
+        s->pump->CancelTimer(s->expiry_timer);
+      }
+      MutexLock lock(&mutex);
+      if (--pending == 0) {
+        cond.Signal();
+      }
+    });
+  }
+  MutexLock lock(&mutex);
+  while (pending) {
+    cond.Wait();
+  }
+}
+
+EventPump *LockTable::PumpFor(const std::string &key) const {
+  return shards_[ShardIndex(HashLockKey(key))]->pump;
+}
+
+// The inline paths avoid copying |key| into a task.
+void LockTable::Acquire(const std::string &key, uint64_t owner,
+                        int64_t lease_ms, AcquireCallback callback) {
+  Acquire(key, owner, lease_ms, 0, 0, std::move(callback));
+}
+
+void LockTable::Acquire(const std::string &key, uint64_t owner,
+                        int64_t lease_ms, int64_t wait_ms, uint64_t wait_id,
+                        AcquireCallback callback) {
+  uint64_t hash = HashLockKey(key);
+  Shard *shard = shards_[ShardIndex(hash)].get();
+  if (shard->pump->IsInLoopThread()) {
+    DoAcquire(shard, hash, key, owner, lease_ms, wait_ms, wait_id, callback);
+    return;
+  }
+  shard->pump->PostTask(
+      [this, shard, hash, key, owner, lease_ms, wait_ms, wait_id, callback] {
+        DoAcquire(shard, hash, key, owner, lease_ms, wait_ms, wait_id,
+                  callback);
+      });
+}
+
+void LockTable::CancelWait(const std::string &key, uint64_t owner,
+                           uint64_t wait_id) {
+  Shard *shard = shards_[ShardIndex(HashLockKey(key))].get();
+  if (shard->pump->IsInLoopThread()) {
+    shard->table.CancelWait(NowMs(), owner, wait_id);
+    RunCallbacks(shard);
+    return;
+  }
+  shard->pump->PostTask([this, shard, owner, wait_id] {
+    shard->table.CancelWait(NowMs(), owner, wait_id);
+    RunCallbacks(shard);
+  });
+}
+
+void LockTable::Release(const std::string &key, uint64_t owner,
+                        CompletionCallback callback) {
+  uint64_t hash = HashLockKey(key);
+  Shard *shard = shards_[ShardIndex(hash)].get();
+  if (shard->pump->IsInLoopThread()) {
+    DoRelease(shard, hash, key, owner, callback);
+    return;
+  }
+  shard->pump->PostTask([this, shard, hash, key, owner, callback] {
+    DoRelease(shard, hash, key, owner, callback);
+  });
+}
+
+void LockTable::Renew(const std::string &key, uint64_t owner,
+                      int64_t lease_ms, CompletionCallback callback) {
+  uint64_t hash = HashLockKey(key);
+  Shard *shard = shards_[ShardIndex(hash)].get();
+  if (shard->pump->IsInLoopThread()) {
+    DoRenew(shard, hash, key, owner, lease_ms, callback);
+    return;
+  }
+  shard->pump->PostTask([this, shard, hash, key, owner, lease_ms, callback] {
+    DoRenew(shard, hash, key, owner, lease_ms, callback);
+  });
+}
+
+void LockTable::DoAcquire(Shard *shard, uint64_t hash,
+                          const std::string &key, uint64_t owner,
+                          int64_t lease_ms, int64_t wait_ms, uint64_t wait_id,
+                          const AcquireCallback &callback) {
+  uint64_t token = 0;
+  int rv;
+  if (wait_ms == 0) {
+    // Spares copying |callback|.
+    rv = shard->table.Acquire(NowMs(), hash, key, owner, lease_ms, &token);
+  } else {
+    rv = shard->table.AcquireOrWait(NowMs(), hash, key, owner, lease_ms,
+                                    wait_ms, wait_id, callback, &token);
+  }
+  ArmExpiry(shard);
+  if (rv != ERR_IO_PENDING) {
+    callback(rv, token);
+  }
+  RunCallbacks(shard);
+}
+
+void LockTable::DoRelease(Shard *shard, uint64_t hash,
+                          const std::string &key, uint64_t owner,
+                          const CompletionCallback &callback) {
+  int rv = shard->table.Release(NowMs(), hash, key, owner);
+  // A waiter got the lock with a new lease.
+  ArmExpiry(shard);
+  callback(rv);
+  RunCallbacks(shard);
+}
+
+void LockTable::DoRenew(Shard *shard, uint64_t hash, const std::string &key,
+                        uint64_t owner, int64_t lease_ms,
+                        const CompletionCallback &callback) {
+  int rv = shard->table.Renew(NowMs(), hash, key, owner, lease_ms);
+  ArmExpiry(shard);
+  callback(rv);
+  RunCallbacks(shard);
+}
+
+void LockTable::ArmExpiry(Shard *shard) {
+  if (!shard->table.has_timers()) {
+    return;
+  }
+  uint64_t tick = shard->table.NextExpiryTick();
+  if (shard->armed_tick && shard->armed_tick <= tick) {
+    return;
+  }
+  if (shard->expiry_timer != kInvalidTimerId) {
+    shard->pump->CancelTimer(shard->expiry_timer);
+  }
+  uint64_t now = NowMs();
+  shard->expiry_timer =
+      shard->pump->RunAfter(tick > now ? tick - now : 0,
+                            [this, shard] { OnExpiryTimer(shard); });
+  shard->armed_tick = tick;
+}
+
+void LockTable::OnExpiryTimer(Shard *shard) {
+  shard->expiry_timer = kInvalidTimerId;
+  shard->armed_tick = 0;
+  shard->table.Advance(NowMs());
+  ArmExpiry(shard);
+  RunCallbacks(shard);
+}
+
+void LockTable::RunCallbacks(Shard *shard) {
+  if (shard->running_callbacks || shard->callbacks_posted ||
+      !shard->table.has_callbacks()) {
+    return;
+  }
+  shard->running_callbacks = true;
+  shard->table.RunCallbacks(kCallbacksPerTask);
+  shard->running_callbacks = false;
+  if (!shard->table.has_callbacks()) {
+    return;
+  }
+  // Gives the loop back to its other tasks and sockets first.
+  shard->callbacks_posted = true;
+  shard->pump->PostTask([this, shard] {
+    shard->callbacks_posted = false;
+    RunCallbacks(shard);
+  });
+}
+
+LockShard::Stats LockTable::GetStats() const {
+  LockShard::Stats total = {};
+  for (const auto &shard : shards_) {
+    const LockShard::Stats &stats = shard->table.stats();
+    total.acquires += stats.acquires;
+    total.contended += stats.contended;
+    total.releases += stats.releases;
+    total.renewals += stats.renewals;
+    total.expirations += stats.expirations;
+    total.waits += stats.waits;
+    total.grants += stats.grants;
+    total.wait_timeouts += stats.wait_timeouts;
+  }
+  return total;
+}
+
+size_t LockTable::size() const {
+  size_t total = 0;
+  for (const auto &shard : shards_) {
+    total += shard->table.size();
+  }
+  return total;
+}
+
+}  // namespace dlock
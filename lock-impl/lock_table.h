@@ -0,0 +1,111 @@
+#ifndef DLOCK_LOCK_LOCK_TABLE_H_
+#define DLOCK_LOCK_LOCK_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "base/noncopyable.h"
+#include "lock/lock_shard.h"
+#include "net/net_errors.h"
+#include "net/timing_wheel.h"
+
+namespace dlock {
+
+class EventPump;
+
+// The lock manager: named locks with leases, split into shards by key hash.
+// Each shard belongs to one event loop and is only touched on its thread,
+// so an operation on a shard of the calling loop runs inline without any
+// locking, and one on another shard costs a single PostTask() to its loop.
+// Leases expire on the shard's loop through a pump timer that is re-armed
+// only when the earliest deadline of the shard moves.
+//
+// Grants to queued acquires run on the shard's loop as well, a bounded
+// number per loop task, so handing a hot lock down a long queue of waiters
+// whose callbacks release it right away does not starve the other work of
+// the loop.
+class LockTable {
+ public:
+  // Gets OK and the fencing token, or an error and 0.
+  typedef std::function<void(int result, uint64_t token)> AcquireCallback;
+
+  // Shard i is owned by |pumps|[i % pumps.size()]; |num_shards| of 0 means
+  // one per pump. Each shard starts out sized for |capacity_per_shard|
+  // locks. The pumps must outlive the table.
+  LockTable(const std::vector<EventPump *> &pumps, int num_shards,
+            size_t capacity_per_shard);
+  // Waits for the loops to drop the expiry timers. Must not be called on
+  // one of them, nor while operations are still in flight.
+  ~LockTable();
+
+  // See LockShard for the semantics. Callable from any thread; callbacks
+  // run on the loop of the shard, right away if that is the calling one.
+  void Acquire(const std::string &key, uint64_t owner, int64_t lease_ms,
+               AcquireCallback callback);
+  // Queues behind the current holder for up to |wait_ms|, see
+  // LockShard::AcquireOrWait(). |callback| runs once, with the result of
+  // the wait if there was one.
+  void Acquire(const std::string &key, uint64_t owner, int64_t lease_ms,
+               int64_t wait_ms, uint64_t wait_id, AcquireCallback callback);
+  // The callback of the wait, if still queued, gets ERR_ABORTED.
+  void CancelWait(const std::string &key, uint64_t owner, uint64_t wait_id);
+  void Release(const std::string &key, uint64_t owner,
+               CompletionCallback callback);
+  void Renew(const std::string &key, uint64_t owner, int64_t lease_ms,
+             CompletionCallback callback);
+
+  int num_shards() const { return static_cast<int>(shards_.size()); }
+  int ShardIndex(uint64_t hash) const {
+    return static_cast<int>((hash >> 32) % shards_.size());
+  }
+  // The loop that runs the operations on |key|. Servers can route a
+  // client's connection to it to keep the acquire path on one thread.
+  EventPump *PumpFor(const std::string &key) const;
+
+  // Sums the statistics of all shards. Call while the loops are idle.
+  LockShard::Stats GetStats() const;
+  // Number of locks held. Same restriction as GetStats().
+  size_t size() const;
+
+ private:
+  struct alignas(kCacheLineSize) Shard {
+    Shard(EventPump *pump, size_t capacity);
+
+    LockShard table;
+    EventPump *pump;
+    TimerId expiry_timer;
+    // The tick |expiry_timer| fires at, or 0 if it is not armed.
+    uint64_t armed_tick;
+    // Set while running grant callbacks, which may call back into the
+    // table, and while a task to run more of them is posted.
+    bool running_callbacks;
+    bool callbacks_posted;
+  };
+
+  // Run on the loop of |shard|.
+  void DoAcquire(Shard *shard, uint64_t hash, const std::string &key,
+                 uint64_t owner, int64_t lease_ms, int64_t wait_ms,
+                 uint64_t wait_id, const AcquireCallback &callback);
+  void DoRelease(Shard *shard, uint64_t hash, const std::string &key,
+                 uint64_t owner, const CompletionCallback &callback);
+  void DoRenew(Shard *shard, uint64_t hash, const std::string &key,
+               uint64_t owner, int64_t lease_ms,
+               const CompletionCallback &callback);
+  // Makes sure the pump wakes up for the next lease deadline of |shard|.
+  void ArmExpiry(Shard *shard);
+  void OnExpiryTimer(Shard *shard);
+  // Runs a batch of the grant callbacks of |shard| and posts a task for
+  // the rest.
+  void RunCallbacks(Shard *shard);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockTable);
+};
+
+}  // namespace dlock
+
+#endif
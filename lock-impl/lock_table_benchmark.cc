@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lock/lock_shard.h"
+#include "lock/lock_table.h"
+#include "net/event_pump.h"
+#include "net/event_pump_group.h"
+#include "net/net_errors.h"
+#include "util/logging.h"
+
+namespace dlock {
+namespace {
+
+const int kWarmupMs = 200;
+const int64_t kLeaseMs = 30000;
+const int kKeysPerLoop = 100000;
+// Operations each worker keeps in flight, as pipelined clients would.
+const int kWindow = 256;
+
+uint64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Acquires and releases random locks from one loop, keeping kWindow pairs
+// in flight. Completions arrive on the loops of the shards.
+class Worker {
+ public:
+  Worker(EventPump *pump, LockTable *table, std::vector<std::string> keys,
+         uint64_t owner)
+      : pump_(pump),
+        table_(table),
+        keys_(std::move(keys)),
+        owner_(owner),
+        rng_(owner),
+        issued_(0),
+        completed_(0),
+        stopping_(false),
+        drained_(false) {}
+
+  void Start() {
+    pump_->PostTask([this]() { Step(); });
+  }
+  void Stop() { stopping_.store(true, std::memory_order_relaxed); }
+  bool drained() const { return drained_.load(std::memory_order_acquire); }
+  int64_t completed() const {
+    return completed_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Tops up the window, then yields the loop to the tasks of other workers
+  // before doing it again. Operations on shards of this loop complete
+  // inline and never fill the window, hence the cap per step.
+  void Step() {
+    if (stopping_.load(std::memory_order_relaxed)) {
+      if (issued_ == completed_.load(std::memory_order_acquire)) {
+        drained_.store(true, std::memory_order_release);
+        return;
+      }
+    } else {
+      for (int i = 0;
+           i < kWindow &&
+           issued_ - completed_.load(std::memory_order_relaxed) < kWindow;
+           ++i) {
+        Issue();
+      }
+    }
+    pump_->PostTask([this]() { Step(); });
+  }
+
+  void Issue() {
+    const std::string *key = &keys_[rng_() % keys_.size()];
+    ++issued_;
+    table_->Acquire(*key, owner_, kLeaseMs, [this, key](int rv, uint64_t) {
+      if (rv != OK) {
+        // Held by another worker.
+        completed_.fetch_add(1, std::memory_order_release);
+        return;
+      }
+      // Runs inline, on the loop of the shard.
+      table_->Release(*key, owner_, [this](int) {
+        completed_.fetch_add(1, std::memory_order_release);
+      });
+    });
+  }
+
+  EventPump *pump_;
+  LockTable *table_;
+  const std::vector<std::string> keys_;
+  const uint64_t owner_;
+  std::mt19937_64 rng_;
+  // Loop thread only.
+  int64_t issued_;
+  // Bumped by the loops of the shards.
+  alignas(kCacheLineSize) std::atomic<int64_t> completed_;
+  std::atomic<bool> stopping_;
+  std::atomic<bool> drained_;
+};
+
+// The ceiling for one core: the shard alone, without loops or tasks.
+void RunShard(int num_keys) {
+  std::vector<std::string> keys;
+  std::vector<uint64_t> hashes;
+  for (int i = 0; i < num_keys; ++i) {
+    keys.push_back("lock/" + std::to_string(i));
+    hashes.push_back(HashLockKey(keys.back()));
+  }
+  LockShard shard(0, num_keys);
+  std::mt19937_64 rng(1);
+  const int kOps = 4000000;
+  uint64_t token;
+  uint64_t start = NowNanos();
+  for (int i = 0; i < kOps; ++i) {
+    size_t k = rng() % keys.size();
+    shard.Acquire(0, hashes[k], keys[k], 1, kLeaseMs, &token);
+    shard.Release(0, hashes[k], keys[k], 1);
+  }
+  double seconds = static_cast<double>(NowNanos() - start) / 1e9;
+  printf(
+      "{\"benchmark\":\"lock_shard\",\"keys\":%d,\"ops\":%d,"
+      "\"ops_per_sec\":%.0f,\"ns_per_op\":%.1f}\n",
+      num_keys, 2 * kOps, 2 * kOps / seconds, seconds * 1e9 / (2 * kOps));
+  fflush(stdout);
+}
+
+// Measures the longest time the loop is kept from its other tasks.
+class StallProbe {
+ public:
+  explicit StallProbe(EventPump *pump)
+      : pump_(pump), last_(0), max_gap_(0), stopping_(false), done_(false) {}
+
+  void Start() {
+    pump_->PostTask([this]() { Tick(); });
+  }
+  // Returns the longest gap between two runs of the probe, in nanoseconds.
+  uint64_t Stop() {
+    stopping_.store(true, std::memory_order_relaxed);
+    while (!done_.load(std::memory_order_acquire)) {
+      usleep(1000);
+    }
+    return max_gap_;
+  }
+
+ private:
+  void Tick() {
+    uint64_t now = NowNanos();
+    if (last_) {
+      max_gap_ = std::max(max_gap_, now - last_);
+    }
+    last_ = now;
+    if (stopping_.load(std::memory_order_relaxed)) {
+      done_.store(true, std::memory_order_release);
+      return;
+    }
+    pump_->PostTask([this]() { Tick(); });
+  }
+
+  EventPump *pump_;
+  uint64_t last_;
+  uint64_t max_gap_;
+  std::atomic<bool> stopping_;
+  std::atomic<bool> done_;
+};
+
+// Hands one lock down a queue of |waiters|, each releasing it as soon as
+// it is granted, while a probe checks that the chain of grants does not
+// hold up the loop.
+void RunHotLock(int waiters) {
+  EventPumpGroup pumps(1, EventPumpGroup::ROUND_ROBIN, true);
+  EventPump *pump = pumps.GetPump(0);
+  LockTable table(std::vector<EventPump *>(1, pump), 0, 16);
+  const std::string key = "hot";
+  std::atomic<int> queued(0);
+  std::atomic<int> granted(0);
+  pump->PostTask([&]() {
+    table.Acquire(key, 0, kLeaseMs, [](int, uint64_t) {});
+    for (int i = 1; i <= waiters; ++i) {
+      uint64_t owner = i;
+      table.Acquire(key, owner, kLeaseMs, LockShard::kWaitForever, owner,
+                    [&table, &key, &granted, owner](int rv, uint64_t) {
+                      CHECK_EQ(rv, OK);
+                      granted.fetch_add(1, std::memory_order_relaxed);
+                      table.Release(key, owner, [](int) {});
+                    });
+    }
+    queued.store(waiters, std::memory_order_release);
+  });
+  while (queued.load(std::memory_order_acquire) != waiters) {
+    usleep(1000);
+  }
+
+  StallProbe probe(pump);
+  probe.Start();
+  uint64_t start = NowNanos();
+  table.Release(key, 0, [](int) {});
+  while (granted.load(std::memory_order_relaxed) != waiters) {
+    usleep(100);
+  }
+  double seconds = static_cast<double>(NowNanos() - start) / 1e9;
+  uint64_t max_stall = probe.Stop();
+  printf(
+      "{\"benchmark\":\"lock_handoff\",\"waiters\":%d,"
+      "\"handoffs_per_sec\":%.0f,\"max_loop_stall_us\":%.1f}\n",
+      waiters, waiters / seconds, static_cast<double>(max_stall) / 1e3);
+  fflush(stdout);
+}
+
+// With |local_keys|, every worker only uses locks of the shards on its own
+// loop, as when connections are routed by LockTable::PumpFor(); otherwise
+// most operations cross to another loop.
+void Run(int loops, bool local_keys, int duration_ms) {
+  EventPumpGroup pumps(loops, EventPumpGroup::ROUND_ROBIN, true);
+  std::vector<EventPump *> pump_list;
+  for (int i = 0; i < loops; ++i) {
+    pump_list.push_back(pumps.GetPump(i));
+  }
+  LockTable table(pump_list, 0, kKeysPerLoop);
+
+  std::vector<std::vector<std::string>> keys(loops);
+  for (int i = 0, added = 0; added < kKeysPerLoop * loops; ++i) {
+    std::string key = "lock/" + std::to_string(i);
+    int index = added % loops;
+    if (local_keys) {
+      EventPump *pump = table.PumpFor(key);
+      for (index = 0; pump_list[index] != pump; ++index) {
+      }
+      if (keys[index].size() == static_cast<size_t>(kKeysPerLoop)) {
+        continue;
+      }
+    }
+    keys[index].push_back(key);
+    ++added;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int i = 0; i < loops; ++i) {
+    workers.emplace_back(
+        new Worker(pump_list[i], &table, std::move(keys[i]), i + 1));
+    workers.back()->Start();
+  }
+
+  usleep(kWarmupMs * 1000);
+  int64_t before = 0;
+  for (auto &worker : workers) {
+    before += worker->completed();
+  }
+  uint64_t start = NowNanos();
+  usleep(duration_ms * 1000);
+  int64_t after = 0;
+  for (auto &worker : workers) {
+    after += worker->completed();
+  }
+  uint64_t elapsed = NowNanos() - start;
+  for (auto &worker : workers) {
+    worker->Stop();
+  }
+  for (auto &worker : workers) {
+    while (!worker->drained()) {
+      usleep(1000);
+    }
+  }
+
+  // The loops are idle now.
+  LockShard::Stats stats = table.GetStats();
+  double seconds = static_cast<double>(elapsed) / 1e9;
+  // An acquire and a release per pair; the rare acquire refused because
+  // another worker held the lock counts as a pair as well.
+  double pairs = static_cast<double>(after - before);
+  printf(
+      "{\"benchmark\":\"lock_table\",\"loops\":%d,\"keys\":\"%s\","
+      "\"seconds\":%.3f,\"pairs_per_sec\":%.0f,\"ops_per_sec\":%.0f,"
+      "\"ops_per_sec_per_loop\":%.0f,\"contended\":%ld}\n",
+      loops, local_keys ? "local" : "any", seconds, pairs / seconds,
+      2 * pairs / seconds, 2 * pairs / seconds / loops, stats.contended);
+  fflush(stdout);
+}
+
+}  // namespace
+}  // namespace dlock
+
+// Prints one JSON object per line, e.g. for jq or a results database.
+int main(int argc, char *argv[]) {
+  int duration_ms = argc > 1 ? atoi(argv[1]) : 1000;
+  int max_loops = argc > 2 ? atoi(argv[2]) : 8;
+  dlock::RunShard(dlock::kKeysPerLoop);
+  dlock::RunHotLock(100000);
+  for (int loops = 1; loops <= max_loops; loops *= 2) {
+    dlock::Run(loops, true, duration_ms);
+    dlock::Run(loops, false, duration_ms);
+  }
+  return 0;
+}
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "base/sync.h"
+#include "net/event_pump.h"
+#include "net/event_pump_group.h"
+#include "net/event_pump_test_util.h"
+#include "net/histogram.h"
+#include "net/io_buffer.h"
+#include "net/net_errors.h"
+#include "net/socket_address.h"
+#include "net/tcp_server_socket.h"
+#include "net/tcp_socket.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+namespace {
+
+const int kReadBufferSize = 64 * 1024;
+const int kWarmupMs = 200;
+
+uint64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Writes back whatever it reads until the peer goes away.
+class EchoSession {
+ public:
+  explicit EchoSession(std::unique_ptr<TCPSocket> socket)
+      : socket_(std::move(socket)), buf_(new IOBuffer(kReadBufferSize)) {}
+
+  TCPSocket *socket() const { return socket_.get(); }
+
+  void Start() {
+    socket_->SetNoDelay(true);
+    DoRead();
+  }
+
+ private:
+  void DoRead() {
+    for (;;) {
+      int rv = socket_->Read(buf_.get(), kReadBufferSize,
+                             [this](int rv) { OnRead(rv); });
+      if (rv == ERR_IO_PENDING) {
+        return;
+      }
+      if (!Echo(rv)) {
+        return;
+      }
+    }
+  }
+
+  void OnRead(int rv) {
+    if (Echo(rv)) {
+      DoRead();
+    }
+  }
+
+  // Returns true if the echo completed without waiting.
+  bool Echo(int rv) {
+    if (rv <= 0) {
+      socket_->Close();
+      return false;
+    }
+    rv = socket_->Write(buf_.get(), rv, [this](int rv) { OnWritten(rv); });
+    if (rv == ERR_IO_PENDING) {
+      return false;
+    }
+    if (rv < 0) {
+      socket_->Close();
+      return false;
+    }
+    return true;
+  }
+
+  void OnWritten(int rv) {
+    if (rv < 0) {
+      socket_->Close();
+      return;
+    }
+    DoRead();
+  }
+
+  std::unique_ptr<TCPSocket> socket_;
+  scoped_refptr<IOBuffer> buf_;
+};
+
+// Shared by the clients of one run; set by the main thread.
+struct RunState {
+  std::atomic<bool> recording{false};
+  std::atomic<bool> stopping{false};
+  // Clients that have not stopped yet.
+  std::atomic<int> active{0};
+};
+
+// Sends a message, waits for all of it to come back, and repeats, so every
+// connection has exactly one request in flight.
+class EchoClient {
+ public:
+  EchoClient(EventPump *pump, int msg_size, RunState *state)
+      : socket_(new TCPSocket(pump)),
+        msg_size_(msg_size),
+        request_(new IOBuffer(msg_size)),
+        response_(new IOBuffer(msg_size)),
+        state_(state),
+        received_(0),
+        start_ns_(0),
+        requests_(0),
+        errors_(0) {
+    memset(request_->data(), 'x', msg_size);
+  }
+
+  TCPSocket *socket() const { return socket_.get(); }
+  const Histogram &latency() const { return latency_; }
+  int64_t requests() const { return requests_; }
+  int64_t errors() const { return errors_; }
+
+  // Must run on the loop thread.
+  void Start(const SocketAddress &server) {
+    state_->active.fetch_add(1);
+    if (socket_->Open()) {
+      Finish(ERR_FAILED);
+      return;
+    }
+    socket_->SetNoDelay(true);
+    int rv = socket_->Connect(server, [this](int rv) { OnConnected(rv); });
+    if (rv != ERR_IO_PENDING) {
+      OnConnected(rv);
+    }
+  }
+
+ private:
+  void OnConnected(int rv) {
+    if (rv != OK) {
+      Finish(rv);
+      return;
+    }
+    SendRequests();
+  }
+
+  void SendRequests() {
+    for (;;) {
+      if (state_->stopping.load(std::memory_order_relaxed)) {
+        Finish(OK);
+        return;
+      }
+      start_ns_ = NowNanos();
+      received_ = 0;
+      int rv = socket_->Write(request_.get(), msg_size_,
+                              [this](int rv) { OnWritten(rv); });
+      if (rv == ERR_IO_PENDING) {
+        return;
+      }
+      if (rv < 0) {
+        Finish(rv);
+        return;
+      }
+      if (!ReadResponse()) {
+        return;
+      }
+    }
+  }
+
+  void OnWritten(int rv) {
+    if (rv < 0) {
+      Finish(rv);
+      return;
+    }
+    if (ReadResponse()) {
+      SendRequests();
+    }
+  }
+
+  // Returns true once the whole response arrived without waiting.
+  bool ReadResponse() {
+    while (received_ < msg_size_) {
+      int rv = socket_->Read(response_.get(), msg_size_ - received_,
+                             [this](int rv) { OnRead(rv); });
+      if (rv == ERR_IO_PENDING) {
+        return false;
+      }
+      if (rv <= 0) {
+        Finish(rv ? rv : ERR_CONNECTION_CLOSED);
+        return false;
+      }
+      received_ += rv;
+    }
+    if (state_->recording.load(std::memory_order_relaxed)) {
+      latency_.Record(static_cast<int64_t>(NowNanos() - start_ns_));
+      ++requests_;
+    }
+    return true;
+  }
+
+  void OnRead(int rv) {
+    if (rv <= 0) {
+      Finish(rv ? rv : ERR_CONNECTION_CLOSED);
+      return;
+    }
+    received_ += rv;
+    if (ReadResponse()) {
+      SendRequests();
+    }
+  }
+
+  void Finish(int rv) {
+    if (rv != OK) {
+      ++errors_;
+    }
+    socket_->Close();
+    state_->active.fetch_sub(1);
+  }
+
+  std::unique_ptr<TCPSocket> socket_;
+  const int msg_size_;
+  scoped_refptr<IOBuffer> request_;
+  scoped_refptr<IOBuffer> response_;
+  RunState *state_;
+  int received_;
+  uint64_t start_ns_;
+  // Loop thread only until the run is over.
+  Histogram latency_;
+  int64_t requests_;
+  int64_t errors_;
+};
+
+// One point of the sweep: |loops| server and |loops| client pumps,
+// |connections| closed-loop clients spread over the latter, each echoing
+// |msg_size| byte messages for |duration_ms|. Prints one JSON object.
+void Run(int msg_size, int connections, int loops, int duration_ms) {
+  EventPumpGroup server_pumps(loops, EventPumpGroup::ROUND_ROBIN, false);
+  EventPumpGroup client_pumps(loops, EventPumpGroup::ROUND_ROBIN, false);
+
+  // Holds an ephemeral port for the sharded listeners, which would each
+  // get their own when binding port 0.
+  TCPSocket port_holder(server_pumps.GetPump(0));
+  SocketAddress address;
+  if (port_holder.Open() || port_holder.AllowPortReuse() ||
+      port_holder.Bind(SocketAddress("127.0.0.1", 0)) ||
+      port_holder.GetLocalAddress(&address)) {
+    fprintf(stderr, "failed to reserve a port\n");
+    exit(1);
+  }
+
+  Mutex sessions_mutex;
+  std::vector<std::unique_ptr<EchoSession>> sessions;
+  TCPServerSocket server;
+  int rv = server.ListenSharded(
+      address, 1024, &server_pumps,
+      [&sessions_mutex, &sessions](std::unique_ptr<TCPSocket> socket) {
+        EchoSession *session = new EchoSession(std::move(socket));
+        {
+          MutexLock lock(&sessions_mutex);
+          sessions.emplace_back(session);
+        }
+        session->Start();
+      });
+  port_holder.Close();
+  if (rv != OK) {
+    fprintf(stderr, "listen on %s failed: %s\n", address.ToString().c_str(),
+            ErrorToString(rv));
+    exit(1);
+  }
+
+  RunState state;
+  std::vector<std::unique_ptr<EchoClient>> clients;
+  for (int i = 0; i < connections; ++i) {
+    EventPump *pump = client_pumps.GetPump(i % loops);
+    EchoClient *client = new EchoClient(pump, msg_size, &state);
+    clients.emplace_back(client);
+    RunOnLoop(pump, [client, &address]() { client->Start(address); });
+  }
+
+  usleep(kWarmupMs * 1000);
+  state.recording.store(true);
+  uint64_t start = NowNanos();
+  usleep(duration_ms * 1000);
+  state.recording.store(false);
+  uint64_t elapsed = NowNanos() - start;
+  state.stopping.store(true);
+  while (state.active.load() > 0) {
+    usleep(1000);
+  }
+
+  Histogram latency;
+  int64_t requests = 0;
+  int64_t errors = 0;
+  for (auto &client : clients) {
+    // Closed already, this only reads what the loop recorded.
+    RunOnLoop(client->socket()->pump(), [&]() {
+      latency.Merge(client->latency());
+      requests += client->requests();
+      errors += client->errors();
+    });
+  }
+  server.StopListeningSharded();
+  for (auto &session : sessions) {
+    TCPSocket *socket = session->socket();
+    RunOnLoop(socket->pump(), [socket]() { socket->Close(); });
+  }
+
+  double seconds = static_cast<double>(elapsed) / 1e9;
+  printf(
+      "{\"benchmark\":\"echo\",\"msg_size\":%d,\"connections\":%d,"
+      "\"loops\":%d,\"seconds\":%.3f,\"requests\":%ld,\"errors\":%ld,"
+      "\"requests_per_sec\":%.0f,\"mb_per_sec\":%.2f,"
+      "\"latency_us\":{\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,"
+      "\"p999\":%.1f,\"max\":%.1f}}\n",
+      msg_size, connections, loops, seconds, requests, errors,
+      requests / seconds, requests * msg_size / seconds / (1 << 20),
+      latency.mean() / 1e3, latency.Percentile(50) / 1e3,
+      latency.Percentile(99) / 1e3, latency.Percentile(99.9) / 1e3,
+      latency.max() / 1e3);
+  fflush(stdout);
+}
+
+}  // namespace
+}  // namespace dlock
+
+// Prints one JSON object per line, e.g. for jq or a results database.
+// Usage: echo_benchmark [duration_ms] [max_loops]
+int main(int argc, char *argv[]) {
+  int duration_ms = argc > 1 ? atoi(argv[1]) : 1000;
+  int max_loops = argc > 2 ? atoi(argv[2]) : 4;
+  const int kMsgSizes[] = {64, 4096, 65536};
+  const int kConnections[] = {1, 16, 128};
+  for (int loops = 1; loops <= max_loops; loops *= 2) {
+    for (int connections : kConnections) {
+      for (int msg_size : kMsgSizes) {
+        dlock::Run(msg_size, connections, loops, duration_ms);
+      }
+    }
+  }
+  return 0;
+}
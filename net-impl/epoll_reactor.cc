@@ -1,7 +1,9 @@
 #include "net/epoll_reactor.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
+#include "net/metrics.h"
 #include "util/logging.h"
 
 namespace dlock {
@@ -14,86 +16,78 @@ EpollReactor::EpollReactor() : epfd_(::epoll_create(1)), ready_(kEventInitNum) {
 
 EpollReactor::~EpollReactor() { close(epfd_); }
 
-void EpollReactor::WatchFd(int fd, EventType event) {
-  struct epoll_event ev;
-  int op;
-  auto [it, ok] = fd_status_.insert({fd, 0});
-  if (ok) {
-    // insert succeed, new fd;
-    op = EPOLL_CTL_ADD;
-  } else {
-    op = EPOLL_CTL_MOD;
-  }
-  it->second |= static_cast<unsigned char>(event);
-
-  ev.events = EPOLLET;
-  ev.data.fd = fd;
-
-  if (it->second & READ) {
-    ev.events |= EPOLLIN;
+int EpollReactor::WaitReady(int timeout_ms) {
+  Metrics::Add(Metrics::REACTOR_WAIT_CALLS, 1);
+  int nfds = epoll_wait(epfd_, ready_.data(), static_cast<int>(ready_.size()),
+                        timeout_ms);
+  if (nfds < 0) {
+    if (errno != EINTR) {
+      LOG_ERROR("epoll_wait failed, %s", strerror(errno));
+    }
+    return 0;
   }
-  if (it->second & WRITE) {
-    ev.events |= EPOLLOUT;
+  if (nfds == static_cast<int>(ready_.size())) {
+    // Grow for the next batch, the events just returned are kept.
+    ready_.resize(nfds * 2);
   }
-
-  LOG_ASSERT(epoll_ctl(epfd_, op, fd, &ev) == 0);
+  return nfds;
 }
 
-bool EpollReactor::UnWatchFd(int fd, EventType event) {
-  auto it = fd_status_.find(fd);
-  if (it == fd_status_.end()) {
-    return false;
+FdWatcher *EpollReactor::ReadyAt(int index, int *fd, int *events) const {
+  const struct epoll_event &ev = ready_[index];
+  FdWatcher *watcher;
+  const Slot *slot = Resolve(ev.data.u64, fd, &watcher);
+  if (!slot) {
+    return nullptr;
   }
+  *events = ToEventMask(ev.events, *slot);
+  return watcher;
+}
 
-  it->second &= ~static_cast<unsigned char>(event);
-  int op;
-  if (it->second) {
-    op = EPOLL_CTL_MOD;
-  } else {
-    op = EPOLL_CTL_DEL;
+bool EpollReactor::ApplyChange(int fd, const Slot &slot) {
+  if (!slot.interest.load(std::memory_order_relaxed)) {
+    // The fd may have been closed already, which removed it from the epoll
+    // set, and possibly reused by a fd we never added.
+    Control(EPOLL_CTL_DEL, fd, slot);
+    return true;
   }
-
-  struct epoll_event ev;
-  ev.events = EPOLLET;
-  ev.data.fd = fd;
-
-  if (op == EPOLL_CTL_MOD) {
-    if (it->second & READ) {
-      ev.events |= EPOLLIN;
-    }
-    if (it->second & WRITE) {
-      ev.events |= EPOLLOUT;
+  bool ok;
+  if (!slot.registered) {
+    ok = Control(EPOLL_CTL_ADD, fd, slot);
+    if (!ok && errno == EEXIST) {
+      ok = Control(EPOLL_CTL_MOD, fd, slot);
     }
   } else {
-    fd_status_.erase(fd);
+    // A fd closed before its pending DEL was flushed left the epoll set,
+    // the reused fd has to be added again.
+    ok = Control(EPOLL_CTL_MOD, fd, slot);
+    if (!ok && errno == ENOENT) {
+      ok = Control(EPOLL_CTL_ADD, fd, slot);
+    }
   }
-
-  LOG_ASSERT(epoll_ctl(epfd_, op, fd, &ev) == 0);
-  return op == EPOLL_CTL_DEL;
+  return ok;
 }
 
-bool EpollReactor::IsWatched(int fd, EventType event) {
-  auto it = fd_status_.find(fd);
-  if (it == fd_status_.end()) {
-    return false;
+bool EpollReactor::Control(int op, int fd, const Slot &slot) {
+  unsigned char interest = slot.interest.load(std::memory_order_relaxed);
+  struct epoll_event ev;
+  ev.events = EPOLLET | EPOLLRDHUP;
+  ev.data.u64 = Tag(fd, slot);
+  if (interest & READ) {
+    ev.events |= EPOLLIN;
   }
-  return it->second & MASK == event;
-}
-
-void EpollReactor::WaitReady(std::vector<int>* readable,
-                             std::vector<int>* writable) {
-  int nfds = epoll_wait(epfd_, ready_.data(), kEventInitNum, -1);
-  for (int i = 0; i < nfds; ++i) {
-    if (readable && ready_[i].events & EPOLLIN) {
-      readable->push_back(ready_[i].data.fd);
-    }
-    if (writable && ready_[i].events & EPOLLOUT) {
-      writable->push_back(ready_[i].data.fd);
-    }
+  if (interest & WRITE) {
+    ev.events |= EPOLLOUT;
   }
-  if (nfds == ready_.size()) {
-    ready_.resize(nfds * 2);
+  Metrics::Add(Metrics::REACTOR_CTL_CALLS, 1);
+  if (epoll_ctl(epfd_, op, fd, &ev) != 0) {
+    if (op != EPOLL_CTL_DEL && errno != EEXIST && errno != ENOENT) {
+      LOG_ERROR("epoll_ctl(%d, %d, %d) failed, %s", epfd_, op, fd,
+                strerror(errno));
+    }
+    return false;
   }
+  return true;
 }
 
-}  // namespace dlock
\ No newline at end of file
+}  // namespace dlock
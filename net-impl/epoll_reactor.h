@@ -2,29 +2,32 @@
 #define DLOCK_NET_EPOLL_REACTOR_H_
 
 #include <sys/epoll.h>
-#include <unordered_map>
 #include <vector>
-#include "net/event_type.h"
+#include "net/reactor.h"
 
 namespace dlock {
 
-class EpollReactor {
+// epoll(7) backend. The fd and its slot generation are kept in
+// epoll_event.data.u64, so a ready event resolves its watcher without a
+// lookup.
+class EpollReactor : public Reactor {
  public:
   EpollReactor();
-  ~EpollReactor();
+  ~EpollReactor() override;
 
-  void WatchFd(int fd, EventType event);
-  bool UnWatchFd(int fd, EventType event);
-  bool IsWatched(int fd, EventType event);
-  void WaitReady(std::vector<int> *readable, std::vector<int> *writable);
+  int WaitReady(int timeout_ms) override;
+  FdWatcher *ReadyAt(int index, int *fd, int *events) const override;
+  ReactorType type() const override { return EPOLL_REACTOR; }
 
  private:
   static const int kEventInitNum;
 
+  bool ApplyChange(int fd, const Slot &slot) override;
+  bool Control(int op, int fd, const Slot &slot);
+
   int epfd_;
   std::vector<struct epoll_event> ready_;
-  std::unordered_map<int, unsigned char> fd_status_;
 };
 }  // namespace dlock
 
-#endif
\ No newline at end of file
+#endif
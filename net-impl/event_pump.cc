@@ -1,96 +1,334 @@
 #include "net/event_pump.h"
-#include "net/epoll_reactor.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 #include "net/fd_watcher.h"
+#include "net/loop_watchdog.h"
+#include "net/metrics.h"
+#include "net/tracer.h"
+#include "net/uring_reactor.h"
 #include "util/logging.h"
 #include "util/mutex_lock.h"
 
 namespace dlock {
 
-EventPump::EventPump()
-    : mutex_(),
-      cond_(&mutex_),
-      reactor_(new EpollReactor()),
-      pending_change_(false),
+static thread_local EventPump *current_pump = nullptr;
+
+class EventPump::WakeupWatcher : public FdWatcher {
+ public:
+  void OnReadable(int fd) override {
+    // Only resets the counter, the loop drains the task queue after every
+    // batch of events anyway.
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) > 0) {
+    }
+  }
+  void OnWritable(int fd) override {}
+};
+
+class EventPump::TimerWatcher : public FdWatcher {
+ public:
+  explicit TimerWatcher(EventPump *pump) : pump_(pump) {}
+  void OnReadable(int fd) override {
+    uint64_t expirations;
+    while (read(fd, &expirations, sizeof(expirations)) > 0) {
+    }
+    pump_->RunTimers();
+  }
+  void OnWritable(int fd) override {}
+
+ private:
+  EventPump *pump_;
+};
+
+static uint64_t NowTick() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+EventPump::EventPump() : EventPump(-1) {}
+
+EventPump::EventPump(int cpu) : EventPump(cpu, EPOLL_REACTOR) {}
+
+EventPump::EventPump(int cpu, ReactorType type)
+    : cpu_(cpu),
+      loop_thread_id_(),
+      mutex_(),
+      reactor_(Reactor::Create(type)),
+      wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      wakeup_watcher_(new WakeupWatcher()),
+      timer_wheel_(NowTick()),
+      timer_fd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      timer_watcher_(new TimerWatcher(this)),
+      armed_tick_(0),
       stop_(false) {
+  CHECK_NE(-1, wakeup_fd_);
+  CHECK_NE(-1, timer_fd_);
+  reactor_->WatchFd(wakeup_fd_, READ, wakeup_watcher_.get());
+  reactor_->WatchFd(timer_fd_, READ, timer_watcher_.get());
+  reactor_->FlushChanges();
   StartThread();
 }
 
 EventPump::~EventPump() {
-  stop_ = true;
+  stop_.store(true, std::memory_order_relaxed);
+  WakeUp();
   StopThread();
+  close(wakeup_fd_);
+  close(timer_fd_);
 }
 
-EventPump *GetInstance() {
+EventPump *EventPump::GetInstance() {
   static EventPump pump;
   return &pump;
 }
 
+EventPump *EventPump::Current() { return current_pump; }
+
+bool EventPump::IsInLoopThread() const {
+  return loop_thread_id_.load(std::memory_order_relaxed) ==
+         std::this_thread::get_id();
+}
+
+UringReactor *EventPump::uring_reactor() const {
+  if (reactor_->type() != IO_URING_REACTOR) {
+    return nullptr;
+  }
+  return static_cast<UringReactor *>(reactor_.get());
+}
+
+void EventPump::PostTask(Task task) {
+  if (tasks_.Push(std::move(task)) && !IsInLoopThread()) {
+    WakeUp();
+  }
+}
+
+void EventPump::PostTaskAndReply(Task task, Task reply) {
+  EventPump *origin = Current();
+  CHECK(origin);
+  PostTask([task = std::move(task), reply = std::move(reply), origin]() {
+    task();
+    origin->PostTask(std::move(reply));
+  });
+}
+
+TimerId EventPump::RunAfter(int64_t delay_ms, Task task) {
+  return ScheduleTimer(delay_ms, 0, std::move(task));
+}
+
+TimerId EventPump::RunEvery(int64_t interval_ms, Task task) {
+  CHECK_LT(0, interval_ms);
+  return ScheduleTimer(interval_ms, interval_ms, std::move(task));
+}
+
+bool EventPump::CancelTimer(TimerId id) {
+  CHECK(IsInLoopThread());
+  // Leaves timer_fd_ armed, a spurious expiration is cheaper than a syscall.
+  return timer_wheel_.Cancel(id);
+}
+
 void EventPump::AddFdWatcher(int fd, EventType event, FdWatcher *watcher) {
   MutexLock lock(&mutex_);
-  auto [it, ok] = fd_watchers_.insert({fd, nullptr});
-  CHECK(ok || it->second == watcher);
-  reactor_->WatchFd(fd, event);
-  it->second = watcher;
+  reactor_->WatchFd(fd, event, watcher);
+  FlushOffLoopChangesLocked();
 }
 
-void EventPump::DelFdWatcher(int fd, EventType event) {
+bool EventPump::DelFdWatcher(int fd, EventType event) {
   MutexLock lock(&mutex_);
-  if (reactor_->UnWatchFd(fd, event)) {
-    fd_watchers_.erase(fd);
-  }
+  bool removed = reactor_->UnWatchFd(fd, event);
+  FlushOffLoopChangesLocked();
+  return removed;
 }
 
 bool EventPump::HasFdWatcher(int fd, EventType event, FdWatcher *watcher) {
   MutexLock lock(&mutex_);
-  auto it = fd_watchers_.find(fd);
-  if (it == fd_watchers_.end() || it->second != watcher) {
+  if (reactor_->GetWatcher(fd) != watcher) {
     return false;
   }
   return reactor_->IsWatched(fd, event);
 }
 
 void EventPump::BlockRemoveFd(int fd) {
-  MutexLock lock(&mutex_);
-  reactor_->UnWatchFd(fd, RDWR);
-  pending_change_ = true;
-  cond_.Wait();
-  fd_watchers_.erase(fd);
+  CHECK(!IsInLoopThread());
+  {
+    MutexLock lock(&mutex_);
+    reactor_->UnWatchFd(fd, RDWR);
+    reactor_->FlushChanges();
+  }
+
+  // Tasks run after the batch of events in progress, so once this one ran
+  // no callback for |fd| is pending.
+  Mutex mutex;
+  CondVar cond(&mutex);
+  bool done = false;
+  PostTask([&]() {
+    MutexLock lock(&mutex);
+    done = true;
+    cond.Signal();
+  });
+  MutexLock lock(&mutex);
+  while (!done) {
+    cond.Wait();
+  }
 }
 
 void EventPump::ThreadEntry() {
-  std::vector<int> readable;
-  std::vector<int> writable;
-  while (!stop_) {
+  loop_thread_id_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  current_pump = this;
+  if (cpu_ >= 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu_, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)) {
+      LOG_ERROR("failed to pin event pump to cpu %d", cpu_);
+    }
+  }
+  // Two clock reads per iteration split the loop time into waiting and
+  // busy for the utilization metric.
+  int64_t busy_start = NowNanos();
+  while (!stop_.load(std::memory_order_relaxed)) {
     {
       MutexLock lock(&mutex_);
-      if (pending_change_) {
-        pending_change_ = false;
-        cond_.Signal();
-      }
+      reactor_->FlushChanges();
     }
-    readable.clear();
-    writable.clear();
-    reactor_->WaitReady(&readable, &writable);
 
-    if (readable.empty() && writable.empty()) {
-      continue;
+    // Tasks posted from the loop thread itself do not write the eventfd.
+    int timeout_ms = tasks_.empty() ? -1 : 0;
+    int64_t wait_start = NowNanos();
+    Metrics::Add(Metrics::LOOP_BUSY_NANOS, wait_start - busy_start);
+    // Watchers are resolved through the reactor's fd slots, so the dispatch
+    // below takes no lock and does no hashing.
+    int nready = reactor_->WaitReady(timeout_ms);
+    busy_start = NowNanos();
+    Metrics::Add(Metrics::LOOP_WAIT_NANOS, busy_start - wait_start);
+    Metrics::Add(Metrics::LOOP_WAKEUPS, 1);
+    Metrics::Add(Metrics::LOOP_EVENTS, nready);
+    Metrics::Record(Metrics::EVENTS_PER_WAKEUP, nready);
+    // Sampled once per iteration, so a toggle takes effect at the next one.
+    bool tracing = Tracer::enabled();
+    bool watching = LoopWatchdog::enabled();
+    if (tracing) {
+      Tracer::Add(Tracer::LOOP_WAIT, wait_start, busy_start, -1, nready,
+                  nullptr);
     }
-
-    for (auto fd : readable) {
-      MutexLock lock(&mutex_);
-      auto it = fd_watchers_.find(fd);
-      if (it != fd_watchers_.end()) {
-        it->second->OnReadable(fd);
+    for (int i = 0; i < nready; ++i) {
+      int fd;
+      int events;
+      FdWatcher *watcher = reactor_->ReadyAt(i, &fd, &events);
+      if (!watcher) {
+        continue;
+      }
+      if (!tracing && !watching) {
+        watcher->OnFdEvents(fd, events);
+        continue;
+      }
+      int64_t start = NowNanos();
+      if (watching) {
+        LoopWatchdog::BeginCallback(start, fd, events, watcher);
+      }
+      watcher->OnFdEvents(fd, events);
+      // |watcher| may be gone, only its address is recorded.
+      int64_t end = NowNanos();
+      if (watching) {
+        LoopWatchdog::EndCallback(end);
+      }
+      if (tracing) {
+        Tracer::Add(Tracer::FD_EVENTS, start, end, fd, events, watcher);
       }
     }
-    for (auto fd : writable) {
-      MutexLock lock(&mutex_);
-      auto it = fd_watchers_.find(fd);
-      if (it != fd_watchers_.end()) {
-        it->second->OnWritable(fd);
+    int64_t tasks_start = 0;
+    if (tracing || watching) {
+      tasks_start = NowNanos();
+      if (watching && !tasks_.empty()) {
+        LoopWatchdog::BeginCallback(tasks_start, -1, 0, nullptr);
+      }
+    }
+    int64_t queue_delay_ns;
+    int ntasks = tasks_.RunAll(&queue_delay_ns);
+    if (ntasks) {
+      Metrics::Add(Metrics::LOOP_TASKS, ntasks);
+      Metrics::Record(Metrics::TASK_QUEUE_DELAY_NANOS, queue_delay_ns);
+      if (tracing || watching) {
+        int64_t end = NowNanos();
+        if (watching) {
+          LoopWatchdog::EndCallback(end);
+        }
+        if (tracing) {
+          Tracer::Add(Tracer::TASKS, tasks_start, end, -1, ntasks, nullptr);
+        }
       }
     }
   }
+  current_pump = nullptr;
+}
+
+void EventPump::WakeUp() {
+  Metrics::Add(Metrics::LOOP_WAKEUP_WRITES, 1);
+  uint64_t one = 1;
+  if (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    LOG_ERROR("failed to wake up event pump, %s", strerror(errno));
+  }
+}
+
+TimerId EventPump::ScheduleTimer(int64_t delay_ms, int64_t interval_ms,
+                                 Task task) {
+  CHECK(IsInLoopThread());
+  CHECK_GE(delay_ms, 0);
+  // The wheel lags behind the clock while the loop waits, count the delay
+  // from now rather than from the last tick it processed.
+  uint64_t expires = NowTick() + delay_ms;
+  uint64_t current = timer_wheel_.current();
+  uint64_t delay = expires > current ? expires - current : 0;
+  TimerId id = timer_wheel_.Schedule(delay, interval_ms, std::move(task));
+  ArmTimerFd();
+  return id;
+}
+
+void EventPump::RunTimers() {
+  armed_tick_ = 0;
+  timer_wheel_.Advance(NowTick());
+  ArmTimerFd();
+}
+
+void EventPump::ArmTimerFd() {
+  if (timer_wheel_.empty()) {
+    return;
+  }
+  uint64_t tick = timer_wheel_.NextTick();
+  if (armed_tick_ && armed_tick_ <= tick) {
+    return;
+  }
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = tick / 1000;
+  spec.it_value.tv_nsec = (tick % 1000) * 1000000;
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    // A zero it_value disarms the timer.
+    spec.it_value.tv_nsec = 1;
+  }
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+    LOG_ERROR("timerfd_settime failed, %s", strerror(errno));
+    return;
+  }
+  armed_tick_ = tick;
+}
+
+void EventPump::FlushOffLoopChangesLocked() {
+  if (!IsInLoopThread()) {
+    // The loop may be blocked in epoll_wait and would not flush them.
+    reactor_->FlushChanges();
+  }
 }
 
-}  // namespace dlock
\ No newline at end of file
+}  // namespace dlock
@@ -1,37 +1,94 @@
 #ifndef DLOCK_NET_EVENT_PUMP_H_
 #define DLOCK_NET_EVENT_PUMP_H_
 
+#include <atomic>
 #include <memory>
-#include <unordered_map>
+#include <thread>
 #include "base/noncopyable.h"
 #include "base/sync.h"
 #include "base/thread.h"
 #include "net/event_type.h"
+#include "net/reactor.h"
+#include "net/task_queue.h"
+#include "net/timing_wheel.h"
 
 namespace dlock {
 
-class EpollReactor;
 class FdWatcher;
+class UringReactor;
 
 class EventPump : public Thread {
  public:
   EventPump();
+  // Pins the loop thread to |cpu| when it is not negative.
+  explicit EventPump(int cpu);
+  // Uses a |type| reactor, falling back to epoll if it is not supported.
+  EventPump(int cpu, ReactorType type);
   ~EventPump();
   static EventPump *GetInstance();
+  // Returns the pump whose loop runs on the calling thread, or nullptr.
+  static EventPump *Current();
+  bool IsInLoopThread() const;
+  // Returns the io_uring reactor for completion-based I/O, or nullptr if
+  // the pump runs on epoll.
+  UringReactor *uring_reactor() const;
+
+  // Runs |task| on the loop thread. Safe to call from any thread; the loop
+  // is woken up if it is waiting for events.
+  void PostTask(Task task);
+  // Runs |task| on the loop thread, then |reply| on the loop of the calling
+  // thread, which must be an EventPump thread.
+  void PostTaskAndReply(Task task, Task reply);
+
+  // Runs |task| on the loop thread once |delay_ms| have passed, or every
+  // |interval_ms| until cancelled. Timers have millisecond resolution and
+  // are managed on the loop thread only, use PostTask() to reach it from
+  // elsewhere. All timers share one timerfd, which is only re-armed when
+  // the earliest tick of the wheel moves, not once per timer.
+  TimerId RunAfter(int64_t delay_ms, Task task);
+  TimerId RunEvery(int64_t interval_ms, Task task);
+  // Returns false if the timer already fired or was cancelled.
+  bool CancelTimer(TimerId id);
+
+  // Changes made on the loop thread take effect when the loop goes back to
+  // waiting, so toggling interest within one batch costs no syscall. Changes
+  // from other threads are applied immediately.
   void AddFdWatcher(int fd, EventType event, FdWatcher *watcher);
-  void DelFdWatcher(int fd, EventType event);
+  // Returns true if |fd| has no watched event left.
+  bool DelFdWatcher(int fd, EventType event);
   bool HasFdWatcher(int fd, EventType event, FdWatcher *watcher);
+  // Removes |fd| and waits until the loop has finished the batch of events
+  // it was dispatching, after which the watcher of |fd| may be destroyed.
+  // Must not be called on the loop thread.
   void BlockRemoveFd(int fd);
 
  private:
+  class WakeupWatcher;
+  class TimerWatcher;
+
   void ThreadEntry() override;
+  void FlushOffLoopChangesLocked();
+  void WakeUp();
+  TimerId ScheduleTimer(int64_t delay_ms, int64_t interval_ms, Task task);
+  void RunTimers();
+  void ArmTimerFd();
 
+  const int cpu_;
+  std::atomic<std::thread::id> loop_thread_id_;
   Mutex mutex_;
-  CondVar cond_;
-  std::unique_ptr<EpollReactor> reactor_;
-  bool pending_change_;
-  bool stop_;
-  std::unordered_map<int, FdWatcher *> fd_watchers_;
+  std::unique_ptr<Reactor> reactor_;
+  TaskQueue tasks_;
+  // An eventfd watched by the loop, written when a task is posted to an
+  // empty queue from another thread.
+  int wakeup_fd_;
+  std::unique_ptr<WakeupWatcher> wakeup_watcher_;
+  // Loop thread only. Ticks are CLOCK_MONOTONIC milliseconds.
+  TimingWheel timer_wheel_;
+  int timer_fd_;
+  std::unique_ptr<TimerWatcher> timer_watcher_;
+  // The tick timer_fd_ fires at, or 0 if it is not armed.
+  uint64_t armed_tick_;
+  std::atomic<bool> stop_;
 
   DISALLOW_COPY_AND_ASSIGN(EventPump)
 };
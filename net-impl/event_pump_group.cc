@@ -0,0 +1,121 @@
+#include "net/event_pump_group.h"
+#include <unistd.h>
+#include <algorithm>
+#include "net/event_pump.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+const int EventPumpGroup::kUnassigned = -1;
+
+EventPumpGroup::EventPumpGroup(int num_pumps, AssignPolicy policy,
+                               bool pin_threads, ReactorType type)
+    : policy_(policy), mutex_(), next_(0) {
+  int num_cpus = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  if (num_cpus <= 0) {
+    num_cpus = 1;
+  }
+  if (num_pumps <= 0) {
+    num_pumps = num_cpus;
+  }
+  pumps_.reserve(num_pumps);
+  for (int i = 0; i < num_pumps; ++i) {
+    int cpu = pin_threads ? i % num_cpus : -1;
+    pumps_.emplace_back(new EventPump(cpu, type));
+  }
+}
+
+EventPumpGroup::~EventPumpGroup() = default;
+
+EventPump *EventPumpGroup::GetPump(int index) const {
+  CHECK_GE(index, 0);
+  CHECK_LT(index, size());
+  return pumps_[index].get();
+}
+
+EventPump *EventPumpGroup::PickPump(int fd) {
+  MutexLock lock(&mutex_);
+  return pumps_[PickIndexLocked(fd, false)].get();
+}
+
+EventPump *EventPumpGroup::AddFdWatcher(int fd, EventType event,
+                                        FdWatcher *watcher) {
+  EventPump *pump;
+  {
+    MutexLock lock(&mutex_);
+    pump = AssignLocked(PickIndexLocked(fd, true), fd);
+  }
+  pump->AddFdWatcher(fd, event, watcher);
+  return pump;
+}
+
+EventPump *EventPumpGroup::AddFdWatcherOn(int index, int fd, EventType event,
+                                          FdWatcher *watcher) {
+  CHECK_GE(index, 0);
+  CHECK_LT(index, size());
+  EventPump *pump;
+  {
+    MutexLock lock(&mutex_);
+    pump = AssignLocked(index, fd);
+  }
+  pump->AddFdWatcher(fd, event, watcher);
+  return pump;
+}
+
+void EventPumpGroup::DelFdWatcher(int fd, EventType event) {
+  EventPump *pump;
+  {
+    MutexLock lock(&mutex_);
+    if (fd < 0 || fd >= static_cast<int>(owners_.size()) ||
+        owners_[fd] == kUnassigned) {
+      return;
+    }
+    pump = pumps_[owners_[fd]].get();
+  }
+  if (pump->DelFdWatcher(fd, event)) {
+    MutexLock lock(&mutex_);
+    owners_[fd] = kUnassigned;
+  }
+}
+
+void EventPumpGroup::BlockRemoveFd(int fd) {
+  EventPump *pump;
+  {
+    MutexLock lock(&mutex_);
+    if (fd < 0 || fd >= static_cast<int>(owners_.size()) ||
+        owners_[fd] == kUnassigned) {
+      return;
+    }
+    pump = pumps_[owners_[fd]].get();
+    owners_[fd] = kUnassigned;
+  }
+  pump->BlockRemoveFd(fd);
+}
+
+int EventPumpGroup::PickIndexLocked(int fd, bool advance) {
+  CHECK_GE(fd, 0);
+  if (fd < static_cast<int>(owners_.size()) && owners_[fd] != kUnassigned) {
+    return owners_[fd];
+  }
+  if (policy_ == FD_MODULO) {
+    return fd % size();
+  }
+  int index = next_ % size();
+  if (advance) {
+    ++next_;
+  }
+  return index;
+}
+
+EventPump *EventPumpGroup::AssignLocked(int index, int fd) {
+  CHECK_GE(fd, 0);
+  if (fd >= static_cast<int>(owners_.size())) {
+    owners_.resize(std::max<size_t>(fd + 1, owners_.size() * 2), kUnassigned);
+  }
+  CHECK(owners_[fd] == kUnassigned || owners_[fd] == index);
+  owners_[fd] = index;
+  return pumps_[index].get();
+}
+
+}  // namespace dlock
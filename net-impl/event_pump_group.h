@@ -0,0 +1,79 @@
+#ifndef DLOCK_NET_EVENT_PUMP_GROUP_H_
+#define DLOCK_NET_EVENT_PUMP_GROUP_H_
+
+#include <memory>
+#include <vector>
+#include "base/noncopyable.h"
+#include "base/sync.h"
+#include "net/event_type.h"
+#include "net/reactor.h"
+
+namespace dlock {
+
+class EventPump;
+class FdWatcher;
+
+// A fixed set of EventPumps, each running its own reactor on its own thread,
+// so readiness dispatch scales with the number of loops instead of being
+// bound to the EventPump::GetInstance() thread.
+//
+// A fd stays on the pump it was first assigned to until all of its events
+// are removed, so callers may keep using the group (or the returned pump)
+// for later changes to the same fd.
+class EventPumpGroup {
+ public:
+  enum AssignPolicy {
+    // Spreads new fds over the pumps in turn.
+    ROUND_ROBIN,
+    // Uses fd % size(); stable and needs no shared counter.
+    FD_MODULO,
+  };
+
+  // Creates |num_pumps| pumps, or one per online cpu if it is not positive.
+  // With |pin_threads|, pump i runs on cpu i % number_of_cpus. Every pump
+  // uses a |type| reactor.
+  EventPumpGroup(int num_pumps, AssignPolicy policy, bool pin_threads,
+                 ReactorType type = EPOLL_REACTOR);
+  ~EventPumpGroup();
+
+  int size() const { return static_cast<int>(pumps_.size()); }
+  EventPump *GetPump(int index) const;
+
+  // Returns the pump |fd| is assigned to, or the one the policy would
+  // choose if it has no watcher yet. Neither records the assignment nor
+  // advances the round robin, so a following AddFdWatcher() for |fd|
+  // picks the same pump unless another fd is added in between.
+  EventPump *PickPump(int fd);
+
+  // Registers |watcher| for |event| on the pump chosen for |fd| and returns
+  // that pump.
+  EventPump *AddFdWatcher(int fd, EventType event, FdWatcher *watcher);
+  // Same as above, but on the pump at |index|. CHECKs if |fd| is already
+  // assigned to another pump.
+  EventPump *AddFdWatcherOn(int index, int fd, EventType event,
+                            FdWatcher *watcher);
+  void DelFdWatcher(int fd, EventType event);
+  // Removes |fd| from its pump and waits until the pump is no longer
+  // dispatching it. See EventPump::BlockRemoveFd().
+  void BlockRemoveFd(int fd);
+
+ private:
+  // Advances the round robin only if |advance|.
+  int PickIndexLocked(int fd, bool advance);
+  EventPump *AssignLocked(int index, int fd);
+
+  static const int kUnassigned;
+
+  const AssignPolicy policy_;
+  std::vector<std::unique_ptr<EventPump>> pumps_;
+  Mutex mutex_;
+  unsigned int next_;
+  // Indexed by fd, holds the index of the owning pump or kUnassigned.
+  std::vector<int> owners_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventPumpGroup)
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef DLOCK_NET_EVENT_PUMP_TEST_UTIL_H_
+#define DLOCK_NET_EVENT_PUMP_TEST_UTIL_H_
+
+#include <unistd.h>
+#include <functional>
+#include "base/sync.h"
+#include "net/event_pump.h"
+#include "util/mutex_lock.h"
+
+// Helpers for tests and benchmarks that drive loop-thread objects from the
+// main thread.
+
+namespace dlock {
+
+// Runs |task| on the loop of |pump| and waits for it to return.
+inline void RunOnLoop(EventPump *pump, std::function<void()> task) {
+  Mutex mutex;
+  CondVar cond(&mutex);
+  bool done = false;
+  pump->PostTask([&] {
+    task();
+    MutexLock lock(&mutex);
+    done = true;
+    cond.Signal();
+  });
+  MutexLock lock(&mutex);
+  while (!done) {
+    cond.Wait();
+  }
+}
+
+// Polls |done| on the loop of |pump| for up to two seconds. Returns whether
+// it became true.
+inline bool WaitFor(EventPump *pump, std::function<bool()> done) {
+  for (int i = 0; i < 200; ++i) {
+    bool result = false;
+    RunOnLoop(pump, [&] { result = done(); });
+    if (result) {
+      return true;
+    }
+    usleep(10 * 1000);
+  }
+  return false;
+}
+
+}  // namespace dlock
+
+#endif
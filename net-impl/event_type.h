@@ -9,6 +9,14 @@ enum EventType {
   RDWR = 0x11,
   MASK = ~0x11,
 };
+
+// Conditions the reactor reports next to READ/WRITE in a ready event mask.
+// They can not be watched for, they are always delivered.
+enum ReadyCondition {
+  PEER_CLOSED = 0x100,  // EPOLLRDHUP, the peer shut down its writing half.
+  HANG_UP = 0x200,      // EPOLLHUP
+  IO_ERROR = 0x400,     // EPOLLERR, fetch it with SO_ERROR or MSG_ERRQUEUE.
+};
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,14 +1,30 @@
 #ifndef DLOCK_NET_FD_WATCHER_H_
 #define DLOCK_NET_FD_WATCHER_H_
 
+#include "net/event_type.h"
+
 namespace dlock {
 
 class FdWatcher {
  public:
   virtual void OnReadable(int fd) = 0;
   virtual void OnWritable(int fd) = 0;
+
+  // Called once per wakeup of |fd| with the combined READ/WRITE and
+  // ReadyCondition bits. An error or hang-up also sets the READ/WRITE bits
+  // the fd is watched for, so that the next read or write observes it.
+  // The default forwards to OnReadable() and then OnWritable(); a watcher
+  // that may delete itself in OnReadable() must override this.
+  virtual void OnFdEvents(int fd, int events) {
+    if (events & READ) {
+      OnReadable(fd);
+    }
+    if (events & WRITE) {
+      OnWritable(fd);
+    }
+  }
 };
 
 }  // namespace dlock
 
-#endif
\ No newline at end of file
+#endif
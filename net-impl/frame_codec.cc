@@ -0,0 +1,250 @@
+#include "net/frame_codec.h"
+#include <string.h>
+#include <utility>
+#include "net/net_errors.h"
+#include "util/logging.h"
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace dlock {
+
+namespace {
+
+const int kMaxVarintLen = 5;
+const int kFixedHeaderLen = 4;
+const int kTrailerLen = 4;
+// Holds the headers and trailers of many frames; fits the smallest
+// IOBufferPool size class.
+const int kScratchSize = 256;
+
+int HeaderLen(const FrameOptions& options, uint32_t len) {
+  if (options.header == FrameOptions::FIXED32_HEADER) {
+    return kFixedHeaderLen;
+  }
+  int bytes = 1;
+  while (len >= 0x80) {
+    len >>= 7;
+    ++bytes;
+  }
+  return bytes;
+}
+
+#if !defined(__SSE4_2__)
+const uint32_t* Crc32cTable() {
+  static uint32_t table[256];
+  static bool initialized = [] {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+      }
+      table[i] = crc;
+    }
+    return true;
+  }();
+  (void)initialized;
+  return table;
+}
+#endif
+
+}  // namespace
+
+const uint32_t FrameOptions::kDefaultMaxFrameSize = 16 * 1024 * 1024;
+
+FrameOptions::FrameOptions()
+    : header(VARINT_HEADER),
+      checksum(false),
+      max_frame_size(kDefaultMaxFrameSize) {}
+
+uint32_t Crc32c(uint32_t crc, const char* data, size_t len) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  crc = ~crc;
+#if defined(__SSE4_2__)
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    len -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+  while (len--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+#else
+  const uint32_t* table = Crc32cTable();
+  while (len--) {
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+#endif
+  return ~crc;
+}
+
+uint32_t Crc32c(const IOBufferChain& chain) {
+  uint32_t crc = 0;
+  for (size_t i = 0; i < chain.num_slices(); ++i) {
+    const IOBufferChain::Slice& slice = chain.slice(i);
+    crc = Crc32c(crc, slice.buf->data() + slice.offset, slice.len);
+  }
+  return crc;
+}
+
+FrameEncoder::FrameEncoder(const FrameOptions& options)
+    : options_(options), scratch_used_(kScratchSize) {}
+
+FrameEncoder::~FrameEncoder() = default;
+
+char* FrameEncoder::Reserve(int len) {
+  if (scratch_used_ + len > kScratchSize) {
+    // Frames encoded earlier keep the old buffer alive.
+    scratch_ = new IOBuffer(kScratchSize);
+    scratch_used_ = 0;
+  }
+  char* out = scratch_->data() + scratch_used_;
+  scratch_used_ += len;
+  return out;
+}
+
+void FrameEncoder::AppendHeader(uint32_t len, IOBufferChain* out) {
+  int header_len = HeaderLen(options_, len);
+  char* header = Reserve(header_len);
+  if (options_.header == FrameOptions::FIXED32_HEADER) {
+    header[0] = static_cast<char>(len >> 24);
+    header[1] = static_cast<char>(len >> 16);
+    header[2] = static_cast<char>(len >> 8);
+    header[3] = static_cast<char>(len);
+  } else {
+    char* p = header;
+    while (len >= 0x80) {
+      *p++ = static_cast<char>(len | 0x80);
+      len >>= 7;
+    }
+    *p = static_cast<char>(len);
+  }
+  out->Append(scratch_, scratch_used_ - header_len, header_len);
+}
+
+void FrameEncoder::AppendTrailer(uint32_t crc, IOBufferChain* out) {
+  char* trailer = Reserve(kTrailerLen);
+  for (int i = 0; i < kTrailerLen; ++i) {
+    trailer[i] = static_cast<char>(crc >> (8 * i));
+  }
+  out->Append(scratch_, scratch_used_ - kTrailerLen, kTrailerLen);
+}
+
+void FrameEncoder::Encode(scoped_refptr<IOBuffer> payload, int offset,
+                          int len, IOBufferChain* out) {
+  CHECK_GE(len, 0);
+  CHECK_LE(static_cast<uint32_t>(len), options_.max_frame_size);
+  AppendHeader(len, out);
+  uint32_t crc = 0;
+  if (options_.checksum) {
+    crc = Crc32c(0, payload->data() + offset, len);
+  }
+  out->Append(std::move(payload), offset, len);
+  if (options_.checksum) {
+    AppendTrailer(crc, out);
+  }
+}
+
+void FrameEncoder::Encode(const IOBufferChain& payload, IOBufferChain* out) {
+  CHECK_LE(payload.size(), options_.max_frame_size);
+  AppendHeader(static_cast<uint32_t>(payload.size()), out);
+  for (size_t i = 0; i < payload.num_slices(); ++i) {
+    const IOBufferChain::Slice& slice = payload.slice(i);
+    out->Append(slice.buf, slice.offset, slice.len);
+  }
+  if (options_.checksum) {
+    AppendTrailer(Crc32c(payload), out);
+  }
+}
+
+FrameDecoder::FrameDecoder(const FrameOptions& options)
+    : options_(options), frame_len_(-1), header_len_(0), error_(OK) {}
+
+FrameDecoder::~FrameDecoder() = default;
+
+void FrameDecoder::Append(scoped_refptr<IOBuffer> buf, int offset, int len) {
+  pending_.Append(std::move(buf), offset, len);
+}
+
+int FrameDecoder::ParseHeader() {
+  char header[kMaxVarintLen];
+  int available = pending_.CopyTo(header, kMaxVarintLen);
+  uint32_t len = 0;
+  if (options_.header == FrameOptions::FIXED32_HEADER) {
+    if (available < kFixedHeaderLen) {
+      return ERR_IO_PENDING;
+    }
+    for (int i = 0; i < kFixedHeaderLen; ++i) {
+      len = (len << 8) | static_cast<unsigned char>(header[i]);
+    }
+    header_len_ = kFixedHeaderLen;
+  } else {
+    int i = 0;
+    for (;; ++i) {
+      if (i == available) {
+        return ERR_IO_PENDING;
+      }
+      unsigned char byte = static_cast<unsigned char>(header[i]);
+      if (i == kMaxVarintLen - 1 && byte > 0x0f) {
+        // More than 32 bits.
+        return ERR_FRAME_CORRUPTED;
+      }
+      len |= static_cast<uint32_t>(byte & 0x7f) << (7 * i);
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    header_len_ = i + 1;
+  }
+  if (len > options_.max_frame_size) {
+    LOG_ERROR("frame of %u bytes exceeds the limit of %u", len,
+              options_.max_frame_size);
+    return ERR_FRAME_TOO_LARGE;
+  }
+  frame_len_ = len;
+  return OK;
+}
+
+int FrameDecoder::Next(IOBufferChain* payload) {
+  if (error_ != OK) {
+    return error_;
+  }
+  if (frame_len_ < 0) {
+    int rv = ParseHeader();
+    if (rv != OK) {
+      if (rv != ERR_IO_PENDING) {
+        error_ = rv;
+      }
+      return rv;
+    }
+  }
+  int trailer_len = options_.checksum ? kTrailerLen : 0;
+  if (pending_.size() <
+      static_cast<size_t>(header_len_ + frame_len_ + trailer_len)) {
+    return ERR_IO_PENDING;
+  }
+  pending_.Consume(header_len_);
+  pending_.Split(static_cast<int>(frame_len_), payload);
+  frame_len_ = -1;
+  if (options_.checksum) {
+    char trailer[kTrailerLen];
+    pending_.CopyTo(trailer, kTrailerLen);
+    pending_.Consume(kTrailerLen);
+    uint32_t expected = 0;
+    for (int i = kTrailerLen - 1; i >= 0; --i) {
+      expected = (expected << 8) | static_cast<unsigned char>(trailer[i]);
+    }
+    if (Crc32c(*payload) != expected) {
+      payload->Clear();
+      error_ = ERR_FRAME_CORRUPTED;
+      return error_;
+    }
+  }
+  return OK;
+}
+
+}  // namespace dlock
@@ -0,0 +1,108 @@
+#ifndef DLOCK_NET_FRAME_CODEC_H_
+#define DLOCK_NET_FRAME_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "base/noncopyable.h"
+#include "base/scoped_refptr.h"
+#include "net/io_buffer.h"
+#include "net/io_buffer_chain.h"
+
+namespace dlock {
+
+// Length-prefixed message framing. On the wire a frame is
+//
+//   header: payload length, as a varint or 4 bytes big endian
+//   payload
+//   trailer: CRC32C of the payload, 4 bytes little endian, if enabled
+//
+// Both peers must use the same options.
+struct FrameOptions {
+  enum HeaderFormat {
+    VARINT_HEADER,
+    FIXED32_HEADER,
+  };
+
+  FrameOptions();
+
+  HeaderFormat header;
+  bool checksum;
+  // Larger frames are rejected from their header, before any of the payload
+  // is buffered.
+  uint32_t max_frame_size;
+
+  static const uint32_t kDefaultMaxFrameSize;
+};
+
+// Frames payloads into an IOBufferChain without copying them. Headers and
+// trailers are written into a shared scratch buffer, so a batch of frames
+// costs one small allocation per few dozen frames.
+class FrameEncoder {
+ public:
+  explicit FrameEncoder(const FrameOptions& options);
+  ~FrameEncoder();
+
+  // Appends a frame holding |len| bytes of |payload| starting at |offset|
+  // to |out|. CHECKs that |len| is within the maximum frame size.
+  void Encode(scoped_refptr<IOBuffer> payload, int offset, int len,
+              IOBufferChain* out);
+  // Same, with a payload that is already a chain, e.g. a decoded frame.
+  void Encode(const IOBufferChain& payload, IOBufferChain* out);
+
+ private:
+  // Returns room for |len| bytes of header or trailer in |scratch_|.
+  char* Reserve(int len);
+  void AppendHeader(uint32_t len, IOBufferChain* out);
+  void AppendTrailer(uint32_t crc, IOBufferChain* out);
+
+  const FrameOptions options_;
+  scoped_refptr<IOBuffer> scratch_;
+  int scratch_used_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrameEncoder);
+};
+
+// Cuts the received byte stream into frames. Buffers are appended as they
+// come off the socket and payloads are handed out as slices of them, so no
+// payload byte is copied and one read can yield many frames.
+class FrameDecoder {
+ public:
+  explicit FrameDecoder(const FrameOptions& options);
+  ~FrameDecoder();
+
+  // Takes |len| received bytes of |buf| starting at |offset|.
+  void Append(scoped_refptr<IOBuffer> buf, int offset, int len);
+
+  // Moves the payload of the next complete frame into |payload|, which
+  // should be empty, and returns OK. Returns ERR_IO_PENDING if more bytes
+  // are needed, or ERR_FRAME_TOO_LARGE or ERR_FRAME_CORRUPTED, after which
+  // the stream is unusable and every call fails the same way.
+  int Next(IOBufferChain* payload);
+
+  // Bytes received but not handed out yet.
+  size_t buffered() const { return pending_.size(); }
+
+ private:
+  // Parses the header at the front of |pending_| into |frame_len_| and
+  // |header_len_|.
+  int ParseHeader();
+
+  const FrameOptions options_;
+  IOBufferChain pending_;
+  // Length of the frame at the front of |pending_|, or -1 if its header
+  // was not parsed yet.
+  int64_t frame_len_;
+  int header_len_;
+  int error_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrameDecoder);
+};
+
+// CRC32C (Castagnoli) of |len| bytes, continuing from |crc|. Uses the
+// SSE4.2 instruction when the build targets it.
+uint32_t Crc32c(uint32_t crc, const char* data, size_t len);
+uint32_t Crc32c(const IOBufferChain& chain);
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,155 @@
+#include "net/frame_codec.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "net/net_errors.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+static scoped_refptr<IOBuffer> MakeBuffer(const std::string& data) {
+  scoped_refptr<IOBuffer> buf = new IOBuffer(data.size() + 1);
+  memcpy(buf->data(), data.data(), data.size());
+  return buf;
+}
+
+static std::string ToString(const IOBufferChain& chain) {
+  std::string out(chain.size(), '\0');
+  chain.CopyTo(&out[0], static_cast<int>(out.size()));
+  return out;
+}
+
+// Encodes |payloads| back to back and flattens them into one buffer.
+static std::string EncodeAll(const FrameOptions& options,
+                             const std::vector<std::string>& payloads) {
+  FrameEncoder encoder(options);
+  IOBufferChain wire;
+  for (const std::string& payload : payloads) {
+    encoder.Encode(MakeBuffer(payload), 0, payload.size(), &wire);
+  }
+  return ToString(wire);
+}
+
+static void CheckRoundTrip(const FrameOptions& options) {
+  std::vector<std::string> payloads = {"", "a", std::string(200, 'b'),
+                                       std::string(70000, 'c')};
+  std::string wire = EncodeAll(options, payloads);
+
+  FrameDecoder decoder(options);
+  decoder.Append(MakeBuffer(wire), 0, wire.size());
+  for (const std::string& payload : payloads) {
+    IOBufferChain frame;
+    CHECK_EQ(decoder.Next(&frame), OK);
+    CHECK_EQ(ToString(frame), payload);
+  }
+  IOBufferChain frame;
+  CHECK_EQ(decoder.Next(&frame), ERR_IO_PENDING);
+  CHECK_EQ(decoder.buffered(), 0u);
+}
+
+UNITTEST_DEFINITION(FrameCodecTest);
+
+TEST(FrameCodecTest, TestRoundTrip) {
+  FrameOptions options;
+  CheckRoundTrip(options);
+  options.checksum = true;
+  CheckRoundTrip(options);
+  options.header = FrameOptions::FIXED32_HEADER;
+  CheckRoundTrip(options);
+  options.checksum = false;
+  CheckRoundTrip(options);
+}
+
+TEST(FrameCodecTest, TestVarintHeader) {
+  FrameOptions options;
+  std::string wire = EncodeAll(options, {std::string(300, 'x')});
+  CHECK_EQ(wire.size(), 302u);
+  CHECK_EQ(static_cast<unsigned char>(wire[0]), 0xacu);
+  CHECK_EQ(static_cast<unsigned char>(wire[1]), 0x02u);
+}
+
+TEST(FrameCodecTest, TestByteAtATime) {
+  FrameOptions options;
+  options.checksum = true;
+  std::string wire = EncodeAll(options, {"hello", std::string(1000, 'y')});
+  FrameDecoder decoder(options);
+  std::vector<std::string> frames;
+  for (char c : wire) {
+    decoder.Append(MakeBuffer(std::string(1, c)), 0, 1);
+    IOBufferChain frame;
+    int rv = decoder.Next(&frame);
+    if (rv == OK) {
+      frames.push_back(ToString(frame));
+    } else {
+      CHECK_EQ(rv, ERR_IO_PENDING);
+    }
+  }
+  CHECK_EQ(frames.size(), 2u);
+  CHECK_EQ(frames[0], "hello");
+  CHECK_EQ(frames[1], std::string(1000, 'y'));
+}
+
+TEST(FrameCodecTest, TestZeroCopy) {
+  FrameOptions options;
+  std::string wire = EncodeAll(options, {"first", "second"});
+  scoped_refptr<IOBuffer> buf = MakeBuffer(wire);
+  FrameDecoder decoder(options);
+  decoder.Append(buf, 0, wire.size());
+
+  IOBufferChain first;
+  IOBufferChain second;
+  CHECK_EQ(decoder.Next(&first), OK);
+  CHECK_EQ(decoder.Next(&second), OK);
+  CHECK_EQ(first.num_slices(), 1u);
+  CHECK_EQ(first.slice(0).buf.get(), buf.get());
+  CHECK_EQ(first.slice(0).offset, 1);
+  CHECK_EQ(second.slice(0).buf.get(), buf.get());
+  CHECK_EQ(second.slice(0).offset, 7);
+}
+
+TEST(FrameCodecTest, TestCorrupted) {
+  FrameOptions options;
+  options.checksum = true;
+  std::string wire = EncodeAll(options, {"payload", "next"});
+  wire[3] ^= 0x01;
+  FrameDecoder decoder(options);
+  decoder.Append(MakeBuffer(wire), 0, wire.size());
+  IOBufferChain frame;
+  CHECK_EQ(decoder.Next(&frame), ERR_FRAME_CORRUPTED);
+  CHECK_EQ(frame.size(), 0u);
+  CHECK_EQ(decoder.Next(&frame), ERR_FRAME_CORRUPTED);
+}
+
+TEST(FrameCodecTest, TestTooLarge) {
+  FrameOptions options;
+  options.max_frame_size = 1024;
+  FrameOptions sender;
+  std::string wire = EncodeAll(sender, {std::string(1025, 'z')});
+  FrameDecoder decoder(options);
+  // Only the header arrived; the frame is refused before its payload.
+  decoder.Append(MakeBuffer(wire), 0, 2);
+  IOBufferChain frame;
+  CHECK_EQ(decoder.Next(&frame), ERR_FRAME_TOO_LARGE);
+
+  std::string overlong = "\xff\xff\xff\xff\x7f";
+  FrameDecoder varint(sender);
+  varint.Append(MakeBuffer(overlong), 0, overlong.size());
+  CHECK_EQ(varint.Next(&frame), ERR_FRAME_CORRUPTED);
+}
+
+TEST(FrameCodecTest, TestCrc32c) {
+  // Check value from RFC 3720, B.4.
+  std::string zeros(32, '\0');
+  CHECK_EQ(Crc32c(0, zeros.data(), zeros.size()), 0x8a9136aau);
+  std::string digits = "123456789";
+  CHECK_EQ(Crc32c(0, digits.data(), digits.size()), 0xe3069283u);
+  uint32_t crc = Crc32c(0, digits.data(), 4);
+  CHECK_EQ(Crc32c(crc, digits.data() + 4, 5), 0xe3069283u);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(FrameCodecTest)
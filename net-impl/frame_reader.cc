@@ -0,0 +1,68 @@
+#include "net/frame_reader.h"
+#include <errno.h>
+#include <utility>
+#include "net/net_errors.h"
+#include "net/tcp_connection.h"
+
+namespace dlock {
+
+// Reads smaller than this start a fresh buffer rather than filling the
+// tail of the current one.
+static const int kMinReadSize = 2048;
+
+const int FrameReader::kReadBufferSize = 64 * 1024;
+
+FrameReader::FrameReader(TCPConnection* connection,
+                         const FrameOptions& options)
+    : connection_(connection),
+      decoder_(options),
+      read_offset_(kReadBufferSize) {}
+
+FrameReader::~FrameReader() = default;
+
+int FrameReader::DrainFrames(std::vector<IOBufferChain>* frames) {
+  int count = 0;
+  for (;;) {
+    IOBufferChain payload;
+    int rv = decoder_.Next(&payload);
+    if (rv == ERR_IO_PENDING) {
+      return count;
+    }
+    if (rv != OK) {
+      return rv;
+    }
+    frames->push_back(std::move(payload));
+    ++count;
+  }
+}
+
+int FrameReader::ReadFrames(std::vector<IOBufferChain>* frames) {
+  int count = DrainFrames(frames);
+  if (count) {
+    return count;
+  }
+  if (kReadBufferSize - read_offset_ < kMinReadSize) {
+    // The old buffer lives on in the frames and pending bytes using it.
+    read_buf_ = new IOBuffer(kReadBufferSize);
+    read_offset_ = 0;
+  }
+  scoped_refptr<DrainableIOBuffer> tail =
+      new DrainableIOBuffer(read_buf_, kReadBufferSize);
+  tail->SetOffset(read_offset_);
+  int rv;
+  do {
+    rv = connection_->Read(tail.get(), tail->BytesRemaining());
+  } while (rv < 0 && errno == EINTR);
+  if (rv < 0) {
+    return MapSystemError(errno);
+  }
+  if (rv == 0) {
+    return ERR_CONNECTION_CLOSED;
+  }
+  decoder_.Append(read_buf_, read_offset_, rv);
+  read_offset_ += rv;
+  count = DrainFrames(frames);
+  return count ? count : ERR_IO_PENDING;
+}
+
+}  // namespace dlock
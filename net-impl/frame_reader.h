@@ -0,0 +1,51 @@
+#ifndef DLOCK_NET_FRAME_READER_H_
+#define DLOCK_NET_FRAME_READER_H_
+
+#include <vector>
+#include "base/noncopyable.h"
+#include "base/scoped_refptr.h"
+#include "net/frame_codec.h"
+#include "net/io_buffer.h"
+#include "net/io_buffer_chain.h"
+
+namespace dlock {
+
+class TCPConnection;
+
+// Reads frames off a non-blocking TCPConnection. Each read lands in the
+// free tail of a shared receive buffer, and the decoder hands out the
+// payloads as slices of it, so a read of many small frames costs one
+// syscall and no copies. Payloads keep their receive buffers alive until
+// they are released.
+class FrameReader {
+ public:
+  // |connection| must outlive the reader.
+  FrameReader(TCPConnection* connection, const FrameOptions& options);
+  ~FrameReader();
+
+  // Reads once and appends every frame completed by it, or already
+  // buffered, to |frames|. Returns the number of frames appended, or
+  // ERR_IO_PENDING if none is complete and the connection has nothing more
+  // to read. Errors include ERR_CONNECTION_CLOSED at end of stream and the
+  // FrameDecoder ones.
+  int ReadFrames(std::vector<IOBufferChain>* frames);
+
+  size_t buffered() const { return decoder_.buffered(); }
+
+  static const int kReadBufferSize;
+
+ private:
+  // Moves the frames the decoder has completed to |frames|.
+  int DrainFrames(std::vector<IOBufferChain>* frames);
+
+  TCPConnection* connection_;
+  FrameDecoder decoder_;
+  scoped_refptr<IOBuffer> read_buf_;
+  int read_offset_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrameReader);
+};
+
+}  // namespace dlock
+
+#endif
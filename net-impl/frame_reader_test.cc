@@ -0,0 +1,182 @@
+#include "net/frame_reader.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "net/net_errors.h"
+#include "net/tcp_connection.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+// Hands out scripted chunks, one per Read(), as a non-blocking socket
+// would: EAGAIN once they run out, then end of stream if closed.
+class FakeConnection : public TCPConnection {
+ public:
+  FakeConnection() : closed_(false) {}
+
+  void AddRead(const std::string& data) { reads_.push_back(data); }
+  void Close() { closed_ = true; }
+
+  int Read(IOBuffer* buf, int buf_len) override {
+    if (reads_.empty()) {
+      if (closed_) {
+        return 0;
+      }
+      errno = EAGAIN;
+      return -1;
+    }
+    std::string& chunk = reads_.front();
+    int len = std::min(buf_len, static_cast<int>(chunk.size()));
+    memcpy(buf->data(), chunk.data(), len);
+    chunk.erase(0, len);
+    if (chunk.empty()) {
+      reads_.pop_front();
+    }
+    return len;
+  }
+  int Write(IOBuffer*, int buf_len) override { return buf_len; }
+  int SetReceiveBufferSize(int32_t) override { return 0; }
+  int SetSendBufferSize(int32_t) override { return 0; }
+  int Connect() override { return 0; }
+  void Disconnect() override {}
+  bool IsConnected() const override { return true; }
+  bool IsConnectedAndIdle() const override { return reads_.empty(); }
+  int GetPeerAddress(SocketAddress*) const override { return 0; }
+  int GetLocalAddress(SocketAddress*) const override { return 0; }
+  bool WasEverUsed() const override { return true; }
+  int64_t GetTotalReceivedBytes() const override { return 0; }
+
+ private:
+  std::deque<std::string> reads_;
+  bool closed_;
+};
+
+static std::string Encode(const FrameOptions& options,
+                          const std::vector<std::string>& payloads) {
+  FrameEncoder encoder(options);
+  IOBufferChain wire;
+  for (const std::string& payload : payloads) {
+    scoped_refptr<IOBuffer> buf = new IOBuffer(payload.size() + 1);
+    memcpy(buf->data(), payload.data(), payload.size());
+    encoder.Encode(buf, 0, static_cast<int>(payload.size()), &wire);
+  }
+  std::string out(wire.size(), '\0');
+  wire.CopyTo(&out[0], static_cast<int>(out.size()));
+  return out;
+}
+
+static std::string ToString(const IOBufferChain& chain) {
+  std::string out(chain.size(), '\0');
+  chain.CopyTo(&out[0], static_cast<int>(out.size()));
+  return out;
+}
+
+UNITTEST_DEFINITION(FrameReaderTest);
+
+TEST(FrameReaderTest, TestFramesPerRead) {
+  FrameOptions options;
+  FakeConnection connection;
+  FrameReader reader(&connection, options);
+  std::vector<IOBufferChain> frames;
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_IO_PENDING);
+
+  connection.AddRead(Encode(options, {"one", "two", "three"}));
+  CHECK_EQ(reader.ReadFrames(&frames), 3);
+  CHECK_EQ(frames.size(), 3u);
+  CHECK_EQ(ToString(frames[2]), "three");
+  CHECK_EQ(reader.buffered(), 0u);
+
+  connection.Close();
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_CONNECTION_CLOSED);
+}
+
+// Once the receive buffer has too little room left, the next read starts
+// a fresh one and a frame straddling both comes out as two slices.
+TEST(FrameReaderTest, TestFrameSplitAcrossBuffers) {
+  FrameOptions options;
+  options.checksum = true;
+  FakeConnection connection;
+  FrameReader reader(&connection, options);
+  // The first frame takes 64412 bytes, so the read ends 100 bytes into
+  // the second.
+  std::string first(FrameReader::kReadBufferSize - 1024 - 107, 'a');
+  std::string second(3000, 'b');
+  std::string wire = Encode(options, {first, second});
+  size_t cut = FrameReader::kReadBufferSize - 1024;
+  connection.AddRead(wire.substr(0, cut));
+  connection.AddRead(wire.substr(cut));
+
+  std::vector<IOBufferChain> frames;
+  CHECK_EQ(reader.ReadFrames(&frames), 1);
+  CHECK_EQ(ToString(frames[0]), first);
+  CHECK_GT(reader.buffered(), 0u);
+  CHECK_EQ(reader.ReadFrames(&frames), 1);
+  CHECK_EQ(frames[1].num_slices(), 2u);
+  CHECK(frames[1].slice(0).buf.get() != frames[1].slice(1).buf.get());
+  CHECK_EQ(ToString(frames[1]), second);
+  CHECK_EQ(reader.buffered(), 0u);
+}
+
+TEST(FrameReaderTest, TestPartialHeader) {
+  FrameOptions options;
+  options.header = FrameOptions::FIXED32_HEADER;
+  FakeConnection connection;
+  FrameReader reader(&connection, options);
+  std::string wire = Encode(options, {"payload"});
+  connection.AddRead(wire.substr(0, 2));
+  connection.AddRead(wire.substr(2, 3));
+  connection.AddRead(wire.substr(5));
+
+  std::vector<IOBufferChain> frames;
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_IO_PENDING);
+  CHECK_EQ(reader.buffered(), 2u);
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_IO_PENDING);
+  CHECK_EQ(reader.ReadFrames(&frames), 1);
+  CHECK_EQ(ToString(frames[0]), "payload");
+}
+
+// The length is refused from the header alone.
+TEST(FrameReaderTest, TestOversizedLength) {
+  FrameOptions options;
+  options.max_frame_size = 1024;
+  FrameOptions sender;
+  FakeConnection connection;
+  FrameReader reader(&connection, options);
+  connection.AddRead(Encode(sender, {std::string(4096, 'x')}).substr(0, 2));
+
+  std::vector<IOBufferChain> frames;
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_FRAME_TOO_LARGE);
+  CHECK(frames.empty());
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_FRAME_TOO_LARGE);
+}
+
+TEST(FrameReaderTest, TestCrcMismatch) {
+  FrameOptions options;
+  options.checksum = true;
+  FakeConnection connection;
+  FrameReader reader(&connection, options);
+  connection.AddRead(Encode(options, {"good"}));
+  std::string bad = Encode(options, {"flipped"});
+  bad[2] ^= 0x20;
+  connection.AddRead(bad);
+
+  std::vector<IOBufferChain> frames;
+  CHECK_EQ(reader.ReadFrames(&frames), 1);
+  CHECK_EQ(ToString(frames[0]), "good");
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_FRAME_CORRUPTED);
+  CHECK_EQ(frames.size(), 1u);
+  // The stream stays unusable.
+  connection.AddRead(Encode(options, {"after"}));
+  CHECK_EQ(reader.ReadFrames(&frames), ERR_FRAME_CORRUPTED);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(FrameReaderTest)
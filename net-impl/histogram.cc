@@ -0,0 +1,113 @@
+#include "net/histogram.h"
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+
+namespace dlock {
+
+namespace {
+
+// Values below 2^kSubBucketBits have a bucket each; above, every power of
+// two gets kHalfBuckets.
+const int kSubBucketBits = 7;
+const int64_t kSubBuckets = 1 << kSubBucketBits;
+const int64_t kHalfBuckets = kSubBuckets / 2;
+const int kMaxValueBits = 40;
+
+inline int BucketIndex(int64_t value) {
+  if (value < kSubBuckets) {
+    return static_cast<int>(value);
+  }
+  int msb = 63 - __builtin_clzll(static_cast<uint64_t>(value));
+  int shift = msb - (kSubBucketBits - 1);
+  return static_cast<int>(shift * kHalfBuckets + (value >> shift));
+}
+
+// The highest value that lands in |index|.
+inline int64_t BucketValue(int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  int shift = static_cast<int>(index / kHalfBuckets) - 1;
+  int64_t sub = index - shift * kHalfBuckets;
+  return (sub << shift) + (static_cast<int64_t>(1) << shift) - 1;
+}
+
+}  // namespace
+
+const int64_t Histogram::kMaxValue =
+    (static_cast<int64_t>(1) << kMaxValueBits) - 1;
+
+Histogram::Histogram()
+    : counts_(BucketIndex(kMaxValue) + 1, 0),
+      count_(0),
+      min_(0),
+      max_(0),
+      sum_(0) {}
+
+void Histogram::Record(int64_t value) {
+  value = std::min(std::max<int64_t>(value, 0), kMaxValue);
+  ++counts_[BucketIndex(value)];
+  if (!count_ || value < min_) {
+    min_ = value;
+  }
+  if (value > max_) {
+    max_ = value;
+  }
+  ++count_;
+  sum_ += value;
+}
+
+void Histogram::Merge(const Histogram& other) {
+  if (!other.count_) {
+    return;
+  }
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    counts_[i] += other.counts_[i];
+  }
+  min_ = count_ ? std::min(min_, other.min_) : other.min_;
+  max_ = std::max(max_, other.max_);
+  count_ += other.count_;
+  sum_ += other.sum_;
+}
+
+void Histogram::Clear() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  count_ = 0;
+  min_ = 0;
+  max_ = 0;
+  sum_ = 0;
+}
+
+int64_t Histogram::Percentile(double percentile) const {
+  if (!count_) {
+    return 0;
+  }
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  uint64_t rank = static_cast<uint64_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(count_)));
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      // The bucket bound may overshoot the largest value recorded.
+      return std::min(BucketValue(static_cast<int>(i)), max_);
+    }
+  }
+  return max_;
+}
+
+double Histogram::mean() const {
+  return count_ ? sum_ / static_cast<double>(count_) : 0;
+}
+
+std::string Histogram::ToString() const {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "count=%ld mean=%.1f p50=%ld p99=%ld p999=%ld max=%ld", count_,
+           mean(), Percentile(50), Percentile(99), Percentile(99.9), max_);
+  return std::string(buf);
+}
+
+}  // namespace dlock
@@ -0,0 +1,50 @@
+#ifndef DLOCK_NET_HISTOGRAM_H_
+#define DLOCK_NET_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dlock {
+
+// A log-linear histogram in the style of HdrHistogram: every power of two
+// is split into 64 linear buckets, so a recorded value is reported with a
+// relative error below 1/64 while a few KB cover nanoseconds to minutes.
+// Record() is a shift and an increment. Not thread safe; keep one per
+// thread or connection and Merge() them for reporting.
+class Histogram {
+ public:
+  Histogram();
+
+  // Negative values count as 0, values beyond kMaxValue as kMaxValue.
+  void Record(int64_t value);
+  void Merge(const Histogram& other);
+  void Clear();
+
+  // Returns the highest value equivalent to the one below which
+  // |percentile| (0 to 100) percent of the recorded values fall, or 0 if
+  // nothing was recorded.
+  int64_t Percentile(double percentile) const;
+
+  int64_t count() const { return count_; }
+  // Exact, not rounded to a bucket.
+  int64_t min() const { return count_ ? min_ : 0; }
+  int64_t max() const { return max_; }
+  double mean() const;
+
+  // "count=.. mean=.. p50=.. p99=.. p999=.. max=..".
+  std::string ToString() const;
+
+  static const int64_t kMaxValue;
+
+ private:
+  std::vector<uint64_t> counts_;
+  int64_t count_;
+  int64_t min_;
+  int64_t max_;
+  double sum_;
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,72 @@
+#include "net/histogram.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(HistogramTest);
+
+TEST(HistogramTest, TestEmpty) {
+  Histogram histogram;
+  CHECK_EQ(histogram.count(), 0);
+  CHECK_EQ(histogram.Percentile(50), 0);
+  CHECK_EQ(histogram.min(), 0);
+  CHECK_EQ(histogram.max(), 0);
+}
+
+TEST(HistogramTest, TestSmallValuesAreExact) {
+  Histogram histogram;
+  for (int64_t value = 1; value <= 100; ++value) {
+    histogram.Record(value);
+  }
+  CHECK_EQ(histogram.count(), 100);
+  CHECK_EQ(histogram.min(), 1);
+  CHECK_EQ(histogram.max(), 100);
+  CHECK_EQ(histogram.Percentile(50), 50);
+  CHECK_EQ(histogram.Percentile(99), 99);
+  CHECK_EQ(histogram.Percentile(100), 100);
+}
+
+TEST(HistogramTest, TestRelativeError) {
+  Histogram histogram;
+  for (int64_t value = 1000; value <= 1000000000; value *= 3) {
+    histogram.Clear();
+    histogram.Record(value);
+    histogram.Record(value * 2);
+    int64_t p50 = histogram.Percentile(50);
+    CHECK_LE(value, p50);
+    CHECK_LE(p50 - value, value / 64);
+  }
+}
+
+TEST(HistogramTest, TestClamp) {
+  Histogram histogram;
+  histogram.Record(-5);
+  histogram.Record(Histogram::kMaxValue + 1000);
+  CHECK_EQ(histogram.min(), 0);
+  CHECK_EQ(histogram.max(), Histogram::kMaxValue);
+  CHECK_EQ(histogram.Percentile(100), Histogram::kMaxValue);
+}
+
+TEST(HistogramTest, TestMerge) {
+  Histogram low;
+  Histogram high;
+  for (int i = 0; i < 990; ++i) {
+    low.Record(10);
+  }
+  for (int i = 0; i < 10; ++i) {
+    high.Record(5000);
+  }
+  low.Merge(high);
+  CHECK_EQ(low.count(), 1000);
+  CHECK_EQ(low.min(), 10);
+  CHECK_EQ(low.max(), 5000);
+  CHECK_EQ(low.Percentile(99), 10);
+  CHECK_EQ(low.Percentile(99.9), 5000);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(HistogramTest)
@@ -1,19 +1,30 @@
 #include "net/io_buffer.h"
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include "net/io_buffer_pool.h"
+#include "util/logging.h"
 
 namespace dlock {
 
-IOBuffer::IOBuffer() : data_(nullptr) {}
+IOBuffer::IOBuffer() : data_(nullptr), pooled_(false) {}
 
-IOBuffer::IOBuffer(size_t buffer_size) {
+IOBuffer::IOBuffer(size_t buffer_size) : pooled_(true) {
   CHECK_GE(buffer_size, 0);
-  data_ = new char[buffer_size];
+  data_ = IOBufferPool::Allocate(buffer_size);
 }
 
-IOBuffer::IOBuffer(char* data) : data_(data) {}
+IOBuffer::IOBuffer(char* data) : data_(data), pooled_(false) {}
 
 IOBuffer::~IOBuffer() {
-  delete[] data_;
+  if (pooled_) {
+    IOBufferPool::Free(data_);
+  } else {
+    delete[] data_;
+  }
   data_ = nullptr;
 }
 
@@ -51,21 +62,32 @@ int DrainableIOBuffer::BytesRemaining() const { return size_ - used_; }
 
 int DrainableIOBuffer::BytesConsumed() const { return used_; }
 
+void DrainableIOBuffer::SetOffset(int bytes) {
+  CHECK_GE(bytes, 0);
+  CHECK_LE(bytes, size_);
+  used_ = bytes;
+  data_ = base_->data() + used_;
+}
+
 DrainableIOBuffer::~DrainableIOBuffer() {
   // The buffer is owned by the |base_| instance.
   data_ = nullptr;
 }
 
-GrowableIOBuffer::GrowableIOBuffer() : IOBuffer(), capacity_(0), offset_(0) {}
+const int GrowableIOBuffer::kMmapThreshold = 1024 * 1024;
+
+static size_t RoundUpToPage(size_t size) {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
+GrowableIOBuffer::GrowableIOBuffer()
+    : IOBuffer(), real_data_(nullptr), mapped_(false), capacity_(0),
+      offset_(0) {}
 
 void GrowableIOBuffer::SetCapacity(int capacity) {
   CHECK_GE(capacity, 0);
-  std::unique_ptr<char[]> buf(new char[capacity]);
-  if (buf) {
-    int size = std::min(offset_, capacity);
-    memmove(buf.get(), real_data_.get(), size);
-    real_data_.swap(buf);
-  }
+  Reallocate(capacity);
   capacity_ = capacity;
   if (offset_ > capacity)
     set_offset(capacity);
@@ -73,17 +95,96 @@ void GrowableIOBuffer::SetCapacity(int capacity) {
     set_offset(offset_);
 }
 
+char* GrowableIOBuffer::Reserve(int bytes) {
+  CHECK_GE(bytes, 0);
+  if (RemainingCapacity() < bytes) {
+    int64_t needed = static_cast<int64_t>(offset_) + bytes;
+    int64_t capacity = std::max<int64_t>(needed, 2LL * capacity_);
+    if (capacity >= kMmapThreshold) {
+      // Use the whole last page of the mapping.
+      capacity = RoundUpToPage(capacity);
+    }
+    capacity = std::min<int64_t>(capacity, INT_MAX);
+    CHECK_LE(needed, capacity);
+    SetCapacity(static_cast<int>(capacity));
+  }
+  return data();
+}
+
+void GrowableIOBuffer::Commit(int bytes) {
+  CHECK_GE(bytes, 0);
+  CHECK_LE(bytes, RemainingCapacity());
+  set_offset(offset_ + bytes);
+}
+
+void GrowableIOBuffer::ShrinkToFit() {
+  if (capacity_ > offset_) {
+    SetCapacity(offset_);
+  }
+}
+
+void GrowableIOBuffer::Reallocate(int capacity) {
+  bool map = capacity >= kMmapThreshold;
+  if (map && mapped_) {
+    void* data = mremap(real_data_, RoundUpToPage(capacity_),
+                        RoundUpToPage(capacity), MREMAP_MAYMOVE);
+    CHECK(data != MAP_FAILED);
+    real_data_ = static_cast<char*>(data);
+    return;
+  }
+  if (!map && !mapped_) {
+    if (!capacity) {
+      FreeRealData();
+      return;
+    }
+    void* data = realloc(real_data_, capacity);
+    CHECK(data);
+    real_data_ = static_cast<char*>(data);
+    return;
+  }
+
+  // Crossing kMmapThreshold, the only case that copies.
+  char* data;
+  if (map) {
+    void* mapping = mmap(nullptr, RoundUpToPage(capacity),
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1, 0);
+    CHECK(mapping != MAP_FAILED);
+    data = static_cast<char*>(mapping);
+  } else {
+    data = static_cast<char*>(malloc(std::max(capacity, 1)));
+    CHECK(data);
+  }
+  memcpy(data, real_data_, std::min(offset_, capacity));
+  FreeRealData();
+  real_data_ = data;
+  mapped_ = map;
+}
+
+void GrowableIOBuffer::FreeRealData() {
+  if (mapped_) {
+    munmap(real_data_, RoundUpToPage(capacity_));
+  } else {
+    free(real_data_);
+  }
+  real_data_ = nullptr;
+  mapped_ = false;
+}
+
 void GrowableIOBuffer::set_offset(int offset) {
   CHECK_GE(offset, 0);
   CHECK_GE_LE(offset, capacity_);
   offset_ = offset;
-  data_ = real_data_.get() + offset;
+  data_ = real_data_ + offset;
 }
 
 int GrowableIOBuffer::RemainingCapacity() { return capacity_ - offset_; }
 
-char* GrowableIOBuffer::StartOfBuffer() { return real_data_.get(); }
+char* GrowableIOBuffer::StartOfBuffer() { return real_data_; }
 
-GrowableIOBuffer::~GrowableIOBuffer() { data_ = nullptr; }
+GrowableIOBuffer::~GrowableIOBuffer() {
+  FreeRealData();
+  data_ = nullptr;
+}
 
 }  // namespace dlock
\ No newline at end of file
@@ -25,6 +25,8 @@ class IOBuffer : public RefCountedThreadSafe<IOBuffer> {
   virtual ~IOBuffer();
 
   char* data_;
+  // Set when |data_| came from IOBufferPool rather than new[].
+  bool pooled_;
 };
 
 class IOBufferWithSize : public IOBuffer {
@@ -81,6 +83,9 @@ class DrainableIOBuffer : public IOBuffer {
   int used_;
 };
 
+// Buffers of kMmapThreshold bytes or more are backed by an anonymous
+// mapping and resized with mremap(), which moves page table entries instead
+// of copying. Smaller ones live on the heap and are resized with realloc().
 class GrowableIOBuffer : public IOBuffer {
  public:
   GrowableIOBuffer();
@@ -96,10 +101,26 @@ class GrowableIOBuffer : public IOBuffer {
   int RemainingCapacity();
   char* StartOfBuffer();
 
+  // Makes room for at least |bytes| past offset(), at least doubling the
+  // capacity when it has to grow, and returns data(). Fill it, then
+  // Commit() what was written.
+  char* Reserve(int bytes);
+  // Moves offset() past |bytes| written into the reserved room.
+  void Commit(int bytes);
+  // Drops the capacity beyond offset(), e.g. once a connection goes idle.
+  void ShrinkToFit();
+
+  static const int kMmapThreshold;
+
  private:
   ~GrowableIOBuffer() override;
 
-  std::unique_ptr<char[]> real_data_;
+  void Reallocate(int capacity);
+  void FreeRealData();
+
+  char* real_data_;
+  // Set if |real_data_| is a mapping rather than heap memory.
+  bool mapped_;
   int capacity_;
   int offset_;
 };
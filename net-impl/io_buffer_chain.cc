@@ -0,0 +1,158 @@
+#include "net/io_buffer_chain.h"
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include "util/logging.h"
+
+namespace dlock {
+
+IOBufferChain::IOBufferChain() : size_(0) {}
+
+IOBufferChain::IOBufferChain(IOBufferChain&& other)
+    : slices_(std::move(other.slices_)), size_(other.size_) {
+  other.Clear();
+}
+
+IOBufferChain& IOBufferChain::operator=(IOBufferChain&& other) {
+  if (this != &other) {
+    slices_ = std::move(other.slices_);
+    size_ = other.size_;
+    other.Clear();
+  }
+  return *this;
+}
+
+IOBufferChain::~IOBufferChain() = default;
+
+void IOBufferChain::Append(scoped_refptr<IOBuffer> buf, int offset, int len) {
+  CHECK_GE(offset, 0);
+  CHECK_GE(len, 0);
+  if (!len) {
+    return;
+  }
+  slices_.push_back({std::move(buf), offset, len});
+  size_ += len;
+}
+
+void IOBufferChain::Prepend(scoped_refptr<IOBuffer> buf, int offset,
+                            int len) {
+  CHECK_GE(offset, 0);
+  CHECK_GE(len, 0);
+  if (!len) {
+    return;
+  }
+  slices_.push_front({std::move(buf), offset, len});
+  size_ += len;
+}
+
+void IOBufferChain::Append(IOBufferChain* other) {
+  CHECK(other != this);
+  for (auto& slice : other->slices_) {
+    slices_.push_back(std::move(slice));
+  }
+  size_ += other->size_;
+  other->Clear();
+}
+
+void IOBufferChain::Split(int len, IOBufferChain* head) {
+  CHECK_GE(len, 0);
+  CHECK_LE(static_cast<size_t>(len), size_);
+  CHECK(head != this);
+  while (len > 0) {
+    Slice& front = slices_.front();
+    if (front.len <= len) {
+      len -= front.len;
+      size_ -= front.len;
+      head->size_ += front.len;
+      head->slices_.push_back(std::move(front));
+      slices_.pop_front();
+    } else {
+      // Both halves share the buffer.
+      head->Append(front.buf, front.offset, len);
+      front.offset += len;
+      front.len -= len;
+      size_ -= len;
+      len = 0;
+    }
+  }
+}
+
+void IOBufferChain::Consume(int len) {
+  CHECK_GE(len, 0);
+  CHECK_LE(static_cast<size_t>(len), size_);
+  size_ -= len;
+  while (len > 0) {
+    Slice& front = slices_.front();
+    if (front.len <= len) {
+      len -= front.len;
+      slices_.pop_front();
+    } else {
+      front.offset += len;
+      front.len -= len;
+      len = 0;
+    }
+  }
+}
+
+void IOBufferChain::Coalesce() {
+  if (slices_.size() < 2) {
+    return;
+  }
+  size_t last = 0;
+  for (size_t i = 1; i < slices_.size(); ++i) {
+    Slice& prev = slices_[last];
+    Slice& slice = slices_[i];
+    if (prev.buf == slice.buf && prev.offset + prev.len == slice.offset) {
+      prev.len += slice.len;
+    } else if (++last != i) {
+      slices_[last] = std::move(slice);
+    }
+  }
+  slices_.resize(last + 1);
+}
+
+scoped_refptr<IOBuffer> IOBufferChain::Flatten() const {
+  if (slices_.size() == 1 && slices_.front().offset == 0) {
+    return slices_.front().buf;
+  }
+  scoped_refptr<IOBuffer> buf = new IOBuffer(size_);
+  char* out = buf->data();
+  for (const auto& slice : slices_) {
+    memcpy(out, slice.buf->data() + slice.offset, slice.len);
+    out += slice.len;
+  }
+  return buf;
+}
+
+int IOBufferChain::CopyTo(char* out, int len) const {
+  int copied = 0;
+  for (const auto& slice : slices_) {
+    if (copied == len) {
+      break;
+    }
+    int chunk = std::min(slice.len, len - copied);
+    memcpy(out + copied, slice.buf->data() + slice.offset, chunk);
+    copied += chunk;
+  }
+  return copied;
+}
+
+int IOBufferChain::FillIovec(struct iovec* iov, int max_iov) const {
+  int count = 0;
+  for (const auto& slice : slices_) {
+    if (count == max_iov) {
+      break;
+    }
+    iov[count].iov_base = slice.buf->data() + slice.offset;
+    iov[count].iov_len = slice.len;
+    ++count;
+  }
+  return count;
+}
+
+void IOBufferChain::Clear() {
+  slices_.clear();
+  size_ = 0;
+}
+
+}  // namespace dlock
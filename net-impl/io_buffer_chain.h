@@ -0,0 +1,72 @@
+#ifndef DLOCK_NET_IO_BUFFER_CHAIN_H_
+#define DLOCK_NET_IO_BUFFER_CHAIN_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <deque>
+#include "base/noncopyable.h"
+#include "base/scoped_refptr.h"
+#include "net/io_buffer.h"
+
+namespace dlock {
+
+// An ordered list of slices of refcounted IOBuffers, so a message can be
+// assembled from a header, a payload and a trailer, or cut into frames,
+// without copying any bytes. Only Flatten() copies.
+class IOBufferChain {
+ public:
+  struct Slice {
+    scoped_refptr<IOBuffer> buf;
+    int offset;
+    int len;
+  };
+
+  IOBufferChain();
+  IOBufferChain(IOBufferChain&& other);
+  IOBufferChain& operator=(IOBufferChain&& other);
+  ~IOBufferChain();
+
+  // Adds |len| bytes of |buf| starting at |offset|. Empty slices are
+  // dropped.
+  void Append(scoped_refptr<IOBuffer> buf, int offset, int len);
+  void Prepend(scoped_refptr<IOBuffer> buf, int offset, int len);
+  // Moves all slices of |other| to the end of this chain.
+  void Append(IOBufferChain* other);
+
+  // Moves the first |len| bytes into |head|, splitting a slice in two if
+  // |len| ends inside it. CHECKs that |len| <= size().
+  void Split(int len, IOBufferChain* head);
+  // Drops the first |len| bytes, e.g. after a partial write.
+  void Consume(int len);
+  // Merges neighbouring slices that are adjacent ranges of the same buffer,
+  // as left behind by Split().
+  void Coalesce();
+  // Copies the chain into one buffer. Returns the single slice's buffer if
+  // the chain is already contiguous and starts at offset 0.
+  scoped_refptr<IOBuffer> Flatten() const;
+
+  // Copies up to |len| bytes from the front of the chain to |out| without
+  // consuming them, e.g. to parse a header that spans slices. Returns the
+  // number of bytes copied.
+  int CopyTo(char* out, int len) const;
+
+  // Fills |iov| with at most |max_iov| entries from the front of the chain
+  // and returns the number of entries used.
+  int FillIovec(struct iovec* iov, int max_iov) const;
+
+  void Clear();
+  bool empty() const { return slices_.empty(); }
+  size_t size() const { return size_; }
+  size_t num_slices() const { return slices_.size(); }
+  const Slice& slice(size_t index) const { return slices_[index]; }
+
+ private:
+  std::deque<Slice> slices_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOBufferChain);
+};
+
+}  // namespace dlock
+
+#endif
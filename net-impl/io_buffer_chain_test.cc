@@ -0,0 +1,192 @@
+#include "net/io_buffer_chain.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(IOBufferChainTest);
+
+namespace {
+
+scoped_refptr<IOBuffer> MakeBuffer(const std::string& data) {
+  scoped_refptr<IOBuffer> buf = new IOBuffer(data.size());
+  memcpy(buf->data(), data.data(), data.size());
+  return buf;
+}
+
+std::string ToString(const IOBufferChain& chain) {
+  std::string out(chain.size(), '\0');
+  CHECK_EQ(chain.CopyTo(&out[0], static_cast<int>(out.size())),
+           static_cast<int>(out.size()));
+  return out;
+}
+
+}  // namespace
+
+TEST(IOBufferChainTest, TestAppendAndPrepend) {
+  IOBufferChain chain;
+  CHECK(chain.empty());
+  chain.Append(MakeBuffer("xxhello"), 2, 5);
+  chain.Append(MakeBuffer("ignored"), 3, 0);
+  chain.Prepend(MakeBuffer(">"), 0, 1);
+  CHECK_EQ(chain.num_slices(), 2);
+  CHECK_EQ(chain.size(), 6);
+
+  IOBufferChain tail;
+  tail.Append(MakeBuffer(" world"), 0, 6);
+  chain.Append(&tail);
+  CHECK(tail.empty());
+  CHECK_EQ(tail.size(), 0);
+  CHECK_EQ(chain.num_slices(), 3);
+  CHECK_EQ(ToString(chain), ">hello world");
+
+  IOBufferChain moved(std::move(chain));
+  CHECK(chain.empty());
+  CHECK_EQ(ToString(moved), ">hello world");
+}
+
+TEST(IOBufferChainTest, TestSplitAndCoalesce) {
+  scoped_refptr<IOBuffer> buf = MakeBuffer("0123456789");
+  IOBufferChain chain;
+  chain.Append(buf, 0, 10);
+  chain.Append(MakeBuffer("abc"), 0, 3);
+
+  IOBufferChain head;
+  chain.Split(4, &head);
+  CHECK_EQ(ToString(head), "0123");
+  CHECK_EQ(ToString(chain), "456789abc");
+  // Both halves point into the same buffer.
+  CHECK(head.slice(0).buf == buf);
+  CHECK(chain.slice(0).buf == buf);
+  CHECK_EQ(chain.slice(0).offset, 4);
+
+  // Ends on a slice boundary.
+  IOBufferChain middle;
+  chain.Split(6, &middle);
+  CHECK_EQ(ToString(middle), "456789");
+  CHECK_EQ(ToString(chain), "abc");
+  CHECK_EQ(chain.num_slices(), 1);
+
+  head.Append(&middle);
+  CHECK_EQ(head.num_slices(), 2);
+  head.Coalesce();
+  CHECK_EQ(head.num_slices(), 1);
+  CHECK_EQ(head.slice(0).offset, 0);
+  CHECK_EQ(head.slice(0).len, 10);
+
+  IOBufferChain all;
+  chain.Split(static_cast<int>(chain.size()), &all);
+  CHECK(chain.empty());
+  CHECK_EQ(ToString(all), "abc");
+}
+
+TEST(IOBufferChainTest, TestConsume) {
+  IOBufferChain chain;
+  chain.Append(MakeBuffer("abc"), 0, 3);
+  chain.Append(MakeBuffer("defg"), 0, 4);
+  chain.Consume(0);
+  CHECK_EQ(chain.size(), 7);
+  chain.Consume(4);
+  CHECK_EQ(chain.num_slices(), 1);
+  CHECK_EQ(ToString(chain), "efg");
+  chain.Consume(3);
+  CHECK(chain.empty());
+  CHECK_EQ(chain.size(), 0);
+}
+
+TEST(IOBufferChainTest, TestFlatten) {
+  scoped_refptr<IOBuffer> buf = MakeBuffer("contiguous");
+  IOBufferChain chain;
+  chain.Append(buf, 0, 10);
+  // Nothing to copy.
+  CHECK(chain.Flatten() == buf);
+
+  chain.Append(MakeBuffer("+more"), 0, 5);
+  scoped_refptr<IOBuffer> flat = chain.Flatten();
+  CHECK(flat.get() != buf.get());
+  CHECK_EQ(std::string(flat->data(), 15), "contiguous+more");
+
+  IOBufferChain offset;
+  offset.Append(buf, 3, 4);
+  flat = offset.Flatten();
+  CHECK(flat.get() != buf.get());
+  CHECK_EQ(std::string(flat->data(), 4), "tigu");
+}
+
+TEST(IOBufferChainTest, TestCopyTo) {
+  IOBufferChain chain;
+  chain.Append(MakeBuffer("ab"), 0, 2);
+  chain.Append(MakeBuffer("cde"), 0, 3);
+  char out[8];
+  CHECK_EQ(chain.CopyTo(out, 3), 3);
+  CHECK_EQ(std::string(out, 3), "abc");
+  // Short chain.
+  CHECK_EQ(chain.CopyTo(out, sizeof(out)), 5);
+  CHECK_EQ(std::string(out, 5), "abcde");
+  CHECK_EQ(chain.size(), 5);
+}
+
+TEST(IOBufferChainTest, TestFillIovec) {
+  IOBufferChain chain;
+  scoped_refptr<IOBuffer> buf = MakeBuffer("abcdef");
+  chain.Append(buf, 1, 2);
+  chain.Append(buf, 4, 2);
+  chain.Append(MakeBuffer("xyz"), 0, 3);
+  struct iovec iov[4];
+  CHECK_EQ(chain.FillIovec(iov, 4), 3);
+  CHECK(iov[0].iov_base == buf->data() + 1);
+  CHECK_EQ(iov[0].iov_len, 2);
+  CHECK(iov[1].iov_base == buf->data() + 4);
+  CHECK_EQ(iov[2].iov_len, 3);
+  CHECK_EQ(chain.FillIovec(iov, 2), 2);
+}
+
+// Read() and Write() of TCPSocket take a chain as the iovecs of one
+// readv() and writev().
+TEST(IOBufferChainTest, TestSocketReadvWritev) {
+  int fds[2];
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  TCPSocket writer;
+  TCPSocket reader;
+  CHECK_EQ(writer.AdoptUnconnectedSocket(fds[0]), 0);
+  CHECK_EQ(reader.AdoptUnconnectedSocket(fds[1]), 0);
+
+  // Nothing to read yet.
+  IOBufferChain in;
+  in.Append(new IOBuffer(4), 0, 4);
+  in.Append(new IOBuffer(16), 0, 16);
+  CHECK_EQ(reader.Read(in), -1);
+  CHECK_EQ(errno, EAGAIN);
+
+  IOBufferChain out;
+  out.Append(MakeBuffer("head"), 0, 4);
+  out.Append(MakeBuffer("--payload--"), 2, 7);
+  out.Append(MakeBuffer("tail"), 0, 4);
+  CHECK_EQ(writer.Write(out), 15);
+  CHECK_EQ(out.size(), 15);
+  CHECK_EQ(writer.stats().write_calls, 1);
+  CHECK_EQ(writer.stats().bytes_written, 15);
+
+  // Scattered over both slices, the chain itself unchanged.
+  CHECK_EQ(reader.Read(in), 15);
+  CHECK_EQ(std::string(in.slice(0).buf->data(), 4), "head");
+  CHECK_EQ(std::string(in.slice(1).buf->data(), 11), "payloadtail");
+  CHECK_EQ(in.size(), 20);
+  CHECK_EQ(reader.stats().bytes_read, 15);
+
+  writer.Close();
+  CHECK_EQ(reader.Read(in), 0);
+  reader.Close();
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(IOBufferChainTest)
@@ -0,0 +1,367 @@
+#include "net/io_buffer_pool.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "base/sync.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+namespace {
+
+const int kNumClasses = 9;
+const int kMinClassShift = 8;  // 256 bytes
+const uint32_t kLargeClass = 0xffffffff;
+// Keeps the payload 16-byte aligned.
+const size_t kHeaderSize = 16;
+const size_t kSlabSize = 2 << 20;
+
+struct BlockHeader {
+  uint32_t size_class;
+  // Slab blocks can not be handed back to the system one by one.
+  uint32_t from_slab;
+};
+
+// Overlays a free block. The link lives in the payload, so the header
+// keeps telling Release() where the block came from.
+struct FreeBlock {
+  BlockHeader header;
+  char padding[kHeaderSize - sizeof(BlockHeader)];
+  FreeBlock *next;
+};
+
+static_assert(offsetof(FreeBlock, next) == kHeaderSize,
+              "the free list link must not overlap the header");
+
+inline size_t ClassPayload(int size_class) {
+  return static_cast<size_t>(1) << (kMinClassShift + size_class);
+}
+
+inline size_t ClassBlock(int size_class) {
+  return ClassPayload(size_class) + kHeaderSize;
+}
+
+inline int SizeClass(size_t size) {
+  for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+    if (size <= ClassPayload(size_class)) {
+      return size_class;
+    }
+  }
+  return -1;
+}
+
+inline BlockHeader *HeaderOf(char *data) {
+  return reinterpret_cast<BlockHeader *>(data - kHeaderSize);
+}
+
+inline char *DataOf(void *block) {
+  return static_cast<char *>(block) + kHeaderSize;
+}
+
+class ThreadCache;
+
+struct Pool {
+  Pool() : options(), slab_bytes(0) {
+    for (int i = 0; i < kNumClasses; ++i) {
+      free_list[i] = nullptr;
+      free_bytes[i] = 0;
+      slab_next[i] = nullptr;
+      slab_end[i] = nullptr;
+    }
+  }
+
+  // Takes up to |max| blocks of |size_class| off the global free list, or
+  // carves them from a slab, and returns how many were added to |head|.
+  int Refill(int size_class, int max, FreeBlock **head, bool *fresh);
+  void Release(int size_class, FreeBlock *block);
+
+  IOBufferPool::Options options;
+  Mutex mutex[kNumClasses];
+  FreeBlock *free_list[kNumClasses];
+  size_t free_bytes[kNumClasses];
+  char *slab_next[kNumClasses];
+  char *slab_end[kNumClasses];
+  std::atomic<uint64_t> slab_bytes;
+
+  // Counters of threads that exited, and the caches of live ones.
+  Mutex registry_mutex;
+  std::vector<ThreadCache *> caches;
+  uint64_t exited_hits = 0;
+  uint64_t exited_misses = 0;
+  uint64_t exited_large = 0;
+};
+
+Pool *GetPool() {
+  // Leaked, thread caches may be flushed after static destructors ran.
+  static Pool *pool = new Pool();
+  return pool;
+}
+
+class ThreadCache {
+ public:
+  ThreadCache() : hits(0), misses(0), large(0) {
+    for (int i = 0; i < kNumClasses; ++i) {
+      head_[i] = nullptr;
+      bytes[i].store(0, std::memory_order_relaxed);
+    }
+    Pool *pool = GetPool();
+    MutexLock lock(&pool->registry_mutex);
+    pool->caches.push_back(this);
+  }
+
+  ~ThreadCache() {
+    Pool *pool = GetPool();
+    for (int i = 0; i < kNumClasses; ++i) {
+      while (head_[i]) {
+        FreeBlock *block = head_[i];
+        head_[i] = block->next;
+        pool->Release(i, block);
+      }
+    }
+    MutexLock lock(&pool->registry_mutex);
+    pool->caches.erase(
+        std::find(pool->caches.begin(), pool->caches.end(), this));
+    pool->exited_hits += hits.load(std::memory_order_relaxed);
+    pool->exited_misses += misses.load(std::memory_order_relaxed);
+    pool->exited_large += large.load(std::memory_order_relaxed);
+  }
+
+  char *Allocate(int size_class) {
+    if (!head_[size_class]) {
+      Pool *pool = GetPool();
+      // Refill with half of what the thread may cache, in one locked step.
+      int max = std::max<size_t>(
+          1, pool->options.thread_cache_bytes / 2 / ClassBlock(size_class));
+      FreeBlock *head = nullptr;
+      bool fresh = false;
+      int count = pool->Refill(size_class, max, &head, &fresh);
+      if (!count) {
+        return nullptr;
+      }
+      Bump(fresh ? &misses : &hits);
+      // The first block is returned right away.
+      head_[size_class] = head->next;
+      Add(size_class, (count - 1) * ClassBlock(size_class));
+      return DataOf(head);
+    }
+    FreeBlock *block = head_[size_class];
+    head_[size_class] = block->next;
+    Add(size_class, -ClassBlock(size_class));
+    Bump(&hits);
+    return DataOf(block);
+  }
+
+  void Free(int size_class, FreeBlock *block) {
+    Pool *pool = GetPool();
+    size_t block_size = ClassBlock(size_class);
+    if (bytes[size_class].load(std::memory_order_relaxed) + block_size >
+        pool->options.thread_cache_bytes) {
+      pool->Release(size_class, block);
+      return;
+    }
+    block->next = head_[size_class];
+    head_[size_class] = block;
+    Add(size_class, block_size);
+  }
+
+  void CountLarge() { Bump(&large); }
+
+  // Written by the owning thread only, read by GetStats().
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> large;
+  std::atomic<size_t> bytes[kNumClasses];
+
+ private:
+  static void Bump(std::atomic<uint64_t> *counter) {
+    counter->store(counter->load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+  }
+
+  void Add(int size_class, size_t delta) {
+    bytes[size_class].store(
+        bytes[size_class].load(std::memory_order_relaxed) + delta,
+        std::memory_order_relaxed);
+  }
+
+  FreeBlock *head_[kNumClasses];
+};
+
+thread_local ThreadCache thread_cache;
+
+int Pool::Refill(int size_class, int max, FreeBlock **head, bool *fresh) {
+  size_t block_size = ClassBlock(size_class);
+  int count = 0;
+  {
+    MutexLock lock(&mutex[size_class]);
+    while (count < max && free_list[size_class]) {
+      FreeBlock *block = free_list[size_class];
+      free_list[size_class] = block->next;
+      free_bytes[size_class] -= block_size;
+      block->next = *head;
+      *head = block;
+      ++count;
+    }
+    if (count || !options.use_huge_pages) {
+      *fresh = false;
+      if (count) {
+        return count;
+      }
+    } else {
+      if (slab_next[size_class] + block_size > slab_end[size_class]) {
+        void *slab = mmap(nullptr, kSlabSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab == MAP_FAILED) {
+          // No reserved huge pages, ask for transparent ones instead.
+          slab = mmap(nullptr, kSlabSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+          if (slab != MAP_FAILED) {
+            madvise(slab, kSlabSize, MADV_HUGEPAGE);
+          }
+        }
+        if (slab != MAP_FAILED) {
+          slab_next[size_class] = static_cast<char *>(slab);
+          slab_end[size_class] = static_cast<char *>(slab) + kSlabSize;
+          slab_bytes.fetch_add(kSlabSize, std::memory_order_relaxed);
+        }
+      }
+      while (count < max &&
+             slab_next[size_class] + block_size <= slab_end[size_class]) {
+        FreeBlock *block =
+            reinterpret_cast<FreeBlock *>(slab_next[size_class]);
+        slab_next[size_class] += block_size;
+        BlockHeader *header = reinterpret_cast<BlockHeader *>(block);
+        header->size_class = size_class;
+        header->from_slab = 1;
+        block->next = *head;
+        *head = block;
+        ++count;
+      }
+      if (count) {
+        *fresh = true;
+        return count;
+      }
+    }
+  }
+
+  // One block from the system, the next frees fill the caches.
+  void *block = malloc(block_size);
+  if (!block) {
+    return 0;
+  }
+  BlockHeader *header = static_cast<BlockHeader *>(block);
+  header->size_class = size_class;
+  header->from_slab = 0;
+  FreeBlock *free_block = static_cast<FreeBlock *>(block);
+  free_block->next = *head;
+  *head = free_block;
+  *fresh = true;
+  return 1;
+}
+
+void Pool::Release(int size_class, FreeBlock *block) {
+  size_t block_size = ClassBlock(size_class);
+  bool from_slab = reinterpret_cast<BlockHeader *>(block)->from_slab;
+  {
+    MutexLock lock(&mutex[size_class]);
+    if (from_slab || free_bytes[size_class] + block_size <=
+                         options.global_free_bytes) {
+      block->next = free_list[size_class];
+      free_list[size_class] = block;
+      free_bytes[size_class] += block_size;
+      return;
+    }
+  }
+  free(block);
+}
+
+}  // namespace
+
+IOBufferPool::Options::Options()
+    : thread_cache_bytes(256 * 1024),
+      global_free_bytes(16 * 1024 * 1024),
+      use_huge_pages(false) {}
+
+void IOBufferPool::SetOptions(const Options &options) {
+  Pool *pool = GetPool();
+  for (int i = 0; i < kNumClasses; ++i) {
+    pool->mutex[i].Lock();
+  }
+  pool->options = options;
+  for (int i = kNumClasses - 1; i >= 0; --i) {
+    pool->mutex[i].Unlock();
+  }
+}
+
+char *IOBufferPool::Allocate(size_t size) {
+  int size_class = SizeClass(size);
+  if (size_class < 0) {
+    thread_cache.CountLarge();
+    void *block = malloc(size + kHeaderSize);
+    CHECK(block);
+    BlockHeader *header = static_cast<BlockHeader *>(block);
+    header->size_class = kLargeClass;
+    header->from_slab = 0;
+    return DataOf(block);
+  }
+  char *data = thread_cache.Allocate(size_class);
+  CHECK(data);
+  BlockHeader *header = HeaderOf(data);
+  header->size_class = size_class;
+  return data;
+}
+
+void IOBufferPool::Free(char *data) {
+  if (!data) {
+    return;
+  }
+  BlockHeader *header = HeaderOf(data);
+  if (header->size_class == kLargeClass) {
+    free(header);
+    return;
+  }
+  thread_cache.Free(header->size_class,
+                    reinterpret_cast<FreeBlock *>(header));
+}
+
+IOBufferPool::Stats IOBufferPool::GetStats() {
+  Pool *pool = GetPool();
+  Stats stats;
+  stats.retained_bytes = 0;
+  for (int i = 0; i < kNumClasses; ++i) {
+    MutexLock lock(&pool->mutex[i]);
+    stats.retained_bytes += pool->free_bytes[i];
+  }
+  stats.slab_bytes = pool->slab_bytes.load(std::memory_order_relaxed);
+
+  MutexLock lock(&pool->registry_mutex);
+  stats.hits = pool->exited_hits;
+  stats.misses = pool->exited_misses;
+  stats.large = pool->exited_large;
+  for (auto cache : pool->caches) {
+    stats.hits += cache->hits.load(std::memory_order_relaxed);
+    stats.misses += cache->misses.load(std::memory_order_relaxed);
+    stats.large += cache->large.load(std::memory_order_relaxed);
+    for (int i = 0; i < kNumClasses; ++i) {
+      stats.retained_bytes += cache->bytes[i].load(std::memory_order_relaxed);
+    }
+  }
+  return stats;
+}
+
+std::string IOBufferPool::StatsToString() {
+  Stats stats = GetStats();
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "hits=%lu misses=%lu large=%lu retained_bytes=%lu slab_bytes=%lu",
+           stats.hits, stats.misses, stats.large, stats.retained_bytes,
+           stats.slab_bytes);
+  return std::string(buf);
+}
+
+}  // namespace dlock
@@ -0,0 +1,53 @@
+#ifndef DLOCK_NET_IO_BUFFER_POOL_H_
+#define DLOCK_NET_IO_BUFFER_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace dlock {
+
+// Size-class allocator behind IOBuffer(size_t), which keeps malloc out of
+// the per-message path. Blocks are rounded up to a power of two between
+// 256 bytes and 64KB; each thread caches a few freed blocks per class and
+// spills the rest to bounded global free lists, beyond which memory goes
+// back to the system. Larger requests bypass the pool.
+class IOBufferPool {
+ public:
+  struct Options {
+    Options();
+    // Bytes each thread may cache per size class.
+    size_t thread_cache_bytes;
+    // Bytes the global free list may hold per size class.
+    size_t global_free_bytes;
+    // Carve fresh blocks out of 2MB slabs backed by huge pages when the
+    // system has them. Slab memory stays with the pool for good.
+    bool use_huge_pages;
+  };
+
+  struct Stats {
+    // Allocations served from a thread cache or a global free list.
+    uint64_t hits;
+    // Allocations that needed new memory from the system.
+    uint64_t misses;
+    // Allocations above the largest size class.
+    uint64_t large;
+    // Bytes of free blocks held by thread caches and free lists.
+    uint64_t retained_bytes;
+    // Bytes of slab memory mapped for huge page backed blocks.
+    uint64_t slab_bytes;
+  };
+
+  // Must be called before the first allocation to take full effect.
+  static void SetOptions(const Options &options);
+  // Returns a block of at least |size| bytes, to be released with Free().
+  static char *Allocate(size_t size);
+  static void Free(char *data);
+
+  static Stats GetStats();
+  static std::string StatsToString();
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,126 @@
+#include "net/io_buffer_pool.h"
+#include <string.h>
+#include <vector>
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(IOBufferPoolTest);
+
+namespace {
+
+// Returns the growth of the retained bytes after freeing each of |blocks|.
+std::vector<int64_t> FreeAll(const std::vector<char *> &blocks) {
+  std::vector<int64_t> growth;
+  for (char *block : blocks) {
+    uint64_t before = IOBufferPool::GetStats().retained_bytes;
+    IOBufferPool::Free(block);
+    growth.push_back(static_cast<int64_t>(
+        IOBufferPool::GetStats().retained_bytes - before));
+  }
+  return growth;
+}
+
+}  // namespace
+
+// Uses 400-byte buffers, a size class no other test touches.
+TEST(IOBufferPoolTest, TestMallocBlocksAndGlobalCap) {
+  IOBufferPool::Options options;
+  options.thread_cache_bytes = 0;
+  // Room for two of the blocks, headers included, but not three.
+  options.global_free_bytes = 1100;
+  options.use_huge_pages = false;
+  IOBufferPool::SetOptions(options);
+
+  IOBufferPool::Stats before = IOBufferPool::GetStats();
+  std::vector<char *> blocks;
+  for (int i = 0; i < 4; ++i) {
+    blocks.push_back(IOBufferPool::Allocate(400));
+    memset(blocks.back(), i, 400);
+  }
+  IOBufferPool::Stats stats = IOBufferPool::GetStats();
+  CHECK_EQ(stats.misses - before.misses, 4);
+  CHECK_EQ(stats.slab_bytes, before.slab_bytes);
+
+  std::vector<int64_t> growth = FreeAll(blocks);
+  CHECK_GT(growth[0], 400);
+  CHECK_EQ(growth[1], growth[0]);
+  // Over the cap, back to the system.
+  CHECK_EQ(growth[2], 0);
+  CHECK_EQ(growth[3], 0);
+
+  before = IOBufferPool::GetStats();
+  blocks.clear();
+  for (int i = 0; i < 4; ++i) {
+    blocks.push_back(IOBufferPool::Allocate(400));
+  }
+  stats = IOBufferPool::GetStats();
+  CHECK_EQ(stats.hits - before.hits, 2);
+  CHECK_EQ(stats.misses - before.misses, 2);
+  CHECK_EQ(static_cast<int64_t>(before.retained_bytes - stats.retained_bytes),
+           2 * growth[0]);
+  FreeAll(blocks);
+  CHECK_EQ(IOBufferPool::GetStats().retained_bytes, before.retained_bytes);
+}
+
+// Slab blocks stay in the pool whatever the caps, since their memory cannot
+// go back to the system one by one.
+TEST(IOBufferPoolTest, TestSlabBlocks) {
+  IOBufferPool::Options options;
+  options.thread_cache_bytes = 0;
+  options.global_free_bytes = 0;
+  options.use_huge_pages = true;
+  IOBufferPool::SetOptions(options);
+
+  IOBufferPool::Stats before = IOBufferPool::GetStats();
+  std::vector<char *> blocks;
+  for (int i = 0; i < 64; ++i) {
+    blocks.push_back(IOBufferPool::Allocate(200));
+    memset(blocks.back(), i, 200);
+  }
+  IOBufferPool::Stats stats = IOBufferPool::GetStats();
+  CHECK_GT(stats.slab_bytes, before.slab_bytes);
+  CHECK_EQ(stats.misses - before.misses, 64);
+
+  std::vector<int64_t> growth = FreeAll(blocks);
+  CHECK_GT(growth[0], 200);
+  for (int64_t bytes : growth) {
+    CHECK_EQ(bytes, growth[0]);
+  }
+
+  // Once more, from the free list this time.
+  before = IOBufferPool::GetStats();
+  blocks.clear();
+  for (int i = 0; i < 64; ++i) {
+    blocks.push_back(IOBufferPool::Allocate(200));
+    memset(blocks.back(), i, 200);
+  }
+  stats = IOBufferPool::GetStats();
+  CHECK_EQ(stats.hits - before.hits, 64);
+  CHECK_EQ(stats.misses, before.misses);
+  CHECK_EQ(stats.slab_bytes, before.slab_bytes);
+  growth = FreeAll(blocks);
+  for (int64_t bytes : growth) {
+    CHECK_EQ(bytes, growth[0]);
+  }
+  CHECK_EQ(IOBufferPool::GetStats().retained_bytes, before.retained_bytes);
+  IOBufferPool::SetOptions(IOBufferPool::Options());
+}
+
+TEST(IOBufferPoolTest, TestLargeBlocks) {
+  IOBufferPool::Stats before = IOBufferPool::GetStats();
+  char *data = IOBufferPool::Allocate(1 << 20);
+  memset(data, 1, 1 << 20);
+  IOBufferPool::Free(data);
+  IOBufferPool::Free(nullptr);
+  IOBufferPool::Stats stats = IOBufferPool::GetStats();
+  CHECK_EQ(stats.large - before.large, 1);
+  CHECK_EQ(stats.retained_bytes, before.retained_bytes);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(IOBufferPoolTest)
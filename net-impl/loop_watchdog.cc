@@ -0,0 +1,376 @@
+#include "net/loop_watchdog.h"
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include "base/sync.h"
+#include "base/thread.h"
+#include "net/metrics.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+namespace {
+
+const int kMaxFrames = 64;
+// The signal handler and the trampoline that called it.
+const int kHandlerFrames = 2;
+
+enum SampleState {
+  SAMPLE_NONE,
+  // The monitor sent the signal, the handler has not run yet.
+  SAMPLE_REQUESTED,
+  SAMPLE_DONE,
+};
+
+int SampleSignal() { return SIGRTMIN + 3; }
+
+int64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// The dispatch state of one loop thread. Written by the loop, read by the
+// monitor, and |frames| by the signal handler once the monitor asks.
+struct Slot {
+  Slot()
+      : thread(),
+        tid(0),
+        in_use(false),
+        seq(0),
+        start_ns(0),
+        fd(-1),
+        events(0),
+        watcher(nullptr),
+        sample_state(SAMPLE_NONE),
+        sampled_seq(0),
+        num_frames(0) {}
+
+  // Guarded by the registry mutex.
+  pthread_t thread;
+  int tid;
+  bool in_use;
+
+  // Bumped by every BeginCallback(); start_ns is 0 between callbacks.
+  std::atomic<uint64_t> seq;
+  std::atomic<int64_t> start_ns;
+  // Loop thread only.
+  int fd;
+  int events;
+  const void *watcher;
+
+  std::atomic<int> sample_state;
+  // The callback the sample was requested for.
+  std::atomic<uint64_t> sampled_seq;
+  void *frames[kMaxFrames];
+  int num_frames;
+};
+
+class Monitor;
+
+struct Registry {
+  Registry()
+      : budget_ns(0), max_reports(0), capture_stacks(false), slow_count(0) {}
+
+  Mutex mutex;
+  std::vector<std::unique_ptr<Slot>> slots;
+  std::atomic<int64_t> budget_ns;
+  size_t max_reports;
+  bool capture_stacks;
+  std::deque<LoopWatchdog::Report> reports;
+  int64_t slow_count;
+
+  // Serializes Start() and Stop(), which must not hold |mutex| while the
+  // monitor is joined.
+  Mutex start_mutex;
+  std::unique_ptr<Monitor> monitor;
+};
+
+Registry *GetRegistry() {
+  // Leaked, loops may still dispatch after static destructors ran.
+  static Registry *registry = new Registry();
+  return registry;
+}
+
+// Read by the signal handler, so it must not need a TLS constructor.
+thread_local Slot *signal_slot = nullptr;
+
+void OnSampleSignal(int) {
+  Slot *slot = signal_slot;
+  if (!slot ||
+      slot->sample_state.load(std::memory_order_acquire) != SAMPLE_REQUESTED) {
+    return;
+  }
+  int saved_errno = errno;
+  // backtrace() is not async-signal-safe: its first call loads libgcc_s
+  // with dlopen() and malloc()s. Start() makes that first call, which is
+  // the only thing making this one acceptable; later calls just unwind.
+  slot->num_frames = backtrace(slot->frames, kMaxFrames);
+  errno = saved_errno;
+  slot->sample_state.store(SAMPLE_DONE, std::memory_order_release);
+}
+
+Slot *AcquireSlot() {
+  Registry *registry = GetRegistry();
+  MutexLock lock(&registry->mutex);
+  Slot *slot = nullptr;
+  for (auto &candidate : registry->slots) {
+    if (!candidate->in_use) {
+      slot = candidate.get();
+      break;
+    }
+  }
+  if (!slot) {
+    registry->slots.emplace_back(new Slot());
+    slot = registry->slots.back().get();
+  }
+  slot->in_use = true;
+  slot->thread = pthread_self();
+  slot->tid = static_cast<int>(syscall(SYS_gettid));
+  slot->start_ns.store(0, std::memory_order_relaxed);
+  slot->sample_state.store(SAMPLE_NONE, std::memory_order_relaxed);
+  signal_slot = slot;
+  return slot;
+}
+
+struct ThreadSlot {
+  ~ThreadSlot() {
+    if (slot) {
+      signal_slot = nullptr;
+      MutexLock lock(&GetRegistry()->mutex);
+      slot->in_use = false;
+    }
+  }
+
+  Slot *slot = nullptr;
+};
+
+thread_local ThreadSlot thread_slot;
+
+// Polls the loops at a quarter of the budget and interrupts the ones stuck
+// in a callback for longer than the budget, once per callback.
+class Monitor : public Thread {
+ public:
+  explicit Monitor(int64_t poll_us) : poll_us_(poll_us), stop_(false) {
+    StartThread();
+  }
+
+  ~Monitor() {
+    stop_.store(true, std::memory_order_relaxed);
+    StopThread();
+  }
+
+ private:
+  void ThreadEntry() override {
+    while (!stop_.load(std::memory_order_relaxed)) {
+      usleep(poll_us_);
+      Scan();
+    }
+  }
+
+  void Scan() {
+    Registry *registry = GetRegistry();
+    int64_t now = NowNanos();
+    int64_t budget_ns = registry->budget_ns.load(std::memory_order_relaxed);
+    MutexLock lock(&registry->mutex);
+    if (!registry->capture_stacks) {
+      return;
+    }
+    for (auto &slot : registry->slots) {
+      if (!slot->in_use) {
+        continue;
+      }
+      uint64_t seq = slot->seq.load(std::memory_order_acquire);
+      int64_t start = slot->start_ns.load(std::memory_order_relaxed);
+      if (!start || now - start <= budget_ns ||
+          slot->sampled_seq.load(std::memory_order_relaxed) == seq ||
+          slot->sample_state.load(std::memory_order_acquire) !=
+              SAMPLE_NONE) {
+        continue;
+      }
+      // If the callback ends meanwhile, the sample lands in a later one
+      // and is discarded for its sequence number.
+      slot->sampled_seq.store(seq, std::memory_order_relaxed);
+      slot->sample_state.store(SAMPLE_REQUESTED, std::memory_order_release);
+      pthread_kill(slot->thread, SampleSignal());
+    }
+  }
+
+  const int64_t poll_us_;
+  std::atomic<bool> stop_;
+};
+
+}  // namespace
+
+std::atomic<bool> LoopWatchdog::enabled_(false);
+
+LoopWatchdog::Options::Options()
+    : budget_ms(20), capture_stacks(false), max_reports(256) {}
+
+std::string LoopWatchdog::Report::ToString() const {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "slow callback: %.3f ms on tid %d, watcher %p fd %d events %d\n",
+           duration_ns / 1e6, tid, watcher, fd, events);
+  std::string out = line;
+  for (size_t i = 0; i < stack.size(); ++i) {
+    snprintf(line, sizeof(line), "  #%zu %s\n", i, stack[i].c_str());
+    out += line;
+  }
+  return out;
+}
+
+void LoopWatchdog::Start(const Options &options) {
+  CHECK_LT(0, options.budget_ms);
+  Registry *registry = GetRegistry();
+  MutexLock start_lock(&registry->start_mutex);
+  std::unique_ptr<Monitor> old_monitor;
+  {
+    MutexLock lock(&registry->mutex);
+    registry->budget_ns.store(options.budget_ms * 1000000,
+                              std::memory_order_relaxed);
+    registry->max_reports = options.max_reports;
+    registry->capture_stacks = options.capture_stacks;
+    old_monitor = std::move(registry->monitor);
+  }
+  old_monitor.reset();
+  if (options.capture_stacks) {
+    // Loads the unwinder now, the signal handler must not be the first
+    // to call backtrace(). Keep this, see OnSampleSignal().
+    void *frame;
+    backtrace(&frame, 1);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSampleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SampleSignal(), &action, nullptr);
+  }
+  int64_t poll_us = std::max<int64_t>(options.budget_ms * 1000 / 4, 1000);
+  std::unique_ptr<Monitor> monitor(new Monitor(poll_us));
+  {
+    MutexLock lock(&registry->mutex);
+    registry->monitor = std::move(monitor);
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void LoopWatchdog::Stop() {
+  Registry *registry = GetRegistry();
+  MutexLock start_lock(&registry->start_mutex);
+  enabled_.store(false, std::memory_order_relaxed);
+  std::unique_ptr<Monitor> monitor;
+  {
+    MutexLock lock(&registry->mutex);
+    monitor = std::move(registry->monitor);
+  }
+  // The handler stays installed, a signal may still be on its way.
+}
+
+void LoopWatchdog::BeginCallback(int64_t start_ns, int fd, int events,
+                                 const void *watcher) {
+  Slot *slot = thread_slot.slot;
+  if (!slot) {
+    slot = thread_slot.slot = AcquireSlot();
+  }
+  slot->fd = fd;
+  slot->events = events;
+  slot->watcher = watcher;
+  slot->start_ns.store(start_ns, std::memory_order_relaxed);
+  slot->seq.store(slot->seq.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+}
+
+void LoopWatchdog::EndCallback(int64_t end_ns) {
+  Slot *slot = thread_slot.slot;
+  if (!slot) {
+    return;
+  }
+  int64_t start_ns = slot->start_ns.load(std::memory_order_relaxed);
+  slot->start_ns.store(0, std::memory_order_relaxed);
+  Registry *registry = GetRegistry();
+  bool sampled = false;
+  if (slot->sample_state.load(std::memory_order_acquire) == SAMPLE_DONE) {
+    sampled = slot->sampled_seq.load(std::memory_order_relaxed) ==
+              slot->seq.load(std::memory_order_relaxed);
+    if (!sampled) {
+      slot->sample_state.store(SAMPLE_NONE, std::memory_order_release);
+    }
+  }
+  int64_t budget_ns = registry->budget_ns.load(std::memory_order_relaxed);
+  if (!start_ns || end_ns - start_ns <= budget_ns) {
+    if (sampled) {
+      slot->sample_state.store(SAMPLE_NONE, std::memory_order_release);
+    }
+    return;
+  }
+
+  Report report;
+  report.start_ns = start_ns;
+  report.duration_ns = end_ns - start_ns;
+  report.tid = slot->tid;
+  report.watcher = slot->watcher;
+  report.fd = slot->fd;
+  report.events = slot->events;
+  if (sampled) {
+    int count = slot->num_frames - kHandlerFrames;
+    char **symbols = count > 0
+                         ? backtrace_symbols(slot->frames + kHandlerFrames,
+                                             count)
+                         : nullptr;
+    for (int i = 0; symbols && i < count; ++i) {
+      report.stack.push_back(symbols[i]);
+    }
+    free(symbols);
+    slot->sample_state.store(SAMPLE_NONE, std::memory_order_release);
+  }
+  Metrics::Add(Metrics::LOOP_SLOW_CALLBACKS, 1);
+
+  int64_t count;
+  {
+    MutexLock lock(&registry->mutex);
+    count = ++registry->slow_count;
+    registry->reports.push_back(report);
+    while (registry->reports.size() > registry->max_reports) {
+      registry->reports.pop_front();
+    }
+  }
+  if ((count & (count - 1)) == 0) {
+    LOG_ERROR("callback of watcher %p on fd %d blocked its loop for %.3f "
+              "ms, %ld slow callbacks so far",
+              report.watcher, report.fd, report.duration_ns / 1e6,
+              static_cast<long>(count));
+  }
+}
+
+std::vector<LoopWatchdog::Report> LoopWatchdog::GetReports() {
+  Registry *registry = GetRegistry();
+  MutexLock lock(&registry->mutex);
+  return std::vector<Report>(registry->reports.begin(),
+                             registry->reports.end());
+}
+
+int64_t LoopWatchdog::slow_callbacks() {
+  Registry *registry = GetRegistry();
+  MutexLock lock(&registry->mutex);
+  return registry->slow_count;
+}
+
+void LoopWatchdog::ClearReports() {
+  Registry *registry = GetRegistry();
+  MutexLock lock(&registry->mutex);
+  registry->reports.clear();
+}
+
+}  // namespace dlock
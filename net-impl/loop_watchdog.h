@@ -0,0 +1,76 @@
+#ifndef DLOCK_NET_LOOP_WATCHDOG_H_
+#define DLOCK_NET_LOOP_WATCHDOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace dlock {
+
+// Finds the callbacks that stall an event loop. EventPump times every
+// OnFdEvents() and batch of tasks it dispatches and reports the ones over
+// the budget, with the watcher and fd. A monitor thread also looks at the
+// loops while they are still stuck and, if asked to, samples the stack of
+// the loop thread with a signal, which shows where the callback blocks.
+class LoopWatchdog {
+ public:
+  struct Options {
+    Options();
+    // Callbacks running longer than this are reported.
+    int64_t budget_ms;
+    // Debugging only, off by default: interrupts a loop thread that is
+    // over budget to capture its stack. Uses SIGRTMIN + 3, installed with
+    // SA_RESTART, which still cuts short sleeps and non-restartable calls
+    // in the callback, and runs backtrace() in the handler, which is not
+    // async-signal-safe.
+    bool capture_stacks;
+    // Reports kept for GetReports(); older ones are dropped.
+    size_t max_reports;
+  };
+
+  struct Report {
+    // CLOCK_MONOTONIC nanoseconds.
+    int64_t start_ns;
+    int64_t duration_ns;
+    // Kernel thread id of the loop.
+    int tid;
+    // The watcher's address and the fd and READ/WRITE bits it was called
+    // for, or nullptr and -1 for a batch of tasks.
+    const void *watcher;
+    int fd;
+    int events;
+    // Symbolized frames of the loop thread, sampled while the callback was
+    // over budget, innermost first. Empty if no sample was taken.
+    std::vector<std::string> stack;
+
+    std::string ToString() const;
+  };
+
+  // Starts the monitor thread. Loops pick the options up with their next
+  // dispatch.
+  static void Start(const Options &options);
+  // Stops the monitor thread and the timing. Reports are kept.
+  static void Stop();
+  static bool enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Called by the loop around each dispatch, only if enabled().
+  static void BeginCallback(int64_t start_ns, int fd, int events,
+                            const void *watcher);
+  static void EndCallback(int64_t end_ns);
+
+  static std::vector<Report> GetReports();
+  // Slow callbacks seen since the process started, including dropped ones.
+  static int64_t slow_callbacks();
+  static void ClearReports();
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,73 @@
+#include "net/loop_watchdog.h"
+#include <time.h>
+#include <vector>
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+static int64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Stands in for a handler that blocks its loop without sleeping, so the
+// sample signal does not cut it short.
+static void SpinFor(int64_t nanos) {
+  int64_t end = NowNanos() + nanos;
+  while (NowNanos() < end) {
+  }
+}
+
+UNITTEST_DEFINITION(LoopWatchdogTest);
+
+TEST(LoopWatchdogTest, TestReportsOverBudget) {
+  LoopWatchdog::Options options;
+  options.budget_ms = 5;
+  options.capture_stacks = false;
+  LoopWatchdog::Start(options);
+  LoopWatchdog::ClearReports();
+  int64_t before = LoopWatchdog::slow_callbacks();
+  int watcher = 0;
+
+  int64_t now = NowNanos();
+  LoopWatchdog::BeginCallback(now, 7, 1, &watcher);
+  LoopWatchdog::EndCallback(now + 1000000);
+  CHECK_EQ(LoopWatchdog::slow_callbacks(), before);
+
+  LoopWatchdog::BeginCallback(now, 9, 2, &watcher);
+  LoopWatchdog::EndCallback(now + 8000000);
+  LoopWatchdog::Stop();
+
+  std::vector<LoopWatchdog::Report> reports = LoopWatchdog::GetReports();
+  CHECK_EQ(reports.size(), 1u);
+  CHECK_EQ(reports[0].fd, 9);
+  CHECK_EQ(reports[0].events, 2);
+  CHECK_EQ(reports[0].watcher, &watcher);
+  CHECK_EQ(reports[0].duration_ns, 8000000);
+  CHECK_EQ(true, reports[0].stack.empty());
+  CHECK_EQ(LoopWatchdog::slow_callbacks(), before + 1);
+}
+
+TEST(LoopWatchdogTest, TestSamplesStuckThread) {
+  LoopWatchdog::Options options;
+  options.budget_ms = 5;
+  LoopWatchdog::Start(options);
+  LoopWatchdog::ClearReports();
+  LoopWatchdog::BeginCallback(NowNanos(), 3, 1, nullptr);
+  SpinFor(100 * 1000000);
+  LoopWatchdog::EndCallback(NowNanos());
+  LoopWatchdog::Stop();
+
+  std::vector<LoopWatchdog::Report> reports = LoopWatchdog::GetReports();
+  CHECK_EQ(reports.size(), 1u);
+  CHECK_EQ(reports[0].fd, 3);
+  CHECK_EQ(false, reports[0].stack.empty());
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(LoopWatchdogTest)
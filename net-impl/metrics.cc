@@ -0,0 +1,186 @@
+#include "net/metrics.h"
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "base/sync.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+namespace {
+
+const char *const kCounterNames[] = {
+    "loop_wakeups",
+    "loop_events",
+    "loop_tasks",
+    "loop_wait_nanos",
+    "loop_busy_nanos",
+    "loop_wakeup_writes",
+    "loop_slow_callbacks",
+    "reactor_wait_calls",
+    "reactor_ctl_calls",
+    "socket_read_calls",
+    "socket_write_calls",
+    "socket_bytes_read",
+    "socket_bytes_written",
+    "socket_would_block",
+    "server_accepts",
+    "server_accept_queue_full",
+    "server_accept_errors",
+};
+static_assert(sizeof(kCounterNames) / sizeof(kCounterNames[0]) ==
+                  Metrics::NUM_COUNTERS,
+              "a counter has no name");
+
+const char *const kHistogramNames[] = {
+    "events_per_wakeup",
+    "task_queue_delay_nanos",
+};
+static_assert(sizeof(kHistogramNames) / sizeof(kHistogramNames[0]) ==
+                  Metrics::NUM_HISTOGRAMS,
+              "a histogram has no name");
+
+class ThreadMetrics;
+
+struct Registry {
+  Registry() {
+    for (int i = 0; i < Metrics::NUM_COUNTERS; ++i) {
+      exited_counters[i] = 0;
+    }
+  }
+
+  Mutex mutex;
+  std::vector<ThreadMetrics *> threads;
+  // What threads that exited recorded.
+  int64_t exited_counters[Metrics::NUM_COUNTERS];
+  Histogram exited_histograms[Metrics::NUM_HISTOGRAMS];
+};
+
+Registry *GetRegistry() {
+  // Leaked, threads may exit after static destructors ran.
+  static Registry *registry = new Registry();
+  return registry;
+}
+
+class ThreadMetrics {
+ public:
+  ThreadMetrics() {
+    for (int i = 0; i < Metrics::NUM_COUNTERS; ++i) {
+      counters_[i].store(0, std::memory_order_relaxed);
+    }
+    Registry *registry = GetRegistry();
+    MutexLock lock(&registry->mutex);
+    registry->threads.push_back(this);
+  }
+
+  ~ThreadMetrics() {
+    Registry *registry = GetRegistry();
+    MutexLock lock(&registry->mutex);
+    registry->threads.erase(std::find(registry->threads.begin(),
+                                      registry->threads.end(), this));
+    MergeInto(registry->exited_counters, registry->exited_histograms);
+  }
+
+  void Add(int counter, int64_t delta) {
+    // Written by this thread only, so no read-modify-write is needed.
+    counters_[counter].store(
+        counters_[counter].load(std::memory_order_relaxed) + delta,
+        std::memory_order_relaxed);
+  }
+
+  void Record(int histogram, int64_t value) {
+    MutexLock lock(&mutex_);
+    histograms_[histogram].Record(value);
+  }
+
+  void MergeInto(int64_t *counters, Histogram *histograms) {
+    for (int i = 0; i < Metrics::NUM_COUNTERS; ++i) {
+      counters[i] += counters_[i].load(std::memory_order_relaxed);
+    }
+    MutexLock lock(&mutex_);
+    for (int i = 0; i < Metrics::NUM_HISTOGRAMS; ++i) {
+      histograms[i].Merge(histograms_[i]);
+    }
+  }
+
+ private:
+  std::atomic<int64_t> counters_[Metrics::NUM_COUNTERS];
+  Mutex mutex_;
+  Histogram histograms_[Metrics::NUM_HISTOGRAMS];
+};
+
+thread_local ThreadMetrics thread_metrics;
+
+}  // namespace
+
+Metrics::Snapshot::Snapshot() {
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    counters[i] = 0;
+  }
+}
+
+double Metrics::Snapshot::LoopUtilization() const {
+  int64_t busy = counters[LOOP_BUSY_NANOS];
+  int64_t total = busy + counters[LOOP_WAIT_NANOS];
+  return total ? static_cast<double>(busy) / total : 0;
+}
+
+std::string Metrics::Snapshot::ToString() const {
+  std::string out;
+  char line[256];
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    snprintf(line, sizeof(line), "%s %ld\n", kCounterNames[i], counters[i]);
+    out += line;
+  }
+  snprintf(line, sizeof(line), "loop_utilization %.3f\n", LoopUtilization());
+  out += line;
+  for (int i = 0; i < NUM_HISTOGRAMS; ++i) {
+    out += kHistogramNames[i];
+    out += ' ';
+    out += histograms[i].ToString();
+    out += '\n';
+  }
+  return out;
+}
+
+void Metrics::Add(Counter counter, int64_t delta) {
+  thread_metrics.Add(counter, delta);
+}
+
+void Metrics::Record(HistogramId histogram, int64_t value) {
+  thread_metrics.Record(histogram, value);
+}
+
+Metrics::Snapshot Metrics::GetSnapshot() {
+  Registry *registry = GetRegistry();
+  Snapshot snapshot;
+  MutexLock lock(&registry->mutex);
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    snapshot.counters[i] = registry->exited_counters[i];
+  }
+  for (int i = 0; i < NUM_HISTOGRAMS; ++i) {
+    snapshot.histograms[i].Merge(registry->exited_histograms[i]);
+  }
+  for (auto thread : registry->threads) {
+    thread->MergeInto(snapshot.counters, snapshot.histograms);
+  }
+  return snapshot;
+}
+
+std::string Metrics::Dump() { return GetSnapshot().ToString(); }
+
+const char *Metrics::CounterName(Counter counter) {
+  CHECK_GE(counter, 0);
+  CHECK_LT(counter, NUM_COUNTERS);
+  return kCounterNames[counter];
+}
+
+const char *Metrics::HistogramName(HistogramId histogram) {
+  CHECK_GE(histogram, 0);
+  CHECK_LT(histogram, NUM_HISTOGRAMS);
+  return kHistogramNames[histogram];
+}
+
+}  // namespace dlock
@@ -0,0 +1,77 @@
+#ifndef DLOCK_NET_METRICS_H_
+#define DLOCK_NET_METRICS_H_
+
+#include <stdint.h>
+#include <string>
+#include "net/histogram.h"
+
+namespace dlock {
+
+// Process-wide counters and histograms of the event loops, reactors and
+// sockets. Each thread updates its own copy, counters with a plain relaxed
+// store and histograms under a mutex only a snapshot contends for, and
+// GetSnapshot() merges them, including what exited threads left behind.
+class Metrics {
+ public:
+  enum Counter {
+    // Returns from the reactor wait, and the fd events they reported.
+    LOOP_WAKEUPS,
+    LOOP_EVENTS,
+    LOOP_TASKS,
+    // Loop time spent blocked in the reactor, and on everything else.
+    LOOP_WAIT_NANOS,
+    LOOP_BUSY_NANOS,
+    // eventfd writes to wake up a loop for a posted task.
+    LOOP_WAKEUP_WRITES,
+    // Callbacks over the LoopWatchdog budget.
+    LOOP_SLOW_CALLBACKS,
+    REACTOR_WAIT_CALLS,
+    REACTOR_CTL_CALLS,
+    // read()/send() style syscalls on connected sockets, the bytes they
+    // moved and the ones that found the socket not ready.
+    SOCKET_READ_CALLS,
+    SOCKET_WRITE_CALLS,
+    SOCKET_BYTES_READ,
+    SOCKET_BYTES_WRITTEN,
+    SOCKET_WOULD_BLOCK,
+    SERVER_ACCEPTS,
+    SERVER_ACCEPT_QUEUE_FULL,
+    SERVER_ACCEPT_ERRORS,
+    NUM_COUNTERS,
+  };
+
+  enum HistogramId {
+    // Fd events per reactor wakeup.
+    EVENTS_PER_WAKEUP,
+    // How long the oldest task of a batch waited in the queue of its loop.
+    TASK_QUEUE_DELAY_NANOS,
+    NUM_HISTOGRAMS,
+  };
+
+  struct Snapshot {
+    Snapshot();
+
+    // Share of loop time not spent waiting for events, from 0 to 1.
+    double LoopUtilization() const;
+    // One "name value" line per counter and one "name count=.. p50=.."
+    // line per histogram.
+    std::string ToString() const;
+
+    int64_t counters[NUM_COUNTERS];
+    Histogram histograms[NUM_HISTOGRAMS];
+  };
+
+  static void Add(Counter counter, int64_t delta);
+  static void Record(HistogramId histogram, int64_t value);
+
+  // Counters are monotonic, so rates are differences of two snapshots.
+  static Snapshot GetSnapshot();
+  static std::string Dump();
+
+  static const char *CounterName(Counter counter);
+  static const char *HistogramName(HistogramId histogram);
+};
+
+}  // namespace dlock
+
+#endif
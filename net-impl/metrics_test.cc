@@ -0,0 +1,55 @@
+#include "net/metrics.h"
+#include <string>
+#include <thread>
+#include <vector>
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(MetricsTest);
+
+TEST(MetricsTest, TestMergesThreads) {
+  Metrics::Snapshot before = Metrics::GetSnapshot();
+  Metrics::Add(Metrics::LOOP_TASKS, 5);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([]() {
+      for (int j = 0; j < 1000; ++j) {
+        Metrics::Add(Metrics::LOOP_TASKS, 1);
+        Metrics::Record(Metrics::EVENTS_PER_WAKEUP, 3);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // The threads exited, their counts must survive them.
+  Metrics::Snapshot after = Metrics::GetSnapshot();
+  CHECK_EQ(after.counters[Metrics::LOOP_TASKS] -
+               before.counters[Metrics::LOOP_TASKS],
+           4005);
+  const Histogram& events = after.histograms[Metrics::EVENTS_PER_WAKEUP];
+  CHECK_EQ(events.count() -
+               before.histograms[Metrics::EVENTS_PER_WAKEUP].count(),
+           4000);
+  CHECK_EQ(events.Percentile(50), 3);
+}
+
+TEST(MetricsTest, TestDump) {
+  Metrics::Add(Metrics::LOOP_BUSY_NANOS, 300);
+  Metrics::Add(Metrics::LOOP_WAIT_NANOS, 100);
+  Metrics::Snapshot snapshot = Metrics::GetSnapshot();
+  CHECK_LT(0, snapshot.LoopUtilization());
+  std::string dump = snapshot.ToString();
+  CHECK_NE(std::string::npos, dump.find("loop_busy_nanos 300\n"));
+  CHECK_NE(std::string::npos, dump.find("events_per_wakeup count="));
+  CHECK_EQ(std::string("server_accepts"),
+           Metrics::CounterName(Metrics::SERVER_ACCEPTS));
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(MetricsTest)
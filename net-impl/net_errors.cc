@@ -0,0 +1,78 @@
+#include "net/net_errors.h"
+#include <errno.h>
+
+namespace dlock {
+
+int MapSystemError(int os_error) {
+  switch (os_error) {
+    case 0:
+      return OK;
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+    case EINPROGRESS:
+      return ERR_IO_PENDING;
+    case ECONNRESET:
+    case EPIPE:
+      return ERR_CONNECTION_RESET;
+    case ECONNREFUSED:
+      return ERR_CONNECTION_REFUSED;
+    case ETIMEDOUT:
+      return ERR_CONNECTION_TIMED_OUT;
+    case EADDRINUSE:
+      return ERR_ADDRESS_IN_USE;
+    case EHOSTUNREACH:
+    case ENETUNREACH:
+      return ERR_ADDRESS_UNREACHABLE;
+    case ENOTCONN:
+      return ERR_SOCKET_NOT_CONNECTED;
+    case EINVAL:
+      return ERR_INVALID_ARGUMENT;
+    case ECONNABORTED:
+      return ERR_CONNECTION_ABORTED;
+    default:
+      return ERR_FAILED;
+  }
+}
+
+const char *ErrorToString(int error) {
+  switch (error) {
+    case OK:
+      return "OK";
+    case ERR_FAILED:
+      return "ERR_FAILED";
+    case ERR_IO_PENDING:
+      return "ERR_IO_PENDING";
+    case ERR_CONNECTION_CLOSED:
+      return "ERR_CONNECTION_CLOSED";
+    case ERR_CONNECTION_RESET:
+      return "ERR_CONNECTION_RESET";
+    case ERR_CONNECTION_REFUSED:
+      return "ERR_CONNECTION_REFUSED";
+    case ERR_CONNECTION_TIMED_OUT:
+      return "ERR_CONNECTION_TIMED_OUT";
+    case ERR_ADDRESS_IN_USE:
+      return "ERR_ADDRESS_IN_USE";
+    case ERR_ADDRESS_UNREACHABLE:
+      return "ERR_ADDRESS_UNREACHABLE";
+    case ERR_SOCKET_NOT_CONNECTED:
+      return "ERR_SOCKET_NOT_CONNECTED";
+    case ERR_INVALID_ARGUMENT:
+      return "ERR_INVALID_ARGUMENT";
+    case ERR_CONNECTION_ABORTED:
+      return "ERR_CONNECTION_ABORTED";
+    case ERR_FRAME_TOO_LARGE:
+      return "ERR_FRAME_TOO_LARGE";
+    case ERR_FRAME_CORRUPTED:
+      return "ERR_FRAME_CORRUPTED";
+    case ERR_TIMED_OUT:
+      return "ERR_TIMED_OUT";
+    case ERR_ABORTED:
+      return "ERR_ABORTED";
+    default:
+      return error > 0 ? "OK" : "ERR_UNKNOWN";
+  }
+}
+
+}  // namespace dlock
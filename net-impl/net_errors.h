@@ -0,0 +1,47 @@
+#ifndef DLOCK_NET_NET_ERRORS_H_
+#define DLOCK_NET_NET_ERRORS_H_
+
+#include <functional>
+
+namespace dlock {
+
+// Results of network operations. OK and ERR_FAILED keep the 0/-1 meaning
+// of the synchronous calls; the others are more specific failures. Reads
+// and writes return a byte count (>= 0) on success.
+enum NetError {
+  OK = 0,
+  ERR_FAILED = -1,
+  // The operation could not complete right away, its callback runs later.
+  ERR_IO_PENDING = -2,
+  ERR_CONNECTION_CLOSED = -3,
+  ERR_CONNECTION_RESET = -4,
+  ERR_CONNECTION_REFUSED = -5,
+  ERR_CONNECTION_TIMED_OUT = -6,
+  ERR_ADDRESS_IN_USE = -7,
+  ERR_ADDRESS_UNREACHABLE = -8,
+  ERR_SOCKET_NOT_CONNECTED = -9,
+  ERR_INVALID_ARGUMENT = -10,
+  ERR_CONNECTION_ABORTED = -11,
+  // A frame declared a length beyond the configured maximum.
+  ERR_FRAME_TOO_LARGE = -12,
+  // A frame header could not be parsed or its checksum did not match.
+  ERR_FRAME_CORRUPTED = -13,
+  // An operation did not complete before a deadline its caller set, e.g.
+  // an RPC or a lock wait. Unlike ERR_CONNECTION_TIMED_OUT, which reports
+  // a connection the kernel or a connect deadline gave up on, the
+  // connection stays usable.
+  ERR_TIMED_OUT = -14,
+  // An operation was cancelled by its caller.
+  ERR_ABORTED = -15,
+};
+
+// Receives the result of an operation that returned ERR_IO_PENDING.
+typedef std::function<void(int)> CompletionCallback;
+
+// Maps an errno value to a NetError. EAGAIN maps to ERR_IO_PENDING.
+int MapSystemError(int os_error);
+const char *ErrorToString(int error);
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,209 @@
+#include "net/reactor.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "net/epoll_reactor.h"
+#include "net/uring_reactor.h"
+#include "util/logging.h"
+
+namespace dlock {
+
+const int Reactor::kSlotsPerChunkShift = 10;
+const int Reactor::kSlotsPerChunk = 1 << kSlotsPerChunkShift;
+const uint32_t Reactor::kGenerationMask = 0x7fffffff;
+
+static int MaxOpenFiles() {
+  // Keeps the chunk directory small when the hard limit is unbounded.
+  const rlim_t kFdLimit = 1 << 24;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+      limit.rlim_max == RLIM_INFINITY || limit.rlim_max > kFdLimit) {
+    return kFdLimit;
+  }
+  return static_cast<int>(limit.rlim_max);
+}
+
+std::unique_ptr<Reactor> Reactor::Create(ReactorType type) {
+  if (type == IO_URING_REACTOR) {
+#ifndef DLOCK_NO_IO_URING
+    std::unique_ptr<Reactor> reactor = UringReactor::Create();
+    if (reactor) {
+      return reactor;
+    }
+#endif
+    LOG_ERROR("io_uring is not available, falling back to epoll");
+  }
+  return std::make_unique<EpollReactor>();
+}
+
+Reactor::Reactor()
+    : max_chunks_((MaxOpenFiles() >> kSlotsPerChunkShift) + 1),
+      chunks_(new std::atomic<Slot *>[max_chunks_]) {
+  for (int i = 0; i < max_chunks_; ++i) {
+    chunks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+Reactor::~Reactor() {
+  for (int i = 0; i < max_chunks_; ++i) {
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+  }
+}
+
+void Reactor::WatchFd(int fd, EventType event, FdWatcher *watcher) {
+  Slot *slot = GetOrCreateSlot(fd);
+  unsigned char interest = slot->interest.load(std::memory_order_relaxed);
+  if (interest) {
+    CHECK(slot->watcher.load(std::memory_order_relaxed) == watcher);
+  } else {
+    slot->watcher.store(watcher, std::memory_order_release);
+  }
+  slot->interest.store(interest | static_cast<unsigned char>(event),
+                       std::memory_order_relaxed);
+  MarkDirty(fd, slot);
+}
+
+bool Reactor::UnWatchFd(int fd, EventType event) {
+  Slot *slot = FindSlot(fd);
+  if (!slot) {
+    return false;
+  }
+  unsigned char interest = slot->interest.load(std::memory_order_relaxed);
+  if (!interest) {
+    return false;
+  }
+
+  interest &= ~static_cast<unsigned char>(event);
+  slot->interest.store(interest, std::memory_order_relaxed);
+  MarkDirty(fd, slot);
+  if (interest) {
+    return false;
+  }
+
+  slot->watcher.store(nullptr, std::memory_order_relaxed);
+  uint32_t generation = slot->generation.load(std::memory_order_relaxed);
+  slot->generation.store((generation + 1) & kGenerationMask,
+                         std::memory_order_release);
+  slot->stale_tag = true;
+  return true;
+}
+
+bool Reactor::IsWatched(int fd, EventType event) const {
+  Slot *slot = FindSlot(fd);
+  if (!slot) {
+    return false;
+  }
+  return (slot->interest.load(std::memory_order_relaxed) & event) == event;
+}
+
+FdWatcher *Reactor::GetWatcher(int fd) const {
+  Slot *slot = FindSlot(fd);
+  if (!slot) {
+    return nullptr;
+  }
+  return slot->watcher.load(std::memory_order_relaxed);
+}
+
+void Reactor::FlushChanges() {
+  for (int fd : dirty_) {
+    Slot *slot = FindSlot(fd);
+    slot->dirty = false;
+    unsigned char interest = slot->interest.load(std::memory_order_relaxed);
+    if (interest != slot->registered || (interest && slot->stale_tag)) {
+      slot->registered = ApplyChange(fd, *slot) ? interest : 0;
+    }
+    // Otherwise the changes cancelled out.
+    slot->stale_tag = false;
+  }
+  dirty_.clear();
+  CommitChanges();
+}
+
+uint64_t Reactor::Tag(int fd, const Slot &slot) {
+  return (static_cast<uint64_t>(
+              slot.generation.load(std::memory_order_relaxed))
+          << 32) |
+         static_cast<uint32_t>(fd);
+}
+
+const Reactor::Slot *Reactor::Resolve(uint64_t tag, int *fd,
+                                      FdWatcher **watcher) const {
+  int tagged_fd = static_cast<int>(tag & 0xffffffff);
+  uint32_t generation = static_cast<uint32_t>(tag >> 32);
+  const Slot *slot = FindSlot(tagged_fd);
+  if (!slot ||
+      slot->generation.load(std::memory_order_acquire) != generation) {
+    return nullptr;
+  }
+  *watcher = slot->watcher.load(std::memory_order_acquire);
+  if (!*watcher) {
+    return nullptr;
+  }
+  *fd = tagged_fd;
+  return slot;
+}
+
+int Reactor::ToEventMask(uint32_t poll_events, const Slot &slot) {
+  // The poll(2) and epoll(7) bits have the same values.
+  int mask = 0;
+  if (poll_events & (EPOLLIN | EPOLLPRI)) {
+    mask |= READ;
+  }
+  if (poll_events & EPOLLOUT) {
+    mask |= WRITE;
+  }
+  if (poll_events & EPOLLRDHUP) {
+    mask |= PEER_CLOSED;
+  }
+  if (poll_events & EPOLLHUP) {
+    mask |= HANG_UP;
+  }
+  if (poll_events & EPOLLERR) {
+    mask |= IO_ERROR;
+  }
+  if (mask & (HANG_UP | IO_ERROR)) {
+    // Let whichever side is waiting run into the error.
+    mask |= slot.interest.load(std::memory_order_relaxed) & RDWR;
+  }
+  return mask;
+}
+
+Reactor::Slot *Reactor::FindSlot(int fd) const {
+  if (fd < 0 || (fd >> kSlotsPerChunkShift) >= max_chunks_) {
+    return nullptr;
+  }
+  Slot *chunk =
+      chunks_[fd >> kSlotsPerChunkShift].load(std::memory_order_acquire);
+  if (!chunk) {
+    return nullptr;
+  }
+  return &chunk[fd & (kSlotsPerChunk - 1)];
+}
+
+Reactor::Slot *Reactor::GetOrCreateSlot(int fd) {
+  CHECK_GE(fd, 0);
+  CHECK_LT(fd >> kSlotsPerChunkShift, max_chunks_);
+  std::atomic<Slot *> &chunk = chunks_[fd >> kSlotsPerChunkShift];
+  Slot *slots = chunk.load(std::memory_order_relaxed);
+  if (!slots) {
+    slots = new Slot[kSlotsPerChunk];
+    for (int i = 0; i < kSlotsPerChunk; ++i) {
+      slots[i].generation.store(0, std::memory_order_relaxed);
+      slots[i].interest.store(0, std::memory_order_relaxed);
+      slots[i].registered = 0;
+      slots[i].dirty = false;
+      slots[i].stale_tag = false;
+      slots[i].watcher.store(nullptr, std::memory_order_relaxed);
+    }
+    chunk.store(slots, std::memory_order_release);
+  }
+  return &slots[fd & (kSlotsPerChunk - 1)];
+}
+
+void Reactor::MarkDirty(int fd, Slot *slot) {
+  if (!slot->dirty) {
+    slot->dirty = true;
+    dirty_.push_back(fd);
+  }
+}
+
+}  // namespace dlock
@@ -0,0 +1,112 @@
+#ifndef DLOCK_NET_REACTOR_H_
+#define DLOCK_NET_REACTOR_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "base/noncopyable.h"
+#include "net/event_type.h"
+
+namespace dlock {
+
+class FdWatcher;
+
+enum ReactorType {
+  EPOLL_REACTOR,
+  IO_URING_REACTOR,
+};
+
+// Readiness notification backend of an EventPump. The base class keeps the
+// per-fd interest and watcher; the backends turn the recorded changes into
+// kernel registrations and report ready fds.
+//
+// WatchFd() and UnWatchFd() only record the new interest; the kernel is
+// told by FlushChanges(), which collapses all changes of a fd since the
+// last flush into at most one operation.
+//
+// WatchFd(), UnWatchFd(), IsWatched(), GetWatcher() and FlushChanges() must
+// be serialized by the caller. WaitReady() and ReadyAt() belong to the loop
+// thread and may run concurrently with them.
+class Reactor {
+ public:
+  // Returns a reactor of |type|, or an epoll one if |type| is not
+  // supported by the running kernel.
+  static std::unique_ptr<Reactor> Create(ReactorType type);
+
+  Reactor();
+  virtual ~Reactor();
+
+  // |watcher| receives all events of |fd| until the fd is fully unwatched.
+  void WatchFd(int fd, EventType event, FdWatcher *watcher);
+  // Returns true if |fd| has no watched event left.
+  bool UnWatchFd(int fd, EventType event);
+  bool IsWatched(int fd, EventType event) const;
+  FdWatcher *GetWatcher(int fd) const;
+  // Applies the interest changes recorded since the last flush.
+  void FlushChanges();
+
+  // Blocks up to |timeout_ms| (-1 for ever) and returns the number of ready
+  // fds, which are then read with ReadyAt().
+  virtual int WaitReady(int timeout_ms) = 0;
+  // Fills |fd| and the combined |events| mask of the |index|th ready fd and
+  // returns its watcher, or nullptr if the fd has been unwatched since.
+  virtual FdWatcher *ReadyAt(int index, int *fd, int *events) const = 0;
+
+  virtual ReactorType type() const = 0;
+
+ protected:
+  // Per-fd state, indexed by the fd itself. |generation| is bumped every
+  // time the fd is fully unwatched and is stored with the fd in the tag
+  // the backend hands to the kernel, so an event that was harvested before
+  // the fd got unwatched, or closed and reused, no longer matches its slot.
+  // |registered| is the interest the kernel knows about, which lags behind
+  // |interest| until the next flush.
+  struct Slot {
+    std::atomic<uint32_t> generation;
+    std::atomic<unsigned char> interest;
+    unsigned char registered;
+    bool dirty;
+    // The generation changed since |registered| was last applied.
+    bool stale_tag;
+    std::atomic<FdWatcher *> watcher;
+  };
+
+  // Tells the kernel about the new interest of |fd|, called for fds whose
+  // interest or tag differs from |slot.registered|. Returns false if the
+  // fd could not be registered.
+  virtual bool ApplyChange(int fd, const Slot &slot) = 0;
+  // Called at the end of every FlushChanges().
+  virtual void CommitChanges() {}
+
+  // Generations wrap at 31 bits, so the top bit of a tag is always clear
+  // and free for the backend to mark other kinds of kernel requests.
+  static const uint32_t kGenerationMask;
+
+  static uint64_t Tag(int fd, const Slot &slot);
+  // Returns the slot |tag| was made for if it is still current, filling
+  // |fd| and |watcher|.
+  const Slot *Resolve(uint64_t tag, int *fd, FdWatcher **watcher) const;
+  // Turns poll(2)/epoll(7) bits into READ/WRITE/ReadyCondition bits.
+  static int ToEventMask(uint32_t poll_events, const Slot &slot);
+
+ private:
+  // Slots live in fixed-size chunks that are never moved or freed, so the
+  // loop thread can read them while another thread grows the table.
+  static const int kSlotsPerChunkShift;
+  static const int kSlotsPerChunk;
+
+  Slot *FindSlot(int fd) const;
+  Slot *GetOrCreateSlot(int fd);
+  void MarkDirty(int fd, Slot *slot);
+
+  int max_chunks_;
+  std::unique_ptr<std::atomic<Slot *>[]> chunks_;
+  std::vector<int> dirty_;
+
+  DISALLOW_COPY_AND_ASSIGN(Reactor)
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,99 @@
+#include "net/rpc_channel.h"
+#include <utility>
+#include "net/event_pump.h"
+#include "net/net_errors.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+
+namespace dlock {
+
+RpcChannel::RpcChannel(std::unique_ptr<TCPSocket> socket,
+                       const FrameOptions& options)
+    : RpcStream(std::move(socket), options), next_call_id_(1) {}
+
+RpcChannel::~RpcChannel() {
+  for (auto& entry : calls_) {
+    if (entry.second.timer != kInvalidTimerId) {
+      pump()->CancelTimer(entry.second.timer);
+    }
+  }
+}
+
+uint64_t RpcChannel::Call(uint32_t method, const IOBufferChain& request,
+                          int64_t timeout_ms, ReplyCallback callback) {
+  if (closed()) {
+    return 0;
+  }
+  uint64_t call_id = next_call_id_++;
+  PendingCall& call = calls_[call_id];
+  call.callback = std::move(callback);
+  call.timer = kInvalidTimerId;
+  if (timeout_ms > 0) {
+    call.timer =
+        pump()->RunAfter(timeout_ms, [this, call_id] { OnTimeout(call_id); });
+  }
+  Send(RpcMessage::REQUEST, call_id, static_cast<int32_t>(method), request);
+  return call_id;
+}
+
+bool RpcChannel::Cancel(uint64_t call_id) {
+  ReplyCallback callback;
+  if (!TakeCall(call_id, &callback)) {
+    return false;
+  }
+  Send(RpcMessage::CANCEL, call_id, 0, IOBufferChain());
+  return true;
+}
+
+bool RpcChannel::TakeCall(uint64_t call_id, ReplyCallback* callback) {
+  auto it = calls_.find(call_id);
+  if (it == calls_.end()) {
+    return false;
+  }
+  if (it->second.timer != kInvalidTimerId) {
+    pump()->CancelTimer(it->second.timer);
+  }
+  callback->swap(it->second.callback);
+  calls_.erase(it);
+  return true;
+}
+
+void RpcChannel::OnMessage(RpcMessage* message) {
+  if (message->type != RpcMessage::RESPONSE) {
+    LOG_ERROR("unexpected rpc message type %d", message->type);
+    return;
+  }
+  ReplyCallback callback;
+  // Replies to cancelled or timed out calls are dropped.
+  if (TakeCall(message->call_id, &callback)) {
+    callback(message->code, &message->body);
+  }
+}
+
+void RpcChannel::OnTimeout(uint64_t call_id) {
+  auto it = calls_.find(call_id);
+  CHECK(it != calls_.end());
+  // The timer fired, there is nothing to cancel.
+  it->second.timer = kInvalidTimerId;
+  ReplyCallback callback;
+  TakeCall(call_id, &callback);
+  Send(RpcMessage::CANCEL, call_id, 0, IOBufferChain());
+  IOBufferChain reply;
+  callback(ERR_TIMED_OUT, &reply);
+}
+
+void RpcChannel::OnClosed(int error) {
+  std::unordered_map<uint64_t, PendingCall> calls;
+  calls.swap(calls_);
+  for (auto& entry : calls) {
+    if (entry.second.timer != kInvalidTimerId) {
+      pump()->CancelTimer(entry.second.timer);
+    }
+  }
+  for (auto& entry : calls) {
+    IOBufferChain reply;
+    entry.second.callback(error, &reply);
+  }
+}
+
+}  // namespace dlock
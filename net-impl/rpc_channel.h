@@ -0,0 +1,67 @@
+#ifndef DLOCK_NET_RPC_CHANNEL_H_
+#define DLOCK_NET_RPC_CHANNEL_H_
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include "base/noncopyable.h"
+#include "net/rpc_stream.h"
+#include "net/timing_wheel.h"
+
+namespace dlock {
+
+// Client end of the RPC protocol. Calls are tagged with ids and written as
+// soon as they are made, so any number of them can be in flight on one
+// connection, and replies are matched to their calls in whatever order the
+// server sends them.
+//
+// Takes a connected socket, e.g. from TCPClientSocket::ReleaseSocket(), and
+// is used on the loop thread of its pump only.
+class RpcChannel : public RpcStream {
+ public:
+  // Gets the status the server replied with, OK or an error, and the reply
+  // body, which may be moved from. Gets ERR_TIMED_OUT if the deadline of the
+  // call passed first, or the error that closed the channel, with an empty
+  // body.
+  typedef std::function<void(int result, IOBufferChain* reply)>
+      ReplyCallback;
+
+  RpcChannel(std::unique_ptr<TCPSocket> socket, const FrameOptions& options);
+  // Drops the callbacks of the calls still pending without running them.
+  ~RpcChannel() override;
+
+  // Sends a request for |method| and returns its call id, never 0.
+  // |callback| runs exactly once, unless the call is cancelled. A
+  // |timeout_ms| of 0 disables the deadline. Returns 0 without taking
+  // |callback| if the channel is closed.
+  uint64_t Call(uint32_t method, const IOBufferChain& request,
+                int64_t timeout_ms, ReplyCallback callback);
+  // Drops the callback of |call_id| and tells the server to abandon the
+  // call. Returns false if the call already completed.
+  bool Cancel(uint64_t call_id);
+
+  size_t pending_calls() const { return calls_.size(); }
+
+ private:
+  struct PendingCall {
+    ReplyCallback callback;
+    TimerId timer;
+  };
+
+  void OnMessage(RpcMessage* message) override;
+  void OnClosed(int error) override;
+  void OnTimeout(uint64_t call_id);
+  // Removes |call_id| from |calls_| and cancels its timer. Returns false if
+  // it is not pending.
+  bool TakeCall(uint64_t call_id, ReplyCallback* callback);
+
+  uint64_t next_call_id_;
+  std::unordered_map<uint64_t, PendingCall> calls_;
+
+  DISALLOW_COPY_AND_ASSIGN(RpcChannel);
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,342 @@
+#include "net/rpc_channel.h"
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "net/event_pump.h"
+#include "net/event_pump_test_util.h"
+#include "net/net_errors.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(RpcChannelTest);
+
+namespace {
+
+const FrameOptions kOptions;
+
+// A decoded message, body included.
+struct Message {
+  int type;
+  uint64_t call_id;
+  int32_t code;
+  std::string body;
+};
+
+IOBufferChain Body(const std::string& data) {
+  IOBufferChain chain;
+  scoped_refptr<IOBuffer> buf = new IOBuffer(data.size() + 1);
+  memcpy(buf->data(), data.data(), data.size());
+  chain.Append(buf, 0, static_cast<int>(data.size()));
+  return chain;
+}
+
+std::string ToString(const IOBufferChain& chain) {
+  std::string out(chain.size(), '\0');
+  chain.CopyTo(&out[0], static_cast<int>(out.size()));
+  return out;
+}
+
+// Frames a raw message payload, so that tests can also send broken ones.
+std::string Frame(const std::string& payload) {
+  FrameEncoder encoder(kOptions);
+  IOBufferChain wire;
+  encoder.Encode(Body(payload), &wire);
+  return ToString(wire);
+}
+
+std::string Header(int type, uint64_t call_id, int32_t code) {
+  std::string header(13, '\0');
+  header[0] = static_cast<char>(type);
+  for (int i = 0; i < 8; ++i) {
+    header[1 + i] = static_cast<char>(call_id >> (56 - 8 * i));
+  }
+  for (int i = 0; i < 4; ++i) {
+    header[9 + i] = static_cast<char>(static_cast<uint32_t>(code) >>
+                                      (24 - 8 * i));
+  }
+  return header;
+}
+
+std::string Reply(uint64_t call_id, int32_t status, const std::string& body) {
+  return Frame(Header(RpcMessage::RESPONSE, call_id, status) + body);
+}
+
+// The server end: a plain blocking socket driven by the test thread.
+class RawPeer {
+ public:
+  explicit RawPeer(int fd) : fd_(fd), decoder_(kOptions) {
+    struct timeval timeout = {5, 0};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+  ~RawPeer() { Close(); }
+
+  void Write(const std::string& data) {
+    CHECK_EQ(write(fd_, data.data(), data.size()),
+             static_cast<ssize_t>(data.size()));
+  }
+
+  // Blocks until the next message from the channel is complete.
+  Message Read() {
+    IOBufferChain payload;
+    while (decoder_.Next(&payload) == ERR_IO_PENDING) {
+      scoped_refptr<IOBuffer> buf = new IOBuffer(4096);
+      ssize_t rv = read(fd_, buf->data(), 4096);
+      CHECK_GT(rv, 0);
+      decoder_.Append(buf, 0, static_cast<int>(rv));
+    }
+    std::string data = ToString(payload);
+    CHECK_GE(data.size(), 13u);
+    Message message;
+    message.type = static_cast<unsigned char>(data[0]);
+    message.call_id = 0;
+    for (int i = 1; i < 9; ++i) {
+      message.call_id =
+          (message.call_id << 8) | static_cast<unsigned char>(data[i]);
+    }
+    uint32_t code = 0;
+    for (int i = 9; i < 13; ++i) {
+      code = (code << 8) | static_cast<unsigned char>(data[i]);
+    }
+    message.code = static_cast<int32_t>(code);
+    message.body = data.substr(13);
+    return message;
+  }
+
+  void Close() {
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+ private:
+  int fd_;
+  FrameDecoder decoder_;
+};
+
+// A started channel on |pump| connected to the returned peer.
+std::unique_ptr<RpcChannel> Connect(EventPump* pump,
+                                    std::unique_ptr<RawPeer>* peer) {
+  int fds[2];
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  peer->reset(new RawPeer(fds[1]));
+  std::unique_ptr<RpcChannel> channel;
+  RunOnLoop(pump, [&] {
+    std::unique_ptr<TCPSocket> socket(new TCPSocket(pump));
+    CHECK_EQ(socket->AdoptUnconnectedSocket(fds[0]), 0);
+    channel.reset(new RpcChannel(std::move(socket), kOptions));
+    channel->Start();
+  });
+  return channel;
+}
+
+struct Result {
+  int result;
+  std::string reply;
+};
+
+}  // namespace
+
+TEST(RpcChannelTest, TestHeaderRoundTrip) {
+  EventPump pump;
+  std::unique_ptr<RawPeer> peer;
+  std::unique_ptr<RpcChannel> channel = Connect(&pump, &peer);
+  std::vector<Result> results;
+  uint64_t call_id = 0;
+  RunOnLoop(&pump, [&] {
+    call_id = channel->Call(
+        0x01020304, Body("ping"), 0, [&](int rv, IOBufferChain* reply) {
+          results.push_back({rv, ToString(*reply)});
+        });
+  });
+  CHECK_NE(call_id, 0u);
+
+  Message request = peer->Read();
+  CHECK_EQ(request.type, RpcMessage::REQUEST);
+  CHECK_EQ(request.call_id, call_id);
+  CHECK_EQ(request.code, 0x01020304);
+  CHECK_EQ(request.body, "ping");
+
+  // Big-endian on the wire, a negative status included.
+  std::string header = Header(RpcMessage::RESPONSE, call_id, -42);
+  CHECK_EQ(header.size(), 13u);
+  CHECK_EQ(header.substr(9), std::string("\xff\xff\xff\xd6", 4));
+  peer->Write(Frame(header + "pong"));
+  CHECK(WaitFor(&pump, [&] { return !results.empty(); }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(results[0].result, -42);
+    CHECK_EQ(results[0].reply, "pong");
+    CHECK_EQ(channel->pending_calls(), 0u);
+    channel.reset();
+  });
+}
+
+TEST(RpcChannelTest, TestRejectsBadHeader) {
+  const std::string bad[] = {
+      // Shorter than the 13-byte header.
+      Frame(Header(RpcMessage::RESPONSE, 1, 0).substr(0, 12)),
+      // Unknown type.
+      Frame(Header(9, 1, 0)),
+  };
+  for (const std::string& message : bad) {
+    EventPump pump;
+    std::unique_ptr<RawPeer> peer;
+    std::unique_ptr<RpcChannel> channel = Connect(&pump, &peer);
+    std::vector<Result> results;
+    RunOnLoop(&pump, [&] {
+      channel->Call(1, Body("x"), 0, [&](int rv, IOBufferChain* reply) {
+        results.push_back({rv, ToString(*reply)});
+      });
+    });
+    peer->Write(message);
+    CHECK(WaitFor(&pump, [&] { return !results.empty(); }));
+    RunOnLoop(&pump, [&] {
+      CHECK_EQ(results[0].result, ERR_FRAME_CORRUPTED);
+      CHECK(channel->closed());
+      CHECK_EQ(channel->pending_calls(), 0u);
+      channel.reset();
+    });
+  }
+}
+
+TEST(RpcChannelTest, TestOutOfOrderReplies) {
+  EventPump pump;
+  std::unique_ptr<RawPeer> peer;
+  std::unique_ptr<RpcChannel> channel = Connect(&pump, &peer);
+  std::vector<Result> results;
+  std::vector<uint64_t> ids;
+  RunOnLoop(&pump, [&] {
+    for (int i = 0; i < 3; ++i) {
+      std::string name = "call" + std::to_string(i);
+      ids.push_back(channel->Call(
+          1, Body(name), 0, [&, name](int rv, IOBufferChain* reply) {
+            results.push_back({rv, name + "=" + ToString(*reply)});
+          }));
+    }
+  });
+  for (int i = 0; i < 3; ++i) {
+    CHECK_EQ(peer->Read().call_id, ids[i]);
+  }
+
+  peer->Write(Reply(ids[2], OK, "c") + Reply(ids[0], OK, "a") +
+              Reply(ids[1], OK, "b"));
+  CHECK(WaitFor(&pump, [&] { return results.size() == 3; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(results[0].reply, "call2=c");
+    CHECK_EQ(results[1].reply, "call0=a");
+    CHECK_EQ(results[2].reply, "call1=b");
+    CHECK_EQ(channel->pending_calls(), 0u);
+    channel.reset();
+  });
+}
+
+TEST(RpcChannelTest, TestTimeoutAndLateReply) {
+  EventPump pump;
+  std::unique_ptr<RawPeer> peer;
+  std::unique_ptr<RpcChannel> channel = Connect(&pump, &peer);
+  std::vector<Result> results;
+  uint64_t call_id = 0;
+  RunOnLoop(&pump, [&] {
+    call_id = channel->Call(1, Body("slow"), 20,
+                            [&](int rv, IOBufferChain* reply) {
+                              results.push_back({rv, ToString(*reply)});
+                            });
+  });
+  CHECK_EQ(peer->Read().call_id, call_id);
+  CHECK(WaitFor(&pump, [&] { return !results.empty(); }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(results[0].result, ERR_TIMED_OUT);
+    CHECK_EQ(results[0].reply, "");
+    CHECK_EQ(channel->pending_calls(), 0u);
+    CHECK(!channel->Cancel(call_id));
+  });
+  // The server is told to give up.
+  Message cancel = peer->Read();
+  CHECK_EQ(cancel.type, RpcMessage::CANCEL);
+  CHECK_EQ(cancel.call_id, call_id);
+
+  // A reply arriving anyway is dropped, and the channel carries on.
+  uint64_t next_id = 0;
+  RunOnLoop(&pump, [&] {
+    next_id = channel->Call(1, Body("next"), 0,
+                            [&](int rv, IOBufferChain* reply) {
+                              results.push_back({rv, ToString(*reply)});
+                            });
+  });
+  CHECK_EQ(peer->Read().call_id, next_id);
+  peer->Write(Reply(call_id, OK, "late") + Reply(next_id, OK, "next"));
+  CHECK(WaitFor(&pump, [&] { return results.size() == 2; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(results.size(), 2u);
+    CHECK_EQ(results[1].reply, "next");
+    CHECK(!channel->closed());
+    channel.reset();
+  });
+}
+
+TEST(RpcChannelTest, TestCancel) {
+  EventPump pump;
+  std::unique_ptr<RawPeer> peer;
+  std::unique_ptr<RpcChannel> channel = Connect(&pump, &peer);
+  int callbacks = 0;
+  uint64_t call_id = 0;
+  RunOnLoop(&pump, [&] {
+    call_id = channel->Call(1, Body("x"), 1000,
+                            [&](int, IOBufferChain*) { ++callbacks; });
+    CHECK_EQ(channel->pending_calls(), 1u);
+    CHECK(channel->Cancel(call_id));
+    CHECK(!channel->Cancel(call_id));
+    CHECK_EQ(channel->pending_calls(), 0u);
+  });
+  CHECK_EQ(peer->Read().type, RpcMessage::REQUEST);
+  Message cancel = peer->Read();
+  CHECK_EQ(cancel.type, RpcMessage::CANCEL);
+  CHECK_EQ(cancel.call_id, call_id);
+
+  peer->Write(Reply(call_id, OK, "late"));
+  usleep(50 * 1000);
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(callbacks, 0);
+    CHECK(!channel->closed());
+    channel.reset();
+  });
+}
+
+TEST(RpcChannelTest, TestCloseFailsPendingCalls) {
+  EventPump pump;
+  std::unique_ptr<RawPeer> peer;
+  std::unique_ptr<RpcChannel> channel = Connect(&pump, &peer);
+  std::vector<Result> results;
+  RunOnLoop(&pump, [&] {
+    for (int i = 0; i < 2; ++i) {
+      channel->Call(1, Body("x"), 0, [&](int rv, IOBufferChain* reply) {
+        results.push_back({rv, ToString(*reply)});
+      });
+    }
+  });
+  // Unread requests would turn the close into a reset.
+  peer->Read();
+  peer->Read();
+  peer->Close();
+  CHECK(WaitFor(&pump, [&] { return results.size() == 2; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(results[0].result, ERR_CONNECTION_CLOSED);
+    CHECK_EQ(results[1].result, ERR_CONNECTION_CLOSED);
+    CHECK(channel->closed());
+    CHECK_EQ(channel->Call(1, Body("y"), 0, nullptr), 0u);
+    channel.reset();
+  });
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(RpcChannelTest)
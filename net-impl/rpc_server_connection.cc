@@ -0,0 +1,43 @@
+#include "net/rpc_server_connection.h"
+#include <utility>
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+
+namespace dlock {
+
+RpcServerConnection::RpcServerConnection(std::unique_ptr<TCPSocket> socket,
+                                         const FrameOptions& options,
+                                         RequestHandler handler)
+    : RpcStream(std::move(socket), options), handler_(std::move(handler)) {}
+
+RpcServerConnection::~RpcServerConnection() = default;
+
+void RpcServerConnection::SendReply(uint64_t call_id, int status,
+                                    const IOBufferChain& reply) {
+  Send(RpcMessage::RESPONSE, call_id, status, reply);
+}
+
+void RpcServerConnection::OnMessage(RpcMessage* message) {
+  switch (message->type) {
+    case RpcMessage::REQUEST:
+      handler_(this, message->call_id, static_cast<uint32_t>(message->code),
+               &message->body);
+      break;
+    case RpcMessage::CANCEL:
+      if (cancel_handler_) {
+        cancel_handler_(this, message->call_id);
+      }
+      break;
+    default:
+      LOG_ERROR("unexpected rpc message type %d", message->type);
+      break;
+  }
+}
+
+void RpcServerConnection::OnClosed(int error) {
+  if (close_callback_) {
+    close_callback_(error);
+  }
+}
+
+}  // namespace dlock
@@ -0,0 +1,64 @@
+#ifndef DLOCK_NET_RPC_SERVER_CONNECTION_H_
+#define DLOCK_NET_RPC_SERVER_CONNECTION_H_
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <utility>
+#include "base/noncopyable.h"
+#include "net/net_errors.h"
+#include "net/rpc_stream.h"
+
+namespace dlock {
+
+// Server end of the RPC protocol on one accepted socket. Clients pipeline
+// their calls, so a single read usually carries many requests: they are
+// handled back to back and the replies sent meanwhile leave together in
+// one vectored write. Replies may also be sent later, in any order, e.g.
+// once a contended lock is granted.
+class RpcServerConnection : public RpcStream {
+ public:
+  // Runs for every request. The handler answers it with SendReply(), right
+  // away or later, at most once. |request| may be moved from.
+  typedef std::function<void(RpcServerConnection* connection,
+                             uint64_t call_id, uint32_t method,
+                             IOBufferChain* request)>
+      RequestHandler;
+  // Runs when the client gives up on a call it has not got a reply for.
+  // Replying to it anyway is harmless.
+  typedef std::function<void(RpcServerConnection* connection,
+                             uint64_t call_id)>
+      CancelHandler;
+
+  RpcServerConnection(std::unique_ptr<TCPSocket> socket,
+                      const FrameOptions& options, RequestHandler handler);
+  ~RpcServerConnection() override;
+
+  void set_cancel_handler(CancelHandler handler) {
+    cancel_handler_ = std::move(handler);
+  }
+  // Runs once the connection is closed by the peer or fails, see
+  // RpcStream::OnClosed(). Destroy the connection from a task posted to
+  // the pump, not from the callback.
+  void set_close_callback(CompletionCallback callback) {
+    close_callback_ = std::move(callback);
+  }
+
+  // Answers |call_id| with |status| and |reply|. Wrap replies sent outside
+  // of request handling in BeginBatch() and EndBatch() to coalesce them.
+  void SendReply(uint64_t call_id, int status, const IOBufferChain& reply);
+
+ private:
+  void OnMessage(RpcMessage* message) override;
+  void OnClosed(int error) override;
+
+  RequestHandler handler_;
+  CancelHandler cancel_handler_;
+  CompletionCallback close_callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(RpcServerConnection);
+};
+
+}  // namespace dlock
+
+#endif
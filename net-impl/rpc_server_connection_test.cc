@@ -0,0 +1,116 @@
+#include "net/rpc_server_connection.h"
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include "net/event_pump.h"
+#include "net/event_pump_test_util.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(RpcServerConnectionTest);
+
+namespace {
+
+const FrameOptions kOptions;
+
+std::string ToString(const IOBufferChain& chain) {
+  std::string out(chain.size(), '\0');
+  chain.CopyTo(&out[0], static_cast<int>(out.size()));
+  return out;
+}
+
+// A framed request as a client puts it on the wire.
+std::string Request(uint64_t call_id, uint32_t method,
+                    const std::string& body) {
+  std::string payload(RpcMessage::kHeaderSize, '\0');
+  payload[0] = static_cast<char>(RpcMessage::REQUEST);
+  for (int i = 0; i < 8; ++i) {
+    payload[1 + i] = static_cast<char>(call_id >> (56 - 8 * i));
+  }
+  for (int i = 0; i < 4; ++i) {
+    payload[9 + i] = static_cast<char>(method >> (24 - 8 * i));
+  }
+  payload += body;
+  IOBufferChain chain;
+  scoped_refptr<IOBuffer> buf = new IOBuffer(payload.size());
+  memcpy(buf->data(), payload.data(), payload.size());
+  chain.Append(buf, 0, static_cast<int>(payload.size()));
+  FrameEncoder encoder(kOptions);
+  IOBufferChain wire;
+  encoder.Encode(chain, &wire);
+  return ToString(wire);
+}
+
+// Blocks until the next frame from |fd| is complete and returns its
+// payload.
+std::string ReadFrame(int fd, FrameDecoder* decoder) {
+  IOBufferChain payload;
+  while (decoder->Next(&payload) == ERR_IO_PENDING) {
+    scoped_refptr<IOBuffer> buf = new IOBuffer(4096);
+    ssize_t rv = read(fd, buf->data(), 4096);
+    CHECK_GT(rv, 0);
+    decoder->Append(buf, 0, static_cast<int>(rv));
+  }
+  return ToString(payload);
+}
+
+}  // namespace
+
+TEST(RpcServerConnectionTest, TestRepliesToOneReadInOneWrite) {
+  // Few enough replies to fit into one writev().
+  const int kRequests = 8;
+  EventPump pump;
+  int fds[2];
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::unique_ptr<RpcServerConnection> connection;
+  int handled = 0;
+  int64_t write_calls = 0;
+  RunOnLoop(&pump, [&] {
+    std::unique_ptr<TCPSocket> socket(new TCPSocket(&pump));
+    CHECK_EQ(socket->AdoptUnconnectedSocket(fds[0]), 0);
+    connection.reset(new RpcServerConnection(
+        std::move(socket), kOptions,
+        [&](RpcServerConnection* server, uint64_t call_id, uint32_t method,
+            IOBufferChain* request) {
+          ++handled;
+          server->SendReply(call_id, static_cast<int>(method), *request);
+        }));
+    write_calls = connection->socket()->stats().write_calls;
+    connection->Start();
+  });
+
+  std::string wire;
+  for (int i = 0; i < kRequests; ++i) {
+    wire += Request(i + 1, 100 + i, std::string(1, 'a' + i));
+  }
+  CHECK_EQ(write(fds[1], wire.data(), wire.size()),
+           static_cast<ssize_t>(wire.size()));
+
+  FrameDecoder decoder(kOptions);
+  for (int i = 0; i < kRequests; ++i) {
+    std::string reply = ReadFrame(fds[1], &decoder);
+    CHECK_EQ(reply.size(), RpcMessage::kHeaderSize + 1u);
+    CHECK_EQ(reply[0], static_cast<char>(RpcMessage::RESPONSE));
+    CHECK_EQ(static_cast<unsigned char>(reply[8]), i + 1);
+    CHECK_EQ(static_cast<unsigned char>(reply[12]), 100 + i);
+    CHECK_EQ(reply[13], 'a' + i);
+  }
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(handled, kRequests);
+    CHECK_EQ(connection->socket()->stats().write_calls, write_calls + 1);
+    connection.reset();
+  });
+  close(fds[1]);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(RpcServerConnectionTest)
@@ -0,0 +1,223 @@
+#include "net/rpc_stream.h"
+#include <errno.h>
+#include <utility>
+#include "net/net_errors.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+
+namespace dlock {
+
+namespace {
+
+// Reads smaller than this start a fresh buffer rather than filling the
+// tail of the current one.
+const int kMinReadSize = 2048;
+// Holds the headers of a few dozen outgoing messages.
+const int kHeaderBufferSize = 512;
+
+// Parses and strips the header at the front of |message->body|.
+int ParseHeader(RpcMessage* message) {
+  char header[RpcMessage::kHeaderSize];
+  if (message->body.CopyTo(header, RpcMessage::kHeaderSize) <
+      RpcMessage::kHeaderSize) {
+    return ERR_FRAME_CORRUPTED;
+  }
+  int type = static_cast<unsigned char>(header[0]);
+  if (type < RpcMessage::REQUEST || type > RpcMessage::CANCEL) {
+    return ERR_FRAME_CORRUPTED;
+  }
+  message->type = static_cast<RpcMessage::Type>(type);
+  message->call_id = 0;
+  for (int i = 1; i < 9; ++i) {
+    message->call_id =
+        (message->call_id << 8) | static_cast<unsigned char>(header[i]);
+  }
+  uint32_t code = 0;
+  for (int i = 9; i < RpcMessage::kHeaderSize; ++i) {
+    code = (code << 8) | static_cast<unsigned char>(header[i]);
+  }
+  message->code = static_cast<int32_t>(code);
+  message->body.Consume(RpcMessage::kHeaderSize);
+  return OK;
+}
+
+}  // namespace
+
+const int RpcMessage::kHeaderSize = 13;
+
+const int RpcStream::kReadBufferSize = 64 * 1024;
+
+RpcStream::RpcStream(std::unique_ptr<TCPSocket> socket,
+                     const FrameOptions& options)
+    : socket_(std::move(socket)),
+      encoder_(options),
+      decoder_(options),
+      read_offset_(kReadBufferSize),
+      header_used_(kHeaderBufferSize),
+      writing_len_(0),
+      batch_depth_(0),
+      closed_(false) {}
+
+RpcStream::~RpcStream() = default;
+
+EventPump* RpcStream::pump() const { return socket_->pump(); }
+
+void RpcStream::Start() { DoRead(); }
+
+void RpcStream::Close() { Fail(ERR_ABORTED); }
+
+void RpcStream::BeginBatch() { ++batch_depth_; }
+
+void RpcStream::EndBatch() {
+  CHECK_GT(batch_depth_, 0);
+  if (--batch_depth_ == 0) {
+    Flush();
+  }
+}
+
+void RpcStream::Send(RpcMessage::Type type, uint64_t call_id, int32_t code,
+                     const IOBufferChain& body) {
+  if (closed_) {
+    return;
+  }
+  if (header_used_ + RpcMessage::kHeaderSize > kHeaderBufferSize) {
+    // Messages still queued keep the old buffer alive.
+    header_buf_ = new IOBuffer(kHeaderBufferSize);
+    header_used_ = 0;
+  }
+  char* header = header_buf_->data() + header_used_;
+  header[0] = static_cast<char>(type);
+  for (int i = 0; i < 8; ++i) {
+    header[1 + i] = static_cast<char>(call_id >> (56 - 8 * i));
+  }
+  uint32_t ucode = static_cast<uint32_t>(code);
+  for (int i = 0; i < 4; ++i) {
+    header[9 + i] = static_cast<char>(ucode >> (24 - 8 * i));
+  }
+  IOBufferChain message;
+  message.Append(header_buf_, header_used_, RpcMessage::kHeaderSize);
+  header_used_ += RpcMessage::kHeaderSize;
+  for (size_t i = 0; i < body.num_slices(); ++i) {
+    const IOBufferChain::Slice& slice = body.slice(i);
+    message.Append(slice.buf, slice.offset, slice.len);
+  }
+  encoder_.Encode(message, &out_);
+  if (batch_depth_ == 0) {
+    Flush();
+  }
+}
+
+void RpcStream::DoRead() {
+  while (!closed_) {
+    if (kReadBufferSize - read_offset_ < kMinReadSize) {
+      // Messages and partial frames still using the old buffer keep it.
+      read_buf_ = new IOBuffer(kReadBufferSize);
+      read_offset_ = 0;
+    }
+    scoped_refptr<DrainableIOBuffer> tail =
+        new DrainableIOBuffer(read_buf_, kReadBufferSize);
+    tail->SetOffset(read_offset_);
+    int rv = socket_->Read(tail.get(), tail->BytesRemaining(),
+                           [this](int rv) { OnRead(rv); });
+    if (rv == ERR_IO_PENDING || !HandleRead(rv)) {
+      return;
+    }
+  }
+}
+
+void RpcStream::OnRead(int rv) {
+  if (HandleRead(rv)) {
+    DoRead();
+  }
+}
+
+bool RpcStream::HandleRead(int rv) {
+  if (rv <= 0) {
+    Fail(rv == 0 ? ERR_CONNECTION_CLOSED : rv);
+    return false;
+  }
+  decoder_.Append(read_buf_, read_offset_, rv);
+  read_offset_ += rv;
+  // Whatever the messages of this read trigger goes out in one write.
+  BeginBatch();
+  while (!closed_) {
+    RpcMessage message;
+    int result = decoder_.Next(&message.body);
+    if (result == ERR_IO_PENDING) {
+      break;
+    }
+    if (result == OK) {
+      result = ParseHeader(&message);
+    }
+    if (result != OK) {
+      LOG_ERROR("dropping rpc connection: %s", ErrorToString(result));
+      Fail(result);
+      break;
+    }
+    OnMessage(&message);
+  }
+  EndBatch();
+  return !closed_;
+}
+
+void RpcStream::Flush() {
+  while (!closed_ && writing_len_ == 0 && !out_.empty()) {
+    int rv = socket_->Write(out_);
+    if (rv >= 0) {
+      out_.Consume(rv);
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    int error = MapSystemError(errno);
+    if (error != ERR_IO_PENDING) {
+      Fail(error);
+      return;
+    }
+    // The socket buffer is full. An async write of the front slice waits
+    // for room, the rest follows with writev() once it completes.
+    const IOBufferChain::Slice& front = out_.slice(0);
+    scoped_refptr<DrainableIOBuffer> buf =
+        new DrainableIOBuffer(front.buf, front.offset + front.len);
+    buf->SetOffset(front.offset);
+    writing_len_ = front.len;
+    rv = socket_->Write(buf.get(), writing_len_,
+                        [this](int rv) { OnWritten(rv); });
+    if (rv == ERR_IO_PENDING) {
+      return;
+    }
+    int len = writing_len_;
+    writing_len_ = 0;
+    if (rv < 0) {
+      Fail(rv);
+      return;
+    }
+    out_.Consume(len);
+  }
+}
+
+void RpcStream::OnWritten(int rv) {
+  int len = writing_len_;
+  writing_len_ = 0;
+  if (rv < 0) {
+    Fail(rv);
+    return;
+  }
+  out_.Consume(len);
+  Flush();
+}
+
+void RpcStream::Fail(int error) {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  // Drops the pending read and write without running their callbacks.
+  socket_->Close();
+  out_.Clear();
+  writing_len_ = 0;
+  OnClosed(error);
+}
+
+}  // namespace dlock
@@ -0,0 +1,117 @@
+#ifndef DLOCK_NET_RPC_STREAM_H_
+#define DLOCK_NET_RPC_STREAM_H_
+
+#include <stdint.h>
+#include <memory>
+#include "base/noncopyable.h"
+#include "base/scoped_refptr.h"
+#include "net/frame_codec.h"
+#include "net/io_buffer.h"
+#include "net/io_buffer_chain.h"
+
+namespace dlock {
+
+class EventPump;
+class TCPSocket;
+
+// A message of the RPC protocol. On the wire each message is one frame
+// whose payload starts with
+//
+//   type: 1 byte
+//   call id: 8 bytes big endian
+//   code: 4 bytes big endian, the method of a request or the status of a
+//         response
+//
+// followed by the body. Call ids are picked by the client and let it match
+// responses that arrive in any order.
+struct RpcMessage {
+  enum Type {
+    REQUEST = 1,
+    RESPONSE = 2,
+    // Tells the server the client gave up on the call.
+    CANCEL = 3,
+  };
+
+  Type type;
+  uint64_t call_id;
+  int32_t code;
+  IOBufferChain body;
+
+  static const int kHeaderSize;
+};
+
+// The connection shared by both ends of the protocol: reads frames off a
+// connected non-blocking socket and hands each decoded message to
+// OnMessage(), and queues outgoing messages for one vectored write.
+//
+// Messages sent while a batch is open, such as the replies produced for all
+// requests decoded from one read, are held back and go out with a single
+// writev() when the outermost batch ends. Messages sent outside of a batch
+// are written right away. Everything runs on the loop thread of the
+// socket's pump; callbacks may Close() the stream but must not destroy it.
+class RpcStream {
+ public:
+  RpcStream(std::unique_ptr<TCPSocket> socket, const FrameOptions& options);
+  virtual ~RpcStream();
+
+  // Starts reading messages.
+  void Start();
+  // Closes the socket and drops queued messages, then runs OnClosed() with
+  // ERR_ABORTED. Does nothing if the stream is closed already.
+  void Close();
+
+  // Batches may nest; the writes are flushed when the outermost one ends.
+  void BeginBatch();
+  void EndBatch();
+
+  bool closed() const { return closed_; }
+  TCPSocket* socket() const { return socket_.get(); }
+  EventPump* pump() const;
+  // Bytes queued but not written to the socket yet.
+  size_t queued_bytes() const { return out_.size(); }
+
+  static const int kReadBufferSize;
+
+ protected:
+  // Queues a message, see the batching rules above. Ignored once closed.
+  // CHECKs that the message fits into the maximum frame size.
+  void Send(RpcMessage::Type type, uint64_t call_id, int32_t code,
+            const IOBufferChain& body);
+
+  // Runs for every message received. |message->body| may be moved from.
+  virtual void OnMessage(RpcMessage* message) = 0;
+  // Runs once when the peer closes the connection or it fails, with
+  // ERR_CONNECTION_CLOSED or the error. The stream is closed by then.
+  virtual void OnClosed(int error) = 0;
+
+ private:
+  void DoRead();
+  void OnRead(int rv);
+  // Decodes and dispatches the messages completed by |rv| bytes read, or
+  // fails the stream. Returns false if reading should stop.
+  bool HandleRead(int rv);
+  void Flush();
+  void OnWritten(int rv);
+  void Fail(int error);
+
+  std::unique_ptr<TCPSocket> socket_;
+  FrameEncoder encoder_;
+  FrameDecoder decoder_;
+  // Reads land in the free tail of |read_buf_| starting at |read_offset_|.
+  scoped_refptr<IOBuffer> read_buf_;
+  int read_offset_;
+  // Room for the headers of outgoing messages.
+  scoped_refptr<IOBuffer> header_buf_;
+  int header_used_;
+  IOBufferChain out_;
+  // Bytes at the front of |out_| handed to a pending async write.
+  int writing_len_;
+  int batch_depth_;
+  bool closed_;
+
+  DISALLOW_COPY_AND_ASSIGN(RpcStream);
+};
+
+}  // namespace dlock
+
+#endif
@@ -5,56 +5,146 @@
 
 namespace dlock {
 
-static bool ParseIp(const std::string& address, uint32_t* ip) {
-  if (address.empty() || nullptr == ip) {
+static bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+static std::string_view Trim(std::string_view str) {
+  while (!str.empty() && IsSpace(str.front())) {
+    str.remove_prefix(1);
+  }
+  while (!str.empty() && IsSpace(str.back())) {
+    str.remove_suffix(1);
+  }
+  return str;
+}
+
+// Parses a decimal number of up to |max_digits| digits without sign or
+// leading zeros, like inet_pton() does for the parts of an address.
+static bool ParseNumber(std::string_view str, size_t max_digits,
+                        uint32_t* value) {
+  if (str.empty() || str.size() > max_digits ||
+      (str.size() > 1 && str[0] == '0')) {
     return false;
   }
-  const char* str = address.c_str();
-  while (isspace(*str)) ++str;
-  if (inet_pton(AF_INET, str, ip)) {
-    return true;
+  uint32_t result = 0;
+  for (char c : str) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    result = result * 10 + (c - '0');
   }
-  return false;
+  *value = result;
+  return true;
 }
 
+// |ip| is stored in network order. Same rules as inet_pton(): four
+// decimal parts of at most 255 without sign or leading zeros.
+static bool ParseIp(std::string_view str, uint32_t* ip) {
+  uint8_t bytes[4];
+  int part = 0;
+  size_t digits = 0;
+  uint32_t value = 0;
+  for (char c : str) {
+    if (c >= '0' && c <= '9') {
+      if (digits == 1 && value == 0) {
+        return false;
+      }
+      value = value * 10 + (c - '0');
+      if (++digits > 3 || value > 255) {
+        return false;
+      }
+    } else if (c == '.' && digits && part < 3) {
+      bytes[part++] = static_cast<uint8_t>(value);
+      digits = 0;
+      value = 0;
+    } else {
+      return false;
+    }
+  }
+  if (!digits || part != 3) {
+    return false;
+  }
+  bytes[3] = static_cast<uint8_t>(value);
+  memcpy(ip, bytes, sizeof(bytes));
+  return true;
+}
+
+static char* FormatNumber(uint32_t value, char* out) {
+  char digits[10];
+  int count = 0;
+  do {
+    digits[count++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  while (count) {
+    *out++ = digits[--count];
+  }
+  return out;
+}
+
+const size_t SocketAddress::kMaxStringSize;
+
 SocketAddress::SocketAddress() : ip_(0), port_(0) {}
 
 SocketAddress::SocketAddress(const std::string& address, uint16_t port)
     : ip_(0), port_(htons(port)) {
-  LOG_ASSERT(ParseIp(address, &ip_));
+  LOG_ASSERT(ParseIp(Trim(address), &ip_));
 }
 
-bool SocketAddress::FromString(const std::string& address) {
-  if (address.empty()) {
+bool SocketAddress::FromString(std::string_view address) {
+  address = Trim(address);
+  size_t pos = address.find(':');
+  if (pos == std::string_view::npos) {
     return false;
   }
-  auto pos = address.find_first_of(':');
-  if (pos == std::string::npos) {
-    return false;
-  }
-  std::string ip_str = address.substr(0, pos);
-  std::string port_str = address.substr(pos + 1);
-
-  if (!ParseIp(ip_str, &ip_)) {
+  uint32_t ip;
+  uint32_t port;
+  if (!ParseIp(address.substr(0, pos), &ip) ||
+      !ParseNumber(Trim(address.substr(pos + 1)), 5, &port) ||
+      port > 65535) {
     return false;
   }
+  ip_ = ip;
+  port_ = htons(static_cast<uint16_t>(port));
+  return true;
+}
 
-  char* end = nullptr;
-  int port = strtol(port_str.c_str(), &end, 10);
-  if (end == port_str.c_str()) {
-    return false;
-  } else if (*end) {
-    for (++end; isspace(*end); ++end)
-      ;
-    if (*end) {
-      return false;
+int SocketAddress::ParseList(std::string_view list,
+                             std::vector<SocketAddress>* addresses) {
+  CHECK(addresses);
+  int failed = 0;
+  while (!list.empty()) {
+    size_t begin = 0;
+    while (begin < list.size() &&
+           (list[begin] == ',' || IsSpace(list[begin]))) {
+      ++begin;
     }
+    size_t end = begin;
+    while (end < list.size() && list[end] != ',' && !IsSpace(list[end])) {
+      ++end;
+    }
+    // The port may follow the colon after whitespace, as in FromString().
+    if (end > begin && list[end - 1] == ':') {
+      while (end < list.size() && IsSpace(list[end])) {
+        ++end;
+      }
+      while (end < list.size() && list[end] != ',' && !IsSpace(list[end])) {
+        ++end;
+      }
+    }
+    if (end > begin) {
+      SocketAddress address;
+      if (address.FromString(list.substr(begin, end - begin))) {
+        addresses->push_back(address);
+      } else {
+        ++failed;
+      }
+    }
+    list.remove_prefix(end);
   }
-  if (port < 0 || port > 65535) {
-    return false;
-  }
-  port_ = htons(port);
-  return true;
+  return failed;
 }
 
 void SocketAddress::FromSockaddrHolder(const SockaddrHolder& sock_addr) {
@@ -73,24 +163,45 @@ SockaddrHolder SocketAddress::ToSockaddrHolder() const {
   return ret;
 }
 
-std::string SocketAddress::ToString() const {
-  char buf[INET_ADDRSTRLEN + 16] = {0};
-  if (inet_ntop(AF_INET, &ip_, buf, INET6_ADDRSTRLEN) == nullptr) {
-    return {};
+size_t SocketAddress::ToBuffer(char* buf, size_t buf_len,
+                               bool with_port) const {
+  CHECK_GE(buf_len, kMaxStringSize);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&ip_);
+  char* out = buf;
+  for (int i = 0; i < 4; ++i) {
+    if (i) {
+      *out++ = '.';
+    }
+    out = FormatNumber(bytes[i], out);
+  }
+  if (with_port) {
+    *out++ = ':';
+    out = FormatNumber(ntohs(port_), out);
   }
-  char* ptr = buf + strlen(buf);
-  *ptr++ = ':';
-  snprintf(ptr, 16, "%d", ntohs(port_));
+  *out = '\0';
+  return out - buf;
+}
 
-  return std::string(buf);
+std::string SocketAddress::ToString() const {
+  char buf[kMaxStringSize];
+  return std::string(buf, ToBuffer(buf, sizeof(buf)));
 }
 
 std::string SocketAddress::ToStringWithoutPort() const {
-  char buf[INET_ADDRSTRLEN + 16] = {0};
-  if (inet_ntop(AF_INET, &ip_, buf, INET6_ADDRSTRLEN) == nullptr) {
-    return {};
-  }
-  return std::string(buf);
+  char buf[kMaxStringSize];
+  return std::string(buf, ToBuffer(buf, sizeof(buf), false));
+}
+
+size_t SocketAddress::Hash() const {
+  // The finalizer of MurmurHash3, so all 48 bits affect every output bit
+  // and nearby addresses or ports spread over the buckets.
+  uint64_t key = (static_cast<uint64_t>(ip_) << 16) | port_;
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return static_cast<size_t>(key);
 }
 
 bool operator<(const SocketAddress& lhs, const SocketAddress& rhs);
@@ -1,9 +1,14 @@
 #ifndef DLOCK_NET_SOCKET_ADDRESS_H_
 #define DLOCK_NET_SOCKET_ADDRESS_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace dlock {
 
@@ -14,15 +19,31 @@ class SocketAddress {
   SocketAddress();
   SocketAddress(const std::string& ip, uint16_t port);
 
-  bool FromString(const std::string& address /*ip:port*/);
+  // Parses "ip:port" without allocating. Leading and trailing whitespace
+  // is ignored, as is whitespace after the colon. The port is plain
+  // decimal like the parts of the ip: no sign and no leading zeros.
+  bool FromString(std::string_view address);
+  // Parses a list of "ip:port" entries separated by commas or whitespace,
+  // e.g. a peer list file, appending them to |addresses|. Entries follow
+  // the rules of FromString(), whitespace after the colon included.
+  // Returns the number of entries that did not parse.
+  static int ParseList(std::string_view list,
+                       std::vector<SocketAddress>* addresses);
   void FromSockaddrHolder(const SockaddrHolder& address);
   SockaddrHolder ToSockaddrHolder() const;
+  // Writes "ip:port", or just "ip", NUL terminated into |buf|, which must
+  // hold kMaxStringSize bytes. Returns the length without the NUL.
+  size_t ToBuffer(char* buf, size_t buf_len, bool with_port = true) const;
   std::string ToString() const;
   std::string ToStringWithoutPort() const;
+  size_t Hash() const;
   bool empty() const { return 0 == ip_ && 0 == port_; }
   uint32_t ip() const { return ip_; }
   uint16_t port() const { return port_; }
 
+  // "255.255.255.255:65535" and the NUL.
+  static const size_t kMaxStringSize = 22;
+
  private:
   friend bool operator<(const SocketAddress& lhs, const SocketAddress& rhs);
   friend bool operator>(const SocketAddress& lhs, const SocketAddress& rhs);
@@ -64,4 +85,15 @@ inline bool operator!=(const SocketAddress& lhs, const SocketAddress& rhs) {
 
 }  // namespace dlock
 
+namespace std {
+
+template <>
+struct hash<dlock::SocketAddress> {
+  size_t operator()(const dlock::SocketAddress& address) const {
+    return address.Hash();
+  }
+};
+
+}  // namespace std
+
 #endif
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "net/socket_address.h"
+
+namespace dlock {
+namespace {
+
+uint64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// The previous implementation: substrings, inet_pton() and strtol().
+bool LegacyFromString(const std::string& address, uint32_t* ip,
+                      uint16_t* port) {
+  auto pos = address.find_first_of(':');
+  if (pos == std::string::npos) {
+    return false;
+  }
+  std::string ip_str = address.substr(0, pos);
+  std::string port_str = address.substr(pos + 1);
+  if (inet_pton(AF_INET, ip_str.c_str(), ip) != 1) {
+    return false;
+  }
+  char* end = nullptr;
+  long value = strtol(port_str.c_str(), &end, 10);
+  if (end == port_str.c_str() || value < 0 || value > 65535) {
+    return false;
+  }
+  *port = htons(static_cast<uint16_t>(value));
+  return true;
+}
+
+// The previous implementation: inet_ntop() and snprintf().
+std::string LegacyToString(uint32_t ip, uint16_t port) {
+  char buf[INET_ADDRSTRLEN + 16] = {0};
+  if (inet_ntop(AF_INET, &ip, buf, INET_ADDRSTRLEN) == nullptr) {
+    return {};
+  }
+  char* ptr = buf + strlen(buf);
+  *ptr++ = ':';
+  snprintf(ptr, 16, "%d", ntohs(port));
+  return std::string(buf);
+}
+
+void Report(const char* name, uint64_t ns, size_t ops, uint64_t sink) {
+  printf("%-26s %7.1fns/op (sink=%" PRIu64 ")\n", name,
+         static_cast<double>(ns) / ops, sink);
+}
+
+// Parses and formats |count| random addresses, old and new way, then looks
+// them up in an ordered and a hashed table.
+void Run(size_t count) {
+  std::mt19937 rng(42);
+  std::vector<std::string> texts;
+  std::vector<SocketAddress> addresses(count);
+  texts.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t ip = rng();
+    uint32_t port = rng() % 65536;
+    char buf[SocketAddress::kMaxStringSize];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u:%u", ip >> 24, (ip >> 16) & 255,
+             (ip >> 8) & 255, ip & 255, port);
+    texts.push_back(buf);
+  }
+
+  uint64_t sink = 0;
+  uint64_t start = NowNanos();
+  for (const auto& text : texts) {
+    uint32_t ip;
+    uint16_t port;
+    sink += LegacyFromString(text, &ip, &port);
+  }
+  Report("parse legacy", NowNanos() - start, count, sink);
+
+  sink = 0;
+  start = NowNanos();
+  for (size_t i = 0; i < count; ++i) {
+    sink += addresses[i].FromString(texts[i]);
+  }
+  Report("parse string_view", NowNanos() - start, count, sink);
+
+  std::string list;
+  for (const auto& text : texts) {
+    list += text;
+    list += '\n';
+  }
+  std::vector<SocketAddress> parsed;
+  parsed.reserve(count);
+  start = NowNanos();
+  sink = SocketAddress::ParseList(list, &parsed);
+  Report("parse list", NowNanos() - start, count, parsed.size());
+
+  sink = 0;
+  start = NowNanos();
+  for (const auto& address : addresses) {
+    sink += LegacyToString(address.ip(), address.port()).size();
+  }
+  Report("format legacy", NowNanos() - start, count, sink);
+
+  sink = 0;
+  start = NowNanos();
+  for (const auto& address : addresses) {
+    sink += address.ToString().size();
+  }
+  Report("format ToString", NowNanos() - start, count, sink);
+
+  sink = 0;
+  start = NowNanos();
+  for (const auto& address : addresses) {
+    char buf[SocketAddress::kMaxStringSize];
+    sink += address.ToBuffer(buf, sizeof(buf));
+  }
+  Report("format ToBuffer", NowNanos() - start, count, sink);
+
+  std::map<SocketAddress, size_t> ordered;
+  std::unordered_map<SocketAddress, size_t> hashed;
+  for (size_t i = 0; i < count; ++i) {
+    ordered[addresses[i]] = i;
+    hashed[addresses[i]] = i;
+  }
+  std::shuffle(addresses.begin(), addresses.end(), rng);
+  sink = 0;
+  start = NowNanos();
+  for (const auto& address : addresses) {
+    sink += ordered.find(address)->second;
+  }
+  Report("lookup std::map", NowNanos() - start, count, sink);
+
+  sink = 0;
+  start = NowNanos();
+  for (const auto& address : addresses) {
+    sink += hashed.find(address)->second;
+  }
+  Report("lookup std::unordered_map", NowNanos() - start, count, sink);
+}
+
+}  // namespace
+}  // namespace dlock
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+  dlock::Run(count);
+  return 0;
+}
@@ -1,6 +1,9 @@
 #include "net/socket_address.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <string.h>
+#include <unordered_set>
+#include <vector>
 #include "util/logging.h"
 #include "util/unittest.h"
 
@@ -81,6 +84,36 @@ TEST(SocketAddressTest, TestFromString) {
   }
 }
 
+TEST(SocketAddressTest, TestFromStringWhitespace) {
+  SocketAddress expected("10.1.2.3", 8080);
+  const char* valid[] = {" 10.1.2.3:8080", "10.1.2.3:8080\n",
+                         "10.1.2.3: 8080", "10.1.2.3:\t8080 "};
+  for (const char* test : valid) {
+    SocketAddress address;
+    CHECK_EQ(true, address.FromString(test));
+    CHECK_EQ(address.ip(), expected.ip());
+    CHECK_EQ(address.port(), expected.port());
+  }
+  const char* invalid[] = {"10.1.2.3 :8080", "10.1.2.3:80 80",
+                           "10.1.2.3: ", "10.1.2.3:"};
+  for (const char* test : invalid) {
+    SocketAddress address;
+    CHECK_EQ(false, address.FromString(test));
+  }
+}
+
+TEST(SocketAddressTest, TestFromStringPort) {
+  SocketAddress address;
+  CHECK_EQ(true, address.FromString("10.1.2.3:0"));
+  CHECK_EQ(address.port(), 0);
+  CHECK_EQ(true, address.FromString("10.1.2.3:65535"));
+  const char* invalid[] = {"10.1.2.3:08080", "10.1.2.3:+80", "10.1.2.3:-1",
+                           "10.1.2.3:65536", "10.1.2.3:0x50"};
+  for (const char* test : invalid) {
+    CHECK_EQ(false, address.FromString(test));
+  }
+}
+
 TEST(SocketAddressTest, TestToSockaddrHolder) {
   for (const auto& test : valid_tests) {
     SocketAddress address(test.ip, test.port);
@@ -144,6 +177,61 @@ TEST(SocketAddressTest, TestComparisons) {
   }
 }
 
+TEST(SocketAddressTest, TestFromStringView) {
+  SocketAddress address;
+  std::string_view text = "  10.0.0.1:7000 ,10.0.0.2:7001";
+  CHECK_EQ(true, address.FromString(text.substr(0, 15)));
+  CHECK_EQ(address, SocketAddress("10.0.0.1", 7000));
+  CHECK_EQ(false, address.FromString(text.substr(0, 11)));
+  CHECK_EQ(false, address.FromString("01.2.3.4:5"));
+  CHECK_EQ(false, address.FromString("1.2.3.4:+5"));
+  CHECK_EQ(false, address.FromString("1.2.3:5"));
+  CHECK_EQ(false, address.FromString("1.2.3.4.5:5"));
+}
+
+TEST(SocketAddressTest, TestToBuffer) {
+  for (const auto& test : valid_tests) {
+    SocketAddress address(test.ip, test.port);
+    std::string ip_port = test.ip + ":" + std::to_string(test.port);
+    char buf[SocketAddress::kMaxStringSize];
+    CHECK_EQ(address.ToBuffer(buf, sizeof(buf)), ip_port.size());
+    CHECK_EQ(std::string(buf), ip_port);
+    CHECK_EQ(address.ToBuffer(buf, sizeof(buf), false), test.ip.size());
+    CHECK_EQ(std::string(buf), test.ip);
+  }
+}
+
+TEST(SocketAddressTest, TestParseList) {
+  std::vector<SocketAddress> addresses;
+  CHECK_EQ(2, SocketAddress::ParseList(
+                  "1.1.1.1:1, 2.2.2.2:2\n3.3.3.3:3,,bad 4.4.4.4:70000\n",
+                  &addresses));
+  CHECK_EQ(addresses.size(), 3u);
+  CHECK_EQ(addresses[0], SocketAddress("1.1.1.1", 1));
+  CHECK_EQ(addresses[2], SocketAddress("3.3.3.3", 3));
+
+  // Whitespace after the colon, as FromString() takes it.
+  addresses.clear();
+  CHECK_EQ(1, SocketAddress::ParseList("1.1.1.1: 1,2.2.2.2:\t2 3.3.3.3: ,",
+                                       &addresses));
+  CHECK_EQ(addresses.size(), 2u);
+  CHECK_EQ(addresses[0], SocketAddress("1.1.1.1", 1));
+  CHECK_EQ(addresses[1], SocketAddress("2.2.2.2", 2));
+}
+
+TEST(SocketAddressTest, TestHash) {
+  std::unordered_set<SocketAddress> set;
+  for (const auto& test : valid_tests) {
+    set.insert(SocketAddress(test.ip, test.port));
+  }
+  CHECK_EQ(set.size(), sizeof(valid_tests) / sizeof(valid_tests[0]));
+  CHECK_EQ(1u, set.count(SocketAddress("127.0.0.1", 3243)));
+  CHECK_EQ(0u, set.count(SocketAddress("127.0.0.1", 3244)));
+  std::hash<SocketAddress> hash;
+  CHECK_NE(hash(SocketAddress("10.0.0.1", 80)),
+           hash(SocketAddress("10.0.0.1", 81)));
+}
+
 }  // namespace unittest
 }  // namespace dlock
 
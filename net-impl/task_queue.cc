@@ -0,0 +1,63 @@
+#include "net/task_queue.h"
+#include <time.h>
+
+namespace dlock {
+
+static int64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+TaskQueue::TaskQueue() : head_(nullptr) {}
+
+TaskQueue::~TaskQueue() {
+  Node *node = head_.exchange(nullptr, std::memory_order_acquire);
+  while (node) {
+    Node *next = node->next;
+    delete node;
+    node = next;
+  }
+}
+
+bool TaskQueue::Push(Task task) {
+  Node *node = new Node{std::move(task), nullptr, NowNanos()};
+  // |node| belongs to the consumer once published, only |head| is safe to
+  // look at afterwards.
+  Node *head = head_.load(std::memory_order_relaxed);
+  do {
+    node->next = head;
+  } while (!head_.compare_exchange_weak(head, node, std::memory_order_release,
+                                        std::memory_order_relaxed));
+  return head == nullptr;
+}
+
+int TaskQueue::RunAll(int64_t *queue_delay_ns) {
+  Node *node = head_.exchange(nullptr, std::memory_order_acquire);
+  if (queue_delay_ns) {
+    *queue_delay_ns = 0;
+  }
+  // The stack holds the newest task first.
+  Node *fifo = nullptr;
+  while (node) {
+    Node *next = node->next;
+    node->next = fifo;
+    fifo = node;
+    node = next;
+  }
+  if (fifo && queue_delay_ns) {
+    *queue_delay_ns = NowNanos() - fifo->posted_ns;
+  }
+
+  int count = 0;
+  while (fifo) {
+    Node *next = fifo->next;
+    fifo->task();
+    delete fifo;
+    fifo = next;
+    ++count;
+  }
+  return count;
+}
+
+}  // namespace dlock
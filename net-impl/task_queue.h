@@ -0,0 +1,48 @@
+#ifndef DLOCK_NET_TASK_QUEUE_H_
+#define DLOCK_NET_TASK_QUEUE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include "base/noncopyable.h"
+
+namespace dlock {
+
+using Task = std::function<void()>;
+
+// Lock-free multi-producer single-consumer task queue. Producers push onto
+// an intrusive stack with one CAS; the consumer detaches the whole stack
+// with one exchange and runs it in posting order, so tasks are drained in
+// batches and tasks posted while a batch runs wait for the next one.
+class TaskQueue {
+ public:
+  TaskQueue();
+  ~TaskQueue();
+
+  // Returns true if the queue was empty, i.e. the consumer may need a
+  // wakeup to notice the task.
+  bool Push(Task task);
+  // Runs every task queued so far and returns how many ran. Must only be
+  // called by the consumer. If |queue_delay_ns| is set, it receives how
+  // long the oldest of them waited, or 0 if there was none.
+  int RunAll(int64_t *queue_delay_ns = nullptr);
+  bool empty() const {
+    return head_.load(std::memory_order_relaxed) == nullptr;
+  }
+
+ private:
+  struct Node {
+    Task task;
+    Node *next;
+    // CLOCK_MONOTONIC nanoseconds.
+    int64_t posted_ns;
+  };
+
+  std::atomic<Node *> head_;
+
+  DISALLOW_COPY_AND_ASSIGN(TaskQueue)
+};
+
+}  // namespace dlock
+
+#endif
@@ -1,24 +1,37 @@
-#include "tcp_client_socket.h"
-#include "tcp_socket.h"
+#include "net/tcp_client_socket.h"
+#include "net/event_pump.h"
+#include "net/socket_address.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
 
 namespace dlock {
 
+const int64_t TCPClientSocket::kDefaultConnectTimeoutMs = 3 * 1000;
+
 TCPClientSocket::TCPClientSocket(const SocketAddress& peer_address)
-    : TCPClientSocket(std::make_unique<TCPSocket>(), peer_address, nullptr) {}
+    : TCPClientSocket(std::make_unique<TCPSocket>(),
+                      std::make_unique<SocketAddress>(peer_address),
+                      nullptr) {}
 
 TCPClientSocket::TCPClientSocket(const SocketAddress& peer_address,
                                  const SocketAddress& bind_address)
-    TCPClientSocket(std::make_unique<TCPSocket>(),
-                    std::make_unique<SocketAddress>(peer_address),
-                    std::make_unique<SocketAddress>(bind_address)) {}
+    : TCPClientSocket(std::make_unique<TCPSocket>(),
+                      std::make_unique<SocketAddress>(peer_address),
+                      std::make_unique<SocketAddress>(bind_address)) {}
+
+TCPClientSocket::TCPClientSocket(const SocketAddress& peer_address,
+                                 EventPump* pump)
+    : TCPClientSocket(std::make_unique<TCPSocket>(pump),
+                      std::make_unique<SocketAddress>(peer_address),
+                      nullptr) {}
 
 TCPClientSocket::TCPClientSocket(std::unique_ptr<TCPSocket> connected_socket,
                                  const SocketAddress& peer_address)
     : TCPClientSocket(std::move(connected_socket),
                       std::make_unique<SocketAddress>(peer_address),
-                      std::make_unique<SocketAddress>(bind_address)) {}
+                      nullptr) {}
 
-TCPClientSocket::TCPClientSocket(std::unique_ptr<TCPSocekt> socket,
+TCPClientSocket::TCPClientSocket(std::unique_ptr<TCPSocket> socket,
                                  std::unique_ptr<SocketAddress> peer_address,
                                  std::unique_ptr<SocketAddress> bind_address)
     : socket_(std::move(socket)),
@@ -28,6 +41,102 @@ TCPClientSocket::TCPClientSocket(std::unique_ptr<TCPSocekt> socket,
       previously_disconnected_(false),
       total_received_bytes_(0),
       was_ever_used_(false),
-      was_disconnected_on_suspend_(false) {}
+      was_disconnected_on_suspend_(false),
+      connect_timeout_ms_(kDefaultConnectTimeoutMs),
+      connect_timer_(kInvalidTimerId) {}
+
+TCPClientSocket::~TCPClientSocket() { CancelConnectTimer(); }
+
+int TCPClientSocket::Connect(CompletionCallback callback) {
+  CHECK(socket_);
+  CHECK(!connect_callback_);
+  CHECK_EQ(CONNECT_STATE_NONE, next_connect_state_);
+  next_connect_state_ = CONNECT_STATE_CONNECT;
+  int rv = DoConnectLoop(OK);
+  if (rv == ERR_IO_PENDING) {
+    connect_callback_ = std::move(callback);
+  }
+  return rv;
+}
+
+std::unique_ptr<TCPSocket> TCPClientSocket::ReleaseSocket() {
+  CHECK_EQ(CONNECT_STATE_NONE, next_connect_state_);
+  return std::move(socket_);
+}
+
+int TCPClientSocket::DoConnectLoop(int result) {
+  int rv = result;
+  do {
+    ConnectState state = next_connect_state_;
+    next_connect_state_ = CONNECT_STATE_NONE;
+    switch (state) {
+      case CONNECT_STATE_CONNECT:
+        rv = DoConnect();
+        break;
+      case CONNECT_STATE_CONNECT_COMPLETE:
+        rv = DoConnectComplete(rv);
+        break;
+      default:
+        LOG_ASSERT(false);
+        rv = ERR_FAILED;
+        break;
+    }
+  } while (rv != ERR_IO_PENDING && next_connect_state_ != CONNECT_STATE_NONE);
+  return rv;
+}
+
+int TCPClientSocket::DoConnect() {
+  next_connect_state_ = CONNECT_STATE_CONNECT_COMPLETE;
+  if (socket_->socket_fd() == kInvalidSocket) {
+    int rv = socket_->Open();
+    if (rv == OK && bind_address_) {
+      rv = socket_->Bind(*bind_address_);
+    }
+    if (rv != OK) {
+      return rv;
+    }
+  }
+  int rv = socket_->Connect(*peer_address_,
+                            [this](int result) { OnConnectComplete(result); });
+  if (rv == ERR_IO_PENDING && connect_timeout_ms_ > 0) {
+    connect_timer_ = socket_->pump()->RunAfter(
+        connect_timeout_ms_, [this] { OnConnectTimeout(); });
+  }
+  return rv;
+}
+
+int TCPClientSocket::DoConnectComplete(int result) {
+  CancelConnectTimer();
+  if (result != OK) {
+    // A new Connect() starts over on a fresh socket.
+    socket_->Close();
+    return result;
+  }
+  previously_disconnected_ = false;
+  return OK;
+}
+
+void TCPClientSocket::OnConnectComplete(int result) {
+  int rv = DoConnectLoop(result);
+  if (rv != ERR_IO_PENDING) {
+    CompletionCallback callback;
+    callback.swap(connect_callback_);
+    callback(rv);
+  }
+}
+
+void TCPClientSocket::OnConnectTimeout() {
+  connect_timer_ = kInvalidTimerId;
+  // Dropping the pending connect, its callback will not run.
+  socket_->Close();
+  OnConnectComplete(ERR_CONNECTION_TIMED_OUT);
+}
+
+void TCPClientSocket::CancelConnectTimer() {
+  if (connect_timer_ != kInvalidTimerId) {
+    socket_->pump()->CancelTimer(connect_timer_);
+    connect_timer_ = kInvalidTimerId;
+  }
+}
 
-}  // namespace dlock
\ No newline at end of file
+}  // namespace dlock
@@ -1,20 +1,26 @@
 #ifndef DLOCK_NET_TCP_CLIENT_SOCKET_H_
 #define DLOCK_NET_TCP_CLIENT_SOCKET_H_
 
+#include <stdint.h>
 #include <memory>
 #include "base/noncopyable.h"
+#include "net/net_errors.h"
 #include "net/tcp_connection.h"
+#include "net/timing_wheel.h"
 
 namespace dlock {
 
+class EventPump;
 class SocketAddress;
-class TCPSocekt;
+class TCPSocket;
 
 class TCPClientSocket : public TCPConnection {
  public:
   explicit TCPClientSocket(const SocketAddress& peer_address);
   TCPClientSocket(const SocketAddress& peer_address,
                   const SocketAddress& bind_address);
+  // Connects through |pump|, which runs the callbacks and the deadline.
+  TCPClientSocket(const SocketAddress& peer_address, EventPump* pump);
   TCPClientSocket(std::unique_ptr<TCPSocket> connected_socket,
                   const SocketAddress& peer_address);
   ~TCPClientSocket() override;
@@ -23,22 +29,38 @@ class TCPClientSocket : public TCPConnection {
   bool SetNoDelay(bool no_delay);
   bool SetKeepAlive(bool enable, int delay_secs);
 
+  // Starts a non-blocking connect. Returns OK or an error if it finished
+  // right away, otherwise ERR_IO_PENDING and |callback| gets the result on
+  // the pump's loop thread. An attempt still pending after the connect
+  // timeout fails with ERR_CONNECTION_TIMED_OUT instead of waiting out the
+  // kernel's SYN retries. Call on the loop thread; destroying the socket
+  // cancels the attempt.
+  int Connect(CompletionCallback callback);
+  // 0 disables the deadline.
+  void set_connect_timeout_ms(int64_t timeout_ms) {
+    connect_timeout_ms_ = timeout_ms;
+  }
+  // Hands over the connected socket, leaving this one disconnected.
+  std::unique_ptr<TCPSocket> ReleaseSocket();
+
+  static const int64_t kDefaultConnectTimeoutMs;
+
   // TCP connection implementation
-  vint Read(IOBuffer* buf, int buf_len) override;
+  int Read(IOBuffer* buf, int buf_len) override;
   int Write(IOBuffer* buf, int buf_len) override;
   int SetReceiveBufferSize(int32_t size) override;
   int SetSendBufferSize(int32_t size) override;
   int Connect() override;
   void Disconnect() override;
   bool IsConnected() const override;
-  bool IsConnectedAndIdle() constoverride;
+  bool IsConnectedAndIdle() const override;
   int GetPeerAddress(SocketAddress* address) const override;
   int GetLocalAddress(SocketAddress* address) const override;
   bool WasEverUsed() const override;
   int64_t GetTotalReceivedBytes() const override;
 
  private:
-  TCPClientSocket(std::unique_ptr<TCPSocekt> socket,
+  TCPClientSocket(std::unique_ptr<TCPSocket> socket,
                   std::unique_ptr<SocketAddress> peer_address,
                   std::unique_ptr<SocketAddress> bind_address);
   enum ConnectState {
@@ -47,7 +69,15 @@ class TCPClientSocket : public TCPConnection {
     CONNECT_STATE_NONE,
   };
 
-  std::unique_ptr<TCPSocekt> socket_;
+  // Runs the connect states until one has to wait or all are done.
+  int DoConnectLoop(int result);
+  int DoConnect();
+  int DoConnectComplete(int result);
+  void OnConnectComplete(int result);
+  void OnConnectTimeout();
+  void CancelConnectTimer();
+
+  std::unique_ptr<TCPSocket> socket_;
   std::unique_ptr<SocketAddress> peer_address_;
   std::unique_ptr<SocketAddress> bind_address_;
 
@@ -56,6 +86,9 @@ class TCPClientSocket : public TCPConnection {
   int64_t total_received_bytes_;
   bool was_ever_used_;
   bool was_disconnected_on_suspend_;
+  int64_t connect_timeout_ms_;
+  TimerId connect_timer_;
+  CompletionCallback connect_callback_;
 
   DISALLOW_COPY_AND_ASSIGN(TCPClientSocket);
 };
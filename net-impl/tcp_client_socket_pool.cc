@@ -0,0 +1,128 @@
+#include "net/tcp_client_socket_pool.h"
+#include <time.h>
+#include <algorithm>
+#include "net/event_pump.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+
+namespace dlock {
+
+static int64_t NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+TCPClientSocketPool::Options::Options()
+    : max_idle_per_peer(8),
+      idle_timeout_ms(60 * 1000),
+      eviction_interval_ms(5 * 1000) {}
+
+TCPClientSocketPool::TCPClientSocketPool(EventPump* pump,
+                                         const Options& options)
+    : pump_(pump),
+      options_(options),
+      idle_count_(0),
+      eviction_timer_(kInvalidTimerId),
+      stats_() {
+  CHECK(pump_);
+  CHECK_LT(0, options_.max_idle_per_peer);
+  CHECK(pump_->IsInLoopThread());
+  eviction_timer_ =
+      pump_->RunEvery(options_.eviction_interval_ms, [this] { EvictIdle(); });
+}
+
+TCPClientSocketPool::~TCPClientSocketPool() {
+  pump_->CancelTimer(eviction_timer_);
+  CloseIdleSockets();
+}
+
+std::unique_ptr<TCPSocket> TCPClientSocketPool::Take(
+    const SocketAddress& peer) {
+  auto it = idle_.find(peer);
+  if (it == idle_.end()) {
+    ++stats_.missed;
+    return nullptr;
+  }
+  std::unique_ptr<TCPSocket> socket = std::move(it->second.back().socket);
+  it->second.pop_back();
+  if (it->second.empty()) {
+    idle_.erase(it);
+  }
+  --idle_count_;
+  ++stats_.reused;
+  socket->StopWatchingIdle();
+  return socket;
+}
+
+void TCPClientSocketPool::Release(const SocketAddress& peer,
+                                  std::unique_ptr<TCPSocket> socket) {
+  CHECK(socket);
+  CHECK_EQ(pump_, socket->pump());
+  std::vector<Entry>& entries = idle_[peer];
+  if (static_cast<int>(entries.size()) >= options_.max_idle_per_peer) {
+    // Keep the newest ones.
+    entries.erase(entries.begin());
+    --idle_count_;
+    ++stats_.evicted;
+  }
+  TCPSocket* raw = socket.get();
+  socket->WatchIdle([this, peer, raw](int rv) { RemoveDead(peer, raw); });
+  entries.push_back({std::move(socket), NowMs()});
+  ++idle_count_;
+}
+
+void TCPClientSocketPool::CloseIdleSockets() {
+  // Destroying the sockets closes them.
+  idle_.clear();
+  idle_count_ = 0;
+}
+
+int TCPClientSocketPool::IdleCount(const SocketAddress& peer) const {
+  auto it = idle_.find(peer);
+  return it == idle_.end() ? 0 : static_cast<int>(it->second.size());
+}
+
+void TCPClientSocketPool::EvictIdle() {
+  int64_t deadline = NowMs() - options_.idle_timeout_ms;
+  for (auto it = idle_.begin(); it != idle_.end();) {
+    std::vector<Entry>& entries = it->second;
+    auto last = std::find_if(entries.begin(), entries.end(),
+                             [deadline](const Entry& entry) {
+                               return entry.released_ms > deadline;
+                             });
+    int evicted = static_cast<int>(last - entries.begin());
+    entries.erase(entries.begin(), last);
+    idle_count_ -= evicted;
+    stats_.evicted += evicted;
+    if (entries.empty()) {
+      it = idle_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void TCPClientSocketPool::RemoveDead(const SocketAddress& peer,
+                                     TCPSocket* socket) {
+  auto it = idle_.find(peer);
+  if (it == idle_.end()) {
+    return;
+  }
+  std::vector<Entry>& entries = it->second;
+  for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+    if (entry->socket.get() == socket) {
+      // Runs from the socket's own callback, which is fine as it does not
+      // touch itself afterwards.
+      entries.erase(entry);
+      --idle_count_;
+      ++stats_.dead;
+      break;
+    }
+  }
+  if (entries.empty()) {
+    idle_.erase(it);
+  }
+}
+
+}  // namespace dlock
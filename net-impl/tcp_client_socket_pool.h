@@ -0,0 +1,85 @@
+#ifndef DLOCK_NET_TCP_CLIENT_SOCKET_POOL_H_
+#define DLOCK_NET_TCP_CLIENT_SOCKET_POOL_H_
+
+#include <stdint.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "base/noncopyable.h"
+#include "net/socket_address.h"
+#include "net/timing_wheel.h"
+
+namespace dlock {
+
+class EventPump;
+class TCPSocket;
+
+// Keeps connected sockets to each peer for reuse, so requests skip the
+// handshake. Idle sockets are handed out last in, first out, which favours
+// the ones with warm caches and lets the rest age out. An idle socket is
+// dropped as soon as the reactor reports a hang-up, an error or stray data
+// on it (see TCPSocket::WatchIdle()), so callers need no recv(MSG_PEEK)
+// probe before reusing one. Take() returns TCPSockets; wrap one in a
+// TCPClientSocket with its connected-socket constructor if needed.
+//
+// The pool and its sockets belong to |pump|: create, use and destroy it on
+// the pump's loop thread.
+class TCPClientSocketPool {
+ public:
+  struct Options {
+    Options();
+    // Idle sockets kept per peer, the most recently released win.
+    int max_idle_per_peer;
+    // Idle sockets older than this are closed.
+    int64_t idle_timeout_ms;
+    // How often the eviction timer looks for such sockets.
+    int64_t eviction_interval_ms;
+  };
+
+  struct Stats {
+    int64_t reused;
+    int64_t missed;
+    // Closed because they idled too long or the peer was full.
+    int64_t evicted;
+    // Closed because the reactor reported them dead while idle.
+    int64_t dead;
+  };
+
+  TCPClientSocketPool(EventPump* pump, const Options& options);
+  ~TCPClientSocketPool();
+
+  // Returns the most recently released live socket to |peer|, or nullptr
+  // if a new connection is needed.
+  std::unique_ptr<TCPSocket> Take(const SocketAddress& peer);
+  // Gives back a connected socket to |peer| with no read or write pending.
+  // It is closed instead if |peer| already has max_idle_per_peer.
+  void Release(const SocketAddress& peer, std::unique_ptr<TCPSocket> socket);
+  void CloseIdleSockets();
+
+  int IdleCount(const SocketAddress& peer) const;
+  int IdleCount() const { return idle_count_; }
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Entry {
+    std::unique_ptr<TCPSocket> socket;
+    int64_t released_ms;
+  };
+
+  void EvictIdle();
+  void RemoveDead(const SocketAddress& peer, TCPSocket* socket);
+
+  EventPump* const pump_;
+  const Options options_;
+  // Per peer, oldest first.
+  std::unordered_map<SocketAddress, std::vector<Entry>> idle_;
+  int idle_count_;
+  TimerId eviction_timer_;
+  Stats stats_;
+
+  DISALLOW_COPY_AND_ASSIGN(TCPClientSocketPool)
+};
+
+}  // namespace dlock
+
+#endif
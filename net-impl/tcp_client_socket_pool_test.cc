@@ -0,0 +1,154 @@
+#include "net/tcp_client_socket_pool.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+#include "net/event_pump.h"
+#include "net/event_pump_test_util.h"
+#include "net/tcp_socket.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(TCPClientSocketPoolTest);
+
+namespace {
+
+// A connected socket on |pump| whose other end goes to |peer_fds|.
+std::unique_ptr<TCPSocket> Connect(EventPump* pump,
+                                   std::vector<int>* peer_fds) {
+  int fds[2];
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::unique_ptr<TCPSocket> socket(new TCPSocket(pump));
+  CHECK_EQ(socket->AdoptUnconnectedSocket(fds[0]), 0);
+  peer_fds->push_back(fds[1]);
+  return socket;
+}
+
+void CloseAll(const std::vector<int>& fds) {
+  for (int fd : fds) {
+    close(fd);
+  }
+}
+
+}  // namespace
+
+TEST(TCPClientSocketPoolTest, TestReuseLastReleasedFirst) {
+  EventPump pump;
+  SocketAddress peer("10.0.0.1", 80);
+  SocketAddress other("10.0.0.2", 80);
+  std::vector<int> peer_fds;
+  RunOnLoop(&pump, [&] {
+    TCPClientSocketPool pool(&pump, TCPClientSocketPool::Options());
+    CHECK(pool.Take(peer) == nullptr);
+    std::vector<TCPSocket*> released;
+    for (int i = 0; i < 3; ++i) {
+      std::unique_ptr<TCPSocket> socket = Connect(&pump, &peer_fds);
+      released.push_back(socket.get());
+      pool.Release(peer, std::move(socket));
+    }
+    CHECK_EQ(pool.IdleCount(), 3);
+    CHECK_EQ(pool.IdleCount(peer), 3);
+    CHECK_EQ(pool.IdleCount(other), 0);
+    CHECK(pool.Take(other) == nullptr);
+
+    std::unique_ptr<TCPSocket> socket = pool.Take(peer);
+    CHECK_EQ(socket.get(), released[2]);
+    CHECK_EQ(pool.Take(peer).get(), released[1]);
+    // Back in again, it is the newest.
+    pool.Release(peer, std::move(socket));
+    CHECK_EQ(pool.Take(peer).get(), released[2]);
+    CHECK_EQ(pool.IdleCount(peer), 1);
+
+    const TCPClientSocketPool::Stats& stats = pool.stats();
+    CHECK_EQ(stats.reused, 3);
+    CHECK_EQ(stats.missed, 2);
+    CHECK_EQ(stats.evicted, 0);
+    pool.CloseIdleSockets();
+    CHECK_EQ(pool.IdleCount(), 0);
+  });
+  CloseAll(peer_fds);
+}
+
+TEST(TCPClientSocketPoolTest, TestKeepsNewestPerPeer) {
+  EventPump pump;
+  SocketAddress peer("10.0.0.1", 80);
+  std::vector<int> peer_fds;
+  RunOnLoop(&pump, [&] {
+    TCPClientSocketPool::Options options;
+    options.max_idle_per_peer = 2;
+    TCPClientSocketPool pool(&pump, options);
+    std::vector<TCPSocket*> released;
+    for (int i = 0; i < 3; ++i) {
+      std::unique_ptr<TCPSocket> socket = Connect(&pump, &peer_fds);
+      released.push_back(socket.get());
+      pool.Release(peer, std::move(socket));
+    }
+    CHECK_EQ(pool.IdleCount(peer), 2);
+    CHECK_EQ(pool.stats().evicted, 1);
+    CHECK_EQ(pool.Take(peer).get(), released[2]);
+    CHECK_EQ(pool.Take(peer).get(), released[1]);
+    CHECK(pool.Take(peer) == nullptr);
+  });
+  CloseAll(peer_fds);
+}
+
+// The reactor reports a hang-up or stray bytes on an idle socket, no
+// probe needed.
+TEST(TCPClientSocketPoolTest, TestDropsDeadSockets) {
+  EventPump pump;
+  SocketAddress peer("10.0.0.1", 80);
+  std::vector<int> peer_fds;
+  std::unique_ptr<TCPClientSocketPool> pool;
+  RunOnLoop(&pump, [&] {
+    pool.reset(new TCPClientSocketPool(&pump, TCPClientSocketPool::Options()));
+    for (int i = 0; i < 3; ++i) {
+      pool->Release(peer, Connect(&pump, &peer_fds));
+    }
+  });
+
+  close(peer_fds[0]);
+  peer_fds.erase(peer_fds.begin());
+  CHECK(WaitFor(&pump, [&] { return pool->IdleCount() == 2; }));
+  CHECK_EQ(write(peer_fds[0], "x", 1), 1);
+  CHECK(WaitFor(&pump, [&] { return pool->IdleCount() == 1; }));
+
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(pool->stats().dead, 2);
+    // The one left is the untouched one.
+    std::unique_ptr<TCPSocket> socket = pool->Take(peer);
+    CHECK(socket != nullptr);
+    CHECK_EQ(pool->IdleCount(peer), 0);
+    pool.reset();
+  });
+  CloseAll(peer_fds);
+}
+
+TEST(TCPClientSocketPoolTest, TestEvictsAfterIdleTimeout) {
+  EventPump pump;
+  SocketAddress peer("10.0.0.1", 80);
+  std::vector<int> peer_fds;
+  std::unique_ptr<TCPClientSocketPool> pool;
+  RunOnLoop(&pump, [&] {
+    TCPClientSocketPool::Options options;
+    options.idle_timeout_ms = 20;
+    options.eviction_interval_ms = 10;
+    pool.reset(new TCPClientSocketPool(&pump, options));
+    pool->Release(peer, Connect(&pump, &peer_fds));
+    pool->Release(peer, Connect(&pump, &peer_fds));
+  });
+  CHECK(WaitFor(&pump, [&] { return pool->IdleCount() == 0; }));
+  RunOnLoop(&pump, [&] {
+    CHECK_EQ(pool->stats().evicted, 2);
+    CHECK_EQ(pool->stats().dead, 0);
+    pool.reset();
+  });
+  CloseAll(peer_fds);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(TCPClientSocketPoolTest)
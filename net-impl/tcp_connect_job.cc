@@ -0,0 +1,129 @@
+#include "net/tcp_connect_job.h"
+#include "net/event_pump.h"
+#include "net/tcp_client_socket.h"
+#include "util/logging.h"
+
+namespace dlock {
+
+TCPConnectJob::Options::Options()
+    : attempt_timeout_ms(TCPClientSocket::kDefaultConnectTimeoutMs),
+      stagger_ms(250) {}
+
+TCPConnectJob::TCPConnectJob(EventPump* pump,
+                             const std::vector<SocketAddress>& addresses,
+                             const Options& options)
+    : pump_(pump),
+      addresses_(addresses),
+      options_(options),
+      next_(0),
+      attempts_(addresses.size()),
+      running_(0),
+      last_error_(ERR_ADDRESS_UNREACHABLE),
+      stagger_timer_(kInvalidTimerId),
+      winner_index_(0) {
+  CHECK(pump_);
+}
+
+TCPConnectJob::~TCPConnectJob() { CancelAttempts(); }
+
+int TCPConnectJob::Connect(CompletionCallback callback) {
+  CHECK(!callback_);
+  CHECK_EQ(0u, next_);
+  int rv = StartAttempts();
+  if (rv == ERR_IO_PENDING) {
+    callback_ = std::move(callback);
+  } else {
+    CancelAttempts();
+  }
+  return rv;
+}
+
+std::unique_ptr<TCPClientSocket> TCPConnectJob::ReleaseSocket() {
+  return std::move(winner_);
+}
+
+const SocketAddress& TCPConnectJob::connected_address() const {
+  return addresses_[winner_index_];
+}
+
+int TCPConnectJob::StartAttempts() {
+  while (next_ < addresses_.size()) {
+    size_t index = next_++;
+    std::unique_ptr<TCPClientSocket> socket(
+        new TCPClientSocket(addresses_[index], pump_));
+    socket->set_connect_timeout_ms(options_.attempt_timeout_ms);
+    int rv = socket->Connect(
+        [this, index](int result) { OnAttemptComplete(index, result); });
+    if (rv == OK) {
+      winner_ = std::move(socket);
+      winner_index_ = index;
+      return OK;
+    }
+    if (rv != ERR_IO_PENDING) {
+      last_error_ = rv;
+      continue;
+    }
+    attempts_[index] = std::move(socket);
+    ++running_;
+    if (options_.stagger_ms > 0) {
+      if (next_ < addresses_.size()) {
+        stagger_timer_ = pump_->RunAfter(options_.stagger_ms,
+                                         [this] { OnStaggerTimer(); });
+      }
+      return ERR_IO_PENDING;
+    }
+  }
+  return running_ ? ERR_IO_PENDING : last_error_;
+}
+
+void TCPConnectJob::OnAttemptComplete(size_t index, int result) {
+  // Called by the attempt itself as its last step, so it may go away here.
+  std::unique_ptr<TCPClientSocket> socket = std::move(attempts_[index]);
+  --running_;
+  if (result == OK) {
+    winner_ = std::move(socket);
+    winner_index_ = index;
+    Finish(OK);
+    return;
+  }
+  last_error_ = result;
+  socket.reset();
+
+  // No need to wait out the stagger after a failure.
+  if (stagger_timer_ != kInvalidTimerId) {
+    pump_->CancelTimer(stagger_timer_);
+    stagger_timer_ = kInvalidTimerId;
+  }
+  int rv = StartAttempts();
+  if (rv != ERR_IO_PENDING) {
+    Finish(rv);
+  }
+}
+
+void TCPConnectJob::OnStaggerTimer() {
+  stagger_timer_ = kInvalidTimerId;
+  int rv = StartAttempts();
+  if (rv != ERR_IO_PENDING) {
+    Finish(rv);
+  }
+}
+
+void TCPConnectJob::CancelAttempts() {
+  if (stagger_timer_ != kInvalidTimerId) {
+    pump_->CancelTimer(stagger_timer_);
+    stagger_timer_ = kInvalidTimerId;
+  }
+  for (auto& attempt : attempts_) {
+    attempt.reset();
+  }
+  running_ = 0;
+}
+
+void TCPConnectJob::Finish(int result) {
+  CancelAttempts();
+  CompletionCallback callback;
+  callback.swap(callback_);
+  callback(result);
+}
+
+}  // namespace dlock
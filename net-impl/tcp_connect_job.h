@@ -0,0 +1,75 @@
+#ifndef DLOCK_NET_TCP_CONNECT_JOB_H_
+#define DLOCK_NET_TCP_CONNECT_JOB_H_
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "base/noncopyable.h"
+#include "net/net_errors.h"
+#include "net/socket_address.h"
+#include "net/timing_wheel.h"
+
+namespace dlock {
+
+class EventPump;
+class TCPClientSocket;
+
+// Connects to the first reachable of several replica addresses. Attempts
+// start in order, the next one |stagger_ms| after the previous or as soon
+// as it fails, and then run concurrently, each bounded by its own connect
+// deadline. The first to connect wins and the others are cancelled, so a
+// dead replica costs at most |stagger_ms| rather than a SYN timeout.
+//
+// Lives on the loop thread of |pump|, like the sockets it creates.
+class TCPConnectJob {
+ public:
+  struct Options {
+    Options();
+    int64_t attempt_timeout_ms;
+    // 0 starts all attempts at once.
+    int64_t stagger_ms;
+  };
+
+  TCPConnectJob(EventPump* pump, const std::vector<SocketAddress>& addresses,
+                const Options& options);
+  // Cancels the attempts still running.
+  ~TCPConnectJob();
+
+  // Returns OK if an attempt connected right away, an error if all failed,
+  // or ERR_IO_PENDING and then runs |callback| with OK or the error of the
+  // last attempt to fail.
+  int Connect(CompletionCallback callback);
+
+  // The winning connection once Connect() reported OK.
+  std::unique_ptr<TCPClientSocket> ReleaseSocket();
+  const SocketAddress& connected_address() const;
+
+ private:
+  // Starts attempts until one is pending, or connects, or the addresses run
+  // out, and returns the state of the whole job.
+  int StartAttempts();
+  void OnAttemptComplete(size_t index, int result);
+  void OnStaggerTimer();
+  // Stops the timer and the remaining attempts.
+  void CancelAttempts();
+  void Finish(int result);
+
+  EventPump* const pump_;
+  const std::vector<SocketAddress> addresses_;
+  const Options options_;
+  size_t next_;
+  // Indexed like |addresses_|, set while the attempt runs.
+  std::vector<std::unique_ptr<TCPClientSocket>> attempts_;
+  int running_;
+  int last_error_;
+  TimerId stagger_timer_;
+  CompletionCallback callback_;
+  std::unique_ptr<TCPClientSocket> winner_;
+  size_t winner_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(TCPConnectJob)
+};
+
+}  // namespace dlock
+
+#endif
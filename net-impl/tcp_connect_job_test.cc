@@ -0,0 +1,158 @@
+#include "net/tcp_connect_job.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "net/event_pump.h"
+#include "net/event_pump_test_util.h"
+#include "net/tcp_client_socket.h"
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(TCPConnectJobTest);
+
+namespace {
+
+// A socket bound to a free loopback port, listening with |backlog| unless
+// it is negative.
+int BindLoopback(int backlog, SocketAddress* address) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)),
+           0);
+  socklen_t len = sizeof(addr);
+  CHECK_EQ(getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len),
+           0);
+  if (backlog >= 0) {
+    CHECK_EQ(listen(fd, backlog), 0);
+  }
+  *address = SocketAddress("127.0.0.1", ntohs(addr.sin_port));
+  return fd;
+}
+
+// Connects do not complete: the accept queue of the listener is full, so
+// it drops their SYNs. Returns the fds to close.
+std::vector<int> Blackhole(SocketAddress* address) {
+  int listener = BindLoopback(0, address);
+  int filler = socket(AF_INET, SOCK_STREAM, 0);
+  SockaddrHolder holder = address->ToSockaddrHolder();
+  CHECK_EQ(connect(filler, holder.addr, holder.addr_len), 0);
+  return {listener, filler};
+}
+
+struct Result {
+  int result;
+  SocketAddress address;
+};
+
+// Runs a job over |addresses| on |pump|, recording what it reports.
+class JobRunner {
+ public:
+  JobRunner(EventPump* pump, const std::vector<SocketAddress>& addresses,
+            const TCPConnectJob::Options& options)
+      : pump_(pump) {
+    RunOnLoop(pump_, [&] {
+      job_.reset(new TCPConnectJob(pump_, addresses, options));
+      int rv = job_->Connect([this](int rv) { OnComplete(rv); });
+      if (rv != ERR_IO_PENDING) {
+        OnComplete(rv);
+      }
+    });
+  }
+  ~JobRunner() {
+    RunOnLoop(pump_, [this] { job_.reset(); });
+  }
+
+  // Waits for the job to report and returns the results so far.
+  std::vector<Result> Wait() {
+    CHECK(WaitFor(pump_, [this] { return !results_.empty(); }));
+    std::vector<Result> results;
+    RunOnLoop(pump_, [&] { results = results_; });
+    return results;
+  }
+
+ private:
+  void OnComplete(int rv) {
+    results_.push_back({rv, rv == OK ? job_->connected_address()
+                                     : SocketAddress()});
+  }
+
+  EventPump* const pump_;
+  std::unique_ptr<TCPConnectJob> job_;
+  std::vector<Result> results_;
+};
+
+}  // namespace
+
+TEST(TCPConnectJobTest, TestFirstSuccessWins) {
+  EventPump pump;
+  SocketAddress dead, live;
+  std::vector<int> fds = Blackhole(&dead);
+  fds.push_back(BindLoopback(16, &live));
+  TCPConnectJob::Options options;
+  options.attempt_timeout_ms = 200;
+  options.stagger_ms = 0;
+  {
+    JobRunner runner(&pump, {dead, live}, options);
+    std::vector<Result> results = runner.Wait();
+    CHECK_EQ(results.size(), 1u);
+    CHECK_EQ(results[0].result, OK);
+    CHECK_EQ(results[0].address, live);
+    // The losing attempt was dropped, its deadline does not report.
+    usleep(400 * 1000);
+    CHECK_EQ(runner.Wait().size(), 1u);
+  }
+  for (int fd : fds) {
+    close(fd);
+  }
+}
+
+TEST(TCPConnectJobTest, TestFailsOverOnRefused) {
+  EventPump pump;
+  SocketAddress refused, live;
+  int closed = BindLoopback(-1, &refused);
+  int listener = BindLoopback(16, &live);
+  // Waiting out the stagger would miss the deadline of Wait().
+  TCPConnectJob::Options options;
+  options.stagger_ms = 10 * 1000;
+  {
+    JobRunner runner(&pump, {refused, live}, options);
+    std::vector<Result> results = runner.Wait();
+    CHECK_EQ(results.size(), 1u);
+    CHECK_EQ(results[0].result, OK);
+    CHECK_EQ(results[0].address, live);
+  }
+  close(closed);
+  close(listener);
+}
+
+TEST(TCPConnectJobTest, TestTimesOut) {
+  EventPump pump;
+  SocketAddress dead;
+  std::vector<int> fds = Blackhole(&dead);
+  TCPConnectJob::Options options;
+  options.attempt_timeout_ms = 100;
+  {
+    JobRunner runner(&pump, {dead}, options);
+    std::vector<Result> results = runner.Wait();
+    CHECK_EQ(results.size(), 1u);
+    CHECK_EQ(results[0].result, ERR_CONNECTION_TIMED_OUT);
+  }
+  for (int fd : fds) {
+    close(fd);
+  }
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(TCPConnectJobTest)
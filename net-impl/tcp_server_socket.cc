@@ -1,16 +1,130 @@
 #include "net/tcp_server_socket.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "net/event_pump.h"
+#include "net/event_pump_group.h"
+#include "net/fd_watcher.h"
+#include "net/metrics.h"
+#include "net/net_errors.h"
 #include "net/socket_address.h"
 #include "net/tcp_socket.h"
+#include "util/logging.h"
 
 namespace dlock {
 
+namespace {
+
+// The accept queue is only inspected, which costs a getsockopt(), after a
+// wakeup that drained at least this many connections, since a queue
+// filling up shows up as long drains first, and on every so many wakeups
+// otherwise.
+const int kQueueSampleBatch = 16;
+const int kQueueSampleInterval = 64;
+
+}  // namespace
+
+class TCPServerSocket::ShardListener : public FdWatcher {
+ public:
+  ShardListener(EventPump* pump, const AcceptCallback* callback)
+      : socket_(new TCPSocket(pump)),
+        pump_(pump),
+        callback_(callback),
+        wakeups_(0),
+        last_batch_(0),
+        accepted_(0),
+        queue_full_(0),
+        errors_(0) {}
+
+  TCPSocket* socket() const { return socket_.get(); }
+  int64_t accepted() const { return accepted_.load(std::memory_order_relaxed); }
+  int64_t queue_full() const {
+    return queue_full_.load(std::memory_order_relaxed);
+  }
+  int64_t errors() const { return errors_.load(std::memory_order_relaxed); }
+
+  void OnReadable(int fd) override {
+    if (++wakeups_ % kQueueSampleInterval == 0 ||
+        last_batch_ >= kQueueSampleBatch) {
+      CheckQueue(fd);
+    }
+
+    // Edge triggered, so the queue must be drained.
+    int batch = 0;
+    for (;;) {
+      std::unique_ptr<TCPSocket> accepted;
+      int rv = socket_->Accept(&accepted, pump_);
+      if (rv == OK) {
+        ++batch;
+        Bump(&accepted_);
+        Metrics::Add(Metrics::SERVER_ACCEPTS, 1);
+        (*callback_)(std::move(accepted));
+        continue;
+      }
+      if (rv == ERR_IO_PENDING) {
+        break;
+      }
+      if (rv == ERR_CONNECTION_ABORTED) {
+        // The client went away while queued.
+        continue;
+      }
+      // Out of fds or memory. The rest waits for the next connection.
+      Bump(&errors_);
+      Metrics::Add(Metrics::SERVER_ACCEPT_ERRORS, 1);
+      LOG_ERROR("accept4 on listener %d failed, %s", fd, ErrorToString(rv));
+      break;
+    }
+    last_batch_ = batch;
+  }
+
+  void OnWritable(int fd) override {}
+
+ private:
+  void CheckQueue(int fd) {
+    // For a listener, tcpi_unacked is the accept queue length and
+    // tcpi_sacked its backlog.
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 &&
+        info.tcpi_unacked >= info.tcpi_sacked) {
+      int64_t count = Bump(&queue_full_);
+      Metrics::Add(Metrics::SERVER_ACCEPT_QUEUE_FULL, 1);
+      if ((count & (count - 1)) == 0) {
+        LOG_ERROR("accept queue of listener %d full (%u), %ld times so far",
+                  fd, info.tcpi_sacked, static_cast<long>(count));
+      }
+    }
+  }
+
+  // Written on the loop thread only.
+  static int64_t Bump(std::atomic<int64_t>* counter) {
+    int64_t value = counter->load(std::memory_order_relaxed) + 1;
+    counter->store(value, std::memory_order_relaxed);
+    return value;
+  }
+
+  std::unique_ptr<TCPSocket> socket_;
+  EventPump* pump_;
+  const AcceptCallback* callback_;
+  // Loop thread only.
+  uint32_t wakeups_;
+  // Connections taken by the last wakeup.
+  int last_batch_;
+  std::atomic<int64_t> accepted_;
+  std::atomic<int64_t> queue_full_;
+  std::atomic<int64_t> errors_;
+};
+
 TCPServerSocket::TCPServerSocket()
     : TCPServerSocket(std::make_unique<TCPSocket>()) {}
 
 TCPServerSocket::TCPServerSocket(std::unique_ptr<TCPSocket> socket)
-    : socket_(std::move(socket)), pending_accept_(false) {}
+    : socket_(std::move(socket)), pending_accept_(false), group_(nullptr) {}
 
-TCPServerSocket::~TCPServerSocket() = default;
+TCPServerSocket::~TCPServerSocket() { StopListeningSharded(); }
 
 int TCPServerSocket::AdoptSocket(int socket_fd) {
   return socket_->AdoptUnconnectedSocket(socket);
@@ -61,4 +175,88 @@ int TCPServerSocket::Accept(std::unique_ptr<TCPConnection>* connection,
   return ret;
 }
 
-}  // namespace dlock
\ No newline at end of file
+int TCPServerSocket::ListenSharded(const SocketAddress& address, int backlog,
+                                   EventPumpGroup* group,
+                                   AcceptCallback callback) {
+  CHECK(group);
+  CHECK(shards_.empty());
+  group_ = group;
+  accept_callback_ = std::move(callback);
+  for (int i = 0; i < group->size(); ++i) {
+    std::unique_ptr<ShardListener> shard(
+        new ShardListener(group->GetPump(i), &accept_callback_));
+    TCPSocket* socket = shard->socket();
+    int ret = socket->Open();
+    if (!ret) {
+      ret = socket->AllowPortReuse();
+    }
+    if (!ret) {
+      ret = socket->Bind(address);
+    }
+    if (!ret) {
+      ret = socket->Listen(backlog);
+    }
+    if (ret) {
+      StopListeningSharded();
+      return ret;
+    }
+    group->AddFdWatcherOn(i, socket->socket_fd(), READ, shard.get());
+    shards_.push_back(std::move(shard));
+  }
+  return OK;
+}
+
+void TCPServerSocket::StopListeningSharded() {
+  for (auto& shard : shards_) {
+    // Waits out a dispatch in progress before the watcher goes away.
+    group_->BlockRemoveFd(shard->socket()->socket_fd());
+  }
+  shards_.clear();
+}
+
+TCPServerSocket::AcceptStats TCPServerSocket::GetAcceptStats() const {
+  AcceptStats stats = {0, 0, 0};
+  for (const auto& shard : shards_) {
+    stats.accepted += shard->accepted();
+    stats.queue_full += shard->queue_full();
+    stats.errors += shard->errors();
+  }
+  return stats;
+}
+
+int TCPServerSocket::GetListenOverflows(int64_t* overflows, int64_t* drops) {
+  CHECK(overflows && drops);
+  FILE* file = fopen("/proc/net/netstat", "r");
+  if (!file) {
+    return ERR_FAILED;
+  }
+  // A "TcpExt:" line of names is followed by one of values.
+  char names[4096];
+  char values[4096];
+  int ret = ERR_FAILED;
+  while (fgets(names, sizeof(names), file) &&
+         fgets(values, sizeof(values), file)) {
+    if (strncmp(names, "TcpExt:", 7) != 0) {
+      continue;
+    }
+    char* name_save;
+    char* value_save;
+    char* name = strtok_r(names, " \n", &name_save);
+    char* value = strtok_r(values, " \n", &value_save);
+    while (name && value) {
+      if (!strcmp(name, "ListenOverflows")) {
+        *overflows = strtoll(value, nullptr, 10);
+        ret = OK;
+      } else if (!strcmp(name, "ListenDrops")) {
+        *drops = strtoll(value, nullptr, 10);
+      }
+      name = strtok_r(nullptr, " \n", &name_save);
+      value = strtok_r(nullptr, " \n", &value_save);
+    }
+    break;
+  }
+  fclose(file);
+  return ret;
+}
+
+}  // namespace dlock
@@ -1,11 +1,16 @@
 #ifndef DLOCK_NET_TCP_SERVER_SOCKET_H_
 #define DLOCK_NET_TCP_SERVER_SOCKET_H_
 
+#include <stdint.h>
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include "base/noncopyable.h"
 
 namespace dlock {
 
+class EventPumpGroup;
 class SocketAddress;
 class TCPSocket;
 class TCPConnection;
@@ -23,15 +28,50 @@ class TCPServerSocket {
   int Accept(std::unique_ptr<TCPConnection>* connection,
              SocketAddress* peer_address=nullptr);
 
+  // Gets a connection accepted by ListenSharded() on the loop thread of the
+  // pump it was accepted on, which is also the pump of the socket. Runs on
+  // all pumps of the group concurrently.
+  typedef std::function<void(std::unique_ptr<TCPSocket> socket)>
+      AcceptCallback;
+
+  // Opens one SO_REUSEPORT listener on |address| per pump of |group|, so
+  // the kernel spreads incoming connections over the loops instead of
+  // funnelling them through one fd. Each readiness event drains the queue
+  // of its listener with accept4() and hands the sockets to |callback|.
+  int ListenSharded(const SocketAddress& address, int backlog,
+                    EventPumpGroup* group, AcceptCallback callback);
+  // Closes the sharded listeners, also done on destruction. Must not be
+  // called on a thread of the group.
+  void StopListeningSharded();
+
+  struct AcceptStats {
+    int64_t accepted;
+    // Wakeups that found an accept queue at its backlog, meaning the
+    // kernel was dropping connection attempts. Only wakeups following a
+    // long drain, and every 64th, look, so this undercounts short bursts.
+    int64_t queue_full;
+    // accept4() failures other than an empty queue, e.g. EMFILE.
+    int64_t errors;
+  };
+  AcceptStats GetAcceptStats() const;
+  // Reads the system wide TcpExt ListenOverflows and ListenDrops counters
+  // from /proc/net/netstat.
+  static int GetListenOverflows(int64_t* overflows, int64_t* drops);
+
  private:
   int ConvertAcccptedSocket(
       std::unique_ptr<TCPConnection>* output_accepted_connection,
       SocketAddress* output_accepted_address);
 
+  class ShardListener;
+
   std::unique_ptr<TCPSocket> socekt_;
   std::unique_ptr<TCPSocekt> accepted_socket_;
   SocketAddress accepted_address_;
   bool pending_accept_;
+  EventPumpGroup* group_;
+  AcceptCallback accept_callback_;
+  std::vector<std::unique_ptr<ShardListener>> shards_;
 
   DISALLOW_COPY_AND_ASSIGN(TCPServerSocket);
 };
@@ -1,13 +1,130 @@
 #include "net/tcp_socket.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include "net/event_pump.h"
+#include "net/io_buffer.h"
+#include "net/io_buffer_chain.h"
+#include "net/metrics.h"
 #include "util/logging.h"
 
 namespace dlock {
 
-TCPSocket::TCPSocekt()
+// Slices beyond this are sent or filled by the next call.
+static const int kMaxIovecs = 64;
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+const int TCPSocket::kDefaultZeroCopyThreshold = 16 * 1024;
+
+// Upper bound of one sendfile()/splice() call.
+static const size_t kMaxSendFileChunk = 1 << 30;
+
+// How often a closed socket polls for the rest of its zero-copy
+// completions, and how long it waits for a peer that stopped reading.
+static const int64_t kZeroCopyReapIntervalMs = 10;
+static const int64_t kZeroCopyLingerMs = 30 * 1000;
+
+class TCPSocket::SourceWatcher : public FdWatcher {
+ public:
+  explicit SourceWatcher(TCPSocket* socket) : socket_(socket) {}
+
+  void OnReadable(int fd) override { socket_->OnSourceReadable(); }
+  void OnWritable(int fd) override {}
+
+ private:
+  TCPSocket* socket_;
+};
+
+// Owns the descriptor of a closed socket until the kernel is done with the
+// pages of its zero-copy sends, then closes it and deletes itself. The
+// error queue is polled rather than watched, as the peer may keep the
+// socket readable meanwhile.
+class TCPSocket::ZeroCopyReaper {
+ public:
+  ZeroCopyReaper(EventPump* pump, int fd, std::deque<ZeroCopySend> pending)
+      : pump_(pump),
+        fd_(fd),
+        pending_(std::move(pending)),
+        waited_ms_(0),
+        timer_(kInvalidTimerId) {}
+
+  // Timers belong to the loop thread, so this may hop there first.
+  void Start() {
+    if (!pump_->IsInLoopThread()) {
+      pump_->PostTask([this] { Start(); });
+      return;
+    }
+    timer_ = pump_->RunEvery(kZeroCopyReapIntervalMs, [this] { Poll(); });
+  }
+
+ private:
+  void Poll() {
+    ReapZeroCopyCompletions(fd_, &pending_);
+    waited_ms_ += kZeroCopyReapIntervalMs;
+    if (!pending_.empty()) {
+      if (waited_ms_ < kZeroCopyLingerMs) {
+        return;
+      }
+      // Resetting the connection purges the send queue, and with it the
+      // references of the kernel to the pages.
+      struct linger abort = {1, 0};
+      setsockopt(fd_, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+    }
+    pump_->CancelTimer(timer_);
+    ::close(fd_);
+    delete this;
+  }
+
+  EventPump* pump_;
+  int fd_;
+  std::deque<ZeroCopySend> pending_;
+  int64_t waited_ms_;
+  TimerId timer_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZeroCopyReaper);
+};
+
+TCPSocket::TCPSocket() : TCPSocket(EventPump::GetInstance()) {}
+
+TCPSocket::TCPSocket(EventPump* pump)
     : socket_fd_(kInvalidSocket),
+      pump_(pump),
+      watched_events_(0),
       read_buf_len_(0),
       write_buf_len_(0),
-      waiting_connect_(false) {}
+      write_buf_offset_(0),
+      waiting_connect_(false),
+      zerocopy_threshold_(0),
+      zerocopy_next_id_(0),
+      zerocopy_copied_(0),
+      sendfile_fd_(-1),
+      sendfile_offset_(0),
+      sendfile_remaining_(0),
+      sendfile_total_(0),
+      sendfile_sent_(0),
+      waiting_source_(false),
+      source_watched_fd_(-1),
+      stats_() {
+  CHECK(pump_);
+}
 
 TCPSocekt::~TCPSocekt() { Close(); }
 
@@ -88,23 +205,70 @@ int TCPSocekt::Accept(std::unique_ptr<TCPSocket>* socket) {
     return -1;
   }
 
-  std::unique_ptr<TCPSocket> accepted_socket(new TCPSocket);
+  std::unique_ptr<TCPSocket> accepted_socket(new TCPSocket(pump_));
   accepted_socket->AdoptConnectedSocket(new_socket,
                                         peer_addr.ToSocketAddress());
   *socket = std::move(accepted_socket);
   return 0;
 }
 
+int TCPSocket::Accept(std::unique_ptr<TCPSocket>* socket, EventPump* pump) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  CHECK(socket);
+  SockaddrHolder peer_addr;
+  int new_socket;
+  do {
+    new_socket = accept4(socket_fd_, peer_addr.addr, &peer_addr.addr_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+  } while (new_socket < 0 && errno == EINTR);
+  if (new_socket < 0) {
+    return MapSystemError(errno);
+  }
+
+  std::unique_ptr<TCPSocket> accepted_socket(new TCPSocket(pump));
+  accepted_socket->socket_fd_ = new_socket;
+  accepted_socket->SetPeerAddress(peer_addr.ToSocketAddress());
+  *socket = std::move(accepted_socket);
+  return OK;
+}
+
 int TCPSocket::Connect(const SocketAddress& address) {
   CHECK_NE(kInvalidSocket, socket_fd_);
   SetPeerAddress(address);
   SockaddrHolder peer_address = address.ToSockaddrHolder();
 
-  if (::connect(socket_fd_, peer_address.addr, peer_address.len) != 0) {
+  if (::connect(socket_fd_, peer_address.addr, peer_address.addr_len) == 0) {
+    return OK;
+  }
+  // The socket is non-blocking, so the handshake usually goes on in the
+  // background; the callback version reports how it ends.
+  int rv = MapSystemError(errno == EINTR ? EINPROGRESS : errno);
+  if (rv != ERR_IO_PENDING) {
     LOG_ERROR("connect failed. %s", strerror(errno));
-    return -1;
   }
-  return 0;
+  return rv;
+}
+
+int TCPSocket::Connect(const SocketAddress& address,
+                       CompletionCallback callback) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  CHECK(!waiting_connect_ && !write_callback_);
+  SetPeerAddress(address);
+  SockaddrHolder peer_address = address.ToSockaddrHolder();
+
+  if (::connect(socket_fd_, peer_address.addr, peer_address.addr_len) == 0) {
+    return OK;
+  }
+  // An interrupted connect() goes on in the background.
+  int rv = MapSystemError(errno == EINTR ? EINPROGRESS : errno);
+  if (rv != ERR_IO_PENDING) {
+    LOG_ERROR("connect failed. %s", strerror(errno));
+    return rv;
+  }
+  waiting_connect_ = true;
+  write_callback_ = std::move(callback);
+  UpdateWatch();
+  return ERR_IO_PENDING;
 }
 
 bool TCPSocket::IsConnected() const {
@@ -136,14 +300,80 @@ bool TCPSocket::IsConnectedAndIdle() const {
 
 int TCPSocket::Read(IOBuffer* buf, int buf_len) {
   CHECK_NE(kInvalidSocket, socket_fd_);
-  return read(socket_fd_, buf->data(), buf_len);
+  int rv = read(socket_fd_, buf->data(), buf_len);
+  CountRead(rv);
+  return rv;
 }
 
 int TCPSocket::Write(IOBuffer* buf, int buf_len) {
   CHECK_NE(kInvalidSocket, socket_fd_);
   CHECK_LT(0, buf_len);
 
-  return send(socket_fd_, buf->data(), buf_len, MSG_NOSIGNAL);
+  int rv = send(socket_fd_, buf->data(), buf_len, MSG_NOSIGNAL);
+  CountWrite(rv);
+  return rv;
+}
+
+int TCPSocket::Read(const IOBufferChain& bufs) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  struct iovec iov[kMaxIovecs];
+  int count = bufs.FillIovec(iov, kMaxIovecs);
+  int rv = readv(socket_fd_, iov, count);
+  CountRead(rv);
+  return rv;
+}
+
+int TCPSocket::Write(const IOBufferChain& bufs) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  CHECK(!bufs.empty());
+  struct iovec iov[kMaxIovecs];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = bufs.FillIovec(iov, kMaxIovecs);
+  // writev() with MSG_NOSIGNAL.
+  int rv = sendmsg(socket_fd_, &msg, MSG_NOSIGNAL);
+  CountWrite(rv);
+  return rv;
+}
+
+int TCPSocket::Read(IOBuffer* buf, int buf_len,
+                    CompletionCallback callback) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  CHECK(!read_callback_);
+  CHECK_LT(0, buf_len);
+  read_buf_ = buf;
+  read_buf_len_ = buf_len;
+  int rv = DoRead();
+  if (rv != ERR_IO_PENDING) {
+    read_buf_ = nullptr;
+    read_buf_len_ = 0;
+    return rv;
+  }
+  read_callback_ = std::move(callback);
+  UpdateWatch();
+  return ERR_IO_PENDING;
+}
+
+int TCPSocket::Write(IOBuffer* buf, int buf_len,
+                     CompletionCallback callback) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  CHECK(!waiting_connect_ && !write_callback_);
+  CHECK_LT(0, buf_len);
+  write_buf_ = buf;
+  write_buf_len_ = buf_len;
+  write_buf_offset_ = 0;
+  int rv = DoWrite();
+  if (rv != ERR_IO_PENDING) {
+    write_buf_ = nullptr;
+    write_buf_len_ = 0;
+    // Zero-copy sends need the error queue watched.
+    UpdateWatch();
+    return rv;
+  }
+  write_callback_ = std::move(callback);
+  UpdateWatch();
+  return ERR_IO_PENDING;
 }
 
 SocketAddress TCPSocket::GetLocalAddress() const {
@@ -156,8 +386,13 @@ SocketAddress TCPSocket::GetLocalAddress() const {
 
 int TCPSocket::GetLocalAddress(SocketAddress* address) const {
   CHECK(address);
-
-  return getsockname(socket_fd_, address->addr, &address->addr_len)
+  SockaddrHolder local;
+  if (::getsockname(socket_fd_, local.addr, &local.addr_len) < 0) {
+    LOG_ERROR("getsockname(%d) failed, %s", socket_fd_, strerror(errno));
+    return -1;
+  }
+  *address = local.ToSocketAddress();
+  return 0;
 }
 
 int TCPSocket::GetPeerAddress(SocketAddress* address) const {
@@ -182,6 +417,16 @@ int TCPSocketPosix::AllowAddressReuse() {
   return SetReuseAddr(socket_->socket_fd(), true);
 }
 
+int TCPSocket::AllowPortReuse() {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  int on = 1;
+  if (setsockopt(socket_fd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    LOG_ERROR("setsockopt(SO_REUSEPORT) failed, %s", strerror(errno));
+    return MapSystemError(errno);
+  }
+  return OK;
+}
+
 bool TCPSocket::SetKeepAlive(bool enable, int delay) {
   if (!socket_) return false;
 
@@ -204,8 +449,393 @@ int TCPSocketPosix::SetSendBufferSize(int32_t size) {
 }
 
 void TCPSocket::Close() {
+  if (socket_fd_ == kInvalidSocket) {
+    return;
+  }
+  if (watched_events_) {
+    pump_->DelFdWatcher(socket_fd_, static_cast<EventType>(watched_events_));
+    watched_events_ = 0;
+  }
+  if (source_watched_fd_ >= 0) {
+    pump_->DelFdWatcher(source_watched_fd_, READ);
+    source_watched_fd_ = -1;
+  }
+  sendfile_fd_ = -1;
+  progress_callback_ = nullptr;
+  waiting_source_ = false;
+  read_buf_ = nullptr;
+  read_buf_len_ = 0;
+  read_callback_ = nullptr;
+  write_buf_ = nullptr;
+  write_buf_len_ = 0;
+  write_buf_offset_ = 0;
+  write_callback_ = nullptr;
+  waiting_connect_ = false;
+  idle_callback_ = nullptr;
+  peer_address_.reset();
+  if (!zerocopy_pending_.empty()) {
+    zerocopy_copied_ +=
+        ReapZeroCopyCompletions(socket_fd_, &zerocopy_pending_);
+  }
+  if (zerocopy_pending_.empty()) {
+    ::close(socket_fd_);
+  } else {
+    // The kernel may still read the pages of these buffers, so they must
+    // not be reused, and only this descriptor tells when they are done.
+    // The peer gets its FIN after the data as with close().
+    shutdown(socket_fd_, SHUT_WR);
+    (new ZeroCopyReaper(pump_, socket_fd_, std::move(zerocopy_pending_)))
+        ->Start();
+    zerocopy_pending_.clear();
+  }
+  socket_fd_ = kInvalidSocket;
+}
+
+void TCPSocket::OnReadable(int fd) { OnFdEvents(fd, READ); }
+
+void TCPSocket::OnWritable(int fd) { OnFdEvents(fd, WRITE); }
+
+void TCPSocket::OnFdEvents(int fd, int events) {
+  CompletionCallback read_callback;
+  CompletionCallback write_callback;
+  int read_rv = OK;
+  int write_rv = OK;
+  if ((events & IO_ERROR) && !zerocopy_pending_.empty()) {
+    zerocopy_copied_ +=
+        ReapZeroCopyCompletions(socket_fd_, &zerocopy_pending_);
+  }
+  CompletionCallback idle_callback;
+  int idle_rv = OK;
+  if (idle_callback_) {
+    idle_rv = CheckIdle(events);
+    if (idle_rv != OK) {
+      idle_callback.swap(idle_callback_);
+    }
+  }
+  if ((events & READ) && read_callback_) {
+    read_rv = DoRead();
+    if (read_rv != ERR_IO_PENDING) {
+      read_buf_ = nullptr;
+      read_buf_len_ = 0;
+      read_callback.swap(read_callback_);
+    }
+  }
+  ProgressCallback progress;
+  int64_t sent = 0;
+  int64_t total = 0;
+  if ((events & WRITE) && write_callback_) {
+    if (waiting_connect_) {
+      write_rv = DoConnectComplete();
+    } else if (sendfile_fd_ >= 0) {
+      int64_t before = sendfile_sent_;
+      write_rv = DoSendFile();
+      if (sendfile_sent_ != before && progress_callback_) {
+        progress = progress_callback_;
+        sent = sendfile_sent_;
+        total = sendfile_total_;
+      }
+    } else {
+      write_rv = DoWrite();
+    }
+    if (write_rv != ERR_IO_PENDING) {
+      waiting_connect_ = false;
+      write_buf_ = nullptr;
+      write_buf_len_ = 0;
+      write_buf_offset_ = 0;
+      sendfile_fd_ = -1;
+      progress_callback_ = nullptr;
+      waiting_source_ = false;
+      write_callback.swap(write_callback_);
+    }
+  }
+  UpdateWatch();
+
+  if (progress) {
+    progress(sent, total);
+  }
+
+  if (idle_callback) {
+    idle_callback(idle_rv);
+  }
+  if (read_callback) {
+    read_callback(read_rv);
+  }
+  if (write_callback) {
+    write_callback(write_rv);
+  }
+}
+
+void TCPSocket::WatchIdle(CompletionCallback callback) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  CHECK(!read_callback_ && !write_callback_);
+  idle_callback_ = std::move(callback);
+  UpdateWatch();
+}
+
+void TCPSocket::StopWatchingIdle() {
+  idle_callback_ = nullptr;
+  UpdateWatch();
+}
+
+int TCPSocket::CheckIdle(int events) {
+  if (events & (PEER_CLOSED | HANG_UP)) {
+    return ERR_CONNECTION_CLOSED;
+  }
+  if (events & IO_ERROR) {
+    // May also be a zero-copy notification, which leaves SO_ERROR at 0.
+    int os_error = 0;
+    socklen_t len = sizeof(os_error);
+    getsockopt(socket_fd_, SOL_SOCKET, SO_ERROR, &os_error, &len);
+    return os_error ? MapSystemError(os_error) : OK;
+  }
+  // Bytes nobody asked for, the protocol state is unknown.
+  return (events & READ) ? ERR_FAILED : OK;
+}
+
+int TCPSocket::DoRead() {
+  int rv;
+  do {
+    rv = read(socket_fd_, read_buf_->data(), read_buf_len_);
+    CountRead(rv);
+  } while (rv < 0 && errno == EINTR);
+  return rv >= 0 ? rv : MapSystemError(errno);
+}
+
+int TCPSocket::DoWrite() {
+  bool copy = false;
+  while (write_buf_offset_ < write_buf_len_) {
+    int remaining = write_buf_len_ - write_buf_offset_;
+    bool zerocopy = !copy && zerocopy_threshold_ > 0 &&
+                    remaining >= zerocopy_threshold_;
+    int rv = send(socket_fd_, write_buf_->data() + write_buf_offset_,
+                  remaining, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+    CountWrite(rv);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (zerocopy && errno == ENOBUFS) {
+        // Out of optmem for notifications, copy this chunk instead.
+        copy = true;
+        continue;
+      }
+      return MapSystemError(errno);
+    }
+    if (zerocopy) {
+      // The kernel numbers every successful MSG_ZEROCOPY send.
+      zerocopy_pending_.push_back({zerocopy_next_id_++, write_buf_});
+    }
+    copy = false;
+    write_buf_offset_ += rv;
+  }
+  return write_buf_len_;
+}
+
+int TCPSocket::ReapZeroCopyCompletions(int fd,
+                                       std::deque<ZeroCopySend>* pending) {
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+  int copied = 0;
+  while (!pending->empty()) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 &&
+            cmsg->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      const struct sock_extended_err* err =
+          reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cmsg));
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        ++copied;
+      }
+      // Sends ee_info through ee_data, inclusive, are done with their pages.
+      uint32_t lo = err->ee_info;
+      uint32_t hi = err->ee_data;
+      auto done = [lo, hi](const ZeroCopySend& send) {
+        return static_cast<int32_t>(send.id - lo) >= 0 &&
+               static_cast<int32_t>(hi - send.id) >= 0;
+      };
+      pending->erase(std::remove_if(pending->begin(), pending->end(), done),
+                     pending->end());
+    }
+  }
+  return copied;
+}
+
+int TCPSocket::EnableZeroCopy(int threshold) {
+  CHECK_NE(kInvalidSocket, socket_fd_);
+  CHECK_LT(0, threshold);
+  int on = 1;
+  if (setsockopt(socket_fd_, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+    LOG_ERROR("setsockopt(SO_ZEROCOPY) failed, %s", strerror(errno));
+    return MapSystemError(errno);
+  }
+  zerocopy_threshold_ = threshold;
+  return OK;
+}
+
+int TCPSocket::SendFile(int file_fd, int64_t offset, int64_t length,
+                        ProgressCallback progress,
+                        CompletionCallback callback) {
   CHECK_NE(kInvalidSocket, socket_fd_);
-  ::close(socket_fd_);
+  CHECK(!waiting_connect_ && !write_callback_);
+  CHECK_LE(0, file_fd);
+  CHECK(offset < 0 || length >= 0);
+  sendfile_fd_ = file_fd;
+  sendfile_offset_ = offset < 0 ? -1 : offset;
+  sendfile_remaining_ = length < 0 ? -1 : length;
+  sendfile_total_ = sendfile_remaining_;
+  sendfile_sent_ = 0;
+  int rv = DoSendFile();
+  if (rv != ERR_IO_PENDING) {
+    sendfile_fd_ = -1;
+    waiting_source_ = false;
+    if (sendfile_sent_ && progress) {
+      progress(sendfile_sent_, sendfile_total_);
+    }
+    return rv;
+  }
+  progress_callback_ = std::move(progress);
+  write_callback_ = std::move(callback);
+  UpdateWatch();
+  if (sendfile_sent_ && progress_callback_) {
+    progress_callback_(sendfile_sent_, sendfile_total_);
+  }
+  return ERR_IO_PENDING;
+}
+
+int TCPSocket::DoSendFile() {
+  waiting_source_ = false;
+  while (sendfile_remaining_) {
+    size_t chunk = kMaxSendFileChunk;
+    if (sendfile_remaining_ > 0 &&
+        sendfile_remaining_ < static_cast<int64_t>(chunk)) {
+      chunk = static_cast<size_t>(sendfile_remaining_);
+    }
+    ssize_t rv;
+    if (sendfile_offset_ >= 0) {
+      off_t offset = sendfile_offset_;
+      rv = sendfile(socket_fd_, sendfile_fd_, &offset, chunk);
+    } else {
+      rv = splice(sendfile_fd_, nullptr, socket_fd_, nullptr, chunk,
+                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+    CountWrite(rv);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN && sendfile_offset_ < 0) {
+        // Either side may be the one that is not ready.
+        struct pollfd source = {sendfile_fd_, POLLIN, 0};
+        waiting_source_ = poll(&source, 1, 0) == 0;
+      }
+      return MapSystemError(errno);
+    }
+    if (rv == 0) {
+      if (sendfile_remaining_ < 0) {
+        break;
+      }
+      LOG_ERROR("SendFile() of fd %d ended %ld bytes early", sendfile_fd_,
+                static_cast<long>(sendfile_remaining_));
+      return ERR_FAILED;
+    }
+    if (sendfile_offset_ >= 0) {
+      sendfile_offset_ += rv;
+    }
+    if (sendfile_remaining_ > 0) {
+      sendfile_remaining_ -= rv;
+    }
+    sendfile_sent_ += rv;
+  }
+  return OK;
+}
+
+void TCPSocket::OnSourceReadable() { OnFdEvents(socket_fd_, WRITE); }
+
+int TCPSocket::DoConnectComplete() {
+  int os_error = 0;
+  socklen_t len = sizeof(os_error);
+  if (getsockopt(socket_fd_, SOL_SOCKET, SO_ERROR, &os_error, &len) < 0) {
+    os_error = errno;
+  }
+  // EINPROGRESS here is a spurious wakeup and keeps waiting.
+  return MapSystemError(os_error);
+}
+
+void TCPSocket::CountRead(ssize_t rv) {
+  // The first Metrics::Add() on a thread sets up its counters, which may
+  // clobber errno before the caller maps it.
+  int saved_errno = errno;
+  ++stats_.read_calls;
+  Metrics::Add(Metrics::SOCKET_READ_CALLS, 1);
+  if (rv > 0) {
+    stats_.bytes_read += rv;
+    Metrics::Add(Metrics::SOCKET_BYTES_READ, rv);
+  } else if (rv < 0 &&
+             (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK)) {
+    Metrics::Add(Metrics::SOCKET_WOULD_BLOCK, 1);
+  }
+  errno = saved_errno;
+}
+
+void TCPSocket::CountWrite(ssize_t rv) {
+  // See CountRead().
+  int saved_errno = errno;
+  ++stats_.write_calls;
+  Metrics::Add(Metrics::SOCKET_WRITE_CALLS, 1);
+  if (rv > 0) {
+    stats_.bytes_written += rv;
+    Metrics::Add(Metrics::SOCKET_BYTES_WRITTEN, rv);
+  } else if (rv < 0 &&
+             (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK)) {
+    Metrics::Add(Metrics::SOCKET_WOULD_BLOCK, 1);
+  }
+  errno = saved_errno;
+}
+
+void TCPSocket::UpdateWatch() {
+  int wanted = 0;
+  // Error queue notifications only arrive while the fd is registered.
+  if (read_callback_ || idle_callback_ || !zerocopy_pending_.empty()) {
+    wanted |= READ;
+  }
+  if (write_callback_ && !waiting_source_) {
+    wanted |= WRITE;
+  }
+  bool want_source = write_callback_ && waiting_source_;
+  if (want_source && source_watched_fd_ < 0) {
+    if (!source_watcher_) {
+      source_watcher_.reset(new SourceWatcher(this));
+    }
+    source_watched_fd_ = sendfile_fd_;
+    pump_->AddFdWatcher(source_watched_fd_, READ, source_watcher_.get());
+  } else if (!want_source && source_watched_fd_ >= 0) {
+    pump_->DelFdWatcher(source_watched_fd_, READ);
+    source_watched_fd_ = -1;
+  }
+  int removed = watched_events_ & ~wanted;
+  int added = wanted & ~watched_events_;
+  watched_events_ = wanted;
+  if (removed) {
+    pump_->DelFdWatcher(socket_fd_, static_cast<EventType>(removed));
+  }
+  if (added) {
+    pump_->AddFdWatcher(socket_fd_, static_cast<EventType>(added), this);
+  }
 }
 
 }  // namespace dlock
\ No newline at end of file
@@ -1,12 +1,20 @@
 #ifndef DLOCK_NET_TCP_SOCKET_H_
 #define DLOCK_NET_TCP_SOCKET_H_
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <deque>
+#include <functional>
+#include <memory>
 #include "net/fd_watcher.h"
+#include "net/net_errors.h"
 #include "scoped_refptr.h"
 
 namespace dlock {
 
+class EventPump;
 class IOBuffer;
+class IOBufferChain;
 class SocketAddress;
 
 const int kInvalidSocket = -1;
@@ -14,6 +22,9 @@ const int kInvalidSocket = -1;
 class TCPSocket : public FdWatcher {
  public:
   TCPSocket();
+  // Pending operations wait for readiness on |pump|, and their callbacks
+  // run on its loop thread. The default is EventPump::GetInstance().
+  explicit TCPSocket(EventPump* pump);
   ~TCPSocket() override;
 
   int Open();
@@ -26,14 +37,74 @@ class TCPSocket : public FdWatcher {
 
   int Listen(int backlog);
   int Accept(std::unique_ptr<TCPSocket>* socket);
+  // Takes one connection off the accept queue with accept4(), so it comes
+  // out non-blocking and close-on-exec without further syscalls, as a
+  // socket on |pump|. Returns ERR_IO_PENDING once the queue is empty.
+  int Accept(std::unique_ptr<TCPSocket>* socket, EventPump* pump);
 
   int Connect(const SocketAddress& address);
+  // Non-blocking versions. Each returns the result right away if it does not
+  // have to wait, otherwise ERR_IO_PENDING, and |callback| gets the result
+  // once the socket is ready. Read() completes with the bytes read, 0 at
+  // end of stream; Write() completes once all |buf_len| bytes are sent,
+  // resuming partial writes on its own. One read and one write may be
+  // pending at a time. Call them on the pump's loop thread; Close() or
+  // destroying the socket drops pending callbacks without running them.
+  int Connect(const SocketAddress& address, CompletionCallback callback);
+  int Read(IOBuffer* buf, int buf_len, CompletionCallback callback);
+  int Write(IOBuffer* buf, int buf_len, CompletionCallback callback);
+
+  // Makes the callback version of Write() send chunks of at least
+  // |threshold| bytes with MSG_ZEROCOPY; smaller ones are still copied.
+  // The kernel then reads the pages of the buffer after the write has
+  // completed, so the socket keeps a reference to it until the completion
+  // arrives on the error queue, and the caller must not modify its bytes
+  // after passing it in. Pays off for payloads well beyond ~10KB. Sends
+  // still in flight at Close() keep their buffers, and the descriptor, on
+  // the loop until the kernel reports them done.
+  int EnableZeroCopy(int threshold = kDefaultZeroCopyThreshold);
+  // Zero-copy sends whose buffers the kernel has not released yet.
+  int zerocopy_pending() const {
+    return static_cast<int>(zerocopy_pending_.size());
+  }
+  // Zero-copy sends the kernel fell back to copying, e.g. over loopback.
+  int64_t zerocopy_copied() const { return zerocopy_copied_; }
+
+  static const int kDefaultZeroCopyThreshold;
+
+  // Bytes SendFile() has handed to the socket so far, and the total or -1
+  // if it sends until end of file.
+  typedef std::function<void(int64_t sent, int64_t total)> ProgressCallback;
+
+  // Streams |length| bytes of |file_fd| starting at |offset| to the socket
+  // with sendfile(), never copying them through user space. With a negative
+  // |offset|, |file_fd| must be a pipe and is drained with splice(); a
+  // negative |length| then sends until the write end is closed. Completes
+  // with OK like Write() above and counts as the pending write. |progress|,
+  // if set, runs whenever more bytes were sent, possibly before SendFile()
+  // returns. |file_fd| stays owned by the caller and must outlive the
+  // transfer. Reads of uncached file pages still block the loop thread.
+  int SendFile(int file_fd, int64_t offset, int64_t length,
+               ProgressCallback progress, CompletionCallback callback);
 
   bool IsConnected() const;
   bool IsConnectedAndIdle() const;
+  // Event driven alternative to IsConnectedAndIdle(): runs |callback| once
+  // the reactor reports that the idle socket was closed by the peer, failed,
+  // or received bytes nobody asked for, with ERR_CONNECTION_CLOSED, the
+  // socket error or ERR_FAILED. No read or write may be pending until
+  // StopWatchingIdle().
+  void WatchIdle(CompletionCallback callback);
+  void StopWatchingIdle();
 
   int Read(IOBuffer* buf, int buf_len);
   int Write(IOBuffer* buf, int buf_len);
+  // Scatter/gather versions: Read() fills the slices of |bufs| in order with
+  // one readv(), Write() sends them with one writev(). Both return the
+  // number of bytes transferred, the chain is left untouched, so callers
+  // Split() or Consume() it accordingly.
+  int Read(const IOBufferChain& bufs);
+  int Write(const IOBufferChain& bufs);
 
   int GetLocalAddress(SocketAddress* address) const;
   int GetPeerAddress(SocketAddress* address) const;
@@ -42,25 +113,98 @@ class TCPSocket : public FdWatcher {
   bool HasPeerAddress() const;
 
   int AllowAddressReuse();
+  // Sets SO_REUSEPORT, letting several sockets listen on one port.
+  int AllowPortReuse();
   int SetReveiveBufferSize(int32_t size);
   int SetSendBufferSize(int32_t size);
   bool SetKeepAlive(bool eable, int delay);
   bool SetNoDelay(bool no_dealy);
 
+  // Traffic of this socket since it was created, updated by the thread
+  // doing the I/O. The process-wide totals are in Metrics.
+  struct Stats {
+    int64_t bytes_read;
+    int64_t bytes_written;
+    int64_t read_calls;
+    int64_t write_calls;
+  };
+  const Stats& stats() const { return stats_; }
+
   void Close();
   int socket_fd() const { return socket_fd_; }
+  EventPump* pump() const { return pump_; }
 
  private:
   void OnReadable(int fd) override;
   void OnWritable(int fd) override;
+  // Completes what the wakeup allows, then runs the callbacks without
+  // touching the socket again, as they may delete it.
+  void OnFdEvents(int fd, int events) override;
+
+  int DoRead();
+  // Returns the bytes written so far once all are sent, or an error.
+  int DoWrite();
+  int DoConnectComplete();
+  int DoSendFile();
+  // Returns OK if |events| leave an idle socket usable.
+  int CheckIdle(int events);
+  // Runs the pending SendFile() when the pipe it drains becomes readable.
+  void OnSourceReadable();
+  struct ZeroCopySend;
+  // Drops the sends in |pending| whose completions are on the error queue
+  // of |fd|, releasing their buffers. Returns how many of them the kernel
+  // copied after all.
+  static int ReapZeroCopyCompletions(int fd,
+                                     std::deque<ZeroCopySend>* pending);
+  // Registers the events the pending operations need with |pump_|.
+  void UpdateWatch();
+  // Account a read or write syscall that returned |rv|; errno must still
+  // be the one it set, and is left unchanged.
+  void CountRead(ssize_t rv);
+  void CountWrite(ssize_t rv);
+
+  class SourceWatcher;
+  class ZeroCopyReaper;
+
+  struct ZeroCopySend {
+    uint32_t id;
+    scoped_refptr<IOBuffer> buf;
+  };
 
   int socket_fd_;
+  EventPump* pump_;
+  // READ/WRITE bits registered with |pump_|.
+  int watched_events_;
   scoped_refptr<IOBuffer> read_buf_;
   int read_buf_len_;
+  CompletionCallback read_callback_;
   scoped_refptr<IOBuffer> write_buf_;
   int write_buf_len_;
+  int write_buf_offset_;
+  CompletionCallback write_callback_;
   bool waiting_connect_;
+  CompletionCallback idle_callback_;
+  // 0 if zero-copy sends are off.
+  int zerocopy_threshold_;
+  uint32_t zerocopy_next_id_;
+  int64_t zerocopy_copied_;
+  std::deque<ZeroCopySend> zerocopy_pending_;
+  // The source of the pending SendFile(), or -1.
+  int sendfile_fd_;
+  // -1 for a pipe.
+  int64_t sendfile_offset_;
+  // -1 if sending until end of file.
+  int64_t sendfile_remaining_;
+  int64_t sendfile_total_;
+  int64_t sendfile_sent_;
+  ProgressCallback progress_callback_;
+  // Set when splice() waits for the pipe rather than the socket.
+  bool waiting_source_;
+  std::unique_ptr<SourceWatcher> source_watcher_;
+  // The pipe |source_watcher_| is registered for, or -1.
+  int source_watched_fd_;
   std::unique_ptr<SocketAddress> peer_address_;
+  Stats stats_;
 
   DISALLOW_COPY_AND_ASSIGN(TCPSocket);
 };
@@ -0,0 +1,259 @@
+#include "net/timing_wheel.h"
+#include <algorithm>
+#include "util/logging.h"
+
+namespace dlock {
+
+const int TimingWheel::kRootBits = 8;
+const int TimingWheel::kLevelBits = 6;
+const int TimingWheel::kRootSize = 1 << kRootBits;
+const int TimingWheel::kLevelSize = 1 << kLevelBits;
+const int TimingWheel::kNumLevels = 4;
+
+TimingWheel::TimingWheel(uint64_t now)
+    : current_(now),
+      size_(0),
+      root_count_(0),
+      slots_(kRootSize + (kNumLevels - 1) * kLevelSize) {
+  for (auto &slot : slots_) {
+    InitList(&slot);
+  }
+}
+
+TimingWheel::~TimingWheel() = default;
+
+TimerId TimingWheel::Schedule(uint64_t delay, uint64_t interval, Task task) {
+  Timer *timer;
+  if (free_.empty()) {
+    timers_.emplace_back();
+    timer = &timers_.back();
+    timer->index = static_cast<uint32_t>(timers_.size() - 1);
+    timer->generation = 1;
+  } else {
+    timer = &timers_[free_.back()];
+    free_.pop_back();
+  }
+  timer->expires = current_ + delay;
+  timer->interval = interval;
+  timer->task = std::move(task);
+  timer->active = true;
+  Place(timer);
+  ++size_;
+  return (static_cast<uint64_t>(timer->generation) << 32) | timer->index;
+}
+
+bool TimingWheel::Cancel(TimerId id) {
+  Timer *timer = Lookup(id);
+  if (!timer) {
+    return false;
+  }
+  if (timer->prev) {
+    // Not the one running right now.
+    if (!timer->level) {
+      --root_count_;
+    }
+    Unlink(timer);
+  }
+  Release(timer);
+  return true;
+}
+
+int TimingWheel::Advance(uint64_t now) {
+  int fired = 0;
+  Link due;
+  while (current_ <= now) {
+    if (!root_count_ && size_ &&
+        now - current_ >= static_cast<uint64_t>(kRootSize) &&
+        now - current_ > size_) {
+      // Cheaper than a cascade per boundary up to |now|.
+      Rebase(now);
+      if (current_ > now) {
+        break;
+      }
+    }
+    int index = static_cast<int>(current_ & (kRootSize - 1));
+    if (!index && !Cascade(1) && !Cascade(2)) {
+      Cascade(3);
+    }
+
+    // Detach the slot, so timers filed while running the tasks can not end
+    // up in the list being walked.
+    InitList(&due);
+    Link *slot = &slots_[index];
+    if (slot->next != slot) {
+      due.next = slot->next;
+      due.prev = slot->prev;
+      due.next->prev = &due;
+      due.prev->next = &due;
+      InitList(slot);
+    }
+    ++current_;
+
+    while (due.next != &due) {
+      Timer *timer = static_cast<Timer *>(due.next);
+      Unlink(timer);
+      --root_count_;
+      ++fired;
+      TimerId id = (static_cast<uint64_t>(timer->generation) << 32) |
+                   timer->index;
+      Task task = std::move(timer->task);
+      if (timer->interval) {
+        timer->expires = std::max(timer->expires + timer->interval, current_);
+        Place(timer);
+      } else {
+        Release(timer);
+      }
+      // |timer| may be cancelled, or released and reused, by the task.
+      task();
+      timer = Lookup(id);
+      if (timer) {
+        timer->task = std::move(task);
+      }
+    }
+
+    if (!root_count_) {
+      // Nothing to run before the next cascade.
+      uint64_t boundary = (current_ + kRootSize - 1) & ~(kRootSize - 1ULL);
+      current_ = std::max(current_, std::min(boundary, now + 1));
+      if (!size_) {
+        current_ = std::max(current_, now + 1);
+      }
+    }
+  }
+  return fired;
+}
+
+uint64_t TimingWheel::NextTick() const {
+  uint64_t boundary = (current_ + kRootSize - 1) & ~(kRootSize - 1ULL);
+  // Timers of the coarser wheels need the cascade at |boundary|.
+  bool coarse = size_ > root_count_;
+  if (coarse && boundary == current_) {
+    return current_;
+  }
+  if (root_count_) {
+    for (uint64_t tick = current_; tick < current_ + kRootSize; ++tick) {
+      const Link *slot = &slots_[tick & (kRootSize - 1)];
+      if (slot->next != slot) {
+        return coarse ? std::min(tick, boundary) : tick;
+      }
+    }
+  }
+  return boundary;
+}
+
+void TimingWheel::InitList(Link *head) {
+  head->prev = head;
+  head->next = head;
+}
+
+void TimingWheel::Append(Link *head, Timer *timer) {
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+void TimingWheel::Unlink(Timer *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = nullptr;
+  timer->next = nullptr;
+}
+
+void TimingWheel::Place(Timer *timer) {
+  uint64_t expires = timer->expires;
+  Link *slot;
+  timer->level = 0;
+  if (expires < current_) {
+    slot = &slots_[current_ & (kRootSize - 1)];
+    ++root_count_;
+  } else if (expires - current_ < static_cast<uint64_t>(kRootSize)) {
+    slot = &slots_[expires & (kRootSize - 1)];
+    ++root_count_;
+  } else {
+    uint64_t delta = expires - current_;
+    int level = 1;
+    int shift = kRootBits;
+    while (level < kNumLevels - 1 &&
+           delta >= (1ULL << (shift + kLevelBits))) {
+      ++level;
+      shift += kLevelBits;
+    }
+    if (delta >= (1ULL << (shift + kLevelBits))) {
+      // Beyond the range of the wheel, it is cascaded again when the last
+      // slot comes around.
+      expires = current_ + (1ULL << (shift + kLevelBits)) - 1;
+    }
+    int index = static_cast<int>((expires >> shift) & (kLevelSize - 1));
+    slot = &slots_[kRootSize + (level - 1) * kLevelSize + index];
+    timer->level = level;
+  }
+  Append(slot, timer);
+}
+
+int TimingWheel::Cascade(int level) {
+  int shift = kRootBits + (level - 1) * kLevelBits;
+  int index = static_cast<int>((current_ >> shift) & (kLevelSize - 1));
+  Link *slot = &slots_[kRootSize + (level - 1) * kLevelSize + index];
+  Link pending;
+  InitList(&pending);
+  if (slot->next != slot) {
+    pending.next = slot->next;
+    pending.prev = slot->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    InitList(slot);
+  }
+  while (pending.next != &pending) {
+    Timer *timer = static_cast<Timer *>(pending.next);
+    Unlink(timer);
+    Place(timer);
+  }
+  return index;
+}
+
+void TimingWheel::Rebase(uint64_t now) {
+  Link pending;
+  InitList(&pending);
+  uint64_t earliest = now + 1;
+  for (size_t i = kRootSize; i < slots_.size(); ++i) {
+    Link *slot = &slots_[i];
+    while (slot->next != slot) {
+      Timer *timer = static_cast<Timer *>(slot->next);
+      Unlink(timer);
+      Append(&pending, timer);
+      earliest = std::min(earliest, timer->expires);
+    }
+  }
+  current_ = std::max(current_, earliest);
+  while (pending.next != &pending) {
+    Timer *timer = static_cast<Timer *>(pending.next);
+    Unlink(timer);
+    Place(timer);
+  }
+}
+
+TimingWheel::Timer *TimingWheel::Lookup(TimerId id) const {
+  uint32_t index = static_cast<uint32_t>(id & 0xffffffff);
+  uint32_t generation = static_cast<uint32_t>(id >> 32);
+  if (index >= timers_.size()) {
+    return nullptr;
+  }
+  Timer *timer = const_cast<Timer *>(&timers_[index]);
+  if (!timer->active || timer->generation != generation) {
+    return nullptr;
+  }
+  return timer;
+}
+
+void TimingWheel::Release(Timer *timer) {
+  timer->task = nullptr;
+  timer->active = false;
+  if (++timer->generation == 0) {
+    timer->generation = 1;
+  }
+  free_.push_back(timer->index);
+  --size_;
+}
+
+}  // namespace dlock
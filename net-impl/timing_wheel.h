@@ -0,0 +1,102 @@
+#ifndef DLOCK_NET_TIMING_WHEEL_H_
+#define DLOCK_NET_TIMING_WHEEL_H_
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "base/noncopyable.h"
+#include "net/task_queue.h"
+
+namespace dlock {
+
+typedef uint64_t TimerId;
+const TimerId kInvalidTimerId = 0;
+
+// Hierarchical timing wheel in the style of the classic Linux timer wheel:
+// a 256-slot wheel of single ticks and three 64-slot wheels of coarser
+// ranges whose timers are cascaded down as time advances. Schedule() and
+// Cancel() are O(1); Advance() costs one step per elapsed tick, and skips
+// ahead when the finest wheel is empty. After a long idle period it
+// re-files the pending timers in one pass instead of cascading through
+// every boundary in between.
+//
+// Not thread-safe. The unit of a tick is up to the owner.
+class TimingWheel {
+ public:
+  // |now| is the current tick.
+  explicit TimingWheel(uint64_t now);
+  ~TimingWheel();
+
+  // Runs |task| once at least |delay| ticks have passed since the last
+  // advanced tick and then, if |interval| is not zero, every |interval|
+  // ticks until cancelled.
+  TimerId Schedule(uint64_t delay, uint64_t interval, Task task);
+  // Returns false if |id| already fired (and was not periodic) or was
+  // cancelled.
+  bool Cancel(TimerId id);
+  // Runs every timer due up to and including tick |now|, returns how many.
+  int Advance(uint64_t now);
+
+  // Returns the earliest tick at which Advance() may have work to do, which
+  // is either the tick of the next due timer or the next cascade of a
+  // coarser wheel. Only meaningful if !empty().
+  uint64_t NextTick() const;
+
+  uint64_t current() const { return current_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  struct Link {
+    Link *prev;
+    Link *next;
+  };
+
+  struct Timer : public Link {
+    uint64_t expires;
+    uint64_t interval;
+    Task task;
+    uint32_t index;
+    uint32_t generation;
+    // The wheel the timer is filed in, 0 being the root.
+    int level;
+    bool active;
+  };
+
+  static const int kRootBits;
+  static const int kLevelBits;
+  static const int kRootSize;
+  static const int kLevelSize;
+  static const int kNumLevels;
+
+  static void InitList(Link *head);
+  static void Append(Link *head, Timer *timer);
+  static void Unlink(Timer *timer);
+
+  // Files |timer| into the slot matching its expiry relative to |current_|.
+  void Place(Timer *timer);
+  // Re-files the timers of the current slot of |level|, returns the slot.
+  int Cascade(int level);
+  // Moves |current_| up to the earliest expiry, or past |now|, and files
+  // every timer anew. Only called while the root wheel is empty.
+  void Rebase(uint64_t now);
+  Timer *Lookup(TimerId id) const;
+  void Release(Timer *timer);
+
+  // The next tick to process.
+  uint64_t current_;
+  size_t size_;
+  // Number of timers filed in the root wheel.
+  size_t root_count_;
+  // kRootSize slots followed by kLevelSize slots per coarser level.
+  std::vector<Link> slots_;
+  // Timers never move, TimerId packs the index and generation.
+  std::deque<Timer> timers_;
+  std::vector<uint32_t> free_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimingWheel)
+};
+
+}  // namespace dlock
+
+#endif
@@ -0,0 +1,111 @@
+#include "net/timing_wheel.h"
+#include <vector>
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+UNITTEST_DEFINITION(TimingWheelTest);
+
+TEST(TimingWheelTest, TestFireOnTime) {
+  const uint64_t delays[] = {0, 1, 255, 256, 300, 16383, 16384, 1 << 20,
+                             (1ULL << 26) + 7};
+  uint64_t now = 1000;
+  TimingWheel wheel(now);
+  std::vector<uint64_t> fired_at;
+  for (auto delay : delays) {
+    wheel.Schedule(delay, 0, [&fired_at, &now]() { fired_at.push_back(now); });
+  }
+  CHECK_EQ(wheel.size(), sizeof(delays) / sizeof(delays[0]));
+
+  while (!wheel.empty()) {
+    now = wheel.NextTick();
+    wheel.Advance(now);
+  }
+  CHECK_EQ(fired_at.size(), sizeof(delays) / sizeof(delays[0]));
+  for (size_t i = 0; i < fired_at.size(); ++i) {
+    CHECK_EQ(fired_at[i], 1000 + delays[i]);
+  }
+}
+
+TEST(TimingWheelTest, TestCancel) {
+  TimingWheel wheel(0);
+  int fired = 0;
+  TimerId near = wheel.Schedule(10, 0, [&fired]() { ++fired; });
+  TimerId far = wheel.Schedule(100000, 0, [&fired]() { ++fired; });
+  wheel.Schedule(20, 0, [&fired]() { ++fired; });
+  CHECK_EQ(true, wheel.Cancel(near));
+  CHECK_EQ(false, wheel.Cancel(near));
+  CHECK_EQ(true, wheel.Cancel(far));
+  CHECK_EQ(wheel.size(), 1);
+  CHECK_EQ(wheel.Advance(200000), 1);
+  CHECK_EQ(fired, 1);
+  CHECK_EQ(true, wheel.empty());
+  CHECK_EQ(false, wheel.Cancel(kInvalidTimerId));
+}
+
+TEST(TimingWheelTest, TestPeriodic) {
+  TimingWheel wheel(0);
+  int fired = 0;
+  TimerId id = kInvalidTimerId;
+  id = wheel.Schedule(5, 7, [&]() {
+    if (++fired == 10) {
+      wheel.Cancel(id);
+    }
+  });
+  for (uint64_t tick = 0; tick < 1000; ++tick) {
+    wheel.Advance(tick);
+  }
+  CHECK_EQ(fired, 10);
+  CHECK_EQ(true, wheel.empty());
+}
+
+TEST(TimingWheelTest, TestIdReuse) {
+  TimingWheel wheel(0);
+  TimerId first = wheel.Schedule(1, 0, []() {});
+  wheel.Advance(1);
+  TimerId second = wheel.Schedule(1, 0, []() {});
+  CHECK_NE(first, second);
+  CHECK_EQ(false, wheel.Cancel(first));
+  CHECK_EQ(true, wheel.Cancel(second));
+}
+
+TEST(TimingWheelTest, TestLongIdle) {
+  // One jump far past every timer fires them all in order, and the wheel
+  // keeps working from the new tick.
+  const uint64_t delays[] = {300, 70000, 1 << 20, (1ULL << 26) + 7};
+  uint64_t now = 5;
+  TimingWheel wheel(now);
+  std::vector<uint64_t> order;
+  for (auto delay : delays) {
+    wheel.Schedule(delay, 0, [&order, delay]() { order.push_back(delay); });
+  }
+  now = 1ULL << 30;
+  CHECK_EQ(wheel.Advance(now), 4);
+  CHECK_EQ(order.size(), 4u);
+  for (size_t i = 0; i < order.size(); ++i) {
+    CHECK_EQ(order[i], delays[i]);
+  }
+  CHECK_EQ(wheel.current(), now + 1);
+
+  // A jump that stops between timers leaves the later ones on time.
+  std::vector<uint64_t> fired_at;
+  wheel.Schedule(1000, 0, [&fired_at, &now]() { fired_at.push_back(now); });
+  wheel.Schedule(100000, 0, [&fired_at, &now]() { fired_at.push_back(now); });
+  uint64_t base = wheel.current();
+  now = base + 50000;
+  CHECK_EQ(wheel.Advance(now), 1);
+  while (!wheel.empty()) {
+    now = wheel.NextTick();
+    wheel.Advance(now);
+  }
+  CHECK_EQ(fired_at.size(), 2u);
+  CHECK_EQ(fired_at[0], base + 50000);
+  CHECK_EQ(fired_at[1], base + 100000);
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(TimingWheelTest)
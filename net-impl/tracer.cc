@@ -0,0 +1,225 @@
+#include "net/tracer.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "base/sync.h"
+#include "net/net_errors.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+namespace {
+
+// One writer, any number of readers. Readers copy without stopping the
+// writer and then drop the records it may have overwritten meanwhile.
+class Ring {
+ public:
+  explicit Ring(size_t capacity)
+      : records_(new Tracer::Record[capacity]),
+        capacity_(capacity),
+        head_(0),
+        start_(0),
+        tid_(0),
+        in_use_(false) {}
+
+  void Append(const Tracer::Record &record) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    records_[head % capacity_] = record;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  void CopyTo(std::vector<Tracer::Record> *out) const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t begin = std::max(head > capacity_ ? head - capacity_ : 0,
+                              start_.load(std::memory_order_relaxed));
+    size_t first = out->size();
+    for (uint64_t i = begin; i < head; ++i) {
+      out->push_back(records_[i % capacity_]);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // The writer may be filling the slot after the one it published last.
+    uint64_t now = head_.load(std::memory_order_relaxed);
+    uint64_t valid = now + 1 > capacity_ ? now + 1 - capacity_ : 0;
+    if (valid > begin) {
+      size_t stale = static_cast<size_t>(std::min(valid, head) - begin);
+      out->erase(out->begin() + first, out->begin() + first + stale);
+    }
+  }
+
+  // Hides what was recorded so far from CopyTo().
+  void Skip() {
+    start_.store(head_.load(std::memory_order_acquire),
+                 std::memory_order_relaxed);
+  }
+
+  std::unique_ptr<Tracer::Record[]> records_;
+  const size_t capacity_;
+  std::atomic<uint64_t> head_;
+  std::atomic<uint64_t> start_;
+  // Guarded by the registry mutex.
+  int tid_;
+  bool in_use_;
+};
+
+struct Registry {
+  Registry() : ring_records(Tracer::kDefaultRingRecords) {}
+
+  Mutex mutex;
+  std::vector<std::unique_ptr<Ring>> rings;
+  size_t ring_records;
+};
+
+Registry *GetRegistry() {
+  // Leaked, threads may exit after static destructors ran.
+  static Registry *registry = new Registry();
+  return registry;
+}
+
+Ring *AcquireRing() {
+  Registry *registry = GetRegistry();
+  MutexLock lock(&registry->mutex);
+  Ring *ring = nullptr;
+  for (auto &candidate : registry->rings) {
+    if (!candidate->in_use_) {
+      ring = candidate.get();
+      // The records of the previous owner would carry the wrong tid.
+      ring->Skip();
+      break;
+    }
+  }
+  if (!ring) {
+    registry->rings.emplace_back(new Ring(registry->ring_records));
+    ring = registry->rings.back().get();
+  }
+  ring->in_use_ = true;
+  ring->tid_ = static_cast<int>(syscall(SYS_gettid));
+  return ring;
+}
+
+struct ThreadRing {
+  ~ThreadRing() {
+    if (ring) {
+      MutexLock lock(&GetRegistry()->mutex);
+      ring->in_use_ = false;
+    }
+  }
+
+  Ring *ring = nullptr;
+};
+
+thread_local ThreadRing thread_ring;
+
+const char *EventName(int type) {
+  switch (type) {
+    case Tracer::LOOP_WAIT:
+      return "WaitReady";
+    case Tracer::FD_EVENTS:
+      return "OnFdEvents";
+    case Tracer::TASKS:
+      return "RunTasks";
+  }
+  return "Unknown";
+}
+
+}  // namespace
+
+const size_t Tracer::kDefaultRingRecords = 64 * 1024;
+
+std::atomic<bool> Tracer::enabled_(false);
+
+void Tracer::Enable(size_t records_per_thread) {
+  Registry *registry = GetRegistry();
+  {
+    MutexLock lock(&registry->mutex);
+    registry->ring_records = std::max<size_t>(records_per_thread, 1);
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::Disable() { enabled_.store(false, std::memory_order_relaxed); }
+
+void Tracer::Add(EventType type, int64_t start_ns, int64_t end_ns, int fd,
+                 int arg, const void *object) {
+  Ring *ring = thread_ring.ring;
+  if (!ring) {
+    ring = thread_ring.ring = AcquireRing();
+  }
+  Record record;
+  record.start_ns = start_ns;
+  record.duration_ns = end_ns - start_ns;
+  record.object = object;
+  record.fd = fd;
+  record.arg = arg;
+  record.type = type;
+  ring->Append(record);
+}
+
+int64_t Tracer::NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+std::string Tracer::ExportChromeTrace() {
+  Registry *registry = GetRegistry();
+  int pid = static_cast<int>(getpid());
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  char event[256];
+  std::vector<Record> records;
+  MutexLock lock(&registry->mutex);
+  for (auto &ring : registry->rings) {
+    records.clear();
+    ring->CopyTo(&records);
+    for (const Record &record : records) {
+      // "X" events are complete ones, with timestamps in microseconds.
+      int len = snprintf(
+          event, sizeof(event),
+          "%s\n{\"name\":\"%s\",\"cat\":\"loop\",\"ph\":\"X\","
+          "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+          first ? "" : ",", EventName(record.type), record.start_ns / 1e3,
+          record.duration_ns / 1e3, pid, ring->tid_);
+      out.append(event, len);
+      if (record.type == FD_EVENTS) {
+        len = snprintf(event, sizeof(event),
+                       "\"fd\":%d,\"events\":%d,\"watcher\":\"%p\"}}",
+                       record.fd, record.arg, record.object);
+      } else {
+        len = snprintf(event, sizeof(event), "\"count\":%d}}", record.arg);
+      }
+      out.append(event, len);
+      first = false;
+    }
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+int Tracer::WriteChromeTrace(const std::string &path) {
+  std::string trace = ExportChromeTrace();
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) {
+    return MapSystemError(errno);
+  }
+  size_t written = fwrite(trace.data(), 1, trace.size(), file);
+  int rv = written == trace.size() ? OK : MapSystemError(errno);
+  if (fclose(file) != 0 && rv == OK) {
+    rv = MapSystemError(errno);
+  }
+  return rv;
+}
+
+void Tracer::Clear() {
+  Registry *registry = GetRegistry();
+  MutexLock lock(&registry->mutex);
+  for (auto &ring : registry->rings) {
+    ring->Skip();
+  }
+}
+
+}  // namespace dlock
@@ -0,0 +1,70 @@
+#ifndef DLOCK_NET_TRACER_H_
+#define DLOCK_NET_TRACER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace dlock {
+
+// Records what the event loops spend their time on, so a latency spike can
+// be reconstructed after the fact. Each thread writes fixed-size records
+// into its own ring, overwriting the oldest, without locks or atomic
+// read-modify-writes; ExportChromeTrace() renders all rings in the Chrome
+// trace event format, for chrome://tracing or Perfetto. While disabled a
+// trace point costs one relaxed load.
+class Tracer {
+ public:
+  enum EventType {
+    // Blocked in the reactor; |arg| is the number of ready fds.
+    LOOP_WAIT,
+    // One FdWatcher::OnFdEvents(); |arg| holds the READ/WRITE bits.
+    FD_EVENTS,
+    // A batch of posted tasks; |arg| is their number.
+    TASKS,
+  };
+
+  struct Record {
+    int64_t start_ns;
+    int64_t duration_ns;
+    // The watcher, for FD_EVENTS. Only compared, never dereferenced.
+    const void *object;
+    int32_t fd;
+    int32_t arg;
+    int32_t type;
+  };
+
+  // Threads allocate a ring of |records_per_thread| on their first record
+  // after this. Rings of exited threads are kept for the export until a new
+  // thread takes them over.
+  static void Enable(size_t records_per_thread = kDefaultRingRecords);
+  // Stops recording and keeps what was recorded.
+  static void Disable();
+  static bool enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Times are CLOCK_MONOTONIC nanoseconds. Call only if enabled().
+  static void Add(EventType type, int64_t start_ns, int64_t end_ns, int fd,
+                  int arg, const void *object);
+  static int64_t NowNanos();
+
+  // Returns the records of all rings as a JSON trace, oldest first per
+  // thread. Safe to call while the loops keep recording; the slot a ring
+  // may be writing is left out, so a full ring yields one record less.
+  static std::string ExportChromeTrace();
+  // Writes ExportChromeTrace() to |path|. Returns a NetError.
+  static int WriteChromeTrace(const std::string &path);
+  // Drops everything recorded so far.
+  static void Clear();
+
+  static const size_t kDefaultRingRecords;
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+}  // namespace dlock
+
+#endif
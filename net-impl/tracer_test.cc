@@ -0,0 +1,67 @@
+#include "net/tracer.h"
+#include <string>
+#include <thread>
+#include "util/logging.h"
+#include "util/unittest.h"
+
+namespace dlock {
+namespace unittest {
+
+static int CountOf(const std::string& text, const std::string& pattern) {
+  int count = 0;
+  for (size_t pos = text.find(pattern); pos != std::string::npos;
+       pos = text.find(pattern, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+UNITTEST_DEFINITION(TracerTest);
+
+TEST(TracerTest, TestDisabledByDefault) {
+  CHECK_EQ(false, Tracer::enabled());
+  Tracer::Clear();
+  CHECK_EQ(0, CountOf(Tracer::ExportChromeTrace(), "\"ph\":\"X\""));
+}
+
+TEST(TracerTest, TestExport) {
+  Tracer::Enable(16);
+  Tracer::Clear();
+  int watcher = 0;
+  Tracer::Add(Tracer::LOOP_WAIT, 1000, 3000, -1, 2, nullptr);
+  Tracer::Add(Tracer::FD_EVENTS, 3000, 3500, 7, 1, &watcher);
+  std::thread([]() {
+    Tracer::Add(Tracer::TASKS, 4000, 9000, -1, 5, nullptr);
+  }).join();
+  Tracer::Disable();
+  std::string trace = Tracer::ExportChromeTrace();
+  CHECK_EQ(3, CountOf(trace, "\"ph\":\"X\""));
+  CHECK_EQ(1, CountOf(trace, "\"name\":\"WaitReady\""));
+  CHECK_EQ(1, CountOf(trace, "\"ts\":3.000,\"dur\":0.500"));
+  CHECK_EQ(1, CountOf(trace, "\"fd\":7,\"events\":1"));
+  CHECK_EQ(1, CountOf(trace, "\"count\":5"));
+  Tracer::Clear();
+  CHECK_EQ(0, CountOf(Tracer::ExportChromeTrace(), "\"ph\":\"X\""));
+}
+
+TEST(TracerTest, TestRingKeepsNewest) {
+  Tracer::Enable(16);
+  // This thread's ring was sized by the previous test.
+  Tracer::Clear();
+  for (int i = 0; i < 100; ++i) {
+    Tracer::Add(Tracer::TASKS, i * 1000, i * 1000 + 1, -1, i, nullptr);
+  }
+  Tracer::Disable();
+  std::string trace = Tracer::ExportChromeTrace();
+  // The slot after the newest record counts as being overwritten.
+  CHECK_EQ(15, CountOf(trace, "\"ph\":\"X\""));
+  CHECK_EQ(1, CountOf(trace, "\"count\":99}"));
+  CHECK_EQ(1, CountOf(trace, "\"count\":85}"));
+  CHECK_EQ(0, CountOf(trace, "\"count\":84}"));
+  Tracer::Clear();
+}
+
+}  // namespace unittest
+}  // namespace dlock
+
+UNITTEST_RUN(TracerTest)
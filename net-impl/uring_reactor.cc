@@ -0,0 +1,389 @@
+#ifndef DLOCK_NO_IO_URING
+
+#include "net/uring_reactor.h"
+#include <errno.h>
+#include <liburing.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include "net/io_buffer.h"
+#include "util/logging.h"
+#include "util/mutex_lock.h"
+
+namespace dlock {
+
+static unsigned PollMask(unsigned char interest) {
+  unsigned mask = POLLRDHUP;
+  if (interest & READ) {
+    mask |= POLLIN;
+  }
+  if (interest & WRITE) {
+    mask |= POLLOUT;
+  }
+  return mask;
+}
+
+const uint64_t UringReactor::kOpBit = 1ULL << 63;
+const unsigned UringReactor::kQueueDepth = 4096;
+
+struct UringReactor::Op {
+  CompletionHandler *handler;
+  // Keeps the payload of a send alive.
+  scoped_refptr<IOBuffer> buf;
+  // Buffer group of a receive, -1 if none.
+  int group;
+  // A poll update has no handler, just the tags of the poll before and
+  // after it.
+  uint64_t old_tag;
+  uint64_t tag;
+};
+
+struct UringReactor::BufferGroup {
+  struct io_uring_buf_ring *ring;
+  char *base;
+  int count;
+  int size;
+};
+
+std::unique_ptr<UringReactor> UringReactor::Create() {
+  std::unique_ptr<UringReactor> reactor(new UringReactor());
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ret =
+      io_uring_queue_init_params(kQueueDepth, reactor->ring_.get(), &params);
+  if (ret < 0) {
+    LOG_ERROR("io_uring_queue_init failed, %s", strerror(-ret));
+    reactor->ring_->ring_fd = -1;
+    return nullptr;
+  }
+  // Waiting with a timeout must not take a submission queue entry, and
+  // multishot polls need the fast poll path.
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_FAST_POLL)) {
+    LOG_ERROR("io_uring lacks IORING_FEAT_EXT_ARG or IORING_FEAT_FAST_POLL");
+    return nullptr;
+  }
+  return reactor;
+}
+
+UringReactor::UringReactor()
+    : ring_(new struct io_uring()), sq_mutex_(), loop_thread_id_() {
+  ring_->ring_fd = -1;
+}
+
+UringReactor::~UringReactor() {
+  if (ring_->ring_fd < 0) {
+    return;
+  }
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    if (groups_[i]) {
+      io_uring_free_buf_ring(ring_.get(), groups_[i]->ring, groups_[i]->count,
+                             i);
+      free(groups_[i]->base);
+    }
+  }
+  io_uring_queue_exit(ring_.get());
+}
+
+int UringReactor::WaitReady(int timeout_ms) {
+  {
+    MutexLock lock(&sq_mutex_);
+    loop_thread_id_.store(std::this_thread::get_id(),
+                          std::memory_order_relaxed);
+    io_uring_submit(ring_.get());
+  }
+
+  struct io_uring_cqe *cqe;
+  int ret;
+  if (timeout_ms < 0) {
+    ret = io_uring_wait_cqe(ring_.get(), &cqe);
+  } else {
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    ret = io_uring_wait_cqe_timeout(ring_.get(), &cqe, &ts);
+  }
+  if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+    LOG_ERROR("io_uring_wait_cqe failed, %s", strerror(-ret));
+  }
+
+  ready_.clear();
+  completions_.clear();
+  terminated_.clear();
+  unsigned head;
+  unsigned count = 0;
+  io_uring_for_each_cqe(ring_.get(), head, cqe) {
+    ++count;
+    uint64_t user_data = cqe->user_data;
+    if (user_data & kOpBit) {
+      Op *op = reinterpret_cast<Op *>(user_data & ~kOpBit);
+      if (op) {
+        completions_.push_back({op, cqe->res, cqe->flags});
+      }
+      continue;
+    }
+    // A poll request. Errors mean it was removed or the fd is gone.
+    if (cqe->res < 0) {
+      continue;
+    }
+    ready_.emplace_back(user_data, static_cast<uint32_t>(cqe->res));
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      // The kernel dropped the multishot poll, e.g. on a full CQ ring.
+      terminated_.push_back(user_data);
+    }
+  }
+  io_uring_cq_advance(ring_.get(), count);
+  MergeReady();
+
+  if (!terminated_.empty()) {
+    MutexLock lock(&sq_mutex_);
+    for (auto tag : terminated_) {
+      int fd;
+      FdWatcher *watcher;
+      const Slot *slot = Resolve(tag, &fd, &watcher);
+      if (slot && fd < static_cast<int>(poll_tags_.size()) &&
+          poll_tags_[fd] == tag) {
+        PollAddLocked(fd, tag,
+                      slot->interest.load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+  for (const auto &completion : completions_) {
+    RunCompletion(completion);
+  }
+  return static_cast<int>(ready_.size());
+}
+
+void UringReactor::MergeReady() {
+  if (ready_.size() < 2) {
+    return;
+  }
+  // A multishot poll may complete several times per batch; callers expect
+  // every fd once, with all of its events.
+  std::sort(ready_.begin(), ready_.end());
+  size_t out = 0;
+  for (size_t i = 1; i < ready_.size(); ++i) {
+    if (ready_[i].first == ready_[out].first) {
+      ready_[out].second |= ready_[i].second;
+    } else {
+      ready_[++out] = ready_[i];
+    }
+  }
+  ready_.resize(out + 1);
+}
+
+FdWatcher *UringReactor::ReadyAt(int index, int *fd, int *events) const {
+  FdWatcher *watcher;
+  const Slot *slot = Resolve(ready_[index].first, fd, &watcher);
+  if (!slot) {
+    return nullptr;
+  }
+  *events = ToEventMask(ready_[index].second, *slot);
+  return watcher;
+}
+
+bool UringReactor::AcceptMultishot(int listen_fd,
+                                   CompletionHandler *handler) {
+  MutexLock lock(&sq_mutex_);
+  struct io_uring_sqe *sqe = GetSqeLocked();
+  io_uring_prep_multishot_accept(sqe, listen_fd, nullptr, nullptr,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+  return SubmitOp(new Op{handler, nullptr, -1, 0, 0}, sqe);
+}
+
+bool UringReactor::AddBufferGroup(uint16_t group, int count, int size) {
+  CHECK_LT(0, count);
+  CHECK_EQ(0, count & (count - 1));
+  CHECK_LT(0, size);
+  if (group < groups_.size() && groups_[group]) {
+    return false;
+  }
+
+  int ret;
+  struct io_uring_buf_ring *ring;
+  {
+    MutexLock lock(&sq_mutex_);
+    ring = io_uring_setup_buf_ring(ring_.get(), count, group, 0, &ret);
+  }
+  if (!ring) {
+    LOG_ERROR("io_uring_setup_buf_ring(%d) failed, %s", group,
+              strerror(-ret));
+    return false;
+  }
+  char *base = nullptr;
+  if (posix_memalign(reinterpret_cast<void **>(&base), 4096,
+                     static_cast<size_t>(count) * size) != 0) {
+    io_uring_free_buf_ring(ring_.get(), ring, count, group);
+    return false;
+  }
+  int mask = io_uring_buf_ring_mask(count);
+  for (int i = 0; i < count; ++i) {
+    io_uring_buf_ring_add(ring, base + static_cast<size_t>(i) * size, size,
+                          i, mask, i);
+  }
+  io_uring_buf_ring_advance(ring, count);
+
+  if (group >= groups_.size()) {
+    groups_.resize(group + 1);
+  }
+  groups_[group].reset(new BufferGroup{ring, base, count, size});
+  return true;
+}
+
+bool UringReactor::RecvMultishot(int fd, uint16_t group,
+                                 CompletionHandler *handler) {
+  CHECK(group < groups_.size() && groups_[group]);
+  MutexLock lock(&sq_mutex_);
+  struct io_uring_sqe *sqe = GetSqeLocked();
+  io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  return SubmitOp(new Op{handler, nullptr, group, 0, 0}, sqe);
+}
+
+bool UringReactor::Send(int fd, IOBuffer *buf, int len,
+                        CompletionHandler *handler) {
+  CHECK_LT(0, len);
+  MutexLock lock(&sq_mutex_);
+  struct io_uring_sqe *sqe = GetSqeLocked();
+  io_uring_prep_send(sqe, fd, buf->data(), len, MSG_NOSIGNAL);
+  return SubmitOp(new Op{handler, buf, -1, 0, 0}, sqe);
+}
+
+void UringReactor::CancelOperations(int fd) {
+  MutexLock lock(&sq_mutex_);
+  struct io_uring_sqe *sqe = GetSqeLocked();
+  io_uring_prep_cancel_fd(sqe, fd, IORING_ASYNC_CANCEL_ALL);
+  io_uring_sqe_set_data64(sqe, kOpBit);
+  SubmitIfOffLoopLocked();
+}
+
+bool UringReactor::ApplyChange(int fd, const Slot &slot) {
+  MutexLock lock(&sq_mutex_);
+  if (fd >= static_cast<int>(poll_tags_.size())) {
+    poll_tags_.resize(std::max<size_t>(fd + 1, poll_tags_.size() * 2), 0);
+  }
+  unsigned char interest = slot.interest.load(std::memory_order_relaxed);
+  uint64_t tag = Tag(fd, slot);
+  struct io_uring_sqe *sqe;
+  if (!interest) {
+    sqe = GetSqeLocked();
+    io_uring_prep_poll_remove(sqe, poll_tags_[fd]);
+    io_uring_sqe_set_data64(sqe, kOpBit);
+    poll_tags_[fd] = 0;
+  } else if (!slot.registered) {
+    PollAddLocked(fd, tag, interest);
+  } else if (slot.stale_tag) {
+    // The fd was unwatched and watched again, maybe after a close and reuse
+    // of the number. The armed poll may be on the old file, start over.
+    sqe = GetSqeLocked();
+    io_uring_prep_poll_remove(sqe, poll_tags_[fd]);
+    io_uring_sqe_set_data64(sqe, kOpBit);
+    PollAddLocked(fd, tag, interest);
+  } else {
+    sqe = GetSqeLocked();
+    io_uring_prep_poll_update(sqe, poll_tags_[fd], tag, PollMask(interest),
+                              IORING_POLL_UPDATE_EVENTS |
+                                  IORING_POLL_UPDATE_USER_DATA |
+                                  IORING_POLL_ADD_MULTI);
+    Op *op = new Op{nullptr, nullptr, -1, poll_tags_[fd], tag};
+    io_uring_sqe_set_data64(sqe, reinterpret_cast<uint64_t>(op) | kOpBit);
+    poll_tags_[fd] = tag;
+  }
+  // A failed poll update is retried as a new poll, see OnPollUpdated().
+  return true;
+}
+
+void UringReactor::CommitChanges() {
+  MutexLock lock(&sq_mutex_);
+  SubmitIfOffLoopLocked();
+}
+
+void UringReactor::SubmitIfOffLoopLocked() {
+  if (loop_thread_id_.load(std::memory_order_relaxed) !=
+      std::this_thread::get_id()) {
+    // The loop may be blocked waiting, it only submits before it waits.
+    io_uring_submit(ring_.get());
+  }
+}
+
+struct io_uring_sqe *UringReactor::GetSqeLocked() {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(ring_.get());
+  while (!sqe) {
+    // The submission queue is full, hand the batch to the kernel early.
+    io_uring_submit(ring_.get());
+    sqe = io_uring_get_sqe(ring_.get());
+  }
+  return sqe;
+}
+
+void UringReactor::PollAddLocked(int fd, uint64_t tag,
+                                 unsigned char interest) {
+  struct io_uring_sqe *sqe = GetSqeLocked();
+  io_uring_prep_poll_multishot(sqe, fd, PollMask(interest));
+  io_uring_sqe_set_data64(sqe, tag);
+  poll_tags_[fd] = tag;
+}
+
+bool UringReactor::SubmitOp(Op *op, struct io_uring_sqe *sqe) {
+  io_uring_sqe_set_data64(sqe, reinterpret_cast<uint64_t>(op) | kOpBit);
+  SubmitIfOffLoopLocked();
+  return true;
+}
+
+void UringReactor::OnPollUpdated(const Op &op, int result) {
+  if (result >= 0) {
+    return;
+  }
+  // The poll ended before the update reached it, e.g. the kernel dropped it
+  // in the same batch, so nothing watches the fd. Arm a new one unless the
+  // fd has moved on since.
+  MutexLock lock(&sq_mutex_);
+  int fd;
+  FdWatcher *watcher;
+  const Slot *slot = Resolve(op.tag, &fd, &watcher);
+  if (!slot || fd >= static_cast<int>(poll_tags_.size()) ||
+      poll_tags_[fd] != op.tag) {
+    return;
+  }
+  struct io_uring_sqe *sqe = GetSqeLocked();
+  io_uring_prep_poll_remove(sqe, op.old_tag);
+  io_uring_sqe_set_data64(sqe, kOpBit);
+  PollAddLocked(fd, op.tag, slot->interest.load(std::memory_order_relaxed));
+}
+
+void UringReactor::RunCompletion(const Completion &completion) {
+  Op *op = completion.op;
+  if (!op->handler) {
+    OnPollUpdated(*op, completion.result);
+    delete op;
+    return;
+  }
+  bool more = completion.flags & IORING_CQE_F_MORE;
+  const char *data = nullptr;
+  int buffer_id = -1;
+  BufferGroup *group = nullptr;
+  if (op->group >= 0 && (completion.flags & IORING_CQE_F_BUFFER)) {
+    group = groups_[op->group].get();
+    buffer_id = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+    data = group->base + static_cast<size_t>(buffer_id) * group->size;
+  }
+
+  op->handler->OnComplete(completion.result, data, more);
+
+  if (group) {
+    io_uring_buf_ring_add(group->ring, const_cast<char *>(data), group->size,
+                          buffer_id, io_uring_buf_ring_mask(group->count), 0);
+    io_uring_buf_ring_advance(group->ring, 1);
+  }
+  if (!more) {
+    delete op;
+  }
+}
+
+}  // namespace dlock
+
+#endif  // DLOCK_NO_IO_URING
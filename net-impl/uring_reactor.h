@@ -0,0 +1,120 @@
+#ifndef DLOCK_NET_URING_REACTOR_H_
+#define DLOCK_NET_URING_REACTOR_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "base/sync.h"
+#include "net/reactor.h"
+
+// Kept out of this header, so that code using the reactor does not need
+// liburing. Builds without it define DLOCK_NO_IO_URING and leave out
+// uring_reactor.cc; Reactor::Create() then always falls back to epoll.
+struct io_uring;
+struct io_uring_sqe;
+
+namespace dlock {
+
+class IOBuffer;
+
+class CompletionHandler {
+ public:
+  // |result| is what the operation returned, or -errno. For a receive into
+  // provided buffers |data| points at the |result| received bytes and is
+  // only valid during the call. A multishot operation stays armed as long
+  // as |more| is true; once it is false the handler may be destroyed.
+  virtual void OnComplete(int result, const char *data, bool more) = 0;
+
+ protected:
+  virtual ~CompletionHandler() = default;
+};
+
+// io_uring(7) backend. FdWatchers are served by multishot IORING_OP_POLL_ADD
+// requests, so code written against the epoll reactor keeps working, and
+// all registrations of a loop iteration go to the kernel with the wait in
+// one io_uring_enter().
+//
+// On top of that it offers completion-based operations that save the
+// separate read/send syscall after a readiness event: multishot accept,
+// multishot receive into a ring of provided buffers, and sends that are
+// batched with the next submission. They may be started from any thread;
+// completions run on the loop thread from within WaitReady().
+class UringReactor : public Reactor {
+ public:
+  // Returns nullptr if the kernel lacks io_uring or the features used here.
+  static std::unique_ptr<UringReactor> Create();
+  ~UringReactor() override;
+
+  int WaitReady(int timeout_ms) override;
+  FdWatcher *ReadyAt(int index, int *fd, int *events) const override;
+  ReactorType type() const override { return IO_URING_REACTOR; }
+
+  // Accepts connections on |listen_fd| until cancelled. Each completion
+  // carries a non-blocking, close-on-exec fd, or -errno.
+  bool AcceptMultishot(int listen_fd, CompletionHandler *handler);
+  // Registers |count| buffers of |size| bytes as buffer group |group|, for
+  // use by RecvMultishot(). |count| must be a power of two. Must be called
+  // before the loop starts or on the loop thread.
+  bool AddBufferGroup(uint16_t group, int count, int size);
+  // Receives from |fd| into buffers of |group| until EOF (result 0), an
+  // error or cancellation. The buffer goes back to the ring once
+  // OnComplete() returns. It also ends with -ENOBUFS when the group ran
+  // dry, in which case the caller may start it again.
+  bool RecvMultishot(int fd, uint16_t group, CompletionHandler *handler);
+  // Sends |len| bytes of |buf|, which is kept alive until the completion.
+  // A short send completes with the number of bytes sent, the caller
+  // resubmits the rest.
+  bool Send(int fd, IOBuffer *buf, int len, CompletionHandler *handler);
+  // Cancels every completion-based operation on |fd|, each of which then
+  // completes with -ECANCELED.
+  void CancelOperations(int fd);
+
+ private:
+  struct Op;
+  struct BufferGroup;
+  struct Completion {
+    Op *op;
+    int result;
+    uint32_t flags;
+  };
+
+  // Set in the user_data of requests that are not fd polls. The value
+  // without it is the Op, or null for requests whose completion is ignored.
+  static const uint64_t kOpBit;
+  static const unsigned kQueueDepth;
+
+  UringReactor();
+  bool ApplyChange(int fd, const Slot &slot) override;
+  void CommitChanges() override;
+
+  void SubmitIfOffLoopLocked();
+  struct io_uring_sqe *GetSqeLocked();
+  void PollAddLocked(int fd, uint64_t tag, unsigned char interest);
+  bool SubmitOp(Op *op, struct io_uring_sqe *sqe);
+  // Re-arms the poll of a failed IORING_POLL_UPDATE_* request |op|.
+  void OnPollUpdated(const Op &op, int result);
+  void RunCompletion(const Completion &completion);
+  // Folds the completions of the same poll in |ready_| into one entry.
+  void MergeReady();
+
+  std::unique_ptr<struct io_uring> ring_;
+  // The submission queue is single-producer.
+  Mutex sq_mutex_;
+  std::atomic<std::thread::id> loop_thread_id_;
+  // Indexed by fd, the user_data of the armed poll request. Guarded by
+  // sq_mutex_.
+  std::vector<uint64_t> poll_tags_;
+  // Loop thread only. One entry per poll tag with the events of all its
+  // completions in the batch ORed together.
+  std::vector<std::pair<uint64_t, uint32_t>> ready_;
+  std::vector<Completion> completions_;
+  std::vector<uint64_t> terminated_;
+  std::vector<std::unique_ptr<BufferGroup>> groups_;
+};
+
+}  // namespace dlock
+
+#endif